@@ -0,0 +1,106 @@
+/*************************************************************************************************
+*
+* File: AudioSink.cpp
+*
+* Description: Implements the file sink and picks the platform's
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <filesystem>
+
+#include "AudioSink.h"
+
+AudioSink *CreateDefaultAudioSink()
+{
+#ifdef _WIN32
+    return CreateWASAPISink();
+#else
+    return CreateALSASink();
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// The file sink
+//-----------------------------------------------------------------------------
+
+namespace
+{
+    long long NowMicroSecs()
+    {
+        return chrono::duration_cast< chrono::microseconds >( chrono::steady_clock::now().time_since_epoch() ).count();
+    }
+
+    void Put16( ofstream &ofs, unsigned iValue ) { ofs.put( static_cast< char >( iValue ) ).put( static_cast< char >( iValue >> 8 ) ); }
+    void Put32( ofstream &ofs, unsigned iValue ) { Put16( ofs, iValue ); Put16( ofs, iValue >> 16 ); }
+}
+
+AudioFileSink::AudioFileSink( const wstring &sFilename, bool bRealTime ) :
+    m_sFilename( sFilename ), m_bRealTime( bRealTime ), m_iRate( 0 ), m_iLatencyFrames( 0 ),
+    m_llFrames( 0 ), m_llStartMicroSecs( 0 )
+{
+}
+
+bool AudioFileSink::Open( int iRate, int iLatencyFrames )
+{
+    Close();
+    m_ofs.open( filesystem::path( m_sFilename ), ios::out | ios::binary | ios::trunc );
+    if ( !m_ofs.is_open() ) return false;
+
+    m_iRate = iRate;
+    m_iLatencyFrames = iLatencyFrames;
+    m_llFrames = 0;
+    m_llStartMicroSecs = NowMicroSecs();
+    WriteHeader();
+    return true;
+}
+
+void AudioFileSink::Close()
+{
+    if ( !m_ofs.is_open() ) return;
+
+    // Now the sizes are known
+    m_ofs.seekp( 0, ios::beg );
+    WriteHeader();
+    m_ofs.close();
+}
+
+// RIFF, then a WAVE_FORMAT_IEEE_FLOAT fmt chunk, then data
+void AudioFileSink::WriteHeader()
+{
+    unsigned uDataSize = static_cast< unsigned >( min( m_llFrames * 8, 0xFFFFFFFFLL - 50 ) );
+    m_ofs.write( "RIFF", 4 );
+    Put32( m_ofs, 4 + 26 + 8 + uDataSize );
+    m_ofs.write( "WAVEfmt ", 8 );
+    Put32( m_ofs, 18 );
+    Put16( m_ofs, 3 ); // Float
+    Put16( m_ofs, 2 );
+    Put32( m_ofs, m_iRate );
+    Put32( m_ofs, m_iRate * 8 );
+    Put16( m_ofs, 8 );
+    Put16( m_ofs, 32 );
+    Put16( m_ofs, 0 );
+    m_ofs.write( "data", 4 );
+    Put32( m_ofs, uDataSize );
+}
+
+// Little-endian hosts only, like the rest of the app
+bool AudioFileSink::Write( const float *pfFrames, int iFrames )
+{
+    if ( !m_ofs.is_open() ) return false;
+
+    m_ofs.write( reinterpret_cast< const char* >( pfFrames ), iFrames * 2 * sizeof( float ) );
+    m_llFrames += iFrames;
+
+    // A device would have the latency's worth still to play
+    if ( m_bRealTime )
+    {
+        long long llDue = m_llStartMicroSecs + ( m_llFrames - m_iLatencyFrames ) * 1000000 / m_iRate;
+        long long llWait = llDue - NowMicroSecs();
+        if ( llWait > 0 ) this_thread::sleep_for( chrono::microseconds( llWait ) );
+    }
+    return m_ofs.good();
+}
@@ -0,0 +1,68 @@
+/*************************************************************************************************
+*
+* File: AudioSink.h
+*
+* Description: Defines where rendered audio goes. WASAPI on Windows, ALSA on Linux, or a file
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <string>
+#include <fstream>
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Takes interleaved stereo floats. Write blocks till the device has room, so
+// whoever's writing is paced by it and never gets more than the latency ahead.
+//-----------------------------------------------------------------------------
+
+class AudioSink
+{
+public:
+    virtual ~AudioSink() { }
+
+    // The rate's a request: shared devices run at their own. iLatencyFrames is how much the caller
+    // wants buffered, and what it writes at a time. The device may round it up
+    virtual bool Open( int iRate, int iLatencyFrames ) = 0;
+    virtual void Close() = 0;
+    virtual int GetRate() const = 0;
+    virtual int GetLatencyFrames() const = 0; // Between Write returning and the speaker
+
+    virtual bool Write( const float *pfFrames, int iFrames ) = 0;
+};
+
+// The platform's output device. NULL where there isn't one. Caller deletes
+AudioSink *CreateDefaultAudioSink();
+AudioSink *CreateWASAPISink();
+AudioSink *CreateALSASink();
+
+//-----------------------------------------------------------------------------
+// A 32-bit float WAV file. Paced to real time unless told not to, so it can
+// stand in for a device; unpaced it renders as fast as the synth can go.
+//-----------------------------------------------------------------------------
+
+class AudioFileSink : public AudioSink
+{
+public:
+    AudioFileSink( const wstring &sFilename, bool bRealTime = true );
+    ~AudioFileSink() { Close(); }
+
+    bool Open( int iRate, int iLatencyFrames );
+    void Close();
+    int GetRate() const { return m_iRate; }
+    int GetLatencyFrames() const { return m_iLatencyFrames; }
+
+    bool Write( const float *pfFrames, int iFrames );
+
+private:
+    void WriteHeader();
+
+    wstring m_sFilename;
+    bool m_bRealTime;
+    ofstream m_ofs;
+    int m_iRate, m_iLatencyFrames;
+    long long m_llFrames;
+    long long m_llStartMicroSecs;
+};
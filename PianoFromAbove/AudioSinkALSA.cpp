@@ -0,0 +1,102 @@
+/*************************************************************************************************
+*
+* File: AudioSinkALSA.cpp
+*
+* Description: Implements the audio sink on ALSA PCM. Links against libasound
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include "AudioSink.h"
+
+#ifdef __linux__
+
+#include <alsa/asoundlib.h>
+
+//-----------------------------------------------------------------------------
+// Blocking writes to the default PCM. ALSA resamples if the hardware can't
+// do our rate. Underruns are recovered from and the write retried.
+//-----------------------------------------------------------------------------
+
+class ALSASink : public AudioSink
+{
+public:
+    ALSASink() : m_pPCM( NULL ), m_iRate( 0 ), m_iLatencyFrames( 0 ) { }
+    ~ALSASink() { Close(); }
+
+    bool Open( int iRate, int iLatencyFrames );
+    void Close();
+    int GetRate() const { return m_iRate; }
+    int GetLatencyFrames() const { return m_iLatencyFrames; }
+
+    bool Write( const float *pfFrames, int iFrames );
+
+private:
+    snd_pcm_t *m_pPCM;
+    int m_iRate, m_iLatencyFrames;
+};
+
+bool ALSASink::Open( int iRate, int iLatencyFrames )
+{
+    Close();
+    if ( snd_pcm_open( &m_pPCM, "default", SND_PCM_STREAM_PLAYBACK, 0 ) < 0 )
+    {
+        m_pPCM = NULL;
+        return false;
+    }
+
+    // Two periods of the caller's size: one playing, one being written
+    unsigned uLatency = static_cast< unsigned >( 2LL * iLatencyFrames * 1000000 / iRate );
+    if ( snd_pcm_set_params( m_pPCM, SND_PCM_FORMAT_FLOAT_LE, SND_PCM_ACCESS_RW_INTERLEAVED, 2, iRate, 1, uLatency ) < 0 )
+    {
+        Close();
+        return false;
+    }
+
+    snd_pcm_uframes_t uBufferSize = 0, uPeriodSize = 0;
+    snd_pcm_get_params( m_pPCM, &uBufferSize, &uPeriodSize );
+    m_iRate = iRate;
+    m_iLatencyFrames = static_cast< int >( uBufferSize );
+    return true;
+}
+
+void ALSASink::Close()
+{
+    if ( !m_pPCM ) return;
+
+    snd_pcm_drop( m_pPCM );
+    snd_pcm_close( m_pPCM );
+    m_pPCM = NULL;
+}
+
+bool ALSASink::Write( const float *pfFrames, int iFrames )
+{
+    if ( !m_pPCM ) return false;
+
+    while ( iFrames > 0 )
+    {
+        snd_pcm_sframes_t iWritten = snd_pcm_writei( m_pPCM, pfFrames, iFrames );
+        if ( iWritten < 0 )
+        {
+            if ( snd_pcm_recover( m_pPCM, static_cast< int >( iWritten ), 1 ) < 0 ) return false;
+            continue;
+        }
+        pfFrames += iWritten * 2;
+        iFrames -= static_cast< int >( iWritten );
+    }
+    return true;
+}
+
+AudioSink *CreateALSASink()
+{
+    return new ALSASink();
+}
+
+#else
+
+AudioSink *CreateALSASink()
+{
+    return NULL;
+}
+
+#endif
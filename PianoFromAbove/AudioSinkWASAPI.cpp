@@ -0,0 +1,191 @@
+/*************************************************************************************************
+*
+* File: AudioSinkWASAPI.cpp
+*
+* Description: Implements the audio sink on WASAPI shared mode
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include "AudioSink.h"
+
+#ifdef _WIN32
+
+#include <Windows.h>
+#include <mmdeviceapi.h>
+#include <audioclient.h>
+#include <ksmedia.h>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Event-driven shared mode on the default device, at the engine's own rate
+// so Windows doesn't resample. Where IAudioClient3 is around (Windows 10) the
+// engine period is asked down to about the caller's latency, else we get the
+// engine's default, around 10 ms. COM is initialized on whichever thread
+// opens, so Open, Write and Close all have to come from that one.
+//-----------------------------------------------------------------------------
+
+class WASAPISink : public AudioSink
+{
+public:
+    WASAPISink() : m_pClient( NULL ), m_pRender( NULL ), m_hEvent( NULL ), m_bComInit( false ),
+                   m_iRate( 0 ), m_iLatencyFrames( 0 ), m_uBufferFrames( 0 ) { }
+    ~WASAPISink() { Close(); }
+
+    bool Open( int iRate, int iLatencyFrames );
+    void Close();
+    int GetRate() const { return m_iRate; }
+    int GetLatencyFrames() const { return m_iLatencyFrames; }
+
+    bool Write( const float *pfFrames, int iFrames );
+
+private:
+    bool Initialize( const WAVEFORMATEX *pMixFormat, int iLatencyFrames );
+
+    IAudioClient *m_pClient;
+    IAudioRenderClient *m_pRender;
+    HANDLE m_hEvent;
+    bool m_bComInit;
+    int m_iRate, m_iLatencyFrames;
+    UINT32 m_uBufferFrames;
+};
+
+bool WASAPISink::Open( int iRate, int iLatencyFrames )
+{
+    Close();
+    m_bComInit = SUCCEEDED( CoInitializeEx( NULL, COINIT_MULTITHREADED ) );
+
+    IMMDeviceEnumerator *pEnumerator = NULL;
+    IMMDevice *pDevice = NULL;
+    WAVEFORMATEX *pMixFormat = NULL;
+    HRESULT hr = CoCreateInstance( __uuidof( MMDeviceEnumerator ), NULL, CLSCTX_ALL, __uuidof( IMMDeviceEnumerator ),
+                                   reinterpret_cast< void** >( &pEnumerator ) );
+    if ( SUCCEEDED( hr ) ) hr = pEnumerator->GetDefaultAudioEndpoint( eRender, eConsole, &pDevice );
+    if ( SUCCEEDED( hr ) )
+        hr = pDevice->Activate( __uuidof( IAudioClient ), CLSCTX_ALL, NULL, reinterpret_cast< void** >( &m_pClient ) );
+    if ( SUCCEEDED( hr ) ) hr = m_pClient->GetMixFormat( &pMixFormat );
+
+    bool bResult = SUCCEEDED( hr ) && Initialize( pMixFormat, iLatencyFrames * static_cast< int >( pMixFormat->nSamplesPerSec ) / iRate );
+    if ( pMixFormat ) CoTaskMemFree( pMixFormat );
+    if ( pDevice ) pDevice->Release();
+    if ( pEnumerator ) pEnumerator->Release();
+    if ( !bResult )
+    {
+        Close();
+        return false;
+    }
+
+    m_pClient->Start();
+    return true;
+}
+
+// Float stereo is what we write. If the engine's mix format is that, it's used as is, and on
+// IAudioClient3 with a small period. Otherwise Windows converts to the mix format for us
+bool WASAPISink::Initialize( const WAVEFORMATEX *pMixFormat, int iLatencyFrames )
+{
+    WAVEFORMATEXTENSIBLE wfx;
+    memset( &wfx, 0, sizeof( wfx ) );
+    wfx.Format.wFormatTag = WAVE_FORMAT_EXTENSIBLE;
+    wfx.Format.nChannels = 2;
+    wfx.Format.nSamplesPerSec = pMixFormat->nSamplesPerSec;
+    wfx.Format.wBitsPerSample = 32;
+    wfx.Format.nBlockAlign = 8;
+    wfx.Format.nAvgBytesPerSec = wfx.Format.nSamplesPerSec * 8;
+    wfx.Format.cbSize = sizeof( WAVEFORMATEXTENSIBLE ) - sizeof( WAVEFORMATEX );
+    wfx.Samples.wValidBitsPerSample = 32;
+    wfx.dwChannelMask = SPEAKER_FRONT_LEFT | SPEAKER_FRONT_RIGHT;
+    wfx.SubFormat = KSDATAFORMAT_SUBTYPE_IEEE_FLOAT;
+
+    const WAVEFORMATEXTENSIBLE *pMixExt = reinterpret_cast< const WAVEFORMATEXTENSIBLE* >( pMixFormat );
+    bool bMixIsOurs = pMixFormat->wFormatTag == WAVE_FORMAT_EXTENSIBLE && pMixFormat->nChannels == 2 &&
+                      pMixFormat->wBitsPerSample == 32 && IsEqualGUID( pMixExt->SubFormat, KSDATAFORMAT_SUBTYPE_IEEE_FLOAT );
+
+    HRESULT hr = E_FAIL;
+#ifdef __IAudioClient3_INTERFACE_DEFINED__
+    IAudioClient3 *pClient3 = NULL;
+    if ( bMixIsOurs && SUCCEEDED( m_pClient->QueryInterface( __uuidof( IAudioClient3 ), reinterpret_cast< void** >( &pClient3 ) ) ) )
+    {
+        // The smallest period the engine allows that's at least what was asked for
+        UINT32 uDefault, uFundamental, uMin, uMax;
+        hr = pClient3->GetSharedModeEnginePeriod( pMixFormat, &uDefault, &uFundamental, &uMin, &uMax );
+        if ( SUCCEEDED( hr ) )
+        {
+            UINT32 uPeriod = max( uMin, static_cast< UINT32 >( iLatencyFrames ) );
+            uPeriod = min( uMax, ( uPeriod + uFundamental - 1 ) / uFundamental * uFundamental );
+            hr = pClient3->InitializeSharedAudioStream( AUDCLNT_STREAMFLAGS_EVENTCALLBACK, uPeriod, pMixFormat, NULL );
+        }
+        pClient3->Release();
+    }
+#endif
+    if ( FAILED( hr ) )
+    {
+        DWORD dwFlags = AUDCLNT_STREAMFLAGS_EVENTCALLBACK;
+        if ( !bMixIsOurs ) dwFlags |= AUDCLNT_STREAMFLAGS_AUTOCONVERTPCM | AUDCLNT_STREAMFLAGS_SRC_DEFAULT_QUALITY;
+        hr = m_pClient->Initialize( AUDCLNT_SHAREMODE_SHARED, dwFlags, 0, 0, &wfx.Format, NULL );
+    }
+    if ( FAILED( hr ) ) return false;
+
+    m_hEvent = CreateEvent( NULL, FALSE, FALSE, NULL );
+    if ( !m_hEvent || FAILED( m_pClient->SetEventHandle( m_hEvent ) ) ) return false;
+    if ( FAILED( m_pClient->GetBufferSize( &m_uBufferFrames ) ) ) return false;
+    if ( FAILED( m_pClient->GetService( __uuidof( IAudioRenderClient ), reinterpret_cast< void** >( &m_pRender ) ) ) ) return false;
+
+    REFERENCE_TIME hnsLatency = 0;
+    m_pClient->GetStreamLatency( &hnsLatency );
+    m_iRate = static_cast< int >( pMixFormat->nSamplesPerSec );
+    m_iLatencyFrames = static_cast< int >( m_uBufferFrames + hnsLatency * m_iRate / 10000000 );
+    return true;
+}
+
+void WASAPISink::Close()
+{
+    if ( m_pClient ) m_pClient->Stop();
+    if ( m_pRender ) m_pRender->Release();
+    if ( m_pClient ) m_pClient->Release();
+    if ( m_hEvent ) CloseHandle( m_hEvent );
+    if ( m_bComInit ) CoUninitialize();
+    m_pRender = NULL;
+    m_pClient = NULL;
+    m_hEvent = NULL;
+    m_bComInit = false;
+}
+
+// Whatever fits now, then wait for the engine to take a period's worth
+bool WASAPISink::Write( const float *pfFrames, int iFrames )
+{
+    if ( !m_pRender ) return false;
+
+    while ( iFrames > 0 )
+    {
+        UINT32 uPadding;
+        if ( FAILED( m_pClient->GetCurrentPadding( &uPadding ) ) ) return false;
+        int iRoom = min( static_cast< int >( m_uBufferFrames - uPadding ), iFrames );
+        if ( iRoom <= 0 )
+        {
+            WaitForSingleObject( m_hEvent, 100 );
+            continue;
+        }
+
+        BYTE *pData;
+        if ( FAILED( m_pRender->GetBuffer( iRoom, &pData ) ) ) return false;
+        memcpy( pData, pfFrames, iRoom * 2 * sizeof( float ) );
+        m_pRender->ReleaseBuffer( iRoom, 0 );
+        pfFrames += iRoom * 2;
+        iFrames -= iRoom;
+    }
+    return true;
+}
+
+AudioSink *CreateWASAPISink()
+{
+    return new WASAPISink();
+}
+
+#else
+
+AudioSink *CreateWASAPISink()
+{
+    return NULL;
+}
+
+#endif
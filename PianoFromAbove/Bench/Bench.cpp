@@ -0,0 +1,250 @@
+/*************************************************************************************************
+*
+* File: Bench.cpp
+*
+* Description: The benchmark runner. "Bench <name> [args]" runs one benchmark, "Bench all" runs
+*              each with its defaults. Build the Release configuration before trusting a number
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#ifdef _WIN32
+#include <Windows.h>
+#include <Psapi.h>
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+#include "Bench.h"
+#include "../Misc.h"
+
+struct Benchmark
+{
+    const char *sName;
+    const char *sUsage;
+    int ( *pfnRun )( int argc, char **argv );
+};
+
+static const Benchmark g_aBenchmarks[] =
+{
+    { "parse", "[file.mid] [runs]  Track decoding and the whole load, in MB/s", BenchParse },
+    { "load", "[file.mid] [runs]  Time in each load phase from a file, and the load's peak memory", BenchLoad },
+    { "midiout", "[out] [in] [msgs]  Output throughput, and latency with the output looped into the input", BenchMIDIOut },
+    { "jobs", "[jobs] [work] [runs]  The job system against a single shared queue", BenchJobs },
+    { "queue", "[msgs] [trips]  TSQueue against the old queue: throughput and round trips", BenchQueue },
+    { "index", "[files] [lookups] [runs]  Library file lookups, hash index against a map", BenchIndex },
+    { "frames", "[secs] [notes] [vsync] [logic]  Frame handoff to the render thread, triple buffered against lockstep", BenchFrames },
+    { "library", "[songs] [runs]  Checks the library list's search and sorts, then times them", BenchLibrary },
+};
+static const int g_iBenchmarks = sizeof( g_aBenchmarks ) / sizeof( g_aBenchmarks[0] );
+
+static void PrintUsage()
+{
+    printf( "Usage: Bench <benchmark> [args], or Bench all\n" );
+    for ( int i = 0; i < g_iBenchmarks; i++ )
+        printf( "  %-10s %s\n", g_aBenchmarks[i].sName, g_aBenchmarks[i].sUsage );
+}
+
+int main( int argc, char **argv )
+{
+    if ( argc < 2 )
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    // All of them with their defaults. Stops at the first to fail
+    if ( strcmp( argv[1], "all" ) == 0 )
+    {
+        for ( int i = 0; i < g_iBenchmarks; i++ )
+        {
+            printf( "== %s\n", g_aBenchmarks[i].sName );
+            int iResult = g_aBenchmarks[i].pfnRun( 0, NULL );
+            if ( iResult != 0 ) return iResult;
+        }
+        return 0;
+    }
+
+    for ( int i = 0; i < g_iBenchmarks; i++ )
+        if ( strcmp( argv[1], g_aBenchmarks[i].sName ) == 0 )
+            return g_aBenchmarks[i].pfnRun( argc - 2, argv + 2 );
+
+    PrintUsage();
+    return 1;
+}
+
+//-----------------------------------------------------------------------------
+// Helpers
+//-----------------------------------------------------------------------------
+
+namespace Bench
+{
+
+double Samples::GetPercentile( double dPercent ) const
+{
+    if ( m_vValues.empty() ) return 0.0;
+
+    vector< double > vSorted( m_vValues );
+    size_t iPos = min( static_cast< size_t >( dPercent / 100.0 * ( vSorted.size() - 1 ) + 0.5 ), vSorted.size() - 1 );
+    nth_element( vSorted.begin(), vSorted.begin() + iPos, vSorted.end() );
+    return vSorted[iPos];
+}
+
+double Samples::GetMean() const
+{
+    double dSum = 0.0;
+    for ( size_t i = 0; i < m_vValues.size(); i++ )
+        dSum += m_vValues[i];
+    return m_vValues.empty() ? 0.0 : dSum / m_vValues.size();
+}
+
+long long GetMicroSecsNow()
+{
+    return Timer::GetNanoSecsNow() / 1000;
+}
+
+// The working set on Windows, the resident set elsewhere
+long long GetMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if ( !GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) ) return 0;
+    return pmc.WorkingSetSize;
+#else
+    long lPages = 0, lResident = 0;
+    FILE *pFile = fopen( "/proc/self/statm", "r" );
+    if ( !pFile ) return 0;
+    if ( fscanf( pFile, "%ld %ld", &lPages, &lResident ) != 2 ) lResident = 0;
+    fclose( pFile );
+    return static_cast< long long >( lResident ) * sysconf( _SC_PAGESIZE );
+#endif
+}
+
+long long GetPeakMemory()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if ( !GetProcessMemoryInfo( GetCurrentProcess(), &pmc, sizeof( pmc ) ) ) return 0;
+    return pmc.PeakWorkingSetSize;
+#else
+    rusage ru;
+    if ( getrusage( RUSAGE_SELF, &ru ) != 0 ) return 0;
+    return ru.ru_maxrss * 1024LL; // In KB
+#endif
+}
+
+int GetIntArg( int argc, char **argv, int iArg, int iDefault )
+{
+    if ( iArg >= argc ) return iDefault;
+    char *pcEnd;
+    long lValue = strtol( argv[iArg], &pcEnd, 10 );
+    return *pcEnd == '\0' && pcEnd != argv[iArg] ? static_cast< int >( lValue ) : iDefault;
+}
+
+namespace
+{
+    void Put32( vector< unsigned char > &vData, unsigned iValue )
+    {
+        for ( int i = 3; i >= 0; i-- )
+            vData.push_back( static_cast< unsigned char >( iValue >> ( 8 * i ) ) );
+    }
+
+    void PutVarNum( vector< unsigned char > &vData, unsigned iValue )
+    {
+        unsigned char acBytes[4];
+        int iBytes = 0;
+        do
+        {
+            acBytes[iBytes++] = static_cast< unsigned char >( iValue & 0x7F );
+            iValue >>= 7;
+        }
+        while ( iValue > 0 && iBytes < 4 );
+        while ( iBytes > 1 )
+            vData.push_back( acBytes[--iBytes] | 0x80 );
+        vData.push_back( acBytes[0] );
+    }
+
+    // Fills in the chunk size once the track's done
+    void EndTrack( vector< unsigned char > &vSong, size_t iStart )
+    {
+        const unsigned char acEnd[] = { 0x00, 0xFF, 0x2F, 0x00 };
+        vSong.insert( vSong.end(), acEnd, acEnd + sizeof( acEnd ) );
+        unsigned iSize = static_cast< unsigned >( vSong.size() - iStart - 8 );
+        for ( int i = 0; i < 4; i++ )
+            vSong[iStart + 4 + i] = static_cast< unsigned char >( iSize >> ( 8 * ( 3 - i ) ) );
+    }
+}
+
+void MakeSong( int iTracks, int iNotes, vector< unsigned char > &vSong )
+{
+    vSong.clear();
+    const unsigned char acHeader[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1 };
+    vSong.insert( vSong.end(), acHeader, acHeader + sizeof( acHeader ) );
+    vSong.push_back( static_cast< unsigned char >( ( iTracks + 1 ) >> 8 ) );
+    vSong.push_back( static_cast< unsigned char >( iTracks + 1 ) );
+    vSong.push_back( 480 >> 8 );
+    vSong.push_back( 480 & 0xFF );
+
+    // Tempo track
+    size_t iStart = vSong.size();
+    const unsigned char acTempo[] = { 'M', 'T', 'r', 'k', 0, 0, 0, 0, 0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20 };
+    vSong.insert( vSong.end(), acTempo, acTempo + sizeof( acTempo ) );
+    EndTrack( vSong, iStart );
+
+    unsigned iSeed = 12345;
+    for ( int iTrack = 0; iTrack < iTracks; iTrack++ )
+    {
+        iStart = vSong.size();
+        vSong.insert( vSong.end(), acTempo, acTempo + 4 );
+        Put32( vSong, 0 );
+
+        int iChannel = iTrack % 16;
+        for ( int i = 0; i < iNotes; i++ )
+        {
+            iSeed = iSeed * 1103515245 + 12345;
+            unsigned iRand = iSeed >> 8;
+            int iNote = 21 + iRand % 88;
+
+            // Mostly short gaps, now and then a long one
+            PutVarNum( vSong, iRand % 61 == 0 ? 200 + iRand % 2000 : iRand % 40 );
+            if ( i == 0 ) vSong.push_back( static_cast< unsigned char >( 0x90 | iChannel ) );
+            vSong.push_back( static_cast< unsigned char >( iNote ) );
+            vSong.push_back( static_cast< unsigned char >( 1 + ( iRand >> 8 ) % 127 ) );
+
+            // Note off as a zero velocity note on, or a pedal or volume change first
+            PutVarNum( vSong, 1 + ( iRand >> 4 ) % 100 );
+            if ( iRand % 97 == 0 )
+            {
+                vSong.push_back( static_cast< unsigned char >( 0xB0 | iChannel ) );
+                vSong.push_back( iRand % 2 ? 64 : 7 );
+                vSong.push_back( static_cast< unsigned char >( ( iRand >> 12 ) % 128 ) );
+                PutVarNum( vSong, 0 );
+                vSong.push_back( static_cast< unsigned char >( 0x90 | iChannel ) );
+            }
+            vSong.push_back( static_cast< unsigned char >( iNote ) );
+            vSong.push_back( 0 );
+        }
+        EndTrack( vSong, iStart );
+    }
+}
+
+bool ReadFile( const char *sFilename, vector< unsigned char > &vData )
+{
+    FILE *pFile = fopen( sFilename, "rb" );
+    if ( !pFile ) return false;
+
+    fseek( pFile, 0, SEEK_END );
+    long lSize = ftell( pFile );
+    fseek( pFile, 0, SEEK_SET );
+    vData.resize( max( lSize, 0L ) );
+    bool bResult = lSize > 0 && fread( &vData[0], 1, lSize, pFile ) == static_cast< size_t >( lSize );
+    fclose( pFile );
+    return bResult;
+}
+
+}
@@ -0,0 +1,59 @@
+/*************************************************************************************************
+*
+* File: Bench.h
+*
+* Description: Defines the helpers shared by the benchmarks, and the benchmarks themselves.
+*              Each takes the arguments after its name and prints what it measured
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <vector>
+#include <string>
+using namespace std;
+
+namespace Bench
+{
+    // Times of repeated runs, in whatever unit they were added in
+    class Samples
+    {
+    public:
+        void Add( double dValue ) { m_vValues.push_back( dValue ); }
+        void Clear() { m_vValues.clear(); }
+        int GetCount() const { return static_cast< int >( m_vValues.size() ); }
+        double GetMin() const { return GetPercentile( 0.0 ); }
+        double GetMedian() const { return GetPercentile( 50.0 ); }
+        double GetMax() const { return GetPercentile( 100.0 ); }
+        double GetPercentile( double dPercent ) const;
+        double GetMean() const;
+
+    private:
+        vector< double > m_vValues;
+    };
+
+    long long GetMicroSecsNow();
+
+    // The process's memory in RAM, in bytes: now, and the most it's had at once
+    long long GetMemory();
+    long long GetPeakMemory();
+
+    // The iArg'th argument as a number, or the default if it's not there
+    int GetIntArg( int argc, char **argv, int iArg, int iDefault );
+
+    // A format 1 song made up on the spot, the same every time: a tempo track, then iTracks tracks of iNotes
+    // notes each, one channel a track. Running status throughout, mostly one byte DTs, a controller every so often
+    void MakeSong( int iTracks, int iNotes, vector< unsigned char > &vSong );
+    bool ReadFile( const char *sFilename, vector< unsigned char > &vData );
+}
+
+// The benchmarks. Each returns the process's exit code
+int BenchParse( int argc, char **argv );
+int BenchLoad( int argc, char **argv );
+int BenchMIDIOut( int argc, char **argv );
+int BenchJobs( int argc, char **argv );
+int BenchQueue( int argc, char **argv );
+int BenchIndex( int argc, char **argv );
+int BenchFrames( int argc, char **argv );
+int BenchLibrary( int argc, char **argv );
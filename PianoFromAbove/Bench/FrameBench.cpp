@@ -0,0 +1,215 @@
+/*************************************************************************************************
+*
+* File: FrameBench.cpp
+*
+* Description: Times frames handed from the game thread to the render thread, decoupled through
+*              a triple buffer as the app does now, against the lockstep handoff where the game
+*              thread waits for each frame to be drawn. No Direct3D: drawing is a pass over the
+*              frame's notes and vsync is a paced wait
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "Bench.h"
+#include "../Misc.h"
+
+namespace
+{
+    // Stands in for MainScreen::Frame: a time stamp and the notes on screen
+    struct Note
+    {
+        long long llStart, llEnd;
+        int iNote;
+        unsigned iColor;
+    };
+
+    struct Frame
+    {
+        long long llFrameTime; // Timer::GetNanoSecsNow when the game thread made it
+        vector< Note > vNotes;
+    };
+
+    // What the game thread does each tick: work out what's on screen
+    void MakeFrame( Frame &frame, int iTick, int iNotes )
+    {
+        frame.vNotes.resize( iNotes );
+        for ( int i = 0; i < iNotes; i++ )
+        {
+            Note &note = frame.vNotes[i];
+            note.llStart = iTick * 4000LL + i * 97;
+            note.llEnd = note.llStart + 50000 + i % 300;
+            note.iNote = 21 + ( iTick + i ) % 88;
+            note.iColor = 0xFF000000 | ( i * 2654435761u >> 8 );
+        }
+        frame.llFrameTime = Timer::GetNanoSecsNow();
+    }
+
+    // What the render thread does: a pass over the notes, a few times like the draw passes
+    unsigned DrawFrame( const Frame &frame )
+    {
+        unsigned iSum = 0;
+        for ( int iPass = 0; iPass < 3; iPass++ )
+            for ( size_t i = 0; i < frame.vNotes.size(); i++ )
+                iSum += static_cast< unsigned >( frame.vNotes[i].llEnd - frame.vNotes[i].llStart ) ^ frame.vNotes[i].iColor;
+        return iSum;
+    }
+
+    // Sleeps to the next vsync on a fixed grid, like Present with vsync on
+    class VSync
+    {
+    public:
+        VSync( int iHz ) : m_llPeriod( 1000000000LL / iHz ), m_llNext( Timer::GetNanoSecsNow() + m_llPeriod ) { }
+        void Wait()
+        {
+            long long llNow = Timer::GetNanoSecsNow();
+            while ( m_llNext <= llNow ) m_llNext += m_llPeriod;
+            if ( m_llNext - llNow > 2000000 )
+                this_thread::sleep_for( chrono::nanoseconds( m_llNext - llNow - 2000000 ) );
+            while ( Timer::GetNanoSecsNow() < m_llNext ) this_thread::yield();
+            m_llNext += m_llPeriod;
+        }
+
+    private:
+        long long m_llPeriod, m_llNext;
+    };
+
+    struct Result
+    {
+        Bench::Samples sFrameTime; // Between frames drawn, ms
+        Bench::Samples sAge; // From made to drawn, ms
+        int iTicks, iFrames;
+    };
+
+    // The game thread ticks on its own schedule and publishes. The render thread draws the newest
+    void RunDecoupled( int iSecs, int iTickHz, int iVSyncHz, int iNotes, Result &result )
+    {
+        TripleBuffer< Frame > frames;
+        atomic< bool > bQuit( false );
+        atomic< int > iTicks( 0 );
+        thread thGame( [&]()
+        {
+            FrameScheduler scheduler;
+            scheduler.SetFrameRate( iTickHz );
+            TSQueue< int > qMessages; // Never gets any. The scheduler sleeps on it
+            for ( int iTick = 0; !bQuit; iTick++ )
+            {
+                MakeFrame( frames.Back(), iTick, iNotes );
+                frames.Publish();
+                iTicks++;
+                scheduler.FrameDone( false );
+                scheduler.Wait( qMessages );
+            }
+        } );
+
+        VSync vsync( iVSyncHz );
+        unsigned iSum = 0;
+        long long llEnd = Timer::GetNanoSecsNow() + iSecs * 1000000000LL, llLast = 0;
+        result.iFrames = 0;
+        while ( Timer::GetNanoSecsNow() < llEnd )
+        {
+            frames.Acquire();
+            const Frame &frame = frames.Front();
+            if ( !frame.vNotes.empty() )
+            {
+                iSum += DrawFrame( frame );
+                result.sAge.Add( ( Timer::GetNanoSecsNow() - frame.llFrameTime ) / 1e6 );
+            }
+            vsync.Wait();
+
+            long long llNow = Timer::GetNanoSecsNow();
+            if ( llLast > 0 ) result.sFrameTime.Add( ( llNow - llLast ) / 1e6 );
+            llLast = llNow;
+            result.iFrames++;
+        }
+        bQuit = true;
+        thGame.join();
+        result.iTicks = iTicks;
+        if ( iSum == 1 ) printf( "!" ); // Keeps the drawing from being optimized out
+    }
+
+    // The game thread makes a frame, hands it over and waits for it to be drawn, vsync included
+    void RunLockstep( int iSecs, int iVSyncHz, int iNotes, Result &result )
+    {
+        Frame frame;
+        mutex mtx;
+        condition_variable cvFrame, cvDrawn;
+        int iMade = 0, iDrawn = 0;
+        bool bQuit = false;
+        thread thRender( [&]()
+        {
+            VSync vsync( iVSyncHz );
+            unsigned iSum = 0;
+            unique_lock< mutex > lock( mtx );
+            for (;;)
+            {
+                cvFrame.wait( lock, [&]() { return bQuit || iMade != iDrawn; } );
+                if ( bQuit ) break;
+                lock.unlock();
+                iSum += DrawFrame( frame );
+                result.sAge.Add( ( Timer::GetNanoSecsNow() - frame.llFrameTime ) / 1e6 );
+                vsync.Wait();
+                lock.lock();
+                iDrawn = iMade;
+                cvDrawn.notify_all();
+            }
+            if ( iSum == 1 ) printf( "!" );
+        } );
+
+        long long llEnd = Timer::GetNanoSecsNow() + iSecs * 1000000000LL, llLast = 0;
+        result.iFrames = 0;
+        for ( int iTick = 0; Timer::GetNanoSecsNow() < llEnd; iTick++ )
+        {
+            MakeFrame( frame, iTick, iNotes );
+            {
+                unique_lock< mutex > lock( mtx );
+                iMade++;
+                cvFrame.notify_one();
+                cvDrawn.wait( lock, [&]() { return iDrawn == iMade; } );
+            }
+
+            long long llNow = Timer::GetNanoSecsNow();
+            if ( llLast > 0 ) result.sFrameTime.Add( ( llNow - llLast ) / 1e6 );
+            llLast = llNow;
+            result.iFrames++;
+        }
+        {
+            lock_guard< mutex > lock( mtx );
+            bQuit = true;
+        }
+        cvFrame.notify_one();
+        thRender.join();
+        result.iTicks = result.iFrames;
+    }
+
+    void PrintResult( const char *sName, const Result &result, int iSecs )
+    {
+        printf( "  %-10s %6.1f Hz %6.1f fps %7.2f %7.2f %7.2f ms %7.2f %7.2f ms\n", sName, static_cast< double >( result.iTicks ) / iSecs,
+                static_cast< double >( result.iFrames ) / iSecs, result.sFrameTime.GetMedian(), result.sFrameTime.GetPercentile( 99.0 ),
+                result.sFrameTime.GetMax(), result.sAge.GetMedian(), result.sAge.GetPercentile( 99.0 ) );
+    }
+}
+
+// Args: [seconds] [notes a frame] [vsync Hz] [logic Hz]
+int BenchFrames( int argc, char **argv )
+{
+    int iSecs = max( Bench::GetIntArg( argc, argv, 0, 3 ), 1 );
+    int iNotes = Bench::GetIntArg( argc, argv, 1, 20000 );
+    int iVSyncHz = max( Bench::GetIntArg( argc, argv, 2, 60 ), 1 );
+    int iTickHz = max( Bench::GetIntArg( argc, argv, 3, 250 ), 1 );
+
+    Result decoupled, lockstep;
+    RunDecoupled( iSecs, iTickHz, iVSyncHz, iNotes, decoupled );
+    RunLockstep( iSecs, iVSyncHz, iNotes, lockstep );
+
+    printf( "%d notes a frame, %d Hz vsync, %d s each\n", iNotes, iVSyncHz, iSecs );
+    printf( "  %-10s %9s %10s %27s %18s\n", "", "logic", "drawn", "frame time (p50 p99 max)", "age (p50 p99)" );
+    PrintResult( "decoupled", decoupled, iSecs );
+    PrintResult( "lockstep", lockstep, iSecs );
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*************************************************************************************************
+*
+* File: IndexBench.cpp
+*
+* Description: Times the song library's file lookups. HashIndex, keyed and compared the way
+*              SongLibrary::FindFile does it, against the map of (filename, size) it replaced
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <map>
+
+#include "Bench.h"
+#include "../Misc.h"
+
+namespace
+{
+    // Stands in for PFAData::File
+    struct File
+    {
+        string sFilename;
+        int iSize;
+    };
+
+    // Library-like paths: a few deep folders with a lot of songs in each, so keys share long prefixes
+    string MakePath( int i )
+    {
+        char sPath[256];
+        sprintf( sPath, "C:\\Users\\Someone\\Music\\MIDI\\Collection %d\\Artist %d\\Song number %d (%d).mid", i % 7, i % 613, i,
+                 i * 7919 % 10007 );
+        return sPath;
+    }
+
+    unsigned HashFile( const string &sFilename, int iSize )
+    {
+        return HashIndex< File* >::Hash( sFilename.data(), sFilename.length(), iSize );
+    }
+
+    struct Query
+    {
+        string sFilename;
+        int iSize;
+    };
+}
+
+// Args: [library size] [lookups] [runs]. A tenth of the lookups miss
+int BenchIndex( int argc, char **argv )
+{
+    int iFiles = Bench::GetIntArg( argc, argv, 0, 200000 );
+    int iLookups = Bench::GetIntArg( argc, argv, 1, 1000000 );
+    int iRuns = Bench::GetIntArg( argc, argv, 2, 3 );
+
+    vector< File > vFiles( iFiles );
+    for ( int i = 0; i < iFiles; i++ )
+    {
+        vFiles[i].sFilename = MakePath( i );
+        vFiles[i].iSize = 1000 + i * 37 % 100000;
+    }
+
+    // Every tenth a miss: a path that isn't there, or one that is with the wrong size
+    vector< Query > vQueries( iLookups );
+    unsigned iSeed = 12345;
+    for ( int i = 0; i < iLookups; i++ )
+    {
+        iSeed = iSeed * 1103515245 + 12345;
+        int iFile = static_cast< int >( ( iSeed >> 8 ) % iFiles );
+        vQueries[i].sFilename = ( i % 20 == 0 ? MakePath( iFiles + iFile ) : vFiles[iFile].sFilename );
+        vQueries[i].iSize = vFiles[iFile].iSize + ( i % 20 == 10 ? 1 : 0 );
+    }
+
+    Bench::Samples sHashBuild, sHashFind, sMapBuild, sMapFind;
+    int iHashFound = 0, iMapFound = 0;
+    for ( int iRun = 0; iRun < iRuns; iRun++ )
+    {
+        // What SongLibrary does
+        {
+            long long llStart = Bench::GetMicroSecsNow();
+            HashIndex< File* > index;
+            for ( int i = 0; i < iFiles; i++ )
+            {
+                File *pFile = &vFiles[i];
+                index.Set( HashFile( pFile->sFilename, pFile->iSize ), [&]( const File *pOther )
+                    { return pOther->iSize == pFile->iSize && pOther->sFilename == pFile->sFilename; }, pFile );
+            }
+            long long llBuilt = Bench::GetMicroSecsNow();
+
+            iHashFound = 0;
+            for ( int i = 0; i < iLookups; i++ )
+            {
+                const Query &q = vQueries[i];
+                File * const *ppFile = index.Find( HashFile( q.sFilename, q.iSize ), [&]( const File *pFile )
+                    { return pFile->iSize == q.iSize && pFile->sFilename == q.sFilename; } );
+                iHashFound += ( ppFile != NULL );
+            }
+            sHashBuild.Add( static_cast< double >( llBuilt - llStart ) );
+            sHashFind.Add( static_cast< double >( Bench::GetMicroSecsNow() - llBuilt ) );
+        }
+
+        // What it did before
+        {
+            long long llStart = Bench::GetMicroSecsNow();
+            map< pair< string, int >, File* > mFiles;
+            for ( int i = 0; i < iFiles; i++ )
+                mFiles[pair< string, int >( vFiles[i].sFilename, vFiles[i].iSize )] = &vFiles[i];
+            long long llBuilt = Bench::GetMicroSecsNow();
+
+            iMapFound = 0;
+            for ( int i = 0; i < iLookups; i++ )
+                iMapFound += ( mFiles.find( pair< string, int >( vQueries[i].sFilename, vQueries[i].iSize ) ) != mFiles.end() );
+            sMapBuild.Add( static_cast< double >( llBuilt - llStart ) );
+            sMapFind.Add( static_cast< double >( Bench::GetMicroSecsNow() - llBuilt ) );
+        }
+    }
+
+    printf( "%d files, %d lookups (%d found), %d runs. Best (median) ms\n", iFiles, iLookups, iHashFound, iRuns );
+    printf( "  %-12s %9s %19s\n", "", "build", "lookups" );
+    printf( "  %-12s %9.1f (%7.1f) %9.1f (%7.1f)\n", "hash index", sHashBuild.GetMin() / 1000.0, sHashBuild.GetMedian() / 1000.0,
+            sHashFind.GetMin() / 1000.0, sHashFind.GetMedian() / 1000.0 );
+    printf( "  %-12s %9.1f (%7.1f) %9.1f (%7.1f)\n", "map", sMapBuild.GetMin() / 1000.0, sMapBuild.GetMedian() / 1000.0,
+            sMapFind.GetMin() / 1000.0, sMapFind.GetMedian() / 1000.0 );
+    if ( iHashFound != iMapFound )
+    {
+        printf( "  The two found different files!\n" );
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,294 @@
+/*************************************************************************************************
+*
+* File: JobBench.cpp
+*
+* Description: Times the job system against a plain pool with one shared queue, on the same
+*              number of threads. Flat batches from outside, jobs that fork their own, and a
+*              recursive split like the loader's per-track work
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+
+#include "Bench.h"
+#include "../JobSystem.h"
+
+namespace
+{
+    //-----------------------------------------------------------------------------
+    // The two pools, behind the same few calls
+    //-----------------------------------------------------------------------------
+
+    class StealingPool
+    {
+    public:
+        typedef JobGroup Group;
+
+        const char *GetName() const { return "work stealing"; }
+        int GetWorkerCount() const { return JobSystem::GetJobSystem().GetWorkerCount(); }
+        void Submit( const function< void() > &fnJob, Group &group ) { JobSystem::GetJobSystem().Submit( fnJob, JobSystem::High, &group ); }
+        void Wait( Group &group ) { JobSystem::GetJobSystem().Wait( group ); }
+    };
+
+    // What the job system replaced: one locked deque that every thread pushes to and pops from the front of
+    class SharedPool
+    {
+    public:
+        class Group
+        {
+        public:
+            Group() : iPending( 0 ) { }
+            atomic< int > iPending;
+        };
+
+        SharedPool( int iWorkers );
+        ~SharedPool();
+
+        const char *GetName() const { return "shared queue"; }
+        int GetWorkerCount() const { return static_cast< int >( m_vWorkers.size() ); }
+        void Submit( const function< void() > &fnJob, Group &group );
+        void Wait( Group &group ); // Runs jobs while it waits, like the job system
+
+    private:
+        struct Job
+        {
+            function< void() > fnRun;
+            Group *pGroup;
+        };
+
+        bool TakeJob( Job &job );
+        void RunJob( Job &job );
+        void Work();
+
+        vector< thread > m_vWorkers;
+        mutex m_mtxJobs;
+        condition_variable m_cvWork, m_cvDone;
+        deque< Job > m_dJobs;
+        bool m_bQuit;
+    };
+
+    SharedPool::SharedPool( int iWorkers ) : m_bQuit( false )
+    {
+        for ( int i = 0; i < iWorkers; i++ )
+            m_vWorkers.push_back( thread( &SharedPool::Work, this ) );
+    }
+
+    SharedPool::~SharedPool()
+    {
+        {
+            lock_guard< mutex > lock( m_mtxJobs );
+            m_bQuit = true;
+        }
+        m_cvWork.notify_all();
+        for ( size_t i = 0; i < m_vWorkers.size(); i++ )
+            m_vWorkers[i].join();
+    }
+
+    void SharedPool::Submit( const function< void() > &fnJob, Group &group )
+    {
+        group.iPending++;
+        Job job = { fnJob, &group };
+        {
+            lock_guard< mutex > lock( m_mtxJobs );
+            m_dJobs.push_back( job );
+        }
+        m_cvWork.notify_one();
+    }
+
+    void SharedPool::Wait( Group &group )
+    {
+        Job job;
+        while ( group.iPending > 0 )
+        {
+            if ( TakeJob( job ) )
+            {
+                RunJob( job );
+                continue;
+            }
+            unique_lock< mutex > lock( m_mtxJobs );
+            m_cvDone.wait( lock, [&]() { return group.iPending == 0 || !m_dJobs.empty(); } );
+        }
+    }
+
+    bool SharedPool::TakeJob( Job &job )
+    {
+        lock_guard< mutex > lock( m_mtxJobs );
+        if ( m_dJobs.empty() ) return false;
+        job = m_dJobs.front();
+        m_dJobs.pop_front();
+        return true;
+    }
+
+    void SharedPool::RunJob( Job &job )
+    {
+        job.fnRun();
+        if ( --job.pGroup->iPending == 0 )
+        {
+            lock_guard< mutex > lock( m_mtxJobs );
+            m_cvDone.notify_all();
+        }
+    }
+
+    void SharedPool::Work()
+    {
+        Job job;
+        for (;;)
+        {
+            {
+                unique_lock< mutex > lock( m_mtxJobs );
+                m_cvWork.wait( lock, [&]() { return m_bQuit || !m_dJobs.empty(); } );
+                if ( m_bQuit ) return;
+                job = m_dJobs.front();
+                m_dJobs.pop_front();
+            }
+            RunJob( job );
+            job = Job();
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    // The workloads. Each returns a checksum so the two pools can be compared
+    //-----------------------------------------------------------------------------
+
+    // About iWork nanoseconds of arithmetic, give or take the machine
+    unsigned Spin( unsigned iSeed, int iWork )
+    {
+        for ( int i = 0; i < iWork; i++ )
+            iSeed = iSeed * 1664525 + 1013904223;
+        return iSeed;
+    }
+
+    // Lots of small jobs from outside the pool, then wait for them all
+    template< class Pool >
+    unsigned RunFlat( Pool &pool, int iJobs, int iWork )
+    {
+        vector< unsigned > vOut( iJobs );
+        typename Pool::Group group;
+        for ( int i = 0; i < iJobs; i++ )
+            pool.Submit( [&vOut, i, iWork]() { vOut[i] = Spin( i, iWork ); }, group );
+        pool.Wait( group );
+
+        unsigned iSum = 0;
+        for ( int i = 0; i < iJobs; i++ ) iSum += vOut[i];
+        return iSum;
+    }
+
+    // A job per worker, each forking its own batch and waiting on it. Forked jobs are what the
+    // workers' own deques are for
+    template< class Pool >
+    unsigned RunNested( Pool &pool, int iJobs, int iWork )
+    {
+        int iParents = max( pool.GetWorkerCount(), 1 );
+        int iChildren = max( iJobs / iParents, 1 );
+        vector< unsigned > vOut( iParents * iChildren );
+        typename Pool::Group group;
+        for ( int p = 0; p < iParents; p++ )
+            pool.Submit( [&pool, &vOut, p, iChildren, iWork]()
+            {
+                typename Pool::Group children;
+                for ( int c = 0; c < iChildren; c++ )
+                {
+                    int i = p * iChildren + c;
+                    pool.Submit( [&vOut, i, iWork]() { vOut[i] = Spin( i, iWork ); }, children );
+                }
+                pool.Wait( children );
+            }, group );
+        pool.Wait( group );
+
+        unsigned iSum = 0;
+        for ( size_t i = 0; i < vOut.size(); i++ ) iSum += vOut[i];
+        return iSum;
+    }
+
+    // Halves a range till it's small, each half a job
+    template< class Pool >
+    unsigned Split( Pool &pool, int iFirst, int iEnd, int iWork )
+    {
+        if ( iEnd - iFirst <= 16 )
+        {
+            unsigned iSum = 0;
+            for ( int i = iFirst; i < iEnd; i++ ) iSum += Spin( i, iWork );
+            return iSum;
+        }
+
+        int iMid = ( iFirst + iEnd ) / 2;
+        unsigned iLeft = 0;
+        typename Pool::Group group;
+        pool.Submit( [&pool, &iLeft, iFirst, iMid, iWork]() { iLeft = Split( pool, iFirst, iMid, iWork ); }, group );
+        unsigned iRight = Split( pool, iMid, iEnd, iWork );
+        pool.Wait( group );
+        return iLeft + iRight;
+    }
+
+    template< class Pool >
+    unsigned RunSplit( Pool &pool, int iJobs, int iWork )
+    {
+        return Split( pool, 0, iJobs, iWork );
+    }
+
+    //-----------------------------------------------------------------------------
+    // Timing
+    //-----------------------------------------------------------------------------
+
+    struct Result
+    {
+        Bench::Samples sTime;
+        unsigned iSum;
+    };
+
+    template< class Pool >
+    void TimeAll( Pool &pool, int iRuns, int iJobs, int iWork, Result aResults[3] )
+    {
+        for ( int iRun = 0; iRun < iRuns; iRun++ )
+        {
+            long long llStart = Bench::GetMicroSecsNow();
+            aResults[0].iSum = RunFlat( pool, iJobs, iWork );
+            long long llFlat = Bench::GetMicroSecsNow();
+            aResults[1].iSum = RunNested( pool, iJobs, iWork );
+            long long llNested = Bench::GetMicroSecsNow();
+            aResults[2].iSum = RunSplit( pool, iJobs, iWork );
+            long long llSplit = Bench::GetMicroSecsNow();
+
+            aResults[0].sTime.Add( static_cast< double >( llFlat - llStart ) );
+            aResults[1].sTime.Add( static_cast< double >( llNested - llFlat ) );
+            aResults[2].sTime.Add( static_cast< double >( llSplit - llNested ) );
+        }
+    }
+}
+
+// Args: [jobs] [work a job] [runs]. Work is in rounds of a few arithmetic ops
+int BenchJobs( int argc, char **argv )
+{
+    int iJobs = Bench::GetIntArg( argc, argv, 0, 100000 );
+    int iWork = Bench::GetIntArg( argc, argv, 1, 200 );
+    int iRuns = Bench::GetIntArg( argc, argv, 2, 5 );
+
+    StealingPool stealing;
+    SharedPool shared( stealing.GetWorkerCount() );
+    Result aStealing[3], aShared[3];
+    TimeAll( stealing, iRuns, iJobs, iWork, aStealing );
+    TimeAll( shared, iRuns, iJobs, iWork, aShared );
+
+    static const char *aNames[3] = { "flat", "nested", "split" };
+    printf( "%d jobs of %d rounds, %d workers plus the caller, %d runs. Best (median) ms\n", iJobs, iWork,
+            stealing.GetWorkerCount(), iRuns );
+    printf( "  %-8s %20s %20s\n", "", stealing.GetName(), shared.GetName() );
+    for ( int i = 0; i < 3; i++ )
+    {
+        printf( "  %-8s %9.2f (%8.2f) %9.2f (%8.2f)%s\n", aNames[i], aStealing[i].sTime.GetMin() / 1000.0,
+                aStealing[i].sTime.GetMedian() / 1000.0, aShared[i].sTime.GetMin() / 1000.0, aShared[i].sTime.GetMedian() / 1000.0,
+                aStealing[i].iSum == aShared[i].iSum ? "" : "  results differ!" );
+    }
+
+    vector< JobSystem::WorkerStats > vStats;
+    JobSystem::GetJobSystem().GetStats( vStats );
+    int iSteals = 0, iRun = 0;
+    for ( size_t i = 0; i < vStats.size(); i++ )
+    {
+        iSteals += vStats[i].iSteals;
+        iRun += vStats[i].iJobs;
+    }
+    printf( "  job system workers ran %d jobs, %d of them stolen\n", iRun, iSteals );
+    return 0;
+}
@@ -0,0 +1,394 @@
+/*************************************************************************************************
+*
+* File: LibraryBench.cpp
+*
+* Description: Checks the library list model against a plain scan and sort, then times it. The
+*              checks cover the searches that don't use the trigram index the usual way (empty,
+*              one and two letter words) and sort keys that tie. Fails if any row comes out wrong
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+#include <algorithm>
+
+#include "Bench.h"
+#include "../LibraryModel.h"
+
+namespace
+{
+    //-----------------------------------------------------------------------------
+    // The reference: what the model should show, worked out the slow way
+    //-----------------------------------------------------------------------------
+
+    struct RefSong
+    {
+        string sText, sFolder, sName; // Lower cased. The text is what gets searched: the path from the folder on
+        int iSeconds, iTracks, iNotes;
+    };
+
+    string ToLower( const string &s )
+    {
+        string sLower( s );
+        for ( size_t i = 0; i < sLower.size(); i++ )
+            if ( sLower[i] >= 'A' && sLower[i] <= 'Z' ) sLower[i] = sLower[i] - 'A' + 'a';
+        return sLower;
+    }
+
+    RefSong MakeRef( const string &sPath, int iSeconds, int iTracks, int iNotes )
+    {
+        RefSong song = { ToLower( sPath ), string(), string(), iSeconds, iTracks, iNotes };
+        size_t iSlash = sPath.rfind( '\\' );
+        if ( iSlash == string::npos )
+        {
+            song.sName = song.sText;
+            return song;
+        }
+        size_t iFolderSlash = ( iSlash == 0 ? string::npos : sPath.rfind( '\\', iSlash - 1 ) );
+        size_t iFolder = ( iFolderSlash == string::npos ? 0 : iFolderSlash + 1 );
+        song.sText = ToLower( sPath.substr( iFolder ) );
+        song.sFolder = ToLower( sPath.substr( iFolder, iSlash - iFolder ) );
+        song.sName = ToLower( sPath.substr( iSlash + 1 ) );
+        return song;
+    }
+
+    // Every word somewhere in the text
+    bool Matches( const RefSong &song, const string &sQuery )
+    {
+        string sLower = ToLower( sQuery );
+        for ( size_t iStart = 0; iStart < sLower.size(); )
+        {
+            size_t iEnd = sLower.find( ' ', iStart );
+            if ( iEnd == string::npos ) iEnd = sLower.size();
+            if ( iEnd > iStart && song.sText.find( sLower.substr( iStart, iEnd - iStart ) ) == string::npos ) return false;
+            iStart = iEnd + 1;
+        }
+        return true;
+    }
+
+    // Songs without a folder sort after the rest. Negative if song1 comes first
+    int CompareFolder( const RefSong &song1, const RefSong &song2 )
+    {
+        if ( song1.sFolder.empty() || song2.sFolder.empty() ) return song1.sFolder.empty() - song2.sFolder.empty();
+        return song1.sFolder.compare( song2.sFolder );
+    }
+
+    // Number columns as doubles. No length means no notes/sec, which goes last
+    double GetKey( const RefSong &song, int iColumn )
+    {
+        if ( iColumn == LibraryModel::Length ) return max( song.iSeconds, 0 );
+        if ( iColumn == LibraryModel::Tracks ) return max( song.iTracks, 0 );
+        if ( song.iSeconds <= 0 ) return 1e30;
+        return max( static_cast< float >( song.iNotes ) / song.iSeconds, 0.0f );
+    }
+
+    // The whole sort key, ties included: the column, then folder and name (name and folder for the name column)
+    int Compare( const RefSong &song1, const RefSong &song2, int iColumn )
+    {
+        int iCompare = 0;
+        if ( iColumn == LibraryModel::Name )
+        {
+            iCompare = song1.sName.compare( song2.sName );
+            return ( iCompare ? iCompare : CompareFolder( song1, song2 ) );
+        }
+        if ( iColumn != LibraryModel::Folder )
+        {
+            double dKey1 = GetKey( song1, iColumn ), dKey2 = GetKey( song2, iColumn );
+            if ( dKey1 != dKey2 ) return ( dKey1 < dKey2 ? -1 : 1 );
+        }
+        iCompare = CompareFolder( song1, song2 );
+        return ( iCompare ? iCompare : song1.sName.compare( song2.sName ) );
+    }
+
+    //-----------------------------------------------------------------------------
+    // Checking
+    //-----------------------------------------------------------------------------
+
+    // Songs are added with their index as the File pointer so rows can be traced back
+    const PFAData::File *ToFile( int i ) { return reinterpret_cast< const PFAData::File* >( static_cast< size_t >( i + 1 ) ); }
+    int FromFile( const PFAData::File *pFile ) { return static_cast< int >( reinterpret_cast< size_t >( pFile ) ) - 1; }
+
+    class Library
+    {
+    public:
+        void Add( const string &sPath, int iSeconds, int iTracks, int iNotes )
+        {
+            m_Model.Add( sPath, iSeconds, iTracks, iNotes, ToFile( static_cast< int >( m_vRef.size() ) ) );
+            m_vRef.push_back( MakeRef( sPath, iSeconds, iTracks, iNotes ) );
+        }
+
+        LibraryModel &GetModel() { return m_Model; }
+        const vector< RefSong > &GetRef() const { return m_vRef; }
+
+        // Whatever's showing against the reference. Prints the first thing wrong
+        bool Check( const char *sWhat )
+        {
+            const string &sQuery = m_Model.GetQuery();
+            int iSortCol = m_Model.GetSortCol(), iColumn = abs( iSortCol );
+
+            int iExpected = 0;
+            for ( size_t i = 0; i < m_vRef.size(); i++ )
+                iExpected += Matches( m_vRef[i], sQuery );
+            if ( m_Model.GetRowCount() != iExpected )
+                return Fail( sWhat, "%d rows, should be %d", m_Model.GetRowCount(), iExpected );
+
+            vector< char > vSeen( m_vRef.size(), 0 );
+            for ( int iRow = 0; iRow < m_Model.GetRowCount(); iRow++ )
+            {
+                int iSong = FromFile( m_Model.GetRow( iRow ).pFile );
+                if ( iSong < 0 || iSong >= static_cast< int >( m_vRef.size() ) || vSeen[iSong] )
+                    return Fail( sWhat, "row %d is a bad or repeated song", iRow );
+                vSeen[iSong] = 1;
+                if ( !Matches( m_vRef[iSong], sQuery ) )
+                    return Fail( sWhat, "row %d (%s) doesn't match", iRow, m_Model.GetRow( iRow ).sPath.c_str() );
+                if ( iRow > 0 )
+                {
+                    int iPrev = FromFile( m_Model.GetRow( iRow - 1 ).pFile );
+                    int iCompare = Compare( m_vRef[iPrev], m_vRef[iSong], iColumn );
+                    if ( iSortCol > 0 ? iCompare > 0 : iCompare < 0 )
+                        return Fail( sWhat, "rows %d and %d out of order", iRow - 1, iRow );
+                }
+            }
+            return true;
+        }
+
+        // Every sort column both ways, for the current query
+        bool CheckSorts( const char *sWhat )
+        {
+            bool bOk = true;
+            for ( int iColumn = 1; iColumn <= LibraryModel::ColumnCount; iColumn++ )
+                for ( int iDir = 1; iDir >= -1; iDir -= 2 )
+                {
+                    m_Model.Sort( iColumn * iDir );
+                    bOk &= Check( sWhat );
+                }
+            return bOk;
+        }
+
+    private:
+        bool Fail( const char *sWhat, const char *sFormat, ... )
+        {
+            printf( "  FAILED %s, query \"%s\", sort %d: ", sWhat, m_Model.GetQuery().c_str(), m_Model.GetSortCol() );
+            va_list args;
+            va_start( args, sFormat );
+            vprintf( sFormat, args );
+            va_end( args );
+            printf( "\n" );
+            return false;
+        }
+
+        LibraryModel m_Model;
+        vector< RefSong > m_vRef;
+    };
+
+    // A handful of songs picked for the edge cases: no folder, a folder that's only a drive, names of
+    // one or two letters, names that differ only in case, punctuation, and numbers that tie
+    void AddEdgeSongs( Library &library )
+    {
+        library.Add( "C:\\Music\\Bach\\Air.mid", 180, 4, 2000 );
+        library.Add( "C:\\Music\\Bach\\air.mid", 180, 4, 2000 ); // Same as the last but for case
+        library.Add( "C:\\Music\\bach\\AIR.MID", 180, 4, 1000 );
+        library.Add( "C:\\Music\\Chopin\\Etude Op. 10 No. 1.mid", 120, 2, 4000 );
+        library.Add( "C:\\Music\\Chopin\\Etude Op. 10 No. 12.mid", 150, 2, 6000 );
+        library.Add( "D:\\a.mid", 0, 0, 0 ); // No length. Notes/sec goes last
+        library.Add( "D:\\ab.mid", 0, 1, 50 );
+        library.Add( "lonely.mid", 60, 1, 60 ); // No folder
+        library.Add( "\\root.mid", 60, 1, 60 );
+        library.Add( "C:\\Music\\Mixed\\x_y-z (1).mid", 60, 16, 60 );
+        library.Add( "C:\\Music\\Mixed\\x-y_z (2).mid", 60, 16, 120 );
+        library.Add( "C:\\Music\\Mixed\\id.mid", 1, 1, 1 );
+        library.Add( "C:\\Music\\Mixed\\Ends in ab", 60, 3, 90 ); // No extension, so the text ends in a two letter word
+        library.Add( "C:\\Music\\Numbers\\100.mid", 100, 10, 1000 );
+        library.Add( "C:\\Music\\Numbers\\010.mid", 100, 10, 1000 );
+    }
+
+    const char *g_aEdgeQueries[] =
+    {
+        "", " ", "   ", // Empty. Everything shows
+        "a", "A", "z", "1", ".", "\\", "_", // One letter, including ones that only fold into the shared slots
+        "ab", "AB", "id", "10", "x_", "-y", "  ab  ", // Two letters: starting a trigram, and ending the text
+        "air", "bach", "op. 1", "no. 12", "x_y", "(1)", // Three and up, with punctuation that can collide
+        "a b", "ab a", "air bach", "e o", "music numbers 0", "zz a", "a zz", // Several words
+    };
+
+    // Words of one to six letters cut out of random songs, and a few pairs of them
+    string RandomQuery( const Library &library, unsigned &iSeed )
+    {
+        const vector< RefSong > &vRef = library.GetRef();
+        string sQuery;
+        iSeed = iSeed * 1103515245 + 12345;
+        int iWords = ( ( iSeed >> 16 ) % 4 == 0 ? 2 : 1 );
+        for ( int iWord = 0; iWord < iWords; iWord++ )
+        {
+            iSeed = iSeed * 1103515245 + 12345;
+            const RefSong &song = vRef[ ( iSeed >> 8 ) % vRef.size() ];
+            const string &sText = ( ( iSeed >> 4 ) & 1 ? song.sName : song.sFolder );
+            iSeed = iSeed * 1103515245 + 12345;
+            size_t iLen = 1 + ( iSeed >> 8 ) % 6;
+            if ( sText.size() < iLen ) continue;
+            size_t iStart = ( iSeed >> 16 ) % ( sText.size() - iLen + 1 );
+            string sWord = sText.substr( iStart, iLen );
+            replace( sWord.begin(), sWord.end(), ' ', 'a' );
+            if ( !sQuery.empty() ) sQuery += ' ';
+            sQuery += sWord;
+        }
+        return sQuery;
+    }
+
+    // Library-like songs with lots of ties: a few hundred folders, lengths in whole minutes, 1 to 16 tracks
+    void AddSongs( Library &library, int iSongs, int iFirst )
+    {
+        static const char *aWords[] = { "Sonata", "Prelude", "Fugue", "Nocturne", "Waltz", "Etude", "Theme", "Remix",
+                                        "Black MIDI", "Medley", "Overture", "Rag" };
+        char sPath[256];
+        for ( int i = iFirst; i < iFirst + iSongs; i++ )
+        {
+            unsigned iHash = i * 2654435761u;
+            sprintf( sPath, "C:\\Music\\Composer %d\\%s in %c %s No. %d.mid", iHash % 311, aWords[ ( iHash >> 8 ) % 12 ],
+                     'A' + ( iHash >> 12 ) % 7, aWords[ ( iHash >> 16 ) % 12 ], i % 97 );
+            int iSeconds = ( iHash >> 20 ) % 10 == 0 ? 0 : 60 * ( 1 + ( iHash >> 20 ) % 8 );
+            library.Add( sPath, iSeconds, 1 + ( iHash >> 4 ) % 16, 100 * ( ( iHash >> 24 ) % 50 ) );
+        }
+    }
+
+    // Returns how many checks failed
+    int RunChecks( int iSongs )
+    {
+        int iFailed = 0;
+
+        // An empty library
+        {
+            Library library;
+            library.GetModel().Build();
+            iFailed += !library.CheckSorts( "empty library" );
+            library.GetModel().Filter( "a" );
+            iFailed += !library.Check( "empty library" );
+        }
+
+        // The edge cases, every query under every sort
+        Library library;
+        AddEdgeSongs( library );
+        LibraryModel &model = library.GetModel();
+        model.Build();
+        for ( size_t i = 0; i < sizeof( g_aEdgeQueries ) / sizeof( g_aEdgeQueries[0] ); i++ )
+        {
+            model.Filter( g_aEdgeQueries[i] );
+            iFailed += !library.CheckSorts( "edge cases" );
+        }
+
+        // More songs after the sort orders were cached, with a query showing. Build has to drop the
+        // orders and redo the search
+        model.Filter( "no. 1" );
+        model.Sort( -LibraryModel::Tracks );
+        AddSongs( library, iSongs, 0 );
+        model.Build();
+        iFailed += !library.Check( "rebuilt" );
+        iFailed += !library.CheckSorts( "rebuilt" );
+
+        // Random words, sorting with the cached orders in between
+        unsigned iSeed = 1;
+        for ( int i = 0; i < 200; i++ )
+        {
+            model.Filter( RandomQuery( library, iSeed ) );
+            model.Sort( ( i % LibraryModel::ColumnCount + 1 ) * ( i & 1 ? -1 : 1 ) );
+            iFailed += !library.Check( "random query" );
+        }
+
+        // Type-to-find goes by file name from the given row on
+        model.Filter( "" );
+        model.Sort( LibraryModel::Name );
+        int iRow = model.FindRowByPrefix( "ETUDE", 0, false );
+        if ( iRow < 0 || ToLower( model.GetRow( iRow ).sPath ).find( "\\etude" ) == string::npos ||
+             ( iRow > 0 && model.FindRowByPrefix( "etude", iRow - 1, false ) != iRow ) )
+        {
+            printf( "  FAILED prefix find: row %d\n", iRow );
+            iFailed++;
+        }
+        return iFailed;
+    }
+
+    //-----------------------------------------------------------------------------
+    // Timing
+    //-----------------------------------------------------------------------------
+
+    // The plain scan the index is there to beat
+    int ScanFilter( const vector< RefSong > &vRef, const string &sQuery )
+    {
+        int iHits = 0;
+        for ( size_t i = 0; i < vRef.size(); i++ )
+            iHits += Matches( vRef[i], sQuery );
+        return iHits;
+    }
+}
+
+// Args: [songs] [runs]. Checks first and returns 1 if any failed
+int BenchLibrary( int argc, char **argv )
+{
+    int iSongs = Bench::GetIntArg( argc, argv, 0, 200000 );
+    int iRuns = Bench::GetIntArg( argc, argv, 1, 5 );
+
+    int iFailed = RunChecks( 2000 );
+    printf( "Checks: %s\n", iFailed ? "FAILED" : "passed" );
+
+    Library library;
+    AddSongs( library, iSongs, 0 );
+    LibraryModel &model = library.GetModel();
+
+    // Build, each sort the first time (makes the order) and again (cached), then searches of each length
+    static const char *aQueries[] = { "a", "no", "rag", "etude", "black midi", "composer 12 sonata", "zzz" };
+    static const int Queries = sizeof( aQueries ) / sizeof( aQueries[0] );
+    Bench::Samples sBuild, aFirstSort[LibraryModel::ColumnCount], aSort[LibraryModel::ColumnCount], aFilter[Queries], aScan[Queries];
+    int aHits[Queries], aScanHits[Queries];
+    model.Build();
+    for ( int iRun = 0; iRun < iRuns; iRun++ )
+    {
+        // Build makes the order it's sorted by, so the name column never has a first sort to time
+        model.Filter( "" );
+        model.Sort( LibraryModel::Name );
+        long long llStart = Bench::GetMicroSecsNow();
+        model.Build();
+        sBuild.Add( static_cast< double >( Bench::GetMicroSecsNow() - llStart ) );
+
+        for ( int iPass = 0; iPass < 2; iPass++ )
+            for ( int i = iPass ? 0 : 1; i < LibraryModel::ColumnCount; i++ )
+            {
+                llStart = Bench::GetMicroSecsNow();
+                model.Sort( i + 1 );
+                ( iPass ? aSort : aFirstSort )[i].Add( static_cast< double >( Bench::GetMicroSecsNow() - llStart ) );
+            }
+
+        for ( int i = 0; i < Queries; i++ )
+        {
+            llStart = Bench::GetMicroSecsNow();
+            model.Filter( aQueries[i] );
+            aFilter[i].Add( static_cast< double >( Bench::GetMicroSecsNow() - llStart ) );
+            aHits[i] = model.GetRowCount();
+
+            llStart = Bench::GetMicroSecsNow();
+            aScanHits[i] = ScanFilter( library.GetRef(), aQueries[i] );
+            aScan[i].Add( static_cast< double >( Bench::GetMicroSecsNow() - llStart ) );
+        }
+    }
+
+    static const char *aColumns[] = { "name", "folder", "length", "tracks", "notes/sec" };
+    printf( "%d songs, %d runs. Best (median) ms\n", iSongs, iRuns );
+    printf( "  %-22s %9.2f (%8.2f)\n", "build, with name order", sBuild.GetMin() / 1000.0, sBuild.GetMedian() / 1000.0 );
+    printf( "  %-22s %20s %20s\n", "sort", "first", "cached" );
+    for ( int i = 0; i < LibraryModel::ColumnCount; i++ )
+    {
+        printf( "    %-20s ", aColumns[i] );
+        if ( aFirstSort[i].GetCount() ) printf( "%9.2f (%8.2f)", aFirstSort[i].GetMin() / 1000.0, aFirstSort[i].GetMedian() / 1000.0 );
+        else printf( "%20s", "-" );
+        printf( " %9.2f (%8.2f)\n", aSort[i].GetMin() / 1000.0, aSort[i].GetMedian() / 1000.0 );
+    }
+    printf( "  %-22s %20s %20s %7s\n", "search", "index", "scan", "hits" );
+    for ( int i = 0; i < Queries; i++ )
+    {
+        printf( "    %-20s %9.2f (%8.2f) %9.2f (%8.2f) %7d%s\n", aQueries[i], aFilter[i].GetMin() / 1000.0, aFilter[i].GetMedian() / 1000.0,
+                aScan[i].GetMin() / 1000.0, aScan[i].GetMedian() / 1000.0, aHits[i], aHits[i] == aScanHits[i] ? "" : "  differs!" );
+        iFailed += ( aHits[i] != aScanHits[i] );
+    }
+    return iFailed ? 1 : 0;
+}
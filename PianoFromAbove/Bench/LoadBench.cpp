@@ -0,0 +1,148 @@
+/*************************************************************************************************
+*
+* File: LoadBench.cpp
+*
+* Description: Times a whole song load the way MainScreen does it, phase by phase as LoadProgress
+*              sees them, and how much memory the load takes at its peak
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <cstring>
+
+#include "Bench.h"
+#include "../MIDI.h"
+#include "../Loader.h"
+
+namespace
+{
+    typedef vector< pair< long long, int > > eventvec_t;
+
+    // What MainScreen keeps of a song: the channel events indexed for seeking, and the meta events
+    class LoadSink : public MIDIEventSink
+    {
+    public:
+        LoadSink( const MIDI::MIDIInfo &mInfo )
+        {
+            vEvents.reserve( mInfo.iChannelEventCount );
+            vNoteOns.reserve( mInfo.iPairedNoteCount );
+            vNonNotes.reserve( mInfo.iChannelEventCount - mInfo.iPairedNoteCount );
+            vProgramChange.reserve( mInfo.iControllerCount );
+            vMetaEvents.reserve( mInfo.iMetaEventCount );
+            vTempo.reserve( mInfo.iTempoCount );
+            vSignature.reserve( mInfo.iSignatureCount );
+        }
+
+        void AddEvent( MIDIEvent *pMIDIEvent )
+        {
+            if ( pMIDIEvent->GetEventType() == MIDIEvent::ChannelEvent )
+            {
+                MIDIChannelEvent *pEvent = reinterpret_cast< MIDIChannelEvent* >( pMIDIEvent );
+                int iPos = static_cast< int >( vEvents.size() );
+                vEvents.push_back( pEvent );
+
+                MIDIChannelEvent::ChannelEventType eEventType = pEvent->GetChannelEventType();
+                if ( eEventType == MIDIChannelEvent::NoteOn && pEvent->GetParam2() > 0 && pEvent->GetSister() )
+                    vNoteOns.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+                else
+                {
+                    vNonNotes.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+                    if ( eEventType == MIDIChannelEvent::ProgramChange || eEventType == MIDIChannelEvent::Controller )
+                        vProgramChange.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+                }
+            }
+            else if ( pMIDIEvent->GetEventType() == MIDIEvent::MetaEvent )
+            {
+                MIDIMetaEvent *pEvent = reinterpret_cast< MIDIMetaEvent* >( pMIDIEvent );
+                int iPos = static_cast< int >( vMetaEvents.size() );
+                vMetaEvents.push_back( pEvent );
+
+                MIDIMetaEvent::MetaEventType eEventType = pEvent->GetMetaEventType();
+                if ( eEventType == MIDIMetaEvent::SetTempo )
+                    vTempo.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+                else if ( eEventType == MIDIMetaEvent::TimeSignature )
+                    vSignature.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+            }
+        }
+
+        vector< MIDIChannelEvent* > vEvents;
+        vector< MIDIMetaEvent* > vMetaEvents;
+        eventvec_t vNoteOns, vNonNotes, vProgramChange, vTempo, vSignature;
+    };
+
+    bool WriteFile( const char *sFilename, const vector< unsigned char > &vData )
+    {
+        FILE *pFile = fopen( sFilename, "wb" );
+        if ( !pFile ) return false;
+        bool bResult = fwrite( &vData[0], 1, vData.size(), pFile ) == vData.size();
+        return fclose( pFile ) == 0 && bResult;
+    }
+}
+
+// Args: [file.mid] [runs]. Without a file, the parse benchmark's made up song, written out to a temp file.
+// The memory peak is only the load's if the load is the biggest thing the process has done, so run it on its own
+int BenchLoad( int argc, char **argv )
+{
+    static const char *sTempFile = "LoadBench.tmp.mid";
+    const char *sFile = sTempFile;
+    int iRuns = 5;
+    if ( argc > 0 && Bench::GetIntArg( argc, argv, 0, -1 ) < 0 )
+    {
+        sFile = argv[0];
+        iRuns = Bench::GetIntArg( argc, argv, 1, iRuns );
+    }
+    else
+    {
+        vector< unsigned char > vSong;
+        Bench::MakeSong( 16, 400000, vSong );
+        if ( !WriteFile( sTempFile, vSong ) )
+        {
+            printf( "Couldn't write %s\n", sTempFile );
+            return 1;
+        }
+        iRuns = Bench::GetIntArg( argc, argv, 0, iRuns );
+    }
+    wstring sFilename( sFile, sFile + strlen( sFile ) );
+
+    long long llMemBefore = Bench::GetMemory();
+    Bench::Samples sRead, sParse, sMerge, sTotal;
+    long long llBytes = 0;
+    int iEvents = 0;
+    bool bFailed = false;
+    for ( int iRun = 0; iRun < iRuns; iRun++ )
+    {
+        LoadProgress progress;
+        MIDI midi( sFilename, &progress );
+        if ( !midi.IsValid() )
+        {
+            printf( "Couldn't load %s\n", sFile );
+            bFailed = true;
+            break;
+        }
+        LoadSink sink( midi.GetInfo() );
+        midi.PostProcess( &sink );
+        progress.SetPhase( LoadProgress::Done );
+
+        double dRead = static_cast< double >( progress.GetPhaseMicroSecs( LoadProgress::Reading ) );
+        double dParse = static_cast< double >( progress.GetPhaseMicroSecs( LoadProgress::Parsing ) );
+        double dMerge = static_cast< double >( progress.GetPhaseMicroSecs( LoadProgress::Merging ) );
+        sRead.Add( dRead );
+        sParse.Add( dParse );
+        sMerge.Add( dMerge );
+        sTotal.Add( dRead + dParse + dMerge );
+        llBytes = progress.llTotalBytes / 2;
+        iEvents = midi.GetInfo().iEventCount;
+    }
+    long long llPeak = Bench::GetPeakMemory();
+    if ( sFile == sTempFile ) remove( sTempFile );
+    if ( bFailed ) return 1;
+
+    printf( "%.1f MB, %d events, %d runs. Best (median)\n", llBytes / 1e6, iEvents, iRuns );
+    printf( "  reading:  %8.1f ms (%8.1f)\n", sRead.GetMin() / 1000.0, sRead.GetMedian() / 1000.0 );
+    printf( "  parsing:  %8.1f ms (%8.1f)\n", sParse.GetMin() / 1000.0, sParse.GetMedian() / 1000.0 );
+    printf( "  merging:  %8.1f ms (%8.1f)\n", sMerge.GetMin() / 1000.0, sMerge.GetMedian() / 1000.0 );
+    printf( "  total:    %8.1f ms (%8.1f)\n", sTotal.GetMin() / 1000.0, sTotal.GetMedian() / 1000.0 );
+    printf( "  peak memory: %.1f MB over the load, %.1f MB for the process\n", ( llPeak - llMemBefore ) / 1e6, llPeak / 1e6 );
+    return 0;
+}
@@ -0,0 +1,202 @@
+/*************************************************************************************************
+*
+* File: MIDIOutBench.cpp
+*
+* Description: Times MIDI output. The app's side on its own (queueing, encoding, handing off),
+*              then a real device: how fast it takes messages and, looped back into an input,
+*              how long they take to come out
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <atomic>
+#include <thread>
+
+#include "Bench.h"
+#include "../MIDIDriver.h"
+#include "../Misc.h"
+
+namespace
+{
+    const int FrameMsgs = 64; // Flushed at a time, about a busy frame's worth
+
+    // A frame's worth of notes, half on and half off
+    void QueueFrame( MIDIOutStream &stream, long long llTime, int iFrame )
+    {
+        for ( int i = 0; i < FrameMsgs; i++ )
+        {
+            int iKey = 21 + ( iFrame * 7 + i ) % 88;
+            stream.Queue( llTime + i * 10, static_cast< unsigned char >( 0x90 | ( i & 0xF ) ), static_cast< unsigned char >( iKey ),
+                          static_cast< unsigned char >( i & 1 ? 0 : 64 ) );
+        }
+    }
+
+    // Messages a second through Queue and Flush into a backend
+    double TimeStream( MIDIOutBackend &backend, int iMsgs )
+    {
+        MIDIOutStream stream( &backend );
+        long long llStart = Bench::GetMicroSecsNow();
+        for ( int iFrame = 0; iFrame * FrameMsgs < iMsgs; iFrame++ )
+        {
+            QueueFrame( stream, iFrame * 1000LL, iFrame );
+            stream.Flush();
+        }
+        long long llTime = max( Bench::GetMicroSecsNow() - llStart, 1LL );
+        return iMsgs / ( llTime / 1000000.0 );
+    }
+
+    // What the input side saw
+    struct Arrivals
+    {
+        atomic< int > iCount;
+        atomic< long long > llLast; // Timer::GetNanoSecsNow when it came in. Round trips can be under a microsecond
+    };
+
+    void OnMessage( const MIDIInMsg &/*msg*/, void *pUserData )
+    {
+        Arrivals *pArrivals = static_cast< Arrivals* >( pUserData );
+        pArrivals->llLast = Timer::GetNanoSecsNow();
+        pArrivals->iCount++;
+    }
+
+    // Round trips: sends a note, waits for it to come back. Returns false if one never did
+    bool TimeRoundTrips( MIDIOutPort &out, Arrivals &arrivals, int iTrips, Bench::Samples &sLatency )
+    {
+        for ( int i = 0; i < iTrips; i++ )
+        {
+            MIDIShortMsg msg = { 0, MIDIShortMsg::Pack( 0x90, static_cast< unsigned char >( 60 + i % 12 ), i & 1 ? 0 : 64 ) };
+            int iBefore = arrivals.iCount;
+            long long llSent = Timer::GetNanoSecsNow();
+            out.SendNow( &msg, 1 );
+            while ( arrivals.iCount == iBefore )
+            {
+                if ( Timer::GetNanoSecsNow() - llSent > 1000000000 ) return false;
+                this_thread::yield();
+            }
+            sLatency.Add( ( arrivals.llLast - llSent ) / 1000.0 );
+        }
+        return true;
+    }
+
+    // Messages a second through Send, a frame at a time. The slowest call is how long the sender can get held up
+    double TimeSends( MIDIOutPort &out, int iMsgs, Bench::Samples &sCalls )
+    {
+        vector< MIDIShortMsg > vMsgs( FrameMsgs );
+        long long llStart = Bench::GetMicroSecsNow();
+        for ( int iFrame = 0; iFrame * FrameMsgs < iMsgs; iFrame++ )
+        {
+            for ( int i = 0; i < FrameMsgs; i++ )
+            {
+                vMsgs[i].llTime = iFrame * 1000LL + i * 10;
+                vMsgs[i].iMsg = MIDIShortMsg::Pack( static_cast< unsigned char >( 0x90 | ( i & 0xF ) ),
+                                                    static_cast< unsigned char >( 21 + ( iFrame * 7 + i ) % 88 ), i & 1 ? 0 : 64 );
+            }
+            long long llCall = Bench::GetMicroSecsNow();
+            out.Send( &vMsgs[0], FrameMsgs );
+            sCalls.Add( static_cast< double >( Bench::GetMicroSecsNow() - llCall ) );
+        }
+        long long llTime = max( Bench::GetMicroSecsNow() - llStart, 1LL );
+        return iMsgs / ( llTime / 1000000.0 );
+    }
+
+    void PrintLatency( const char *sName, const Bench::Samples &sLatency )
+    {
+        printf( "  %-22s %8.1f us median, %8.1f us p99, %8.1f us max\n", sName, sLatency.GetMedian(), sLatency.GetPercentile( 99.0 ),
+                sLatency.GetMax() );
+    }
+}
+
+// Args: [out device] [in device] [messages]. Without devices, only the app's side and the loopback driver.
+// Loop the output back into the input (a cable, or a virtual port) for latencies
+int BenchMIDIOut( int argc, char **argv )
+{
+    int iOutDev = Bench::GetIntArg( argc, argv, 0, -1 );
+    int iInDev = Bench::GetIntArg( argc, argv, 1, -1 );
+    int iMsgs = Bench::GetIntArg( argc, argv, 2, 1000000 );
+
+    // The app's side
+    MIDINullOut nullBytes, nullMsgs( 0 );
+    printf( "%d messages, %d a flush\n", iMsgs, FrameMsgs );
+    printf( "  stream, bytes:         %8.1f M msgs/s\n", TimeStream( nullBytes, iMsgs ) / 1e6 );
+    printf( "  stream, messages:      %8.1f M msgs/s\n", TimeStream( nullMsgs, iMsgs ) / 1e6 );
+
+    // The loopback driver delivers on the sending thread, so this is the cost of the ports themselves
+    {
+        MIDILoopbackDriver loopback;
+        MIDIOutPort *pOut = loopback.CreateOutPort();
+        MIDIInPort *pIn = loopback.CreateInPort();
+        Arrivals arrivals;
+        arrivals.iCount = 0;
+        Bench::Samples sLatency, sCalls;
+        if ( pOut->Open( 0 ) && pIn->Open( 0, OnMessage, &arrivals ) )
+        {
+            printf( "  loopback:              %8.1f M msgs/s\n", TimeSends( *pOut, iMsgs, sCalls ) / 1e6 );
+            TimeRoundTrips( *pOut, arrivals, 1000, sLatency );
+            PrintLatency( "loopback round trip:", sLatency );
+        }
+        pIn->Close();
+        pOut->Close();
+        delete pIn;
+        delete pOut;
+    }
+
+    if ( iOutDev < 0 )
+    {
+        MIDIDriver &driver = MIDIDriver::GetDriver();
+        printf( "Pass a device for more. %ls outputs:\n", driver.GetName() );
+        for ( int i = 0; i < driver.GetNumOutDevs(); i++ )
+            printf( "  %d: %ls\n", i, driver.GetOutDevName( i ).c_str() );
+        return 0;
+    }
+
+    // A real device. Scheduled sends queue up in the driver, so they show whether a sender ever waits on it
+    MIDIDriver &driver = MIDIDriver::GetDriver();
+    MIDIOutPort *pOut = driver.CreateOutPort();
+    if ( !pOut->Open( iOutDev ) )
+    {
+        printf( "Couldn't open output %d\n", iOutDev );
+        delete pOut;
+        return 1;
+    }
+    printf( "%ls\n", driver.GetOutDevName( iOutDev ).c_str() );
+
+    int iDeviceMsgs = min( iMsgs, 100000 ); // Real devices are a lot slower
+    Bench::Samples sCalls;
+    double dRate = TimeSends( *pOut, iDeviceMsgs, sCalls );
+    printf( "  immediate:             %8.1f K msgs/s, %8.1f us slowest send\n", dRate / 1e3, sCalls.GetMax() );
+    if ( pOut->SetScheduled( true ) )
+    {
+        sCalls.Clear();
+        dRate = TimeSends( *pOut, iDeviceMsgs, sCalls );
+        printf( "  scheduled:             %8.1f K msgs/s, %8.1f us slowest send\n", dRate / 1e3, sCalls.GetMax() );
+        pOut->SetScheduled( false );
+    }
+
+    int iResult = 0;
+    if ( iInDev >= 0 )
+    {
+        MIDIInPort *pIn = driver.CreateInPort();
+        Arrivals arrivals;
+        arrivals.iCount = 0;
+        Bench::Samples sLatency;
+        if ( !pIn->Open( iInDev, OnMessage, &arrivals ) )
+        {
+            printf( "Couldn't open input %d\n", iInDev );
+            iResult = 1;
+        }
+        else if ( !TimeRoundTrips( *pOut, arrivals, 500, sLatency ) )
+        {
+            printf( "Nothing came back on input %d. Is it looped back?\n", iInDev );
+            iResult = 1;
+        }
+        else
+            PrintLatency( "round trip:", sLatency );
+        pIn->Close();
+        delete pIn;
+    }
+
+    pOut->Close();
+    delete pOut;
+    return iResult;
+}
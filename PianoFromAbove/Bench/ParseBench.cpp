@@ -0,0 +1,95 @@
+/*************************************************************************************************
+*
+* File: ParseBench.cpp
+*
+* Description: Times loading a song. Decoding tracks one after the other on one thread, then
+*              ParseMIDI as the loader calls it (tracks over the job system), then the merge
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+
+#include "Bench.h"
+#include "../MIDI.h"
+
+// Args: [file.mid] [runs]. Without a file, a made up 16 track song of about 40 MB
+int BenchParse( int argc, char **argv )
+{
+    vector< unsigned char > vSong;
+    int iRuns = 5;
+    if ( argc > 0 && Bench::GetIntArg( argc, argv, 0, -1 ) < 0 )
+    {
+        if ( !Bench::ReadFile( argv[0], vSong ) )
+        {
+            printf( "Couldn't read %s\n", argv[0] );
+            return 1;
+        }
+        iRuns = Bench::GetIntArg( argc, argv, 1, iRuns );
+    }
+    else
+    {
+        Bench::MakeSong( 16, 400000, vSong );
+        iRuns = Bench::GetIntArg( argc, argv, 0, iRuns );
+    }
+    const unsigned char *pcData = &vSong[0];
+    int iSize = static_cast< int >( vSong.size() );
+
+    // Where the tracks are, for decoding them one at a time
+    vector< int > vStarts;
+    int iTrkSize;
+    for ( int iPos = 14; iSize - iPos >= 8 && MIDI::Parse32Bit( pcData + iPos + 4, iSize - iPos - 4, &iTrkSize ) == 4;
+          iPos += 8 + iTrkSize )
+        vStarts.push_back( iPos );
+
+    Bench::Samples sScan, sDecode, sParse, sMerge;
+    int iEvents = 0;
+    for ( int iRun = 0; iRun < iRuns; iRun++ )
+    {
+        // Decode only, no events made. What the library scanner does
+        MIDI::MIDIInfo mInfo;
+        long long llStart = Bench::GetMicroSecsNow();
+        MIDI::ScanInfo( pcData, iSize, mInfo );
+        sScan.Add( static_cast< double >( Bench::GetMicroSecsNow() - llStart ) );
+
+        // Decode into events: no job system, no track info merging
+        {
+            Arena arena;
+            vector< MIDITrack* > vTracks;
+            llStart = Bench::GetMicroSecsNow();
+            for ( size_t i = 0; i < vStarts.size(); i++ )
+            {
+                vTracks.push_back( new MIDITrack() );
+                vTracks.back()->ParseTrack( pcData + vStarts[i], iSize - vStarts[i], static_cast< int >( i ), arena );
+            }
+            sDecode.Add( static_cast< double >( Bench::GetMicroSecsNow() - llStart ) );
+            for ( size_t i = 0; i < vTracks.size(); i++ )
+                delete vTracks[i];
+        }
+
+        // The loader's path
+        MIDI midi;
+        llStart = Bench::GetMicroSecsNow();
+        if ( midi.ParseMIDI( pcData, iSize ) <= 0 )
+        {
+            printf( "Parse failed\n" );
+            return 1;
+        }
+        long long llParsed = Bench::GetMicroSecsNow();
+        vector< MIDIEvent* > vEvents;
+        midi.PostProcess( &vEvents );
+        sParse.Add( static_cast< double >( llParsed - llStart ) );
+        sMerge.Add( static_cast< double >( Bench::GetMicroSecsNow() - llParsed ) );
+        iEvents = midi.GetInfo().iEventCount;
+    }
+
+    printf( "%.1f MB, %d tracks, %d events, %d runs. Best (median)\n", iSize / 1e6, static_cast< int >( vStarts.size() ), iEvents, iRuns );
+    printf( "  scan, 1 thread:   %7.1f MB/s (%7.1f)  %6.1f M events/s\n", iSize / sScan.GetMin(), iSize / sScan.GetMedian(),
+            iEvents / sScan.GetMin() );
+    printf( "  decode, 1 thread: %7.1f MB/s (%7.1f)  %6.1f M events/s\n", iSize / sDecode.GetMin(), iSize / sDecode.GetMedian(),
+            iEvents / sDecode.GetMin() );
+    printf( "  ParseMIDI:        %7.1f MB/s (%7.1f)  %6.1f M events/s\n", iSize / sParse.GetMin(), iSize / sParse.GetMedian(),
+            iEvents / sParse.GetMin() );
+    printf( "  merge:            %7.1f ms   (%7.1f)\n", sMerge.GetMin() / 1000.0, sMerge.GetMedian() / 1000.0 );
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*************************************************************************************************
+*
+* File: QueueBench.cpp
+*
+* Description: Times TSQueue against the queue it replaced, with message sized elements. One
+*              thread pushing and popping, a producer and a consumer thread, and a round trip
+*              over a pair of queues
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cstdio>
+#include <atomic>
+#include <thread>
+
+#include "Bench.h"
+#include "../Misc.h"
+
+namespace
+{
+    // About the size of a MSG, which is what g_MsgQueue carries
+    struct Message
+    {
+        long long aFields[6];
+    };
+
+    // The old TSQueue: one line for both indices, % to wrap, and a slot always left empty. Its
+    // volatile indices are spelled as the acquire/release that MSVC gave them
+    template < typename T >
+    class OldQueue
+    {
+    public:
+        OldQueue() : m_iWrite( 0 ), m_iRead( 0 ) { }
+
+        bool Push( const T &tElement )
+        {
+            int iWrite = m_iWrite.load( memory_order_relaxed );
+            int iNextElement = ( iWrite + 1 ) % QueueSize;
+            if ( iNextElement == m_iRead.load( memory_order_acquire ) ) return false;
+            m_tQueue[iWrite] = tElement;
+            m_iWrite.store( iNextElement, memory_order_release );
+            return true;
+        }
+
+        bool Pop( T &tElement )
+        {
+            int iRead = m_iRead.load( memory_order_relaxed );
+            if ( m_iWrite.load( memory_order_acquire ) == iRead ) return false;
+            tElement = m_tQueue[iRead];
+            m_iRead.store( ( iRead + 1 ) % QueueSize, memory_order_release );
+            return true;
+        }
+
+        // No batches: one at a time
+        int Push( const T *pElements, int iCount )
+        {
+            int i = 0;
+            while ( i < iCount && Push( pElements[i] ) ) i++;
+            return i;
+        }
+
+        int Pop( T *pElements, int iMaxCount )
+        {
+            int i = 0;
+            while ( i < iMaxCount && Pop( pElements[i] ) ) i++;
+            return i;
+        }
+
+    private:
+        static const int QueueSize = 1024;
+        T m_tQueue[QueueSize];
+        atomic< int > m_iWrite;
+        atomic< int > m_iRead;
+    };
+
+    const int Batch = 64;
+
+    // Nanoseconds a message, pushing and popping on one thread, a queue's worth at a time
+    template < class Queue >
+    double TimeSingleThread( Queue &queue, int iMsgs )
+    {
+        Message msg = { { 0 } };
+        long long llSum = 0;
+        long long llStart = Timer::GetNanoSecsNow();
+        for ( int i = 0; i < iMsgs; i += 512 )
+        {
+            for ( int j = 0; j < 512; j++ )
+            {
+                msg.aFields[0] = i + j;
+                queue.Push( msg );
+            }
+            for ( int j = 0; j < 512; j++ )
+            {
+                queue.Pop( msg );
+                llSum += msg.aFields[0];
+            }
+        }
+        long long llTime = Timer::GetNanoSecsNow() - llStart;
+        if ( llSum < 0 ) printf( "!" ); // Keeps the work from being optimized out
+        return static_cast< double >( llTime ) / iMsgs;
+    }
+
+    // Millions of messages a second from one thread to another. Spins when full or empty. Returns
+    // -1 if the messages came out wrong
+    template < class Queue >
+    double TimeThreads( Queue &queue, int iMsgs, int iBatch )
+    {
+        long long llStart = Timer::GetNanoSecsNow();
+        thread thProducer( [&queue, iMsgs, iBatch]()
+        {
+            Message aMsgs[Batch] = { { { 0 } } };
+            for ( int i = 0; i < iMsgs; )
+            {
+                // Whatever didn't fit gets filled in again next time round
+                int iCount = min( iBatch, iMsgs - i );
+                for ( int j = 0; j < iCount; j++ )
+                    aMsgs[j].aFields[0] = i + j;
+                int iPushed = ( iBatch == 1 ? ( queue.Push( aMsgs[0] ) ? 1 : 0 ) : queue.Push( aMsgs, iCount ) );
+                if ( iPushed == 0 ) this_thread::yield();
+                i += iPushed;
+            }
+        } );
+
+        bool bInOrder = true;
+        Message aMsgs[Batch];
+        for ( int i = 0; i < iMsgs; )
+        {
+            int iPopped = ( iBatch == 1 ? ( queue.Pop( aMsgs[0] ) ? 1 : 0 ) : queue.Pop( aMsgs, Batch ) );
+            if ( iPopped == 0 ) this_thread::yield();
+            for ( int j = 0; j < iPopped; j++ )
+                bInOrder &= ( aMsgs[j].aFields[0] == i + j );
+            i += iPopped;
+        }
+        thProducer.join();
+        long long llTime = Timer::GetNanoSecsNow() - llStart;
+        return bInOrder ? iMsgs / ( llTime / 1000.0 ) : -1.0;
+    }
+
+    // Microseconds there and back: one thread echoes whatever comes in on one queue out on the other
+    template < class Queue >
+    void TimeRoundTrips( Queue &qThere, Queue &qBack, int iTrips, Bench::Samples &sTrips )
+    {
+        thread thEcho( [&qThere, &qBack, iTrips]()
+        {
+            Message msg;
+            for ( int i = 0; i < iTrips; i++ )
+            {
+                while ( !qThere.Pop( msg ) ) this_thread::yield();
+                while ( !qBack.Push( msg ) ) this_thread::yield();
+            }
+        } );
+
+        Message msg = { { 0 } };
+        for ( int i = 0; i < iTrips; i++ )
+        {
+            long long llStart = Timer::GetNanoSecsNow();
+            qThere.Push( msg );
+            while ( !qBack.Pop( msg ) ) this_thread::yield();
+            sTrips.Add( ( Timer::GetNanoSecsNow() - llStart ) / 1000.0 );
+        }
+        thEcho.join();
+    }
+
+    template < class Queue >
+    void TimeQueue( const char *sName, int iMsgs, int iTrips, bool bBatches )
+    {
+        Queue *pQueue = new Queue(), *pBack = new Queue();
+        double dSingle = TimeSingleThread( *pQueue, iMsgs );
+        double dThreads = TimeThreads( *pQueue, iMsgs, 1 );
+        double dBatched = ( bBatches ? TimeThreads( *pQueue, iMsgs, Batch ) : 0.0 );
+        Bench::Samples sTrips;
+        TimeRoundTrips( *pQueue, *pBack, iTrips, sTrips );
+
+        printf( "  %-6s %8.1f ns %10.1f M/s", sName, dSingle, dThreads );
+        if ( bBatches ) printf( " %10.1f M/s", dBatched );
+        else printf( " %14s", "-" );
+        printf( " %8.2f us (%6.2f)\n", sTrips.GetMedian(), sTrips.GetPercentile( 99.0 ) );
+        if ( dThreads < 0 || dBatched < 0 ) printf( "  %s: messages came out wrong!\n", sName );
+
+        delete pQueue;
+        delete pBack;
+    }
+}
+
+// Args: [messages] [round trips]
+int BenchQueue( int argc, char **argv )
+{
+    int iMsgs = Bench::GetIntArg( argc, argv, 0, 20000000 );
+    int iTrips = Bench::GetIntArg( argc, argv, 1, 100000 );
+
+    printf( "%d messages of %d bytes, %d round trips\n", iMsgs, static_cast< int >( sizeof( Message ) ), iTrips );
+    printf( "  %-6s %11s %14s %14s %20s\n", "", "1 thread", "2 threads", "batched", "round trip (p99)" );
+    TimeQueue< OldQueue< Message > >( "old", iMsgs, iTrips, false );
+    TimeQueue< TSQueue< Message > >( "new", iMsgs, iTrips, true );
+    return 0;
+}
@@ -12,10 +12,20 @@
 #include <TChar.h>
 
 #include <fstream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <filesystem>
+#include <google/protobuf/io/coded_stream.h>
 using namespace std;
+namespace fs = std::filesystem;
 
 #include "Config.h"
 #include "Misc.h"
+#include "JobSystem.h"
+#include "MIDIDriver.h"
+#include "SoftSynth.h"
 //-----------------------------------------------------------------------------
 // Main Config class
 //-----------------------------------------------------------------------------
@@ -147,12 +157,18 @@ void AudioSettings::LoadDefaultValues()
 {
     this->iInDevice = -1;
     this->iOutDevice = -1;
+    this->iMaxVoices = 1024;
+    this->iMaxChannelVoices = 0;
+    this->bOptimizeEvents = false;
+    this->iThinMilliSecs = 5;
+    this->sSoundFont.clear();
     LoadMIDIDevices();
 }
 
 void VideoSettings::LoadDefaultValues()
 {
     this->bLimitFPS = true;
+    this->iMaxFPS = 0;
     this->bShowFPS = false;
     this->eRenderer = Direct3D;
 }
@@ -216,12 +232,11 @@ void AudioSettings::LoadMIDIDevices()
     wstring oldInDev( this->iInDevice >= 0 ? this->vMIDIInDevices[this->iInDevice] : L"" );
     this->iInDevice = -1;
     this->vMIDIInDevices.clear();
-    int iNumInDevs = midiInGetNumDevs();
+    MIDIDriver &driver = MIDIDriver::GetDriver();
+    int iNumInDevs = driver.GetNumInDevs();
     for ( int i = 0; i < iNumInDevs; i++ )
     {
-        MIDIINCAPS mic;
-        midiInGetDevCaps( i, &mic, sizeof( MIDIINCAPS ) );
-        this->vMIDIInDevices.push_back( mic.szPname );
+        this->vMIDIInDevices.push_back( driver.GetInDevName( i ) );
 
         if ( this->sDesiredIn == this->vMIDIInDevices[i] )
             this->iInDevice = i;
@@ -234,13 +249,13 @@ void AudioSettings::LoadMIDIDevices()
     wstring oldOutDev( this->iOutDevice >= 0 ? this->vMIDIOutDevices[this->iOutDevice] : L"" );
     this->iOutDevice = -1;
     this->vMIDIOutDevices.clear();
-    int iNumOutDevs = midiOutGetNumDevs();
+    int iNumOutDevs = driver.GetNumOutDevs();
     for ( int i = 0; i < iNumOutDevs; i++ )
+        this->vMIDIOutDevices.push_back( driver.GetOutDevName( i ) );
+    if ( SoftSynth::GetSynth().HasSoundFont() )
+        this->vMIDIOutDevices.push_back( SoftSynth::GetDeviceName() );
+    for ( int i = 0; i < static_cast< int >( this->vMIDIOutDevices.size() ); i++ )
     {
-        MIDIOUTCAPS moc;
-        midiOutGetDevCaps( i, &moc, sizeof( MIDIOUTCAPS ) );
-        this->vMIDIOutDevices.push_back( moc.szPname );
-
         if ( this->sDesiredOut == this->vMIDIOutDevices[i] )
             this->iOutDevice = i;
         if ( oldOutDev == this->vMIDIOutDevices[i] && this->iOutDevice < 0 )
@@ -295,6 +310,15 @@ void AudioSettings::LoadConfigValues( TiXmlElement *txRoot )
     TiXmlElement *txAudio = txRoot->FirstChildElement( "Audio" );
     if ( !txAudio ) return;
 
+    // Loaded first, so the synth's there to be picked as the output
+    string sSoundFont;
+    if ( txAudio->QueryStringAttribute( "SoundFont", &sSoundFont ) == TIXML_SUCCESS )
+    {
+        this->sSoundFont = Util::StringToWstring( sSoundFont );
+        if ( SoftSynth::GetSynth().SetSoundFont( this->sSoundFont ) )
+            LoadMIDIDevices();
+    }
+
     string sMIDIOutDevice;
     if ( txAudio->QueryStringAttribute( "MIDIOutDevice", &sMIDIOutDevice ) == TIXML_SUCCESS )
     {
@@ -312,6 +336,16 @@ void AudioSettings::LoadConfigValues( TiXmlElement *txRoot )
             if ( this->vMIDIInDevices[i] == this->sDesiredIn )
                 this->iInDevice = (int)i;
     }
+
+    int iAttrVal;
+    if ( txAudio->QueryIntAttribute( "MaxVoices", &iAttrVal ) == TIXML_SUCCESS )
+        this->iMaxVoices = max( iAttrVal, 0 );
+    if ( txAudio->QueryIntAttribute( "MaxChannelVoices", &iAttrVal ) == TIXML_SUCCESS )
+        this->iMaxChannelVoices = max( iAttrVal, 0 );
+    if ( txAudio->QueryIntAttribute( "OptimizeEvents", &iAttrVal ) == TIXML_SUCCESS )
+        this->bOptimizeEvents = ( iAttrVal != 0 );
+    if ( txAudio->QueryIntAttribute( "ThinMilliSecs", &iAttrVal ) == TIXML_SUCCESS )
+        this->iThinMilliSecs = max( iAttrVal, 0 );
 }
 
 void VideoSettings::LoadConfigValues( TiXmlElement *txRoot )
@@ -324,6 +358,8 @@ void VideoSettings::LoadConfigValues( TiXmlElement *txRoot )
         this->bShowFPS = ( iAttrVal != 0 );
     if ( txVideo->QueryIntAttribute( "LimitFPS", &iAttrVal ) == TIXML_SUCCESS )
         this->bLimitFPS = ( iAttrVal != 0 );
+    if ( txVideo->QueryIntAttribute( "MaxFPS", &iAttrVal ) == TIXML_SUCCESS )
+        this->iMaxFPS = max( iAttrVal, 0 );
     if ( txVideo->QueryIntAttribute( "Renderer", &iAttrVal ) == TIXML_SUCCESS )
         this->eRenderer = static_cast< Renderer >( iAttrVal );
 }
@@ -374,37 +410,176 @@ void SongLibrary::LoadConfigValues( TiXmlElement *txRoot )
     }
 }
 
+// The file from llStart on. False if it couldn't be read. Doesn't lock out the journal's writer
+static bool ReadWholeFile( const string &sPath, vector< char > &vData, long long llStart = 0 )
+{
+    vData.clear();
+    ifstream ifs( sPath, ios::in | ios::binary | ios::ate );
+    if ( !ifs.is_open() ) return false;
+
+    long long llSize = static_cast< long long >( ifs.tellg() ) - llStart;
+    if ( llSize < 0 || llSize > INT_MAX ) return false;
+    vData.resize( static_cast< size_t >( llSize ) );
+    ifs.seekg( llStart, ios::beg );
+    if ( llSize > 0 ) ifs.read( &vData[0], llSize );
+    return !ifs.fail();
+}
+
+// ParseFromArray stops at 64 MB, which a big enough library gets past. The limit's raised rather than lifted
+bool SongLibrary::ParseMetaData( const vector< char > &vData, PFAData::MetaData &data )
+{
+    google::protobuf::io::CodedInputStream input( reinterpret_cast< const google::protobuf::uint8* >( vData.data() ),
+                                                  static_cast< int >( vData.size() ) );
+    input.SetTotalBytesLimit( MetaDataBytesLimit, MetaDataBytesWarning );
+    return data.ParseFromCodedStream( &input );
+}
+
 void SongLibrary::LoadMetaData()
 {
     string sPath = Config::GetFolder();
     if ( sPath.length() == 0 ) return;
 
-    // Open the file
-    ifstream ifs( sPath + "\\MetaData.pb", ios::in | ios::binary | ios::ate );
+    // MetaData.pb, then whatever changed since it was written. If it's there and doesn't parse (corrupt,
+    // or past the limit) the library starts out empty and the files on disk are left as they are
+    vector< char > vData;
+    if ( ReadWholeFile( sPath + "\\MetaData.pb", vData ) )
+    {
+        m_bBadMetaData = !ParseMetaData( vData, m_Data );
+        if ( m_bBadMetaData ) m_Data.Clear();
+        else m_llBaseSize = vData.size();
+    }
+    bool bClean = true;
+    if ( !m_bBadMetaData && ReadWholeFile( sPath + "\\MetaData.log", vData ) )
+    {
+        m_llJournalSize = ReplayJournal( vData.data(), static_cast< int >( vData.size() ), m_Data );
+        bClean = ( m_llJournalSize == static_cast< long long >( vData.size() ) );
+    }
+    vector< char >().swap( vData );
+    m_iJournaledFiles = m_Data.file_size();
+    m_iJournaledInfos = m_Data.fileinfo_size();
+
+    // Create the file maps
+    for ( int i = 0; i < m_Data.file_size(); i++ )
+    {
+        PFAData::File *file = m_Data.mutable_file( i );
+        IndexFile( file );
+    }
+    for ( int i = 0; i < m_Data.fileinfo_size(); i++ )
+        IndexFileInfo( i );
+
+    if ( !m_bBadMetaData ) LoadSnapshots( sPath + "\\Folders.dat" );
+    m_Thumbnails.Open( sPath + "\\Thumbs.dat" );
+    if ( m_bBadMetaData ) return;
+
+    // A torn record at the end (crashed mid write) gets cut off before anything's appended after it
+    error_code ec;
+    if ( !bClean ) fs::resize_file( sPath + "\\MetaData.log", m_llJournalSize, ec );
+    if ( !bClean && ec ) CompactMetaData( sPath );
+    if ( !m_ofsJournal.is_open() )
+        m_ofsJournal.open( sPath + "\\MetaData.log", ios::out | ios::binary | ios::app );
+    if ( m_llJournalSize > m_llBaseSize / CompactRatio )
+        StartCompaction( sPath );
+}
+
+// MetaData.log is a list of records: type, position, length, checksum, then the serialized File or FileInfo.
+// Each one replaces (or appends) the entry at its position, so replaying a record twice does no harm.
+// Stops at the first record that's cut off or doesn't check out
+int SongLibrary::ReplayJournal( const char *pcData, int iSize, PFAData::MetaData &data )
+{
+    int iPos = 0;
+    int aHeader[JournalHeaderSize];
+    while ( iSize - iPos >= static_cast< int >( sizeof( aHeader ) ) )
+    {
+        memcpy( aHeader, pcData + iPos, sizeof( aHeader ) );
+        int iLen = aHeader[2];
+        if ( iLen < 0 || iSize - iPos - static_cast< int >( sizeof( aHeader ) ) < iLen ) break;
+        string sRecord( pcData + iPos + sizeof( aHeader ), iLen );
+        if ( static_cast< unsigned >( aHeader[3] ) != JournalChecksum( aHeader, sRecord ) ) break;
+
+        int iEntry = aHeader[1];
+        if ( aHeader[0] == FileRecord && iEntry >= 0 && iEntry <= data.file_size() )
+        {
+            PFAData::File file;
+            if ( !file.ParseFromString( sRecord ) ) break;
+            *( iEntry < data.file_size() ? data.mutable_file( iEntry ) : data.add_file() ) = file;
+        }
+        else if ( aHeader[0] == FileInfoRecord && iEntry >= 0 && iEntry <= data.fileinfo_size() )
+        {
+            PFAData::FileInfo fileInfo;
+            if ( !fileInfo.ParseFromString( sRecord ) ) break;
+            *( iEntry < data.fileinfo_size() ? data.mutable_fileinfo( iEntry ) : data.add_fileinfo() ) = fileInfo;
+        }
+        else
+            break;
+
+        iPos += sizeof( aHeader ) + iLen;
+    }
+    return iPos;
+}
+
+// Folders.dat: "PFAF", version, folder count, then for each folder its path, write time, subdir flag,
+// files (positions in m_Data.file, each followed by its write time) and subdirs. Files are only ever appended
+// so the positions stay good
+void SongLibrary::LoadSnapshots( const string &sPath )
+{
+    ifstream ifs( sPath, ios::in | ios::binary | ios::ate );
     if ( !ifs.is_open() )
         return;
 
     // Read it all in
     int iSize = static_cast<int>( ifs.tellg() );
-    char *pcMemBlock = new char[iSize];
+    vector< char > vData( iSize + 1 );
     ifs.seekg( 0, ios::beg );
-    ifs.read( pcMemBlock, iSize );
+    ifs.read( &vData[0], iSize );
     ifs.close();
 
-    m_Data.ParseFromArray( pcMemBlock, iSize );
-    delete[] pcMemBlock;
-
-    // Create the file maps
-    for ( int i = 0; i < m_Data.file_size(); i++ )
+    // Readers. Once one fails (not enough data, or an int out of range) bOk stays false and they all return 0
+    const char *pcData = &vData[0], *pcEnd = pcData + iSize;
+    bool bOk = ( iSize >= 4 && memcmp( pcData, "PFAF", 4 ) == 0 );
+    pcData += 4;
+    auto fnRead = [&]( void *pOut, size_t iBytes )
     {
-        PFAData::File *file = m_Data.mutable_file( i );
-        m_mMD5s[ pair< string, int >( file->filename(), file->filesize() ) ] = file;
-    }
-    for ( int i = 0; i < m_Data.fileinfo_size(); i++ )
+        bOk = bOk && static_cast< size_t >( pcEnd - pcData ) >= iBytes;
+        if ( !bOk ) return;
+        memcpy( pOut, pcData, iBytes );
+        pcData += iBytes;
+    };
+    auto fnInt = [&]( int iMax ) -> int
     {
-        PFAData::FileInfo *fileInfo = m_Data.mutable_fileinfo( i );
-        m_mFileInfos[ fileInfo->info().md5() ] = i;
+        int iVal = 0;
+        fnRead( &iVal, sizeof( iVal ) );
+        bOk = bOk && iVal >= 0 && iVal <= iMax;
+        return bOk ? iVal : 0;
+    };
+    auto fnString = [&]() -> wstring
+    {
+        wstring sVal( fnInt( iSize ), L'\0' );
+        if ( sVal.length() > 0 ) fnRead( &sVal[0], sVal.length() * sizeof( wchar_t ) );
+        return sVal;
+    };
+
+    bOk = bOk && fnInt( INT_MAX ) == FolderSnapshotVersion;
+    map< wstring, FolderSnapshot > mSnapshots;
+    for ( int iFolders = fnInt( iSize ); bOk && iFolders > 0; iFolders-- )
+    {
+        FolderSnapshot &snapshot = mSnapshots[ fnString() ];
+        fnRead( &snapshot.llWriteTime, sizeof( snapshot.llWriteTime ) );
+        snapshot.bSubdirs = fnInt( 1 ) != 0;
+        for ( int iFiles = fnInt( iSize ); bOk && iFiles > 0; iFiles-- )
+        {
+            int iPos = fnInt( m_Data.file_size() - 1 );
+            long long llWriteTime = -1;
+            fnRead( &llWriteTime, sizeof( llWriteTime ) );
+            if ( !bOk ) break;
+            snapshot.vFiles.push_back( m_Data.mutable_file( iPos ) );
+            snapshot.vWriteTimes.push_back( llWriteTime );
+        }
+        for ( int iSubdirs = fnInt( iSize ); bOk && iSubdirs > 0; iSubdirs-- )
+            snapshot.vSubdirs.push_back( fnString() );
     }
+
+    // All or nothing. A bad snapshot could hide files
+    if ( bOk ) m_mSnapshots.swap( mSnapshots );
 }
 
 void PlaybackSettings::LoadConfigValues( TiXmlElement *txRoot )
@@ -492,6 +667,12 @@ bool AudioSettings::SaveConfigValues( TiXmlElement *txRoot )
         txAudio->SetAttribute( "MIDIOutDevice", Util::WstringToString( this->sDesiredOut ) );
     if ( this->sDesiredIn.length() > 0 )
         txAudio->SetAttribute( "MIDIInDevice", Util::WstringToString( this->sDesiredIn ) );
+    txAudio->SetAttribute( "MaxVoices", this->iMaxVoices );
+    txAudio->SetAttribute( "MaxChannelVoices", this->iMaxChannelVoices );
+    txAudio->SetAttribute( "OptimizeEvents", this->bOptimizeEvents );
+    txAudio->SetAttribute( "ThinMilliSecs", this->iThinMilliSecs );
+    if ( this->sSoundFont.length() > 0 )
+        txAudio->SetAttribute( "SoundFont", Util::WstringToString( this->sSoundFont ) );
 
     return true;
 }
@@ -503,6 +684,7 @@ bool VideoSettings::SaveConfigValues( TiXmlElement *txRoot )
     txVideo->SetAttribute( "Renderer", this->eRenderer );
     txVideo->SetAttribute( "ShowFPS", this->bShowFPS );
     txVideo->SetAttribute( "LimitFPS", this->bLimitFPS );
+    txVideo->SetAttribute( "MaxFPS", this->iMaxFPS );
     return true;
 }
 
@@ -547,20 +729,188 @@ bool SongLibrary::SaveConfigValues( TiXmlElement *txRoot )
     return bSaved;
 }
 
+// Changes are already in the log. MetaData.pb only gets rewritten if the log's gotten big (or couldn't be written)
 bool SongLibrary::SaveMetaData()
 {
     string sPath = Config::GetFolder();
-    if ( sPath.length() == 0 ) return false;
+    if ( sPath.length() == 0 || m_bBadMetaData ) return false;
+
+    JournalAdded();
+    JobSystem::GetJobSystem().Wait( m_Compaction );
+    bool bJournaled;
+    {
+        lock_guard< mutex > lock( m_JournalMutex );
+        bJournaled = m_ofsJournal.is_open() && m_ofsJournal.good();
+    }
+    if ( !bJournaled && !CompactMetaData( sPath ) ) return false;
+
+    // Only worth keeping if they match the saved files
+    return SaveSnapshots( sPath + "\\Folders.dat" );
+}
+
+// Written next to the real one and then swapped in, so a crash leaves one or the other
+static bool ReplaceFile( const string &sPath, const char *pcData, size_t iSize )
+{
+    string sTemp = sPath + ".tmp";
+    ofstream ofs( sTemp, ios::out | ios::binary );
+    if ( !ofs.is_open() ) return false;
+
+    ofs.write( pcData, iSize );
+    ofs.close();
+    return ofs && MoveFileExA( sTemp.c_str(), sPath.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH );
+}
+
+// Writes out the whole library from memory and starts a fresh log. For when the log can't be trusted to
+// hold everything: the library has to be still while it runs
+bool SongLibrary::CompactMetaData( const string &sPath )
+{
+    lock_guard< mutex > lock( m_JournalMutex );
+    string sData;
+    if ( !m_Data.SerializeToString( &sData ) ) return false;
+    if ( !ReplaceFile( sPath + "\\MetaData.pb", sData.data(), sData.length() ) ) return false;
+
+    m_ofsJournal.close();
+    m_ofsJournal.clear();
+    m_ofsJournal.open( sPath + "\\MetaData.log", ios::out | ios::binary | ios::trunc );
+    m_llBaseSize = sData.length();
+    m_llJournalSize = 0;
+    m_iJournaledFiles = m_Data.file_size();
+    m_iJournaledInfos = m_Data.fileinfo_size();
+    return true;
+}
+
+// Folds what's in the log so far into MetaData.pb on a background job. Only the caller's thread starts these
+void SongLibrary::StartCompaction( const string &sPath )
+{
+    long long llLogged;
+    {
+        lock_guard< mutex > lock( m_JournalMutex );
+        if ( !m_Compaction.IsDone() || !m_ofsJournal.is_open() ) return;
+        llLogged = m_llJournalSize;
+    }
+    JobSystem::GetJobSystem().Submit( [this, sPath, llLogged]() { CompactLogged( sPath, llLogged ); },
+                                      JobSystem::Background, &m_Compaction );
+}
+
+// Runs on a worker. Works from the files rather than m_Data, which the game thread changes without a lock.
+// Records logged after the first llLogged bytes get carried over to the new log. A crash between the two
+// swaps leaves records that are already in MetaData.pb at the front of the log, and replaying them is harmless
+bool SongLibrary::CompactLogged( const string &sPath, long long llLogged )
+{
+    string sBase = sPath + "\\MetaData.pb", sLog = sPath + "\\MetaData.log";
+    PFAData::MetaData data;
+    vector< char > vData;
+    if ( ReadWholeFile( sBase, vData ) && !ParseMetaData( vData, data ) ) return false;
+    if ( !ReadWholeFile( sLog, vData ) || static_cast< long long >( vData.size() ) < llLogged ||
+         ReplayJournal( vData.data(), static_cast< int >( llLogged ), data ) != llLogged )
+        return false;
 
     string sData;
-    m_Data.SerializeToString( &sData );
+    if ( !data.SerializeToString( &sData ) || !ReplaceFile( sBase, sData.data(), sData.length() ) ) return false;
+    data.Clear();
+
+    lock_guard< mutex > lock( m_JournalMutex );
+    m_llBaseSize = sData.length();
+    if ( !ReadWholeFile( sLog, vData, llLogged ) ) return false;
+    m_ofsJournal.close();
+    bool bSwapped = ReplaceFile( sLog, vData.data(), vData.size() );
+    m_ofsJournal.clear();
+    m_ofsJournal.open( sLog, ios::out | ios::binary | ios::app );
+    if ( bSwapped ) m_llJournalSize -= llLogged;
+    return bSwapped;
+}
+
+// Appends whatever files and infos were added since last time
+void SongLibrary::JournalAdded()
+{
+    bool bCompact;
+    {
+        lock_guard< mutex > lock( m_JournalMutex );
+        if ( !m_ofsJournal.is_open() ) return;
+
+        for ( ; m_iJournaledInfos < m_Data.fileinfo_size(); m_iJournaledInfos++ )
+            AppendRecord( FileInfoRecord, m_iJournaledInfos, m_Data.fileinfo( m_iJournaledInfos ) );
+        for ( ; m_iJournaledFiles < m_Data.file_size(); m_iJournaledFiles++ )
+            AppendRecord( FileRecord, m_iJournaledFiles, m_Data.file( m_iJournaledFiles ) );
+        bCompact = m_llJournalSize > m_llBaseSize / CompactRatio;
+    }
+    if ( bCompact ) StartCompaction( Config::GetFolder() );
+}
+
+// New labels and scores. Infos that haven't been logged yet get picked up by JournalAdded instead
+void SongLibrary::JournalInfo( int iPos, const PFAData::FileInfo *pFileInfo )
+{
+    lock_guard< mutex > lock( m_JournalMutex );
+    if ( m_ofsJournal.is_open() && pFileInfo && iPos >= 0 && iPos < m_iJournaledInfos )
+        AppendRecord( FileInfoRecord, iPos, *pFileInfo );
+}
+
+// Caller holds the journal lock. Flushed right away so a crash only loses the record being written
+void SongLibrary::AppendRecord( JournalRecord eType, int iPos, const google::protobuf::MessageLite &msg )
+{
+    string sRecord;
+    if ( !msg.SerializeToString( &sRecord ) ) return;
+
+    int aHeader[JournalHeaderSize] = { eType, iPos, static_cast< int >( sRecord.length() ), 0 };
+    aHeader[3] = static_cast< int >( JournalChecksum( aHeader, sRecord ) );
+    m_ofsJournal.write( reinterpret_cast< const char* >( aHeader ), sizeof( aHeader ) );
+    m_ofsJournal << sRecord;
+    m_ofsJournal.flush();
+    m_llJournalSize += sizeof( aHeader ) + sRecord.length();
+}
+
+// FNV-1a over the type, position, length and the record itself
+unsigned SongLibrary::JournalChecksum( const int aHeader[JournalHeaderSize], const string &sRecord )
+{
+    unsigned iHash = 2166136261u;
+    const unsigned char *pcHeader = reinterpret_cast< const unsigned char* >( aHeader );
+    for ( size_t i = 0; i < 3 * sizeof( int ); i++ )
+        iHash = ( iHash ^ pcHeader[i] ) * 16777619u;
+    for ( size_t i = 0; i < sRecord.length(); i++ )
+        iHash = ( iHash ^ static_cast< unsigned char >( sRecord[i] ) ) * 16777619u;
+    return iHash;
+}
+
+bool SongLibrary::SaveSnapshots( const string &sPath )
+{
+    map< const PFAData::File*, int > mFilePos;
+    for ( int i = 0; i < m_Data.file_size(); i++ )
+        mFilePos[ &m_Data.file( i ) ] = i;
+
+    string sData( "PFAF" );
+    auto fnWrite = [&]( const void *pData, size_t iBytes ) { sData.append( static_cast< const char* >( pData ), iBytes ); };
+    auto fnInt = [&]( int i ) { fnWrite( &i, sizeof( i ) ); };
+    auto fnString = [&]( const wstring &s ) { fnInt( static_cast< int >( s.length() ) ); fnWrite( s.c_str(), s.length() * sizeof( wchar_t ) ); };
+
+    int iFolders = 0;
+    for ( map< wstring, FolderSnapshot >::const_iterator it = m_mSnapshots.begin(); it != m_mSnapshots.end(); ++it )
+        iFolders += it->second.bSeen;
+    fnInt( FolderSnapshotVersion );
+    fnInt( iFolders );
+    for ( map< wstring, FolderSnapshot >::const_iterator it = m_mSnapshots.begin(); it != m_mSnapshots.end(); ++it )
+    {
+        const FolderSnapshot &snapshot = it->second;
+        if ( !snapshot.bSeen ) continue;
+        fnString( it->first );
+        fnWrite( &snapshot.llWriteTime, sizeof( snapshot.llWriteTime ) );
+        fnInt( snapshot.bSubdirs );
+        fnInt( static_cast< int >( snapshot.vFiles.size() ) );
+        for ( size_t i = 0; i < snapshot.vFiles.size(); i++ )
+        {
+            fnInt( mFilePos[ snapshot.vFiles[i] ] );
+            fnWrite( &snapshot.vWriteTimes[i], sizeof( snapshot.vWriteTimes[i] ) );
+        }
+        fnInt( static_cast< int >( snapshot.vSubdirs.size() ) );
+        for ( vector< wstring >::const_iterator itSubdir = snapshot.vSubdirs.begin(); itSubdir != snapshot.vSubdirs.end(); ++itSubdir )
+            fnString( *itSubdir );
+    }
 
-    ofstream ofs( sPath + "\\MetaData.pb", ios::out | ios::binary );
+    ofstream ofs( sPath, ios::out | ios::binary );
     if ( !ofs.is_open() ) return false;
 
     ofs << sData;
     ofs.close();
-    return true;
+    return !ofs.fail();
 }
 
 bool PlaybackSettings::SaveConfigValues( TiXmlElement *txRoot )
@@ -599,7 +949,7 @@ bool ViewSettings::SaveConfigValues( TiXmlElement *txRoot )
 // Library functions
 //-----------------------------------------------------------------------------
 
-int SongLibrary::AddSource( const wstring &sSource, Source eSource, bool bExpand )
+int SongLibrary::AddSource( const wstring &sSource, Source eSource, bool bExpand, bool bVerify )
 {
     int iChanged = 0;
     map< wstring, Source >::iterator pos = m_mSources.find( sSource );
@@ -609,7 +959,7 @@ int SongLibrary::AddSource( const wstring &sSource, Source eSource, bool bExpand
         else iChanged = RemoveSource( sSource );
     }
 
-    if ( bExpand ) iChanged += ExpandSource( sSource, eSource );
+    if ( bExpand ) iChanged += ExpandSource( sSource, eSource, bVerify );
     m_mSources[sSource] = eSource;
 
     return iChanged;
@@ -650,78 +1000,362 @@ void SongLibrary::clear()
     }
     m_mFiles.clear();
     m_mSources.clear();
-    m_mMD5s.clear();
-    m_mFileInfos.clear();
+    m_FileIndex.clear();
+    m_FileInfoIndex.clear();
+    m_mSnapshots.clear();
     m_Data.Clear();
+    m_iJournaledFiles = m_iJournaledInfos = 0;
 }
 
-int SongLibrary::ExpandSource( const wstring &sSource, Source eSource )
+// Finding the files is cheap. Parsing the new ones is what takes time, so that's spread across the cores.
+// Results are added afterwards on this thread, in the order the files were found
+int SongLibrary::ExpandSource( const wstring &sSource, Source eSource, bool bVerify )
 {
-    TCHAR buf[1024];
+    vector< ScannedFile > vFound;
+    FindFiles( TEXT( "\\\\?\\" ) + sSource, eSource, bVerify, vFound );
+    ScanFiles( vFound );
+
     vector< PFAData::File* > *pvFiles = new vector< PFAData::File* >();
+    for ( vector< ScannedFile >::const_iterator it = vFound.begin(); it != vFound.end(); ++it )
+    {
+        PFAData::File *pInfo = it->pFile;
+        if ( !pInfo && it->bValid ) pInfo = AddFile( it->sFilename, it->iSize, it->songInfo );
+        if ( !pInfo ) continue;
+        pvFiles->push_back( pInfo );
+        if ( it->pFolder )
+        {
+            it->pFolder->vFiles.push_back( pInfo );
+            it->pFolder->vWriteTimes.push_back( it->llWriteTime );
+        }
+    }
 
-    int iExpanded = ExpandSource( TEXT( "\\\\?\\" ) + sSource, eSource, pvFiles, buf );
+    int iExpanded = static_cast< int >( pvFiles->size() );
     if ( iExpanded > 0 ) m_mFiles[sSource] = pvFiles;
     else delete pvFiles;
 
+    JournalAdded();
     return iExpanded;
 }
 
-// Passing the buffer around avoids having to put it on the recursive stack
-int SongLibrary::ExpandSource( const wstring &sPath, Source eSource, vector< PFAData::File* > *pvFiles, wchar_t buf[1024] )
+// Walks a folder source. Folders are walked with one recursive iterator, except where a snapshot is still
+// good: that folder isn't listed again and each of its subfolders gets checked on its own
+void SongLibrary::FindFiles( const wstring &sPath, Source eSource, bool bVerify, vector< ScannedFile > &vFound )
 {
+    error_code ec;
     if ( eSource == File )
     {
-        PFAData::File *pInfo = AddFile( sPath );
-        if ( !pInfo ) return 0;
-        pvFiles->push_back( pInfo );
-        return 1;
+        uintmax_t iSize = fs::file_size( sPath, ec );
+        if ( ec ) return;
+        vFound.push_back( ScannedFile( sPath, Util::WstringToString( sPath.substr( 4 ) ), static_cast< int >( iSize ) ) );
+        return;
     }
-    else
+
+    // Write times of the files in the snapshots being redone, so ones written over still get spotted
+    bool bSubdirs = ( eSource == FolderWSubdirs );
+    map< string, long long > mWritten;
+    FolderSnapshot *pRoot = CheckSnapshot( sPath, bSubdirs, bVerify, vFound, mWritten );
+    if ( !pRoot ) return;
+
+    // The snapshot being filled in at each depth. An entry's folder is the one at its depth
+    vector< FolderSnapshot* > vFolders( 1, pRoot );
+    fs::recursive_directory_iterator it( sPath, fs::directory_options::skip_permission_denied, ec ), itEnd;
+    for ( ; !ec && it != itEnd; it.increment( ec ) )
     {
-        // Copy the file to the buffer
-        if ( sPath.length() + 7 > 1024 ) return 0;
-        memcpy( buf, sPath.c_str(), sPath.length() * sizeof( wchar_t ) );
-        memcpy( buf + sPath.length(), L"\\*.mid", 7 * sizeof( wchar_t ) );
+        const fs::directory_entry &entry = *it;
+        FolderSnapshot *pFolder = vFolders[it.depth()];
+        error_code ecEntry;
+        if ( entry.is_directory( ecEntry ) )
+        {
+            FolderSnapshot *pSubdir = NULL;
+            if ( bSubdirs )
+            {
+                pFolder->vSubdirs.push_back( entry.path().filename().wstring() );
+                pSubdir = CheckSnapshot( entry.path().wstring(), bSubdirs, bVerify, vFound, mWritten );
+            }
+            if ( !pSubdir )
+            {
+                it.disable_recursion_pending();
+                continue;
+            }
+            vFolders.resize( it.depth() + 2 );
+            vFolders[it.depth() + 1] = pSubdir;
+        }
+        else if ( _wcsicmp( entry.path().extension().c_str(), L".mid" ) == 0 )
+        {
+            uintmax_t iSize = entry.file_size( ecEntry ); // Came with the listing, as did the write time
+            if ( ecEntry ) continue;
+            wstring wsFile = entry.path().wstring();
+            vFound.push_back( ScannedFile( wsFile, Util::WstringToString( wsFile.substr( 4 ) ), static_cast< int >( iSize ) ) );
+            ScannedFile &found = vFound.back();
+            found.llWriteTime = entry.last_write_time( ecEntry ).time_since_epoch().count();
+            found.pFolder = pFolder;
+            map< string, long long >::const_iterator itWritten = mWritten.find( found.sFilename );
+            found.bChanged = ( itWritten != mWritten.end() && itWritten->second != found.llWriteTime );
+        }
+    }
+}
 
-        int iExpanded = 0;
-        WIN32_FIND_DATA ffd;
-        HANDLE hFind = FindFirstFile( buf, &ffd );
-        if ( hFind != INVALID_HANDLE_VALUE )
+// Nothing's been added, removed or renamed since last time: reuses what was found then and returns NULL.
+// Otherwise returns the folder's emptied snapshot for the walk to fill in, with its files' old write times
+// left in mWritten. NULL too if the folder's gone. The write time comes from the folder itself, since the
+// copy in its parent's listing can lag. Verifying (File > Refresh) also checks each file of a reused folder
+// for a new size or write time, a stat each, and any that were written over get scanned again
+SongLibrary::FolderSnapshot *SongLibrary::CheckSnapshot( const wstring &sPath, bool bSubdirs, bool bVerify, vector< ScannedFile > &vFound,
+                                                        map< string, long long > &mWritten )
+{
+    error_code ec;
+    fs::file_time_type ftWrite = fs::last_write_time( sPath, ec );
+    if ( ec ) return NULL;
+    long long llWriteTime = ftWrite.time_since_epoch().count(); // A FILETIME, same as Folders.dat has always had
+
+    FolderSnapshot &snapshot = m_mSnapshots[sPath];
+    snapshot.bSeen = true;
+    if ( snapshot.llWriteTime == llWriteTime && ( snapshot.bSubdirs || !bSubdirs ) )
+    {
+        if ( !bVerify )
         {
-            do
+            for ( vector< PFAData::File* >::const_iterator it = snapshot.vFiles.begin(); it != snapshot.vFiles.end(); ++it )
             {
-                PFAData::File *pInfo = AddFile( sPath + L'\\' + ffd.cFileName );
-                if ( pInfo )
+                vFound.push_back( ScannedFile( wstring(), string(), 0 ) );
+                vFound.back().pFile = *it;
+            }
+        }
+        else
+        {
+            // Changed files come out of the snapshot. ExpandSource puts them back once they've been added
+            size_t iKept = 0;
+            for ( size_t i = 0; i < snapshot.vFiles.size(); i++ )
+            {
+                PFAData::File *pFile = snapshot.vFiles[i];
+                wstring wsFile = TEXT( "\\\\?\\" ) + wstring( Util::StringToWstring( pFile->filename() ) );
+                fs::directory_entry entry( wsFile, ec );
+                uintmax_t iSize = entry.file_size( ec );
+                if ( ec ) continue;
+                long long llFileTime = entry.last_write_time( ec ).time_since_epoch().count();
+
+                vFound.push_back( ScannedFile( wsFile, pFile->filename(), static_cast< int >( iSize ) ) );
+                ScannedFile &found = vFound.back();
+                if ( !ec && static_cast< int >( iSize ) == pFile->filesize() && llFileTime == snapshot.vWriteTimes[i] )
+                {
+                    found.pFile = pFile;
+                    snapshot.vFiles[iKept] = pFile;
+                    snapshot.vWriteTimes[iKept++] = llFileTime;
+                }
+                else
                 {
-                    pvFiles->push_back( pInfo );
-                    iExpanded++;
+                    found.llWriteTime = llFileTime;
+                    found.pFolder = &snapshot;
+                    found.bChanged = true;
                 }
             }
-            while ( FindNextFile( hFind, &ffd ) );
-            FindClose( hFind );
+            snapshot.vFiles.resize( iKept );
+            snapshot.vWriteTimes.resize( iKept );
         }
+        if ( bSubdirs )
+            for ( vector< wstring >::const_iterator it = snapshot.vSubdirs.begin(); it != snapshot.vSubdirs.end(); ++it )
+                FindFiles( sPath + L'\\' + *it, FolderWSubdirs, bVerify, vFound );
+        return NULL;
+    }
+
+    for ( size_t i = 0; i < snapshot.vFiles.size(); i++ )
+        mWritten[ snapshot.vFiles[i]->filename() ] = snapshot.vWriteTimes[i];
+    snapshot.llWriteTime = llWriteTime;
+    snapshot.bSubdirs = bSubdirs;
+    snapshot.vFiles.clear();
+    snapshot.vWriteTimes.clear();
+    snapshot.vSubdirs.clear();
+    return &snapshot;
+}
 
-        if ( eSource == FolderWSubdirs )
+// Scans everything that isn't in the library yet. The library is only read until all the workers are done
+void SongLibrary::ScanFiles( vector< ScannedFile > &vFound ) const
+{
+    size_t iNew = 0;
+    for ( vector< ScannedFile >::iterator it = vFound.begin(); it != vFound.end(); ++it )
+    {
+        if ( it->pFile ) continue;
+        if ( !it->bChanged ) it->pFile = FindFile( it->sFilename, it->iSize );
+        if ( !it->pFile ) iNew++;
+    }
+    if ( iNew == 0 ) return;
+
+    JobSystem::GetJobSystem().ParallelFor( static_cast< int >( vFound.size() ),
+        [&]( int i ) { if ( !vFound[i].pFile ) ScanFile( vFound[i] ); }, JobSystem::Background );
+}
+
+// Runs on a worker thread. Scanning gets the same numbers as loading the song, without making any events
+void SongLibrary::ScanFile( ScannedFile &file )
+{
+    MIDI::MIDIInfo mInfo;
+    if ( !MIDI::ScanInfo( file.wsPath, mInfo ) ) return;
+
+    file.bValid = true;
+    file.songInfo.set_md5( mInfo.sMd5 );
+    file.songInfo.set_division( mInfo.iDivision );
+    file.songInfo.set_notes( mInfo.iNoteCount );
+    file.songInfo.set_beats( mInfo.iTotalBeats );
+    file.songInfo.set_seconds( static_cast< int >( mInfo.llTotalMicroSecs / 1000000 ) );
+    file.songInfo.set_tracks( mInfo.iNumChannels );
+}
+
+// Queues up every song without stats or a thumbnail. Whatever's waiting gets applied first so it isn't queued again
+void SongLibrary::StartAnalysis( const function< void() > &fnReady )
+{
+    ApplyStats();
+
+    deque< AnalysisJob > qJobs;
+    vector< ThumbnailCache::Job > vThumbJobs;
+    vector< char > vQueued( m_Data.fileinfo_size(), 0 );
+    for ( map< wstring, vector< PFAData::File* >* >::const_iterator itSource = m_mFiles.begin(); itSource != m_mFiles.end(); ++itSource )
+        for ( vector< PFAData::File* >::const_iterator itFile = itSource->second->begin(); itFile != itSource->second->end(); ++itFile )
         {
-            buf[sPath.length() + 2] = L'\0';
-            hFind = FindFirstFile( buf, &ffd );
-            if ( hFind == INVALID_HANDLE_VALUE ) return iExpanded;
+            int iPos = ( *itFile )->infopos();
+            if ( iPos < 0 || iPos >= m_Data.fileinfo_size() || vQueued[iPos] ) continue;
+            vQueued[iPos] = 1;
 
-            do
-            {
-                if ( ffd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY &&
-                     wcscmp( ffd.cFileName, TEXT( ".." ) ) && wcscmp( ffd.cFileName, TEXT( "." ) ) )
-                    iExpanded += ExpandSource( sPath + L'\\' + ffd.cFileName, eSource, pvFiles, buf );
-            }
-            while ( FindNextFile( hFind, &ffd ) );
-            FindClose( hFind );
+            const PFAData::SongInfo &songInfo = m_Data.fileinfo( iPos ).info();
+            bool bStats = ( songInfo.statsversion() != StatsVersion ), bThumb = !m_Thumbnails.Has( songInfo.md5() );
+            if ( !bStats && !bThumb ) continue;
+
+            wstring wsPath = TEXT( "\\\\?\\" ) + wstring( Util::StringToWstring( ( *itFile )->filename() ) );
+            if ( bStats ) qJobs.push_back( AnalysisJob( wsPath, songInfo.md5(), iPos ) );
+            if ( bThumb ) vThumbJobs.push_back( ThumbnailCache::Job( wsPath, songInfo.md5() ) );
         }
-    
-        return iExpanded;
+    m_Thumbnails.Generate( vThumbJobs );
+
+    {
+        lock_guard< mutex > lock( m_AnalysisMutex );
+        if ( m_iAnalyzing >= 0 )
+            qJobs.erase( remove_if( qJobs.begin(), qJobs.end(), [&]( const AnalysisJob &job ) { return job.iInfoPos == m_iAnalyzing; } ), qJobs.end() );
+        m_qAnalysis.swap( qJobs );
+        m_fnStatsReady = fnReady;
+        m_bStopAnalysis = false;
+        if ( !m_AnalysisThread.joinable() && !m_qAnalysis.empty() )
+        {
+            m_AnalysisThread = thread( &SongLibrary::AnalyzeSongs, this );
+            SetThreadPriority( m_AnalysisThread.native_handle(), THREAD_PRIORITY_IDLE );
+        }
+    }
+    m_cvAnalysis.notify_one();
+}
+
+// Waits for the songs being worked on, if any. The rest get picked up next time
+void SongLibrary::StopAnalysis()
+{
+    m_Thumbnails.Stop();
+    {
+        lock_guard< mutex > lock( m_AnalysisMutex );
+        m_bStopAnalysis = true;
+        m_qAnalysis.clear();
+    }
+    m_cvAnalysis.notify_one();
+    if ( m_AnalysisThread.joinable() )
+        m_AnalysisThread.join();
+}
+
+// Runs on the UI thread, which owns the library. Infos that are already in the log get logged again
+int SongLibrary::ApplyStats()
+{
+    vector< AnalysisJob > vDone;
+    {
+        lock_guard< mutex > lock( m_AnalysisMutex );
+        vDone.swap( m_vAnalyzed );
+    }
+
+    int iApplied = 0;
+    lock_guard< mutex > lock( m_JournalMutex );
+    for ( vector< AnalysisJob >::const_iterator it = vDone.begin(); it != vDone.end(); ++it )
+    {
+        if ( it->iInfoPos >= m_Data.fileinfo_size() ) continue;
+        PFAData::FileInfo *pFileInfo = m_Data.mutable_fileinfo( it->iInfoPos );
+        PFAData::SongInfo *pSongInfo = pFileInfo->mutable_info();
+        if ( pSongInfo->md5() != it->sMd5 ) continue;
+
+        pSongInfo->set_statsversion( StatsVersion );
+        pSongInfo->set_peaknotespersec( it->mStats.iPeakNotesPerSec );
+        pSongInfo->set_maxchord( it->mStats.iMaxChord );
+        pSongInfo->set_maxchordspan( it->mStats.iMaxChordSpan );
+        pSongInfo->set_lowkey( it->mStats.iLowKey );
+        pSongInfo->set_highkey( it->mStats.iHighKey );
+        pSongInfo->set_tempochanges( it->mStats.iTempoChanges );
+        if ( m_ofsJournal.is_open() && it->iInfoPos < m_iJournaledInfos )
+            AppendRecord( FileInfoRecord, it->iInfoPos, *pFileInfo );
+        iApplied++;
+    }
+    return iApplied;
+}
+
+// The analysis thread. Songs that changed on disk since they were added are left for a rescan to sort out
+void SongLibrary::AnalyzeSongs()
+{
+    unique_lock< mutex > lock( m_AnalysisMutex );
+    for (;;)
+    {
+        while ( !m_bStopAnalysis && m_qAnalysis.empty() )
+            m_cvAnalysis.wait( lock );
+        if ( m_bStopAnalysis )
+            return;
+
+        AnalysisJob job = m_qAnalysis.front();
+        m_qAnalysis.pop_front();
+        m_iAnalyzing = job.iInfoPos;
+        lock.unlock();
+
+        MIDI::MIDIInfo mInfo;
+        DWORD dwStart = GetTickCount();
+        bool bValid = MIDI::ScanInfo( job.wsPath, mInfo, &job.mStats ) && mInfo.sMd5 == job.sMd5;
+        DWORD dwTaken = GetTickCount() - dwStart;
+
+        lock.lock();
+        m_iAnalyzing = -1;
+        if ( !bValid ) continue;
+
+        // Only the first result needs a call. The rest are picked up along with it
+        m_vAnalyzed.push_back( job );
+        if ( m_vAnalyzed.size() == 1 && m_fnStatsReady )
+        {
+            function< void() > fnReady = m_fnStatsReady;
+            lock.unlock();
+            fnReady();
+            lock.lock();
+        }
+
+        // Rest before the next one. Stopping cuts it short
+        m_cvAnalysis.wait_for( lock, chrono::milliseconds( static_cast< long long >( dwTaken ) * AnalysisRestRatio ),
+                               [this]() { return m_bStopAnalysis; } );
     }
 }
 
+PFAData::File *SongLibrary::FindFile( const string &sFilename, int iSize ) const
+{
+    unsigned iHash = HashIndex< PFAData::File* >::Hash( sFilename.data(), sFilename.length(), iSize );
+    PFAData::File * const *ppFile = m_FileIndex.Find( iHash, [&]( const PFAData::File *file )
+        { return file->filesize() == iSize && file->filename() == sFilename; } );
+    return ppFile ? *ppFile : NULL;
+}
+
+int SongLibrary::FindFileInfo( const string &sMd5 ) const
+{
+    unsigned iHash = HashIndex< int >::Hash( sMd5.data(), sMd5.length() );
+    const int *piPos = m_FileInfoIndex.Find( iHash, [&]( int iPos ) { return m_Data.fileinfo( iPos ).info().md5() == sMd5; } );
+    return piPos ? *piPos : -1;
+}
+
+void SongLibrary::IndexFile( PFAData::File *file )
+{
+    const string &sFilename = file->filename();
+    int iSize = file->filesize();
+    unsigned iHash = HashIndex< PFAData::File* >::Hash( sFilename.data(), sFilename.length(), iSize );
+    m_FileIndex.Set( iHash, [&]( const PFAData::File *other ) { return other->filesize() == iSize && other->filename() == sFilename; }, file );
+}
+
+void SongLibrary::IndexFileInfo( int iPos )
+{
+    const string &sMd5 = m_Data.fileinfo( iPos ).info().md5();
+    unsigned iHash = HashIndex< int >::Hash( sMd5.data(), sMd5.length() );
+    m_FileInfoIndex.Set( iHash, [&]( int iOther ) { return m_Data.fileinfo( iOther ).info().md5() == sMd5; }, iPos );
+}
+
 PFAData::File* SongLibrary::AddFile( const wstring &wsFilename, MIDI *pMidi )
 {
     // Does it exist? Prob should remove from map if it's there.
@@ -733,53 +1367,53 @@ PFAData::File* SongLibrary::AddFile( const wstring &wsFilename, MIDI *pMidi )
     string sFilename = Util::WstringToString( wsFilename.substr( 4 ) );
 
     // Is it already there?
-    pair< string, int > fileLookup( sFilename, fad.nFileSizeLow );
-    map< pair< string, int >, PFAData::File* >::const_iterator itFile =
-        m_mMD5s.find( fileLookup );
-    if ( itFile != m_mMD5s.end() ) return itFile->second;
+    PFAData::File *pFound = FindFile( sFilename, fad.nFileSizeLow );
+    if ( pFound ) return pFound;
 
     // No meta data for the file exists yet. Parse the file, unless already parsed
-    bool bIsNew = false;
+    ScannedFile scanned( wsFilename, sFilename, fad.nFileSizeLow );
     if ( !pMidi )
+        ScanFile( scanned );
+    else if ( pMidi->IsValid() )
     {
-        pMidi = new MIDI( wsFilename );
-        bIsNew = true;
-    }
-    if ( !pMidi->IsValid() )
-    {
-        if ( bIsNew ) delete pMidi;
-        return NULL;
+        const MIDI::MIDIInfo &mInfo = pMidi->GetInfo();
+        scanned.bValid = true;
+        scanned.songInfo.set_md5( mInfo.sMd5 );
+        scanned.songInfo.set_division( mInfo.iDivision );
+        scanned.songInfo.set_notes( mInfo.iNoteCount );
+        scanned.songInfo.set_beats( mInfo.iTotalBeats );
+        scanned.songInfo.set_seconds( static_cast< int >( mInfo.llTotalMicroSecs / 1000000 ) );
+        scanned.songInfo.set_tracks( mInfo.iNumChannels );
     }
+    if ( !scanned.bValid ) return NULL;
 
+    PFAData::File *file = AddFile( sFilename, fad.nFileSizeLow, scanned.songInfo );
+    JournalAdded();
+    return file;
+}
+
+// Adds a scanned file. songInfo only needs more than the MD5 if the song isn't in the library under another name
+PFAData::File* SongLibrary::AddFile( const string &sFilename, int iSize, const PFAData::SongInfo &songInfo )
+{
     // Create file info
     PFAData::File *file = m_Data.add_file();
     file->set_filename( sFilename );
-    file->set_filesize( fad.nFileSizeLow );
-    m_mMD5s[ fileLookup ] = file;
+    file->set_filesize( iSize );
+    IndexFile( file );
 
     // Do we already have data for this file
-    const MIDI::MIDIInfo &mInfo = pMidi->GetInfo();
-    map< string, int >::const_iterator itFileInfo = m_mFileInfos.find( mInfo.sMd5 );
-    if ( itFileInfo != m_mFileInfos.end() ) 
+    int iInfoPos = FindFileInfo( songInfo.md5() );
+    if ( iInfoPos >= 0 )
     {
-        file->set_infopos( itFileInfo->second );
-        if ( bIsNew ) delete pMidi;
+        file->set_infopos( iInfoPos );
         return file;
     }
 
     // We don't. Add the data to the lookup and the buffer
-    if ( bIsNew ) pMidi->PostProcess();
     PFAData::FileInfo* fileInfo = m_Data.add_fileinfo();
-    PFAData::SongInfo* songInfo = fileInfo->mutable_info();
-    songInfo->set_md5( mInfo.sMd5 );
-    songInfo->set_division( mInfo.iDivision );
-    songInfo->set_notes( mInfo.iNoteCount );
-    songInfo->set_beats( mInfo.iTotalBeats );
-    songInfo->set_seconds( static_cast< int >( mInfo.llTotalMicroSecs / 1000000 ) );
-    songInfo->set_tracks( mInfo.iNumChannels );
-    m_mFileInfos[ mInfo.sMd5 ] = m_Data.fileinfo_size() - 1;
+    *fileInfo->mutable_info() = songInfo;
+    IndexFileInfo( m_Data.fileinfo_size() - 1 );
 
     file->set_infopos( m_Data.fileinfo_size() - 1 );
-    if ( bIsNew ) delete pMidi;
     return file;
 }
\ No newline at end of file
@@ -11,12 +11,20 @@
 
 #include <vector>
 #include <map>
+#include <deque>
 #include <string>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
 
 #include "ProtoBuf\MetaData.pb.h"
 #include "tinyxml\tinyxml.h"
 
 #include "MIDI.h"
+#include "JobSystem.h"
+#include "Thumbnails.h"
 #include "GameState.h"
 #include "MainProcs.h"
 
@@ -63,6 +71,10 @@ struct AudioSettings : public ISettings
     vector< wstring > vMIDIOutDevices;
     int iInDevice, iOutDevice;
     wstring sDesiredIn, sDesiredOut;
+    int iMaxVoices, iMaxChannelVoices; // Output polyphony. 0 for no limit
+    bool bOptimizeEvents; // Take redundant events out of a song once it's loaded
+    int iThinMilliSecs; // Closest that optimizing leaves a continuous controller's events. 0 to not thin
+    wstring sSoundFont; // For the built-in synth, which is listed as an output once it's loaded
 };
 
 struct VideoSettings : public ISettings
@@ -73,6 +85,7 @@ struct VideoSettings : public ISettings
 
     enum Renderer { Direct3D, OpenGL, GDI } eRenderer;
     bool bShowFPS, bLimitFPS;
+    int iMaxFPS; // When not limited to the refresh rate. 0 for no limit
 };
 
 struct ControlsSettings : public ISettings
@@ -188,7 +201,9 @@ private:
 class SongLibrary : public ISettings
 {
 public:
-    ~SongLibrary() { clear(); }
+    SongLibrary() : m_iJournaledFiles( 0 ), m_iJournaledInfos( 0 ), m_llBaseSize( 0 ), m_llJournalSize( 0 ), m_bBadMetaData( false ),
+                    m_iAnalyzing( -1 ), m_bStopAnalysis( false ) { }
+    ~SongLibrary() { StopAnalysis(); clear(); }
 
     void LoadDefaultValues();
     void LoadConfigValues( TiXmlElement *txRoot );
@@ -198,14 +213,24 @@ public:
 
     enum Source { File, Folder, FolderWSubdirs } eRenderer;
 
-    int AddSource( const wstring &sSource, Source eSource, bool bExpand = true );
+    int AddSource( const wstring &sSource, Source eSource, bool bExpand = true, bool bVerify = false ); // Verify: see CheckSnapshot
     int RemoveSource( const wstring &sSource );
     int ExpandSources();
     PFAData::File* SongLibrary::AddFile( const wstring &wsFilename, MIDI *pMidi = NULL );
+    void JournalInfo( int iPos, const PFAData::FileInfo *pFileInfo ); // After changing labels or scores. Any thread
     void clear();
 
+    // Difficulty stats get worked out on a low priority thread for every song that doesn't have them at
+    // StatsVersion yet. fnReady is called from that thread when there are results for ApplyStats to pick up.
+    // Songs without a thumbnail get one made at the same time
+    static const int StatsVersion = 1;
+    void StartAnalysis( const function< void() > &fnReady );
+    void StopAnalysis();
+    int ApplyStats(); // Returns how many songs got their stats
+
     const map < wstring, Source > &GetSources() const { return m_mSources; }
     const map< wstring, vector< PFAData::File* >* > &GetFiles() const { return m_mFiles; }
+    const ThumbnailCache &GetThumbnails() const { return m_Thumbnails; }
     PFAData::FileInfo *GetInfo( int iPos ) { return m_Data.mutable_fileinfo( iPos ); }
     bool GetAlwaysAdd() const { return m_bAlwaysAdd; }
     int GetSortCol() const { return m_iSortCol; }
@@ -214,8 +239,90 @@ public:
     void SetSortCol( int iSortCol ) { m_iSortCol = iSortCol; }
 
 private:
-    int ExpandSource( const wstring &sSource, Source eSource );
-    int ExpandSource( const wstring &sPath, Source eSource, vector< PFAData::File* > *pvFiles, wchar_t buf[] );
+    // What a folder held the last time it was walked. It isn't walked again until its write time changes,
+    // which happens when files get added, removed or renamed. Files written over in place don't change it.
+    // Those are only caught when the folder's walked anyway, or when asked to verify
+    struct FolderSnapshot
+    {
+        FolderSnapshot() : llWriteTime( -1 ), bSubdirs( false ), bSeen( false ) { }
+
+        long long llWriteTime;
+        bool bSubdirs; // vSubdirs was filled in
+        bool bSeen; // Used this session. Only these get saved
+        vector< PFAData::File* > vFiles;
+        vector< long long > vWriteTimes; // One for each of vFiles
+        vector< wstring > vSubdirs;
+    };
+
+    // A file turned up while expanding a source. Ones not in the library yet get scanned on the worker threads
+    struct ScannedFile
+    {
+        ScannedFile( const wstring &wsPath, const string &sFilename, int iSize ) :
+            wsPath( wsPath ), sFilename( sFilename ), iSize( iSize ), llWriteTime( -1 ), pFile( NULL ), pFolder( NULL ),
+            bChanged( false ), bValid( false ) { }
+
+        wstring wsPath;
+        string sFilename; // Library name. No \\?\ prefix
+        int iSize;
+        long long llWriteTime;
+        PFAData::File *pFile; // Non-NULL if it was already in the library
+        FolderSnapshot *pFolder; // Where it was found, if its folder got walked
+        bool bChanged; // Written over since its folder's snapshot. Scanned even if the library has its name and size
+        bool bValid;
+        PFAData::SongInfo songInfo;
+    };
+
+    // The journal (MetaData.log). Additions and changes get appended as they happen. MetaData.pb is only
+    // rewritten once the log passes a fraction of its size, on a background job
+    enum JournalRecord { FileRecord = 1, FileInfoRecord };
+    static const int JournalHeaderSize = 4; // ints: type, position, length, checksum
+    static const int CompactRatio = 4;
+    static const int MetaDataBytesLimit = 512 << 20; // protobuf's default of 64 MB is too few for a big library
+    static const int MetaDataBytesWarning = 64 << 20;
+    static bool ParseMetaData( const vector< char > &vData, PFAData::MetaData &data );
+    static int ReplayJournal( const char *pcData, int iSize, PFAData::MetaData &data ); // Returns how much of it was good
+    bool CompactMetaData( const string &sPath );
+    void StartCompaction( const string &sPath );
+    bool CompactLogged( const string &sPath, long long llLogged );
+    void JournalAdded();
+    void AppendRecord( JournalRecord eType, int iPos, const google::protobuf::MessageLite &msg );
+    static unsigned JournalChecksum( const int aHeader[JournalHeaderSize], const string &sRecord );
+
+    static const int FolderSnapshotVersion = 2;
+    void LoadSnapshots( const string &sPath );
+    bool SaveSnapshots( const string &sPath );
+
+    int ExpandSource( const wstring &sSource, Source eSource, bool bVerify = false );
+    void FindFiles( const wstring &sPath, Source eSource, bool bVerify, vector< ScannedFile > &vFound );
+    FolderSnapshot *CheckSnapshot( const wstring &sPath, bool bSubdirs, bool bVerify, vector< ScannedFile > &vFound,
+                                   map< string, long long > &mWritten );
+    void ScanFiles( vector< ScannedFile > &vFound ) const;
+    static void ScanFile( ScannedFile &file );
+    PFAData::File* AddFile( const string &sFilename, int iSize, const PFAData::SongInfo &songInfo );
+
+    // The analyzer. Only works on copies of what it needs, so the library can change under it. Results are checked
+    // against the MD5 before they go in. It rests a multiple of the time each song took so it never hogs a core
+    struct AnalysisJob
+    {
+        AnalysisJob( const wstring &wsPath, const string &sMd5, int iInfoPos ) : wsPath( wsPath ), sMd5( sMd5 ), iInfoPos( iInfoPos ) { }
+
+        wstring wsPath;
+        string sMd5;
+        int iInfoPos;
+        MIDI::MIDIStats mStats;
+    };
+    static const int AnalysisRestRatio = 4;
+    void AnalyzeSongs();
+
+    thread m_AnalysisThread;
+    mutex m_AnalysisMutex;
+    condition_variable m_cvAnalysis;
+    deque< AnalysisJob > m_qAnalysis;
+    vector< AnalysisJob > m_vAnalyzed; // Waiting for ApplyStats
+    int m_iAnalyzing; // Info being worked on. -1 if none
+    bool m_bStopAnalysis;
+    function< void() > m_fnStatsReady;
+    ThumbnailCache m_Thumbnails;
 
     bool m_bAlwaysAdd;
     int m_iSortCol;
@@ -224,12 +331,23 @@ private:
     map< wstring, Source > m_mSources;
     map< wstring, vector< PFAData::File* >* > m_mFiles;
 
-    // Info maps
-    map< pair< string, int >, PFAData::File* > m_mMD5s;
-    map< string, int > m_mFileInfos;
+    // Info indices. Keyed by ( filename, size ) and MD5, checked against the entries in m_Data
+    PFAData::File *FindFile( const string &sFilename, int iSize ) const;
+    int FindFileInfo( const string &sMd5 ) const; // -1 if it's not there
+    void IndexFile( PFAData::File *file );
+    void IndexFileInfo( int iPos );
+    HashIndex< PFAData::File* > m_FileIndex;
+    HashIndex< int > m_FileInfoIndex;
+    map< wstring, FolderSnapshot > m_mSnapshots;
 
     // DB
     PFAData::MetaData m_Data;
+    ofstream m_ofsJournal;
+    int m_iJournaledFiles, m_iJournaledInfos; // Entries below these are in MetaData.pb or the log
+    long long m_llBaseSize, m_llJournalSize;
+    bool m_bBadMetaData; // MetaData.pb didn't parse. Nothing on disk gets written over this run
+    mutex m_JournalMutex; // The game thread logs label and score changes
+    JobGroup m_Compaction;
 };
 
 class Config : public ISettings
@@ -417,6 +417,10 @@ INT_PTR WINAPI VideoProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
             CheckDlgButton( hWnd, IDC_DISPLAYFPS, cVideo.bShowFPS ? BST_CHECKED : BST_UNCHECKED );
             CheckDlgButton( hWnd, IDC_LIMITFPS, cVideo.bLimitFPS ? BST_CHECKED : BST_UNCHECKED );
 
+            TCHAR buf[32];
+            _stprintf_s( buf, TEXT( "%d" ), cVideo.iMaxFPS );
+            SetWindowText( GetDlgItem( hWnd, IDC_MAXFPS ), buf );
+
             return TRUE;
         }
         case WM_COMMAND:
@@ -441,6 +445,20 @@ INT_PTR WINAPI VideoProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                     cVideo.bShowFPS = ( IsDlgButtonChecked( hWnd, IDC_DISPLAYFPS ) == BST_CHECKED );
                     cVideo.bLimitFPS = ( IsDlgButtonChecked( hWnd, IDC_LIMITFPS ) == BST_CHECKED );
 
+                    TCHAR buf[32];
+                    int iEditVal = 0;
+                    HWND hWndMaxFPS = GetDlgItem( hWnd, IDC_MAXFPS );
+                    int len = GetWindowText( hWndMaxFPS, buf, 32 );
+                    if ( len > 0 && _stscanf_s( buf, TEXT( "%d" ), &iEditVal ) == 1 && iEditVal >= 0 )
+                        cVideo.iMaxFPS = iEditVal;
+                    else
+                    {
+                        MessageBox( hWnd, TEXT( "Please specify a frame rate, or 0 for no limit" ), TEXT( "Error" ), MB_OK | MB_ICONEXCLAMATION );
+                        PostMessage( hWnd, WM_NEXTDLGCTL, ( WPARAM )hWndMaxFPS, TRUE);
+                        SetWindowLongPtr( hWnd, DWLP_MSGRESULT, PSNRET_INVALID );
+                        return TRUE;
+                    }
+
                     config.SetVideoSettings( cVideo );
                     SetWindowLongPtr( hWnd, DWLP_MSGRESULT, PSNRET_NOERROR );
                     return TRUE;
@@ -9,6 +9,7 @@
 *
 *************************************************************************************************/
 #include <tchar.h>
+#include <climits>
 
 #include "Globals.h"
 #include "GameState.h"
@@ -53,6 +54,99 @@ GameState::GameError GameState::ChangeState( GameState *pNextState, GameState **
     return Success;
 }
 
+//-----------------------------------------------------------------------------
+// RenderThread
+//-----------------------------------------------------------------------------
+
+RenderThread::RenderThread() : m_pRenderer( NULL ), m_hrInit( S_OK ), m_pState( NULL ),
+                               m_iFrame( 0 ), m_iDrawn( 0 ), m_bStarted( false ), m_bQuit( false )
+{
+}
+
+RenderThread::~RenderThread()
+{
+    Stop();
+}
+
+HRESULT RenderThread::Start( HWND hWnd, bool bLimitFPS )
+{
+    m_Thread = thread( &RenderThread::Run, this, hWnd, bLimitFPS );
+
+    unique_lock< mutex > lock( m_FrameMutex );
+    m_cvDrawn.wait( lock, [this]() { return m_bStarted; } );
+    return m_hrInit;
+}
+
+void RenderThread::Stop()
+{
+    if ( !m_Thread.joinable() ) return;
+    {
+        lock_guard< mutex > lock( m_FrameMutex );
+        m_bQuit = true;
+    }
+    m_cvFrame.notify_one();
+    m_Thread.join();
+}
+
+GameState::GameError RenderThread::ChangeState( GameState *pNextState, GameState **pDestObj )
+{
+    if ( !pNextState ) return GameState::Success;
+
+    lock_guard< mutex > lock( m_StateMutex );
+    GameState::GameError ge = GameState::ChangeState( pNextState, pDestObj );
+    m_pState = *pDestObj;
+    return ge;
+}
+
+void RenderThread::FrameDone( bool bWait )
+{
+    unique_lock< mutex > lock( m_FrameMutex );
+    int iFrame = ++m_iFrame;
+    m_cvFrame.notify_one();
+    if ( bWait )
+        m_cvDrawn.wait( lock, [&]() { return m_iDrawn - iFrame >= 0 || m_bQuit; } );
+}
+
+// Direct3D gets made, used and let go of all on this thread
+void RenderThread::Run( HWND hWnd, bool bLimitFPS )
+{
+    Renderer *pRenderer = new D3D9Renderer();
+    HRESULT hr = pRenderer->Init( hWnd, bLimitFPS );
+    {
+        lock_guard< mutex > lock( m_FrameMutex );
+        m_pRenderer = ( SUCCEEDED( hr ) ? pRenderer : NULL );
+        m_hrInit = hr;
+        m_bStarted = true;
+    }
+    m_cvDrawn.notify_all();
+
+    // Draws the latest frame, however many the game thread's done since the last one. Errors go to the
+    // main window like the game thread's, once each till a frame draws again so a lost device isn't a flood
+    GameState::GameError geLast = GameState::Success;
+    unique_lock< mutex > lock( m_FrameMutex );
+    while ( SUCCEEDED( hr ) )
+    {
+        m_cvFrame.wait( lock, [this]() { return m_bQuit || m_iFrame != m_iDrawn; } );
+        if ( m_bQuit ) break;
+        int iFrame = m_iFrame;
+        lock.unlock();
+        {
+            lock_guard< mutex > lockState( m_StateMutex );
+            GameState::GameError ge = ( m_pState ? m_pState->Render() : GameState::Success );
+            if ( ge != GameState::Success && ge != geLast )
+                PostMessage( g_hWnd, WM_COMMAND, ID_GAMEERROR, ge );
+            geLast = ge;
+        }
+        lock.lock();
+        m_iDrawn = iFrame;
+        m_cvDrawn.notify_all();
+    }
+    m_pRenderer = NULL;
+    lock.unlock();
+
+    delete pRenderer;
+}
+
 //-----------------------------------------------------------------------------
 // IntroScreen GameState object
 //-----------------------------------------------------------------------------
@@ -70,7 +164,7 @@ GameState::GameError IntroScreen::MsgProc( HWND hWnd, UINT msg, WPARAM wParam, L
                     m_pNextState = reinterpret_cast< GameState* >( lParam );
                     return Success;
                 case ID_VIEW_RESETDEVICE:
-                    m_pRenderer->ResetDevice();
+                    m_pRenderer->RequestReset();
                     return Success;
             }
         }
@@ -121,8 +215,6 @@ SplashScreen::SplashScreen( HWND hWnd, Renderer *pRenderer ) : GameState( hWnd,
     // Parse MIDI
     m_MIDI.ParseMIDI( pData, iSize );
     vector< MIDIEvent* > vEvents;
-    vEvents.reserve( m_MIDI.GetInfo().iEventCount );
-    m_MIDI.ConnectNotes(); // Order's important here
     m_MIDI.PostProcess( &vEvents );
 
     // Allocate
@@ -162,6 +254,7 @@ void SplashScreen::InitState()
     if ( cAudio.iOutDevice >= 0 )
         m_OutDevice.Open( cAudio.iOutDevice );
     m_OutDevice.SetVolume( 1.0 );
+    m_OutStream.SetBackend( &m_OutDevice );
 }
 
 GameState::GameError SplashScreen::Init()
@@ -220,7 +313,7 @@ GameState::GameError SplashScreen::MsgProc( HWND hWnd, UINT msg, WPARAM wParam,
                     m_pNextState = reinterpret_cast< GameState* >( lParam );
                     return Success;
                 case ID_VIEW_RESETDEVICE:
-                    m_pRenderer->ResetDevice();
+                    m_pRenderer->RequestReset();
                     return Success;
             }
         }
@@ -268,12 +361,11 @@ GameState::GameError SplashScreen::Logic()
 
     // Time stuff
     long long llMaxTime = m_MIDI.GetInfo().llTotalMicroSecs + 500000;
-    long long llElapsed = m_Timer.GetMicroSecs();
-    m_Timer.Start();
+    long long llElapsed = m_Timer.Lap();
 
     // If we just paused, kill the music. SetVolume is better than AllNotesOff
     if ( ( bPausedChanged || bMuteChanged ) && ( m_bPaused || m_bMute ) )
-        m_OutDevice.AllNotesOff();
+        m_OutStream.QueueAllNotesOff( m_llStartTime );
 
     // Figure out start and end times for display
     long long llOldStartTime = m_llStartTime;
@@ -296,13 +388,14 @@ GameState::GameError SplashScreen::Logic()
     {
         MIDIChannelEvent *pEvent = m_vEvents[m_iStartPos];
         if ( pEvent->GetChannelEventType() != MIDIChannelEvent::NoteOn )
-            m_OutDevice.PlayEvent( pEvent->GetEventCode(), pEvent->GetParam1(), pEvent->GetParam2() );
+            m_OutStream.Queue( pEvent->GetAbsMicroSec(), pEvent->GetEventCode(), pEvent->GetParam1(), pEvent->GetParam2() );
         else if ( !m_bMute && !m_vTrackSettings[pEvent->GetTrack()].aChannels[pEvent->GetChannel()].bMuted )
-            m_OutDevice.PlayEvent( pEvent->GetEventCode(), pEvent->GetParam1(),
-                                    static_cast< int >( pEvent->GetParam2() * dVolumeCorrect + 0.5 ) );
+            m_OutStream.Queue( pEvent->GetAbsMicroSec(), pEvent->GetEventCode(), pEvent->GetParam1(),
+                               static_cast< int >( pEvent->GetParam2() * dVolumeCorrect + 0.5 ) );
         UpdateState( m_iStartPos );
         m_iStartPos++;
     }
+    m_OutStream.Flush();
 
     return Success;
 }
@@ -499,62 +592,273 @@ float SplashScreen::GetNoteX( int iNote )
 // MainScreen GameState object
 //-----------------------------------------------------------------------------
 
-MainScreen::MainScreen( wstring sMIDIFile, State eGameMode, HWND hWnd, Renderer *pRenderer ) :
-    GameState( hWnd, pRenderer ), m_MIDI( sMIDIFile ), m_eGameMode( eGameMode ), m_cbLastNotes( 500 )
-{
-    // Finish off midi processing
-    if ( !m_MIDI.IsValid() ) return;
-    vector< MIDIEvent* > vEvents;
-    vEvents.reserve( m_MIDI.GetInfo().iEventCount );
-    m_MIDI.ConnectNotes(); // Order's important here
-    m_MIDI.PostProcess( &vEvents );
+// May run on a loader thread. Stays away from the song library and anything else shared
+MainScreen::MainScreen( wstring sMIDIFile, State eGameMode, HWND hWnd, Renderer *pRenderer, LoadProgress *pProgress, bool bStream ) :
+    GameState( hWnd, pRenderer ), m_MIDI( sMIDIFile, pProgress, bStream ), m_eGameMode( eGameMode ), m_cbLastNotes( 500 ), m_pFileInfo( NULL ), m_iFileInfoPos( -1 ),
+    m_llLoadMicroSecs( 0 ), m_bStopStream( false ), m_iChannelsSet( -1 ), m_iLibraryVersion( 0 ), m_iFrameLibraryVersion( -1 )
+{
+    // Finish off midi processing. Timing and indexing happen in one pass over the merged tracks.
+    // When streaming, only the start of the song is merged now
+    m_bStreaming = m_MIDI.IsStreaming();
+    m_llStreamTime = m_llStreamShared = m_llStreamLength = 0;
+    m_dStreamFraction = 0.0;
+    m_bStreamDone = false;
+    if ( m_bStreaming )
+        InitStream( pProgress );
+    else if ( m_MIDI.IsValid() )
+        InitNoteMap(); // Longish
+    m_MIDI.SetProgress( NULL );
+    if ( !m_MIDI.IsValid() || ( pProgress && pProgress->IsCanceled() ) ) return;
 
     // Allocate
     m_vTrackSettings.resize( m_MIDI.GetInfo().iNumTracks );
     m_vState.reserve( 128 );
 
     // Initialize
-    InitNoteMap( vEvents ); // Longish
     InitColors();
     InitLabels();
     InitState();
     InitLearning();
 }
 
-void MainScreen::InitNoteMap( const vector< MIDIEvent* > &vEvents )
+// Freeing a big song takes a while. The song data goes to the background so the next state starts right away
+MainScreen::~MainScreen()
+{
+    StopStream();
+
+    struct SongData
+    {
+        MIDI midi;
+        vector< MIDIChannelEvent* > vEvents;
+        vector< MIDIMetaEvent* > vMetaEvents;
+        eventvec_t vNoteOns, vNonNotes, vProgramChange;
+    };
+
+    SongData *pSongData = new SongData();
+    pSongData->midi.swap( m_MIDI );
+    pSongData->vEvents.swap( m_vEvents );
+    pSongData->vMetaEvents.swap( m_vMetaEvents );
+    pSongData->vNoteOns.swap( m_vNoteOns );
+    pSongData->vNonNotes.swap( m_vNonNotes );
+    pSongData->vProgramChange.swap( m_vProgramChange );
+    Disposer::GetDisposer().Delete( pSongData );
+}
+
+// Everything is sized up front from the counts gathered while parsing
+void MainScreen::InitNoteMap()
+{
+    const MIDI::MIDIInfo &mInfo = m_MIDI.GetInfo();
+    m_vEvents.reserve( mInfo.iChannelEventCount );
+    m_vNoteOns.reserve( mInfo.iPairedNoteCount );
+    m_vNonNotes.reserve( mInfo.iChannelEventCount - mInfo.iPairedNoteCount );
+    m_vProgramChange.reserve( mInfo.iControllerCount );
+    m_vMetaEvents.reserve( mInfo.iMetaEventCount );
+    m_vTempo.reserve( mInfo.iTempoCount );
+    m_vSignature.reserve( mInfo.iSignatureCount );
+
+    m_MIDI.PostProcess( this );
+
+    static const AudioSettings &cAudio = Config::GetConfig().GetAudioSettings();
+    if ( cAudio.bOptimizeEvents )
+        OptimizeEvents();
+}
+
+// Takes out redundant channel events. Only whole songs, so streamed loads don't get it
+void MainScreen::OptimizeEvents()
+{
+    static const AudioSettings &cAudio = Config::GetConfig().GetAudioSettings();
+    MIDI::OptimizeEvents( m_vEvents, cAudio.iThinMilliSecs * 1000LL, m_OptimizeStats, &m_vSourcePos );
+
+    // Positions have moved
+    m_vNoteOns.clear();
+    m_vNonNotes.clear();
+    m_vProgramChange.clear();
+    for ( int i = 0; i < static_cast< int >( m_vEvents.size() ); i++ )
+        IndexEvent( i );
+}
+
+// Labels are stored by position in the unoptimized song, so they stay put whatever the optimize settings
+int MainScreen::GetSourcePos( int iEvent ) const
+{
+    return m_vSourcePos.empty() ? iEvent : m_vSourcePos[iEvent];
+}
+
+// The event at a position in the unoptimized song, or -1 if it's not there or was taken out
+int MainScreen::FindSourcePos( int iSourcePos ) const
+{
+    if ( m_vSourcePos.empty() )
+        return iSourcePos >= 0 && iSourcePos < static_cast< int >( m_vEvents.size() ) ? iSourcePos : -1;
+    vector< int >::const_iterator it = lower_bound( m_vSourcePos.begin(), m_vSourcePos.end(), iSourcePos );
+    return it != m_vSourcePos.end() && *it == iSourcePos ? static_cast< int >( it - m_vSourcePos.begin() ) : -1;
+}
+
+// Called by PostProcess for each event, in order
+void MainScreen::AddEvent( MIDIEvent *pMIDIEvent )
 {
     //Get only the channel events
-    m_vEvents.reserve( vEvents.size() );
-    m_vNoteOns.reserve( vEvents.size() / 2 );
-    for ( vector< MIDIEvent* >::const_iterator it = vEvents.begin(); it != vEvents.end(); ++it )
-        if ( (*it)->GetEventType() == MIDIEvent::ChannelEvent )
-        {
-            MIDIChannelEvent *pEvent = reinterpret_cast< MIDIChannelEvent* >( *it );
-            m_vEvents.push_back( pEvent );
+    if ( pMIDIEvent->GetEventType() == MIDIEvent::ChannelEvent )
+    {
+        MIDIChannelEvent *pEvent = reinterpret_cast< MIDIChannelEvent* >( pMIDIEvent );
+        m_vEvents.push_back( pEvent );
+        IndexEvent( static_cast< int >( m_vEvents.size() ) - 1 );
+    }
+    // Have to keep track of tempo and signature for the measure lines
+    else if ( pMIDIEvent->GetEventType() == MIDIEvent::MetaEvent )
+    {
+        MIDIMetaEvent *pEvent = reinterpret_cast< MIDIMetaEvent* >( pMIDIEvent );
+        m_vMetaEvents.push_back( pEvent );
 
-            // Makes random access to the song faster, but unsure if it's worth it
-            MIDIChannelEvent::ChannelEventType eEventType = pEvent->GetChannelEventType();
-            if ( eEventType == MIDIChannelEvent::NoteOn && pEvent->GetParam2() > 0 && pEvent->GetSister() )
-                m_vNoteOns.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vEvents.size() - 1 ) );
-            else
-            {
-                m_vNonNotes.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vEvents.size() - 1 ) );
-                if ( eEventType == MIDIChannelEvent::ProgramChange || eEventType == MIDIChannelEvent::Controller )
-                   m_vProgramChange.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vEvents.size() - 1 ) );
-            }
+        MIDIMetaEvent::MetaEventType eEventType = pEvent->GetMetaEventType();
+        if ( eEventType == MIDIMetaEvent::SetTempo )
+            m_vTempo.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vMetaEvents.size() - 1 ) );
+        else if ( eEventType == MIDIMetaEvent::TimeSignature )
+            m_vSignature.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vMetaEvents.size() - 1 ) );
+    }
+}
+
+// Makes random access to the song faster, but unsure if it's worth it
+void MainScreen::IndexEvent( int iPos )
+{
+    MIDIChannelEvent *pEvent = m_vEvents[iPos];
+    MIDIChannelEvent::ChannelEventType eEventType = pEvent->GetChannelEventType();
+    if ( eEventType == MIDIChannelEvent::NoteOn && pEvent->GetParam2() > 0 && ( pEvent->GetSister() || m_bStreaming ) )
+        m_vNoteOns.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+    else
+    {
+        m_vNonNotes.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+        if ( eEventType == MIDIChannelEvent::ProgramChange || eEventType == MIDIChannelEvent::Controller )
+           m_vProgramChange.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), iPos ) );
+    }
+}
+
+// Merges the first few seconds of the song. The rest streams in once playback starts
+void MainScreen::InitStream( LoadProgress *pProgress )
+{
+    if ( pProgress )
+    {
+        pProgress->SetPhase( LoadProgress::Parsing );
+        pProgress->llTotalBytes = 1000;
+    }
+
+    MIDIEventVector sink( m_vStreamBatch );
+    long long llPrimeEnd = LLONG_MAX;
+    bool bMore = true;
+    while ( bMore && m_MIDI.GetStreamTime() <= llPrimeEnd )
+    {
+        bMore = m_MIDI.StreamEvents( LoadProgress::CheckInterval, llPrimeEnd, &sink );
+        for ( vector< MIDIEvent* >::const_iterator it = m_vStreamBatch.begin(); it != m_vStreamBatch.end(); ++it )
+            AddStreamedEvent( *it );
+        m_vStreamBatch.clear();
+
+        if ( m_MIDI.GetInfo().iNoteCount > 0 )
+            llPrimeEnd = m_MIDI.GetInfo().llFirstNote + StreamPrimeTime;
+        if ( pProgress )
+        {
+            pProgress->llBytesParsed = static_cast< long long >( 1000 * m_MIDI.GetStreamFraction() );
+            if ( pProgress->IsCanceled() ) return;
         }
-        // Have to keep track of tempo and signature for the measure lines
-        else if ( (*it)->GetEventType() == MIDIEvent::MetaEvent )
+    }
+
+    m_llStreamTime = m_MIDI.GetStreamTime();
+    m_dStreamFraction = m_MIDI.GetStreamFraction();
+    m_llStreamLength = static_cast< long long >( m_llStreamTime / max( m_dStreamFraction, 0.001 ) );
+    if ( !bMore ) FinishStream(); // Short song. It all made it in
+}
+
+// Runs on its own thread. Merges as fast as it can and hands the events over a chunk at a time
+void MainScreen::StreamProc()
+{
+    vector< MIDIEvent* > vEvents;
+    MIDIEventVector sink( vEvents );
+    bool bMore = true;
+    while ( bMore && !m_bStopStream )
+    {
+        bMore = m_MIDI.StreamEvents( LoadProgress::CheckInterval, LLONG_MAX, &sink );
+        long long llTime = m_MIDI.GetStreamTime();
+        double dFraction = m_MIDI.GetStreamFraction();
+
+        lock_guard< mutex > lock( m_StreamMutex );
+        m_vStreamEvents.insert( m_vStreamEvents.end(), vEvents.begin(), vEvents.end() );
+        m_llStreamShared = llTime;
+        m_dStreamFraction = dFraction;
+        m_bStreamDone = !bMore;
+        vEvents.clear();
+    }
+}
+
+// Picks up whatever the stream thread merged since last frame
+void MainScreen::PollStream()
+{
+    bool bDone;
+    double dFraction;
+    {
+        lock_guard< mutex > lock( m_StreamMutex );
+        m_vStreamBatch.swap( m_vStreamEvents );
+        m_llStreamTime = m_llStreamShared;
+        dFraction = m_dStreamFraction;
+        bDone = m_bStreamDone;
+    }
+
+    // Adding can move the index vectors around. Hang on to the iterators as offsets
+    size_t iNextProgramChange = m_itNextProgramChange - m_vProgramChange.begin();
+    size_t iNextTempo = m_itNextTempo - m_vTempo.begin();
+    size_t iNextSignature = m_itNextSignature - m_vSignature.begin();
+    for ( vector< MIDIEvent* >::const_iterator it = m_vStreamBatch.begin(); it != m_vStreamBatch.end(); ++it )
+        AddStreamedEvent( *it );
+    m_vStreamBatch.clear();
+    m_itNextProgramChange = m_vProgramChange.begin() + iNextProgramChange;
+    m_itNextTempo = m_vTempo.begin() + iNextTempo;
+    m_itNextSignature = m_vSignature.begin() + iNextSignature;
+
+    if ( bDone )
+        FinishStream();
+    else
+        m_llStreamLength = max( m_llStreamLength, static_cast< long long >( m_llStreamTime / max( dFraction, 0.001 ) ) );
+}
+
+// Same as what PostProcess does for a regular load, plus settings for channels we haven't seen yet
+void MainScreen::AddStreamedEvent( MIDIEvent *pEvent )
+{
+    m_MIDI.AddStreamedEvent( pEvent );
+    if ( m_iChannelsSet >= 0 && pEvent->GetEventType() == MIDIEvent::ChannelEvent )
+    {
+        MIDIChannelEvent *pChannelEvent = reinterpret_cast< MIDIChannelEvent* >( pEvent );
+        int iTrack = pChannelEvent->GetTrack();
+        int iChannel = pChannelEvent->GetChannel();
+        if ( pChannelEvent->GetChannelEventType() == MIDIChannelEvent::NoteOn && pChannelEvent->GetParam2() > 0 &&
+             m_MIDI.GetTracks()[iTrack]->GetInfo().aNoteCount[iChannel] == 1 )
+            SetChannelSettings( iTrack, iChannel, m_iChannelsSet++ );
+    }
+    AddEvent( pEvent );
+}
+
+// The whole song's in. From here on it's the same as a regular load
+void MainScreen::FinishStream()
+{
+    if ( m_StreamThread.joinable() )
+        m_StreamThread.join();
+    m_MIDI.FinishStream();
+    m_bStreaming = false;
+
+    // Notes that never got a note off don't get drawn in a regular load either
+    for ( vector< int >::iterator it = m_vState.begin(); it != m_vState.end(); )
+    {
+        if ( m_vEvents[*it]->GetSister() )
         {
-            MIDIMetaEvent *pEvent = reinterpret_cast< MIDIMetaEvent* >( *it );
-            m_vMetaEvents.push_back( pEvent );
-
-            MIDIMetaEvent::MetaEventType eEventType = pEvent->GetMetaEventType();
-            if ( eEventType == MIDIMetaEvent::SetTempo )
-                m_vTempo.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vMetaEvents.size() - 1 ) );
-            else if ( eEventType == MIDIMetaEvent::TimeSignature )
-                m_vSignature.push_back( pair< long long, int >( pEvent->GetAbsMicroSec(), m_vMetaEvents.size() - 1 ) );
+            ++it;
+            continue;
         }
+        int iNote = m_vEvents[*it]->GetParam1();
+        if ( m_pNoteState[iNote] == *it ) m_pNoteState[iNote] = -1;
+        it = m_vState.erase( it );
+    }
+}
+
+void MainScreen::StopStream()
+{
+    m_bStopStream = true;
+    if ( m_StreamThread.joinable() )
+        m_StreamThread.join();
 }
 
 // Display colors
@@ -571,46 +875,56 @@ void MainScreen::InitColors()
 void MainScreen::InitLabels()
 {
     // Scoring notifications
-    vector< TextPath::TextPathVertex > vPath;
-    TextPath::TextPathVertex v1 = { 0.0f, -23.0f, 0.0f, 0xFF }; vPath.push_back( v1 );
-    TextPath::TextPathVertex v2 = { 0.0f, -26.0f, 0.05f, 0xFF }; vPath.push_back( v2 );
-    TextPath::TextPathVertex v3 = { 0.0f, -23.0f, 0.1f, 0xFF }; vPath.push_back( v3 );
-    TextPath::TextPathVertex v4 = { 0.0f, -23.0f, 0.4f, 0xFF }; vPath.push_back( v4 );
-    TextPath::TextPathVertex v5 = { 0.0f, 0.0f, 0.5f, 0xFF }; vPath.push_back( v5 );
+    TextPath::TextPathVertex v1 = { 0.0f, -23.0f, 0.0f, 0xFF }; m_vParticlePath.push_back( v1 );
+    TextPath::TextPathVertex v2 = { 0.0f, -26.0f, 0.05f, 0xFF }; m_vParticlePath.push_back( v2 );
+    TextPath::TextPathVertex v3 = { 0.0f, -23.0f, 0.1f, 0xFF }; m_vParticlePath.push_back( v3 );
+    TextPath::TextPathVertex v4 = { 0.0f, -23.0f, 0.4f, 0xFF }; m_vParticlePath.push_back( v4 );
+    TextPath::TextPathVertex v5 = { 0.0f, 0.0f, 0.5f, 0xFF }; m_vParticlePath.push_back( v5 );
     for ( int i = 0; i < 128; i++ )
     {
-        m_tpParticles[i].SetPath( vPath );
+        m_tpParticles[i].SetPath( &m_vParticlePath );
         m_tpParticles[i].SetFont( Renderer::SmallComic );
         m_tpParticles[i].Reset( 0.0f, 0.0f, 0, NULL );
         m_tpParticles[i].Kill();
     }
 
     // Generic message
-    vPath.clear();
-    TextPath::TextPathVertex v6 = { 0.0f, 0.0f, 0.0f, 0xFF }; vPath.push_back( v6 );
-    TextPath::TextPathVertex v7 = { 0.0f, 0.0f, 1.0f, 0xFF }; vPath.push_back( v7 );
-    TextPath::TextPathVertex v8 = { 0.0f, 0.0f, 1.1f, 0x00 }; vPath.push_back( v8 );
-    m_tpMessage.SetPath( vPath );
+    TextPath::TextPathVertex v6 = { 0.0f, 0.0f, 0.0f, 0xFF }; m_vMessagePath.push_back( v6 );
+    TextPath::TextPathVertex v7 = { 0.0f, 0.0f, 1.0f, 0xFF }; m_vMessagePath.push_back( v7 );
+    TextPath::TextPathVertex v8 = { 0.0f, 0.0f, 1.1f, 0x00 }; m_vMessagePath.push_back( v8 );
+    m_tpMessage.SetPath( &m_vMessagePath );
     m_tpMessage.SetFont( Renderer::Large );
     m_tpMessage.Kill();
 
-    vPath.clear();
-    TextPath::TextPathVertex v9 = { 0.0f, 0.0f, 0.0f, 0xFF }; vPath.push_back( v9 );
-    TextPath::TextPathVertex v10 = { 0.0f, 0.0f, TransitionTime * 1.5f / 1000000.0f, 0xFF }; vPath.push_back( v10 );
-    TextPath::TextPathVertex v11 = { 0.0f, 0.0f, TransitionTime * 1.5f / 1000000.0f + 0.1f, 0x00 }; vPath.push_back( v11 );
-    m_tpLongMessage.SetPath( vPath );
+    TextPath::TextPathVertex v9 = { 0.0f, 0.0f, 0.0f, 0xFF }; m_vLongMessagePath.push_back( v9 );
+    TextPath::TextPathVertex v10 = { 0.0f, 0.0f, TransitionTime * 1.5f / 1000000.0f, 0xFF }; m_vLongMessagePath.push_back( v10 );
+    TextPath::TextPathVertex v11 = { 0.0f, 0.0f, TransitionTime * 1.5f / 1000000.0f + 0.1f, 0x00 }; m_vLongMessagePath.push_back( v11 );
+    m_tpLongMessage.SetPath( &m_vLongMessagePath );
     m_tpLongMessage.SetFont( Renderer::Large );
     m_tpLongMessage.Kill();
+}
 
-    // Note labels
+// Note labels and top 10. The library belongs to the UI thread so this isn't done in the constructor
+void MainScreen::InitLibrary()
+{
     static Config &config = Config::GetConfig();
     static SongLibrary &cLibrary = config.GetSongLibrary();
 
-    m_pFileInfo = cLibrary.GetInfo( cLibrary.AddFile( m_MIDI.GetInfo().sFilename, &m_MIDI )->infopos() );
+    // Streamed songs stay out of the library. Adding one means parsing and hashing the whole file
+    if ( m_bStreaming ) return;
+
+    m_iFileInfoPos = cLibrary.AddFile( m_MIDI.GetInfo().sFilename, &m_MIDI )->infopos();
+    m_pFileInfo = cLibrary.GetInfo( m_iFileInfoPos );
     if ( !m_pFileInfo ) return;
 
+    // A label on an event that was optimized out is kept, but not shown
     for ( int i = 0; i < m_pFileInfo->label_size(); i++ )
-        m_vEvents[ m_pFileInfo->label( i ).pos() ]->SetLabelPtr( m_pFileInfo->mutable_label( i )->mutable_label() );
+    {
+        int iPos = FindSourcePos( m_pFileInfo->label( i ).pos() );
+        if ( iPos >= 0 )
+            m_vEvents[iPos]->SetLabelPtr( m_pFileInfo->mutable_label( i )->mutable_label() );
+    }
+    m_iLibraryVersion++;
 }
 
 // Init state vars. Only those which validate the date.
@@ -630,11 +944,12 @@ void MainScreen::InitState()
     m_bTrackPos = m_bTrackZoom = false;
     m_fTempZoomX = 1.0f;
     m_fTempOffsetX = m_fTempOffsetY = 0.0f;
-    m_dFPS = 0.0;
-    m_iFPSCount = 0;
-    m_llFPSTime = 0;
+    m_dFPS = m_dTickRate = 0.0;
+    m_iFPSCount = m_iTickCount = 0;
+    m_llFPSTime = m_llTickTime = 0;
+    m_dJitter = 0.0;
     m_dSpeed = -1.0; // Forces a speed reset upon first call to Logic
-    m_iNextHotNote = m_iSelectedNote = -1;
+    m_iHotNote = m_iNextHotNote = m_iRenderHotNote = m_iSelectedNote = -1;
     m_bHaveMouse = false;
     m_iShowTop10 = -1;
     m_bScored = false;
@@ -692,7 +1007,17 @@ GameState::GameError MainScreen::Init()
         return NoInputDevice;
 
     m_OutDevice.SetVolume( 1.0 );
+    m_OutStream.SetBackend( &m_OutDevice );
+    m_Governor.SetLimits( cAudio.iMaxVoices, cAudio.iMaxChannelVoices );
+    m_OutStream.SetGovernor( &m_Governor );
     NextTrack(); // Called here so settings don't get overwritten
+
+    // Playback's about to start. Stream in the rest of the song
+    if ( m_bStreaming && !m_StreamThread.joinable() )
+    {
+        m_StreamThread = thread( &MainScreen::StreamProc, this );
+        SetThreadPriority( m_StreamThread.native_handle(), THREAD_PRIORITY_BELOW_NORMAL );
+    }
     return Success;
 }
 
@@ -748,15 +1073,16 @@ ChannelSettings* MainScreen::GetChannelSettings( int iTrack )
     return NULL;
 }
 
+// The settings are kept around for channels that show up later in a streamed song
 void MainScreen::SetChannelSettings( const vector< bool > &vScored, const vector< bool > &vMuted, const vector< bool > &vHidden, const vector< unsigned > &vColor )
 {
     const MIDI::MIDIInfo &mInfo = m_MIDI.GetInfo();
     const vector< MIDITrack* > &vTracks = m_MIDI.GetTracks();
 
-    bool bScored = vScored.size() > 0;
-    bool bMuted = vMuted.size() > 0;
-    bool bHidden = vHidden.size() > 0;
-    bool bColor = vColor.size() > 0;
+    m_vChannelScored = vScored;
+    m_vChannelMuted = vMuted;
+    m_vChannelHidden = vHidden;
+    m_vChannelColor = vColor;
 
     size_t iPos = 0;
     for ( int i = 0; i < mInfo.iNumTracks; i++ )
@@ -764,17 +1090,21 @@ void MainScreen::SetChannelSettings( const vector< bool > &vScored, const vector
         const MIDITrack::MIDITrackInfo &mTrackInfo = vTracks[i]->GetInfo();
         for ( int j = 0; j < 16; j++ )
             if ( mTrackInfo.aNoteCount[j] > 0 )
-            {
-                ScoreChannel( i, j, bScored ? vScored[min( iPos, vScored.size() - 1 )] : false );
-                MuteChannel( i, j, bMuted ? vMuted[min( iPos, vMuted.size() - 1 )] : false );
-                HideChannel( i, j, bHidden ? vHidden[min( iPos, vHidden.size() - 1 )] : false );
-                if ( bColor && iPos < vColor.size() )
-                    ColorChannel( i, j, vColor[iPos] );
-                else
-                    ColorChannel( i, j, 0, true );
-                iPos++;
-            }
+                SetChannelSettings( i, j, iPos++ );
     }
+    m_iChannelsSet = static_cast< int >( iPos );
+}
+
+void MainScreen::SetChannelSettings( int iTrack, int iChannel, size_t iPos )
+{
+    const vector< bool > &vScored = m_vChannelScored, &vMuted = m_vChannelMuted, &vHidden = m_vChannelHidden;
+    ScoreChannel( iTrack, iChannel, vScored.size() > 0 ? vScored[min( iPos, vScored.size() - 1 )] : false );
+    MuteChannel( iTrack, iChannel, vMuted.size() > 0 ? vMuted[min( iPos, vMuted.size() - 1 )] : false );
+    HideChannel( iTrack, iChannel, vHidden.size() > 0 ? vHidden[min( iPos, vHidden.size() - 1 )] : false );
+    if ( iPos < m_vChannelColor.size() )
+        ColorChannel( iTrack, iChannel, m_vChannelColor[iPos] );
+    else
+        ColorChannel( iTrack, iChannel, 0, true );
 }
 
 GameState::GameError MainScreen::MsgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
@@ -844,20 +1174,22 @@ GameState::GameError MainScreen::MsgProc( HWND hWnd, UINT msg, WPARAM wParam, LP
                     NextTrack();
                     return Success;
                 case ID_VIEW_RESETDEVICE:
-                    m_pRenderer->ResetDevice();
+                    m_pRenderer->RequestReset();
                     return Success;
                 case ID_SETLABEL:
                 {
                     MIDIChannelEvent *pEvent = m_vEvents[lParam];
                     if ( pEvent->GetLabel() )
                         pEvent->SetLabel( cView.GetCurLabel() );
-                    else
+                    else if ( m_pFileInfo )
                     {
                         PFAData::Label *pLabel = m_pFileInfo->add_label();
-                        pLabel->set_pos( (int)lParam );
+                        pLabel->set_pos( GetSourcePos( (int)lParam ) );
                         pLabel->set_label( cView.GetCurLabel() );
                         pEvent->SetLabelPtr( pLabel->mutable_label() );
                     }
+                    m_iLibraryVersion++;
+                    if ( m_pFileInfo ) config.GetSongLibrary().JournalInfo( m_iFileInfoPos, m_pFileInfo );
                     return Success;
                 }
                 case ID_VIEW_MOVEANDZOOM:
@@ -1012,8 +1344,6 @@ GameState::GameError MainScreen::MsgProc( HWND hWnd, UINT msg, WPARAM wParam, LP
             return Success;
         case WM_MOUSEMOVE:
         {
-            if ( !m_bHaveMouse )
-                m_iNextHotNote = -1;
             m_bHaveMouse = true;
 
             if ( !m_bTrackPos && !m_bTrackZoom && !m_bPaused ) return Success;
@@ -1040,7 +1370,7 @@ GameState::GameError MainScreen::MsgProc( HWND hWnd, UINT msg, WPARAM wParam, LP
             return Success;
         }
         case WM_MOUSELEAVE:
-            m_iSelectedNote = m_iNextHotNote = -1;
+            m_iSelectedNote = -1;
             m_bHaveMouse = false;
             return Success;
     }
@@ -1056,6 +1386,7 @@ GameState::GameError MainScreen::Logic( void )
     static const VisualSettings &cVisual = config.GetVisualSettings();
     static const VideoSettings &cVideo = config.GetVideoSettings();
     const MIDI::MIDIInfo &mInfo = m_MIDI.GetInfo();
+    if ( m_bStreaming ) PollStream();
 
     // Detect changes in state
     bool bPaused = cPlayback.GetPaused();
@@ -1096,27 +1427,25 @@ GameState::GameError MainScreen::Logic( void )
     double dVolumeCorrect = ( mInfo.iVolumeSum > 0 ? ( m_dVolume * 127.0 * mInfo.iNoteCount ) / mInfo.iVolumeSum : 1.0 );
     dVolumeCorrect = min( dVolumeCorrect, dMaxCorrect );
 
-    m_iHotNote = m_iNextHotNote;
-    m_iNextHotNote = -1;
+    m_iHotNote = ( m_bHaveMouse ? m_iNextHotNote.load() : -1 );
     if ( !m_bPaused ) m_iSelectedNote = -1;
 
     // Time stuff
     long long llMaxTime = GetMaxTime();
-    long long llElapsed = m_Timer.GetMicroSecs();
-    m_Timer.Start();
+    long long llElapsed = m_Timer.Lap();
 
-    // Compute FPS every half a second
-    m_llFPSTime += llElapsed;
-    m_iFPSCount++;
-    if ( m_llFPSTime >= 500000 )
+    // Compute the tick rate every half a second
+    m_llTickTime += llElapsed;
+    m_iTickCount++;
+    if ( m_llTickTime >= 500000 )
     {
-        m_dFPS = m_iFPSCount / ( m_llFPSTime / 1000000.0 );
-        m_llFPSTime = m_iFPSCount = 0;
+        m_dTickRate = m_iTickCount / ( m_llTickTime / 1000000.0 );
+        m_llTickTime = m_iTickCount = 0;
     }
 
     // If we just paused, kill the music. SetVolume is better than AllNotesOff
     if ( ( bPausedChanged || bMuteChanged ) && ( m_bPaused || m_bMute ) )
-        m_OutDevice.AllNotesOff();
+        m_OutStream.QueueAllNotesOff( m_llStartTime );
 
     // If speed has been changed, rejigger inputpos
     if ( bSpeedChanged && !m_bInTransition )
@@ -1129,10 +1458,12 @@ GameState::GameError MainScreen::Logic( void )
     long long llOldStartTime = m_llStartTime;
     long long llNextStartTime = m_llStartTime + static_cast< long long >( llElapsed * m_dSpeed + 0.5 );
 
-    // Figure out if we need to wait
+    // Figure out if we need to wait. Also have to if playback catches up with streaming
     bool bWait = ( !m_bPaused ? DoWaiting( llNextStartTime, llElapsed ) : false );
+    bWait |= ( m_bStreaming && llNextStartTime + m_llTimeSpan > m_llStreamTime );
 
-    if ( !bWait && !m_bPaused && m_llStartTime < llMaxTime )
+    bool bTimeMoving = ( !bWait && !m_bPaused && m_llStartTime < llMaxTime );
+    if ( bTimeMoving )
         m_llStartTime = llNextStartTime;
     m_iStartTick = GetCurrentTick( m_llStartTime );
     long long llEndTime = m_llStartTime + m_llTimeSpan;
@@ -1173,11 +1504,11 @@ GameState::GameError MainScreen::Logic( void )
         {
             MIDIChannelEvent *pEvent = m_vEvents[m_iStartPos];
             if ( pEvent->GetChannelEventType() != MIDIChannelEvent::NoteOn )
-                m_OutDevice.PlayEvent( pEvent->GetEventCode(), pEvent->GetParam1(), pEvent->GetParam2() );
+                m_OutStream.Queue( pEvent->GetAbsMicroSec(), pEvent->GetEventCode(), pEvent->GetParam1(), pEvent->GetParam2() );
             else if ( !m_bMute && !m_vTrackSettings[pEvent->GetTrack()].aChannels[pEvent->GetChannel()].bMuted &&
                       ( m_eGameMode != Learn || m_iLearnOrdinal >= 0 ) )
-                m_OutDevice.PlayEvent( pEvent->GetEventCode(), pEvent->GetParam1(),
-                                       static_cast< int >( pEvent->GetParam2() * dVolumeCorrect + 0.5 ) );
+                m_OutStream.Queue( pEvent->GetAbsMicroSec(), pEvent->GetEventCode(), pEvent->GetParam1(),
+                                   static_cast< int >( pEvent->GetParam2() * dVolumeCorrect + 0.5 ) );
             UpdateState( m_iStartPos );
             m_iStartPos++;
         }
@@ -1249,7 +1580,7 @@ GameState::GameError MainScreen::Logic( void )
     if ( llOldPos != llNewPos ) cPlayback.SetPosition( static_cast< int >( llNewPos ) );
 
     // Song's over
-    if ( !m_bPaused && m_llStartTime >= llMaxTime && !m_bInTransition )
+    if ( !m_bPaused && m_llStartTime >= llMaxTime && !m_bInTransition && !m_bStreaming )
     {
         if ( m_eGameMode == Learn && m_iLearnOrdinal >= 0 )
         {
@@ -1262,9 +1593,18 @@ GameState::GameError MainScreen::Logic( void )
         {
             cPlayback.SetPaused( true, true );
             if ( m_eGameMode == Play && m_iShowTop10 == -1 )
+            {
                 m_iShowTop10 = m_Score.AddToTop10( m_pFileInfo );
+                m_iLibraryVersion++;
+                config.GetSongLibrary().JournalInfo( m_iFileInfoPos, m_pFileInfo );
+            }
         }
     }
+
+    // Everything this frame played goes out together
+    m_OutStream.Flush();
+
+    PublishFrame( bTimeMoving && !m_bPaused && !m_bInTransition );
     return Success;
 }
 
@@ -1272,14 +1612,15 @@ void MainScreen::UpdateState( int iPos )
 {
     // Event data
     MIDIChannelEvent *pEvent = m_vEvents[iPos];
-    if ( !pEvent->GetSister() ) return;
-
     MIDIChannelEvent::ChannelEventType eEventType = pEvent->GetChannelEventType();
     int iTrack = pEvent->GetTrack();
     int iChannel = pEvent->GetChannel();
     int iNote = pEvent->GetParam1();
     int iVelocity = pEvent->GetParam2();
 
+    // While streaming, a note on might not have its note off yet
+    if ( !pEvent->GetSister() && ( !m_bStreaming || eEventType != MIDIChannelEvent::NoteOn || iVelocity == 0 ) ) return;
+
     // Turn note on
     if ( eEventType == MIDIChannelEvent::NoteOn && iVelocity > 0 )
     {
@@ -1311,13 +1652,14 @@ void TextPath::Logic( long long llElapsed )
     float fElapsed = llElapsed / 1000000.0f;
     m_t += fElapsed;
 
-    int iSize = (int)m_vPath.size();
-    while ( m_iPos < iSize - 1 && m_vPath[m_iPos + 1].t < m_t )
+    const vector< TextPathVertex > &vPath = *m_pPath;
+    int iSize = (int)vPath.size();
+    while ( m_iPos < iSize - 1 && vPath[m_iPos + 1].t < m_t )
         m_iPos++;
     if ( m_iPos >= iSize - 1 ) return;
     
-    const TextPathVertex &curr = m_vPath[m_iPos];
-    const TextPathVertex &next = m_vPath[m_iPos + 1];
+    const TextPathVertex &curr = vPath[m_iPos];
+    const TextPathVertex &next = vPath[m_iPos + 1];
     m_x = curr.x + ( next.x - curr.x ) * ( m_t - curr.t ) / ( next.t - curr.t );
     m_y = curr.y + ( next.y - curr.y ) * ( m_t - curr.t ) / ( next.t - curr.t );
     int a = curr.a + static_cast< int >( ( next.a - curr.a ) * ( m_t - curr.t ) / ( next.t - curr.t ) + 0.5f );
@@ -1342,7 +1684,7 @@ void MainScreen::PlayMetronome( double dVolumeCorrect )
                 ( bIsMeasure && cPlayback.GetMetronome() == PlaybackSettings::EveryMeasure ) ) )
         {
             m_iLastMetronomeNote = ( m_iLastMetronomeNote == HiWoodBlock ? LowWoodBlock : HiWoodBlock );
-            m_OutDevice.PlayEvent( 0x99, m_iLastMetronomeNote, static_cast< int >( mInfo.iVolumeSum * dVolumeCorrect / mInfo.iNoteCount + -.5 ) );
+            m_OutStream.Queue( m_llStartTime, 0x99, m_iLastMetronomeNote, static_cast< int >( mInfo.iVolumeSum * dVolumeCorrect / mInfo.iNoteCount + -.5 ) );
         }
 
         m_iNextBeatTick = GetBeatTick( m_iStartTick + 1, m_iBeatType, m_iLastSignatureTick );
@@ -1444,13 +1786,14 @@ void MainScreen::ProcessInput()
 void MainScreen::JumpTo( long long llStartTime, bool bUpdateGUI, bool bInitLearning )
 {
     // Kill the music!
-    m_OutDevice.AllNotesOff();
+    m_OutStream.QueueAllNotesOff( m_llStartTime );
     m_bInstructions = false;
     if ( bInitLearning ) InitLearning();
 
-    // Start time. Piece of cake!
+    // Start time. Piece of cake! Can't go past what's been streamed in though
     long long llFirstTime = GetMinTime();
     long long llLastTime = GetMaxTime();
+    if ( m_bStreaming ) llStartTime = min( llStartTime, m_llStreamTime - m_llTimeSpan );
     m_llStartTime = min( max( llStartTime, llFirstTime ), llLastTime );
     long long llEndTime = m_llStartTime + m_llTimeSpan;
 
@@ -1480,9 +1823,11 @@ void MainScreen::JumpTo( long long llStartTime, bool bUpdateGUI, bool bInitLearn
         {
             MIDIChannelEvent *pEvent = m_vEvents[ it->second ];
             MIDIChannelEvent *pSister = pEvent->GetSister();
-            if ( pSister->GetAbsMicroSec() > itPrev->first ) // > because itMiddle is the max for its time
+            if ( !pSister && !m_bStreaming ) continue;
+            long long llNoteEnd = ( pSister ? pSister->GetAbsMicroSec() : LLONG_MAX ); // Streaming: still on as far as we know
+            if ( llNoteEnd > itPrev->first ) // > because itMiddle is the max for its time
                 iFound++;
-            if ( pSister->GetAbsMicroSec() > llStartTime ) // > because we don't care about simultaneous ending notes
+            if ( llNoteEnd > llStartTime ) // > because we don't care about simultaneous ending notes
             {
                 m_vState.push_back( it->second );
                 pEvent->SetInputQuality( MIDIChannelEvent::Ignore );
@@ -1577,13 +1922,13 @@ void MainScreen::PlaySkippedEvents( eventvec_t::const_iterator itOldProgramChang
                   !aProgram[pEvent->GetChannel()] )
         {
             aProgram[pEvent->GetChannel()] = true;
-            m_OutDevice.PlayEvent( pEvent->GetEventCode(), pEvent->GetParam1(), pEvent->GetParam2() );
+            m_OutStream.Queue( pEvent->GetAbsMicroSec(), pEvent->GetEventCode(), pEvent->GetParam1(), pEvent->GetParam2() );
         }
     }
 
     // Finally play the controller events. vControl is in reverse time order
     for ( vector< MIDIChannelEvent* >::reverse_iterator it = vControl.rbegin(); it != vControl.rend(); ++it )
-        m_OutDevice.PlayEvent( ( *it )->GetEventCode(), ( *it )->GetParam1(), ( *it )->GetParam2() );
+        m_OutStream.Queue( ( *it )->GetAbsMicroSec(), ( *it )->GetEventCode(), ( *it )->GetParam1(), ( *it )->GetParam2() );
 }
 
 // Advance program change, tempo, and signature
@@ -1908,25 +2253,300 @@ int MainScreen::GetMetTick( int iTick, int iClocksPerMet, int iLastSignatureTick
     return -1;
 }
 
+// Paused with nothing fading out. Mouse and keyboard come in as messages and wake the loop up, but
+// the input device doesn't, so it has to keep being polled
+bool MainScreen::IsIdle() const
+{
+    if ( !m_bPaused || m_bInTransition || m_InDevice.IsOpen() ) return false;
+    if ( m_tpMessage.IsAlive() || m_tpLongMessage.IsAlive() ) return false;
+    for ( int i = 0; i < 128; i++ )
+        if ( m_tpParticles[i].IsAlive() ) return false;
+    return true;
+}
+
 const float MainScreen::SharpRatio = 0.65f;
 const float MainScreen::KBPercent = 0.25f;
 const float MainScreen::KeyRatio = 0.1775f;
 
+// Copies out everything Render needs. Skipped while the render thread hasn't picked up the last one:
+// it carries time forward itself, so a newer copy isn't worth making till it's wanted
+void MainScreen::PublishFrame( bool bTimeMoving )
+{
+    if ( m_Frames.IsPending() ) return;
+    Frame &f = m_Frames.Back();
+
+    // Time
+    f.llFrameTime = Timer::GetNanoSecsNow();
+    f.dSpeed = ( bTimeMoving ? m_dSpeed : 0.0 );
+    f.llStartTime = m_llStartTime;
+    f.llTimeSpan = m_llTimeSpan;
+    f.llTotalMicroSecs = m_MIDI.GetInfo().llTotalMicroSecs;
+    f.llMinTime = m_llMinTime;
+
+    // Layout
+    f.iStartNote = m_iStartNote;
+    f.iEndNote = m_iEndNote;
+    f.iAllWhiteKeys = m_iAllWhiteKeys;
+    f.fNotesX = m_fNotesX;
+    f.fNotesY = m_fNotesY;
+    f.fNotesCX = m_fNotesCX;
+    f.fNotesCY = m_fNotesCY;
+    f.fWhiteCX = m_fWhiteCX;
+    f.bShowKB = m_bShowKB;
+    f.csBackground = m_csBackground;
+
+    // Notes. Same ones RenderNotes used to look at
+    f.vNotes.clear();
+    f.iStateNotes = 0;
+    if ( m_iFrameLibraryVersion != m_iLibraryVersion )
+        BuildFrameLibrary();
+    if ( m_iEndPos >= 0 && m_iStartPos < static_cast< int >( m_vEvents.size() ) )
+    {
+        for ( vector< int >::iterator it = m_vState.begin(); it != m_vState.end(); ++it )
+            AddFrameNote( f, *it );
+        f.iStateNotes = static_cast< int >( f.vNotes.size() );
+
+        for ( int i = m_iStartPos; i <= m_iEndPos; i++ )
+        {
+            MIDIChannelEvent *pEvent = m_vEvents[i];
+            if ( pEvent->GetChannelEventType() == MIDIChannelEvent::NoteOn &&
+                 pEvent->GetParam2() > 0 && ( pEvent->GetSister() || m_bStreaming ) )
+                AddFrameNote( f, i );
+        }
+    }
+    FindMeasures( f, m_llStartTime + m_llTimeSpan + static_cast< long long >( MaxFrameAge * f.dSpeed ) );
+    f.bNoteLabels = m_bNoteLabels;
+    f.iNotesAlpha = m_iNotesAlpha;
+    f.iWaitingAlpha = m_iWaitingAlpha;
+
+    // Keyboard
+    for ( int i = 0; i < 128; i++ )
+    {
+        f.aKeyDown[i] = ( m_pNoteState[i] != -1 || m_pInputState[i] != -1 );
+        if ( !f.aKeyDown[i] ) continue;
+
+        const MIDIChannelEvent *pEvent = ( m_pInputState[i] >= 0 ? m_vEvents[m_pInputState[i]] : m_pNoteState[i] >= 0 ? m_vEvents[m_pNoteState[i]] : NULL );
+        const int iTrack = ( pEvent ? pEvent->GetTrack() : -1 );
+        const int iChannel = ( pEvent ? pEvent->GetChannel() : -1 );
+        bool bBadLearn = ( m_eGameMode == Learn && m_iLearnOrdinal >= 0 && ( iTrack != m_iLearnTrack || iChannel != m_iLearnChannel ) );
+        f.aKeyColors[i] = ( m_pInputState[i] == -2 || bBadLearn ||
+                            pEvent->GetInputQuality() == MIDIChannelEvent::Missed ? m_csKBBadNote :
+                            m_vTrackSettings[iTrack].aChannels[iChannel] );
+    }
+
+    // Mouse
+    f.bPaused = m_bPaused;
+    f.bHaveMouse = m_bHaveMouse;
+    f.bZoomMove = m_bZoomMove;
+    f.iHotNote = m_iHotNote;
+    f.iSelectedNote = m_iSelectedNote;
+    f.ptLastPos = m_ptLastPos;
+
+    // Text. Messages point at m_sBuf, which MsgProc can write to any time
+    copy( m_tpParticles, m_tpParticles + 128, f.tpParticles );
+    f.tpMessage = m_tpMessage;
+    f.tpLongMessage = m_tpLongMessage;
+    if ( m_tpMessage.IsAlive() )
+    {
+        wcscpy_s( f.sMessage, m_tpMessage.GetText() );
+        f.tpMessage.SetText( f.sMessage );
+    }
+    if ( m_tpLongMessage.IsAlive() )
+    {
+        wcscpy_s( f.sLongMessage, m_tpLongMessage.GetText() );
+        f.tpLongMessage.SetText( f.sLongMessage );
+    }
+    f.eGameMode = m_eGameMode;
+    f.eLearnMode = m_eLearnMode;
+    f.iLearnOrdinal = m_iLearnOrdinal;
+    f.bShowFPS = m_bShowFPS;
+    f.bInstructions = m_bInstructions;
+    f.bScored = m_bScored;
+    f.bInDevice = m_InDevice.IsOpen();
+    f.iScore = m_Score.GetScore();
+    f.iMult = m_Score.GetMult();
+    f.dTickRate = m_dTickRate;
+    f.llNotesDropped = m_Governor.GetStats().llDropped;
+    f.llNotesMerged = m_Governor.GetStats().llMerged;
+    f.iEventsOptimized = m_OptimizeStats.iControllers + m_OptimizeStats.iPrograms + m_OptimizeStats.iThinned + 2 * m_OptimizeStats.iZeroNotes;
+    f.llLoadMicroSecs = m_llLoadMicroSecs;
+    f.iShowTop10 = m_iShowTop10;
+    if ( f.iLibraryVersion != m_iFrameLibraryVersion )
+    {
+        f.pLibrary = m_pFrameLibrary;
+        f.iLibraryVersion = m_iFrameLibraryVersion;
+    }
+
+    m_Frames.Publish();
+}
+
+// Copies the labels and top 10 out of the file info. Frames hold on to the old copy till they're reused
+void MainScreen::BuildFrameLibrary()
+{
+    shared_ptr< FrameLibrary > pLibrary = make_shared< FrameLibrary >();
+    m_mFrameLabels.clear();
+    if ( m_pFileInfo )
+    {
+        for ( int i = 0; i < m_pFileInfo->label_size(); i++ )
+        {
+            const PFAData::Label &label = m_pFileInfo->label( i );
+            int iPos = FindSourcePos( label.pos() );
+            if ( iPos < 0 || label.label().empty() ) continue;
+            m_mFrameLabels[iPos] = static_cast< int >( pLibrary->vLabels.size() );
+            pLibrary->vLabels.push_back( label.label() );
+        }
+        int iTop10 = min( m_pFileInfo->top10_size(), 10 );
+        for ( int i = 0; i < iTop10; i++ )
+            pLibrary->vTop10.push_back( m_pFileInfo->top10( i ) );
+    }
+
+    m_pFrameLibrary = pLibrary;
+    m_iFrameLibraryVersion = m_iLibraryVersion;
+}
+
+// Hidden notes are left out. Colors are worked out here, where the settings can't change underneath
+void MainScreen::AddFrameNote( Frame &f, int iPos )
+{
+    const MIDIChannelEvent *pNote = m_vEvents[iPos];
+    int iTrack = pNote->GetTrack();
+    int iChannel = pNote->GetChannel();
+    const ChannelSettings &csChannel = m_vTrackSettings[iTrack].aChannels[iChannel];
+    if ( csChannel.bHidden ) return;
+
+    MIDIChannelEvent::InputQuality eInputQuality = pNote->GetInputQuality();
+    bool bMissed = ( eInputQuality == MIDIChannelEvent::Missed );
+    bool bBadLearn = ( m_eGameMode == Learn && m_iLearnOrdinal >= 0 && ( iTrack != m_iLearnTrack || iChannel != m_iLearnChannel ) );
+    const ChannelSettings &csNote = ( bMissed || bBadLearn ? m_csKBBadNote : csChannel );
+
+    FrameNote note;
+    note.iPos = iPos;
+    note.iNote = pNote->GetParam1();
+    note.llNoteStart = pNote->GetAbsMicroSec();
+    note.llNoteEnd = ( pNote->GetSister() ? pNote->GetSister()->GetAbsMicroSec() : -1 );
+    note.bWaiting = ( eInputQuality == MIDIChannelEvent::Waiting );
+    note.bOutline = ( note.llNoteStart < m_llMinTime && !bBadLearn );
+    note.iPrimaryRGB = csNote.iPrimaryRGB;
+    note.iDarkRGB = csNote.iDarkRGB;
+    note.iVeryDarkRGB = csNote.iVeryDarkRGB;
+    note.iLabelRGB = ( bMissed ? m_csKBBadNote : csChannel ).iVeryDarkRGB;
+
+    note.iLabel = -1;
+    if ( pNote->GetLabel() )
+    {
+        map< int, int >::const_iterator it = m_mFrameLabels.find( iPos );
+        if ( it != m_mFrameLabels.end() ) note.iLabel = it->second;
+    }
+
+    f.vNotes.push_back( note );
+}
+
+// Times of the measure lines from the start of the window through llEndTime. Render places them
+void MainScreen::FindMeasures( Frame &f, long long llEndTime )
+{
+    f.vMeasures.clear();
+    int iDivision = m_MIDI.GetInfo().iDivision;
+    if ( iDivision & 0x8000 ) return;
+
+    // Copy time state vars
+    int iCurrTick = m_iStartTick - 1;
+
+    // Copy tempo state vars
+    int iLastTempoTick = m_iLastTempoTick;
+    int iMicroSecsPerBeat = m_iMicroSecsPerBeat;
+    long long llLastTempoTime = m_llLastTempoTime;
+    eventvec_t::const_iterator itNextTempo = m_itNextTempo;
+
+    // Copy signature state vars
+    int iLastSignatureTick = m_iLastSignatureTick;
+    int iBeatsPerMeasure = m_iBeatsPerMeasure;
+    int iBeatType = m_iBeatType;
+    eventvec_t::const_iterator itNextSignature = m_itNextSignature;
+
+    // Compute initial next beat tick and next beat time
+    long long llNextBeatTime = 0;
+    do
+    {
+        int iNextBeatTick = GetBeatTick( iCurrTick + 1, iBeatType, iLastSignatureTick );
+
+        // Next beat crosses the next tempo event. handle the event and recalculate next beat time
+        while ( itNextTempo != m_vTempo.end() && m_vMetaEvents[itNextTempo->second]->GetDataLen() == 3 &&
+                iNextBeatTick > m_vMetaEvents[itNextTempo->second]->GetAbsT() )
+        {
+            MIDIMetaEvent *pEvent = m_vMetaEvents[itNextTempo->second];
+            MIDI::Parse24Bit( pEvent->GetData(), 3, &iMicroSecsPerBeat );
+            iLastTempoTick = pEvent->GetAbsT();
+            llLastTempoTime = pEvent->GetAbsMicroSec();
+            ++itNextTempo;
+        }
+        while ( itNextSignature != m_vSignature.end() && m_vMetaEvents[itNextSignature->second]->GetDataLen() == 4 &&
+                iNextBeatTick > m_vMetaEvents[itNextSignature->second]->GetAbsT() )
+        {
+            MIDIMetaEvent *pEvent = m_vMetaEvents[itNextSignature->second];
+            iBeatsPerMeasure = pEvent->GetData()[0];
+            iBeatType = 1 << pEvent->GetData()[1];
+            iLastSignatureTick = pEvent->GetAbsT();
+            iNextBeatTick = GetBeatTick( iLastSignatureTick + 1, iBeatType, iLastSignatureTick );
+            ++itNextSignature;
+        }
+
+        // Finally keep the beat if it's a measure
+        int iNextBeat = GetBeat( iNextBeatTick, iBeatType, iLastSignatureTick );
+        bool bIsMeasure = !( ( iNextBeat < 0 ? -iNextBeat : iNextBeat ) % iBeatsPerMeasure );
+        llNextBeatTime = GetTickTime( iNextBeatTick, iLastTempoTick, llLastTempoTime, iMicroSecsPerBeat ); 
+        if ( bIsMeasure )
+            f.vMeasures.push_back( llNextBeatTime );
+
+        iCurrTick = iNextBeatTick;
+    }
+    while ( llNextBeatTime <= llEndTime );
+}
+
+// Draws the newest frame Logic published. Runs on the render thread, so it only reads the frame, the
+// colors set up on construction, and its own counters
 GameState::GameError MainScreen::Render() 
 {
+    // Nothing new since the last one
+    if ( !m_Frames.Acquire() ) return Success;
     if ( FAILED( m_pRenderer->ResetDeviceIfNeeded() ) ) return DirectXError;
 
+    // Logic's ticks don't line up with vsync. Carry time forward to now, so notes move smoothly.
+    // The front frame is ours till the next Acquire
+    Frame &f = m_Frames.Front();
+    long long llAge = ( Timer::GetNanoSecsNow() - f.llFrameTime ) / 1000;
+    if ( llAge > MaxFrameAge ) llAge = MaxFrameAge;
+    f.llStartTime += static_cast< long long >( llAge * f.dSpeed + 0.5 );
+
+    // Round down start time. This is only used for rendering purposes
+    long long llMicroSecsPP = static_cast< long long >( f.llTimeSpan / f.fNotesCY + 0.5f );
+    f.llRndStartTime = f.llStartTime - ( f.llStartTime < 0 ? llMicroSecsPP : 0 );
+    f.llRndStartTime = ( f.llRndStartTime / llMicroSecsPP ) * llMicroSecsPP;
+
+    // Compute FPS and jitter every half a second
+    long long llElapsed = m_RenderTimer.Lap();
+    m_llFPSTime += llElapsed;
+    m_iFPSCount++;
+    m_ClockStats.AddFrame( llElapsed );
+    if ( m_llFPSTime >= 500000 )
+    {
+        m_dFPS = m_iFPSCount / ( m_llFPSTime / 1000000.0 );
+        m_llFPSTime = m_iFPSCount = 0;
+        m_dJitter = m_ClockStats.GetJitter();
+        m_ClockStats.ResetJitter();
+    }
+
     m_pRenderer->Clear( 0x00000000 );
 
+    m_iRenderHotNote = -1;
     m_pRenderer->BeginScene();
-    RenderLines();
-    RenderNotes();
-    RenderLabels();
-    if ( m_bShowKB )
-        RenderKeys();
-    RenderBorder();
-    RenderText();
+    RenderLines( f );
+    RenderNotes( f );
+    RenderLabels( f );
+    if ( f.bShowKB )
+        RenderKeys( f );
+    RenderBorder( f );
+    RenderText( f );
     m_pRenderer->EndScene();
+    m_iNextHotNote = m_iRenderHotNote;
 
     // Present the backbuffer contents to the display
     m_pRenderer->Present();
@@ -1934,7 +2554,7 @@ GameState::GameError MainScreen::Render()
 }
 
 // These used to be created as local variables inside each Render* function, but too much copying of code :/
-// Depends on m_llStartTime, m_llTimeSpan, m_eKeysShown, m_iStartNote, m_iEndNote
+// Depends on m_eKeysShown, m_iStartNote, m_iEndNote. Logic hands them to Render in the frame
 void MainScreen::RenderGlobals()
 {
     // Midi info
@@ -1972,158 +2592,66 @@ void MainScreen::RenderGlobals()
         fIdealKeyCY = ( fIdealKeyCY / 0.95f + 2.0f ) / 0.93f;
         m_fNotesCY = floor( m_pRenderer->GetBufferHeight() - min( fIdealKeyCY, fMaxKeyCY ) + 0.5f );
     }
-
-    // Round down start time. This is only used for rendering purposes
-    long long llMicroSecsPP = static_cast< long long >( m_llTimeSpan / m_fNotesCY + 0.5f );
-    m_llRndStartTime = m_llStartTime - ( m_llStartTime < 0 ? llMicroSecsPP : 0 );
-    m_llRndStartTime = ( m_llRndStartTime / llMicroSecsPP ) * llMicroSecsPP;
 }
 
-void MainScreen::RenderLines()
+void MainScreen::RenderLines( const Frame &f )
 {
-    m_pRenderer->DrawRect( m_fNotesX, m_fNotesY, m_fNotesCX, m_fNotesCY, m_csBackground.iPrimaryRGB );
+    m_pRenderer->DrawRect( f.fNotesX, f.fNotesY, f.fNotesCX, f.fNotesCY, f.csBackground.iPrimaryRGB );
 
     // Vertical lines
-    for ( int i = m_iStartNote + 1; i <= m_iEndNote; i++ )
+    for ( int i = f.iStartNote + 1; i <= f.iEndNote; i++ )
         if ( !MIDI::IsSharp( i - 1 ) && !MIDI::IsSharp( i ) )
         {
-            int iWhiteKeys = MIDI::WhiteCount( m_iStartNote, i );
-            float fStartX = MIDI::IsSharp( m_iStartNote ) * SharpRatio / 2.0f;
-            float x = m_fNotesX + m_fWhiteCX * ( iWhiteKeys + fStartX );
+            int iWhiteKeys = MIDI::WhiteCount( f.iStartNote, i );
+            float fStartX = MIDI::IsSharp( f.iStartNote ) * SharpRatio / 2.0f;
+            float x = f.fNotesX + f.fWhiteCX * ( iWhiteKeys + fStartX );
             x = floor( x + 0.5f ); // Needs to be rounded because of the gradient
-            m_pRenderer->DrawRect( x - 1.0f, m_fNotesY, 3.0f, m_fNotesCY,
-                m_csBackground.iDarkRGB, m_csBackground.iVeryDarkRGB, m_csBackground.iVeryDarkRGB, m_csBackground.iDarkRGB );
+            m_pRenderer->DrawRect( x - 1.0f, f.fNotesY, 3.0f, f.fNotesCY,
+                f.csBackground.iDarkRGB, f.csBackground.iVeryDarkRGB, f.csBackground.iVeryDarkRGB, f.csBackground.iDarkRGB );
         }
 
-    // Horizontal (Hard!)
-    int iDivision = m_MIDI.GetInfo().iDivision;
-    if ( !( iDivision & 0x8000 ) )
+    // Horizontal. Logic found the measures
+    for ( vector< long long >::const_iterator it = f.vMeasures.begin(); it != f.vMeasures.end(); ++it )
     {
-        // Copy time state vars
-        int iCurrTick = m_iStartTick - 1;
-        long long llEndTime = m_llStartTime + m_llTimeSpan;
-
-        // Copy tempo state vars
-        int iLastTempoTick = m_iLastTempoTick;
-        int iMicroSecsPerBeat = m_iMicroSecsPerBeat;
-        long long llLastTempoTime = m_llLastTempoTime;
-        eventvec_t::const_iterator itNextTempo = m_itNextTempo;
-
-        // Copy signature state vars
-        int iLastSignatureTick = m_iLastSignatureTick;
-        int iBeatsPerMeasure = m_iBeatsPerMeasure;
-        int iBeatType = m_iBeatType;
-        eventvec_t::const_iterator itNextSignature = m_itNextSignature;
-
-        // Compute initial next beat tick and next beat time
-        long long llNextBeatTime = 0;
-        do
-        {
-            int iNextBeatTick = GetBeatTick( iCurrTick + 1, iBeatType, iLastSignatureTick );
-
-            // Next beat crosses the next tempo event. handle the event and recalculate next beat time
-            while ( itNextTempo != m_vTempo.end() && m_vMetaEvents[itNextTempo->second]->GetDataLen() == 3 &&
-                    iNextBeatTick > m_vMetaEvents[itNextTempo->second]->GetAbsT() )
-            {
-                MIDIMetaEvent *pEvent = m_vMetaEvents[itNextTempo->second];
-                MIDI::Parse24Bit( pEvent->GetData(), 3, &iMicroSecsPerBeat );
-                iLastTempoTick = pEvent->GetAbsT();
-                llLastTempoTime = pEvent->GetAbsMicroSec();
-                ++itNextTempo;
-            }
-            while ( itNextSignature != m_vSignature.end() && m_vMetaEvents[itNextSignature->second]->GetDataLen() == 4 &&
-                    iNextBeatTick > m_vMetaEvents[itNextSignature->second]->GetAbsT() )
-            {
-                MIDIMetaEvent *pEvent = m_vMetaEvents[itNextSignature->second];
-                iBeatsPerMeasure = pEvent->GetData()[0];
-                iBeatType = 1 << pEvent->GetData()[1];
-                iLastSignatureTick = pEvent->GetAbsT();
-                iNextBeatTick = GetBeatTick( iLastSignatureTick + 1, iBeatType, iLastSignatureTick );
-                ++itNextSignature;
-            }
-
-            // Finally render the beat or measure
-            int iNextBeat = GetBeat( iNextBeatTick, iBeatType, iLastSignatureTick );
-            bool bIsMeasure = !( ( iNextBeat < 0 ? -iNextBeat : iNextBeat ) % iBeatsPerMeasure );
-            llNextBeatTime = GetTickTime( iNextBeatTick, iLastTempoTick, llLastTempoTime, iMicroSecsPerBeat ); 
-            float y = m_fNotesY + m_fNotesCY * ( 1.0f - static_cast< float >( llNextBeatTime - m_llRndStartTime ) / m_llTimeSpan );
-            y = floor( y + 0.5f );
-            if ( bIsMeasure && y + 1.0f > m_fNotesY )
-                m_pRenderer->DrawRect( m_fNotesX, y - 1.0f, m_fNotesCX, 3.0f,
-                    m_csBackground.iDarkRGB, m_csBackground.iDarkRGB, m_csBackground.iVeryDarkRGB, m_csBackground.iVeryDarkRGB );
-
-            iCurrTick = iNextBeatTick;
-        }
-        while ( llNextBeatTime <= llEndTime );
+        float y = f.fNotesY + f.fNotesCY * ( 1.0f - static_cast< float >( *it - f.llRndStartTime ) / f.llTimeSpan );
+        y = floor( y + 0.5f );
+        if ( y + 1.0f > f.fNotesY )
+            m_pRenderer->DrawRect( f.fNotesX, y - 1.0f, f.fNotesCX, 3.0f,
+                f.csBackground.iDarkRGB, f.csBackground.iDarkRGB, f.csBackground.iVeryDarkRGB, f.csBackground.iVeryDarkRGB );
     }
 }
 
-void MainScreen::RenderNotes()
+void MainScreen::RenderNotes( const Frame &f )
 {
-    // Do we have any notes to render?
-    if ( m_iEndPos < 0 || m_iStartPos >= static_cast< int >( m_vEvents.size() ) )
-        return;
-
     // Render notes. Regular notes then sharps to  make sure they're not hidden
     bool bHasSharp = false;
-    for ( vector< int >::iterator it = m_vState.begin(); it != m_vState.end(); ++it )
-        if ( !MIDI::IsSharp( m_vEvents[*it]->GetParam1() ) )
-            RenderNote( *it );
+    for ( vector< FrameNote >::const_iterator it = f.vNotes.begin(); it != f.vNotes.end(); ++it )
+        if ( !MIDI::IsSharp( it->iNote ) )
+            RenderNote( f, *it );
         else
             bHasSharp = true;
 
-    for ( int i = m_iStartPos; i <= m_iEndPos; i++ )
-    {
-        MIDIChannelEvent *pEvent = m_vEvents[i];
-        if ( pEvent->GetChannelEventType() == MIDIChannelEvent::NoteOn &&
-             pEvent->GetParam2() > 0 && pEvent->GetSister() )
-        {
-            if ( !MIDI::IsSharp( pEvent->GetParam1() ) )
-                RenderNote( i );
-            else
-                bHasSharp = true;
-        }
-    }
-
     // Do it all again, but only for the sharps
     if ( bHasSharp )
     {
-        for ( vector< int >::iterator it = m_vState.begin(); it != m_vState.end(); ++it )
-            if ( MIDI::IsSharp( m_vEvents[*it]->GetParam1() ) )
-                RenderNote( *it );
-
-        for ( int i = m_iStartPos; i <= m_iEndPos; i++ )
-        {
-            MIDIChannelEvent *pEvent = m_vEvents[i];
-            if ( pEvent->GetChannelEventType() == MIDIChannelEvent::NoteOn &&
-                 pEvent->GetParam2() > 0 && pEvent->GetSister() &&
-                 MIDI::IsSharp( pEvent->GetParam1() ) )
-                RenderNote( i );                
-        }
+        for ( vector< FrameNote >::const_iterator it = f.vNotes.begin(); it != f.vNotes.end(); ++it )
+            if ( MIDI::IsSharp( it->iNote ) )
+                RenderNote( f, *it );
     }
 }
 
-void MainScreen::RenderNote( int iPos )
+void MainScreen::RenderNote( const Frame &f, const FrameNote &note )
 {
-    const MIDIChannelEvent *pNote = m_vEvents[iPos];
-    int iNote = pNote->GetParam1();
-    int iTrack = pNote->GetTrack();
-    int iChannel = pNote->GetChannel();
-    MIDIChannelEvent::InputQuality eInputQuality = pNote->GetInputQuality();
-    long long llNoteStart = pNote->GetAbsMicroSec();
-    long long llNoteEnd = pNote->GetSister()->GetAbsMicroSec();
-
-    bool bBadLearn = ( m_eGameMode == Learn && m_iLearnOrdinal >= 0 && ( iTrack != m_iLearnTrack || iChannel != m_iLearnChannel ) );
-    ChannelSettings &csTrack = ( eInputQuality == MIDIChannelEvent::Missed || bBadLearn ? m_csKBBadNote :
-                                 m_vTrackSettings[iTrack].aChannels[iChannel] );
-    if ( m_vTrackSettings[iTrack].aChannels[iChannel].bHidden ) return;
+    int iNote = note.iNote;
+    long long llNoteStart = note.llNoteStart;
+    long long llNoteEnd = ( note.llNoteEnd >= 0 ? note.llNoteEnd : f.llStartTime + f.llTimeSpan ); // Still streaming
 
     // Compute true positions
-    float x = GetNoteX( iNote );
-    float y = m_fNotesY + m_fNotesCY * ( 1.0f - static_cast< float >( llNoteStart - m_llRndStartTime ) / m_llTimeSpan );
-    float cx =  MIDI::IsSharp( iNote ) ? m_fWhiteCX * SharpRatio : m_fWhiteCX;
-    float cy = m_fNotesCY * ( static_cast< float >( llNoteEnd - llNoteStart ) / m_llTimeSpan );
-    float fDeflate = m_fWhiteCX * 0.15f / 2.0f;
+    float x = GetNoteX( iNote, f.iStartNote, f.fNotesX, f.fWhiteCX );
+    float y = f.fNotesY + f.fNotesCY * ( 1.0f - static_cast< float >( llNoteStart - f.llRndStartTime ) / f.llTimeSpan );
+    float cx =  MIDI::IsSharp( iNote ) ? f.fWhiteCX * SharpRatio : f.fWhiteCX;
+    float cy = f.fNotesCY * ( static_cast< float >( llNoteEnd - llNoteStart ) / f.llTimeSpan );
+    float fDeflate = f.fWhiteCX * 0.15f / 2.0f;
 
     // Rounding to make everything consistent
     cy = floor( cy + 0.5f ); // constant cy across rendering
@@ -2132,8 +2660,8 @@ void MainScreen::RenderNote( int iPos )
     fDeflate = max( min( fDeflate, 3.0f ), 1.0f );
 
     // Clipping :/
-    float fMinY = m_fNotesY - 5.0f;
-    float fMaxY = m_fNotesY + m_fNotesCY + 5.0f;
+    float fMinY = f.fNotesY - 5.0f;
+    float fMaxY = f.fNotesY + f.fNotesCY + 5.0f;
     if ( y > fMaxY )
     {
         cy -= ( y - fMaxY );
@@ -2145,88 +2673,70 @@ void MainScreen::RenderNote( int iPos )
         y = fMinY + cy;
     }
 
-    if ( m_ptLastPos.x >= x && m_ptLastPos.x <= x + cx &&
-         m_ptLastPos.y <= y && m_ptLastPos.y >= y - cy )
-        m_iNextHotNote = iPos;
+    if ( f.ptLastPos.x >= x && f.ptLastPos.x <= x + cx &&
+         f.ptLastPos.y <= y && f.ptLastPos.y >= y - cy )
+        m_iRenderHotNote = note.iPos;
 
     // Visualize!
-    int iAlpha = ( eInputQuality == MIDIChannelEvent::Waiting ? m_iWaitingAlpha : m_iNotesAlpha ) << 24;
-    if ( m_bPaused && m_bHaveMouse && iPos == m_iHotNote && !m_bZoomMove && ( m_iSelectedNote == -1 || m_iSelectedNote == iPos ) )
+    int iAlpha = ( note.bWaiting ? f.iWaitingAlpha : f.iNotesAlpha ) << 24;
+    if ( f.bPaused && f.bHaveMouse && note.iPos == f.iHotNote && !f.bZoomMove && ( f.iSelectedNote == -1 || f.iSelectedNote == note.iPos ) )
     {
-        m_pRenderer->DrawRect( x, y - cy, cx, cy, csTrack.iPrimaryRGB | iAlpha );
+        m_pRenderer->DrawRect( x, y - cy, cx, cy, note.iPrimaryRGB | iAlpha );
         m_pRenderer->DrawRect( x + fDeflate, y - cy + fDeflate,
                                 cx - fDeflate * 2.0f, cy - fDeflate * 2.0f,
-                                csTrack.iVeryDarkRGB | iAlpha, csTrack.iDarkRGB | iAlpha, csTrack.iDarkRGB | iAlpha, csTrack.iVeryDarkRGB | iAlpha );
+                                note.iVeryDarkRGB | iAlpha, note.iDarkRGB | iAlpha, note.iDarkRGB | iAlpha, note.iVeryDarkRGB | iAlpha );
     }
-    else if ( llNoteStart < m_llMinTime && !bBadLearn )
+    else if ( note.bOutline )
     {
-        m_pRenderer->DrawRect( x, y - cy, fDeflate, cy, csTrack.iVeryDarkRGB | iAlpha );
-        m_pRenderer->DrawRect( x, y - cy, cx, fDeflate, csTrack.iVeryDarkRGB | iAlpha );
-        m_pRenderer->DrawRect( x + cx - fDeflate, y - cy, fDeflate, cy, csTrack.iVeryDarkRGB | iAlpha );
-        m_pRenderer->DrawRect( x, y - fDeflate, cx, fDeflate, csTrack.iVeryDarkRGB | iAlpha );
+        m_pRenderer->DrawRect( x, y - cy, fDeflate, cy, note.iVeryDarkRGB | iAlpha );
+        m_pRenderer->DrawRect( x, y - cy, cx, fDeflate, note.iVeryDarkRGB | iAlpha );
+        m_pRenderer->DrawRect( x + cx - fDeflate, y - cy, fDeflate, cy, note.iVeryDarkRGB | iAlpha );
+        m_pRenderer->DrawRect( x, y - fDeflate, cx, fDeflate, note.iVeryDarkRGB | iAlpha );
     }
     else
     {
-        m_pRenderer->DrawRect( x, y - cy, cx, cy, csTrack.iVeryDarkRGB | iAlpha );
+        m_pRenderer->DrawRect( x, y - cy, cx, cy, note.iVeryDarkRGB | iAlpha );
         m_pRenderer->DrawRect( x + fDeflate, y - cy + fDeflate,
                                 cx - fDeflate * 2.0f, cy - fDeflate * 2.0f,
-                                csTrack.iPrimaryRGB | iAlpha, csTrack.iDarkRGB | iAlpha, csTrack.iDarkRGB | iAlpha, csTrack.iPrimaryRGB | iAlpha );
+                                note.iPrimaryRGB | iAlpha, note.iDarkRGB | iAlpha, note.iDarkRGB | iAlpha, note.iPrimaryRGB | iAlpha );
     }
 }
 
 // Similar to RenderNotes. It's not in that function because text is done separate.
-void MainScreen::RenderLabels()
+void MainScreen::RenderLabels( const Frame &f )
 {
-    // Do we have any notes to render?
-    if ( m_iEndPos < 0 || m_iStartPos >= static_cast< int >( m_vEvents.size() ) )
-        return;
-
+    // Notes still streaming in don't get labels
     bool bSetState = true;
-    for ( vector< int >::iterator it = m_vState.begin(); it != m_vState.end(); ++it )
-        bSetState &= !RenderLabel( *it, bSetState );
-
-    for ( int i = m_iStartPos; i <= m_iEndPos; i++ )
-    {
-        MIDIChannelEvent *pEvent = m_vEvents[i];
-        if ( pEvent->GetChannelEventType() == MIDIChannelEvent::NoteOn &&
-             pEvent->GetParam2() > 0 && pEvent->GetSister() )
-            bSetState &= !RenderLabel( i, bSetState );
-    }
+    for ( int i = 0; i < static_cast< int >( f.vNotes.size() ); i++ )
+        if ( i < f.iStateNotes || f.vNotes[i].llNoteEnd >= 0 )
+            bSetState &= !RenderLabel( f, f.vNotes[i], bSetState );
 
     for ( int i = 0; i < 128; i++ )
-        if ( m_tpParticles[i].IsAlive() )
+        if ( f.tpParticles[i].IsAlive() )
         {
             if ( bSetState ) m_pRenderer->BeginText();
-            m_tpParticles[i].Render( m_pRenderer, 0.0f, m_fNotesY + m_fNotesCY );
+            f.tpParticles[i].Render( m_pRenderer, 0.0f, f.fNotesY + f.fNotesCY );
             bSetState = false;
         }
 
     if ( !bSetState ) m_pRenderer->EndText();
 }
 
-bool MainScreen::RenderLabel( int iPos, bool bSetState )
+bool MainScreen::RenderLabel( const Frame &f, const FrameNote &note, bool bSetState )
 {
-    const MIDIChannelEvent *pNote = m_vEvents[iPos];
-
-    const string *sLabel = pNote->GetLabel();
-    int iLabels = ( m_bNoteLabels ? 1 : 0 ) + ( sLabel && sLabel->length() > 0 ? 1 : 0 );
+    const string *sLabel = ( note.iLabel >= 0 ? &f.pLibrary->vLabels[note.iLabel] : NULL );
+    int iLabels = ( f.bNoteLabels ? 1 : 0 ) + ( sLabel ? 1 : 0 );
     if ( !iLabels ) return false;
 
-    int iNote = pNote->GetParam1();
-    int iTrack = pNote->GetTrack();
-    int iChannel = pNote->GetChannel();
-    MIDIChannelEvent::InputQuality eInputQuality = pNote->GetInputQuality();
-    long long llNoteStart = pNote->GetAbsMicroSec();
-    ChannelSettings &csTrack = ( eInputQuality == MIDIChannelEvent::Missed ? m_csKBBadNote :
-                                 m_vTrackSettings[iTrack].aChannels[iChannel] );
-    if ( m_vTrackSettings[iTrack].aChannels[iChannel].bHidden ) return false;
+    int iNote = note.iNote;
+    long long llNoteStart = note.llNoteStart;
 
     // Compute true positions
-    float x = GetNoteX( iNote );
-    float y = m_fNotesY + m_fNotesCY * ( 1.0f - static_cast< float >( llNoteStart - m_llRndStartTime ) / m_llTimeSpan );
-    float cx =  MIDI::IsSharp( iNote ) ? m_fWhiteCX * SharpRatio : m_fWhiteCX;
+    float x = GetNoteX( iNote, f.iStartNote, f.fNotesX, f.fWhiteCX );
+    float y = f.fNotesY + f.fNotesCY * ( 1.0f - static_cast< float >( llNoteStart - f.llRndStartTime ) / f.llTimeSpan );
+    float cx =  MIDI::IsSharp( iNote ) ? f.fWhiteCX * SharpRatio : f.fWhiteCX;
 
-    float fMaxY = m_fNotesY + m_fNotesCY + 3.0f + 15.0f * iLabels;
+    float fMaxY = f.fNotesY + f.fNotesCY + 3.0f + 15.0f * iLabels;
     if ( y > fMaxY ) return false;
 
     y = floor( y + 0.5f );
@@ -2235,20 +2745,20 @@ bool MainScreen::RenderLabel( int iPos, bool bSetState )
 
     if ( bSetState ) m_pRenderer->BeginText();
 
-    int iAlpha = ( 0xFF - ( eInputQuality == MIDIChannelEvent::Waiting ? m_iWaitingAlpha : m_iNotesAlpha ) ) << 24;
-    if ( sLabel && sLabel->length() > 0 )
+    int iAlpha = ( 0xFF - ( note.bWaiting ? f.iWaitingAlpha : f.iNotesAlpha ) ) << 24;
+    if ( sLabel )
     {
         OffsetRect( &rc, -1, -1 );
-        m_pRenderer->DrawTextA( sLabel->c_str(), Renderer::SmallBold, &rc, DT_CENTER | DT_NOCLIP, csTrack.iVeryDarkRGB | iAlpha );
+        m_pRenderer->DrawTextA( sLabel->c_str(), Renderer::SmallBold, &rc, DT_CENTER | DT_NOCLIP, note.iLabelRGB | iAlpha );
         OffsetRect( &rc, 1, 1 );
         m_pRenderer->DrawTextA( sLabel->c_str(), Renderer::SmallBold, &rc, DT_CENTER | DT_NOCLIP, 0x00FFFFFF | iAlpha );
         OffsetRect( &rc, 0, 15 );
     }
-    if ( m_bNoteLabels )
+    if ( f.bNoteLabels )
     {
         OffsetRect( &rc, -1, -1 );
         const wstring &sLabel = MIDI::NoteName( iNote );
-        m_pRenderer->DrawTextW( sLabel.c_str(), Renderer::SmallBold, &rc, DT_CENTER | DT_NOCLIP, csTrack.iVeryDarkRGB | iAlpha, (int)sLabel.length() - 1 );
+        m_pRenderer->DrawTextW( sLabel.c_str(), Renderer::SmallBold, &rc, DT_CENTER | DT_NOCLIP, note.iLabelRGB | iAlpha, (int)sLabel.length() - 1 );
         OffsetRect( &rc, 1, 1 );
         m_pRenderer->DrawTextW( sLabel.c_str(), Renderer::SmallBold, &rc, DT_CENTER | DT_NOCLIP, 0x00FFFFFF | iAlpha, (int)sLabel.length() - 1 );
     }
@@ -2256,24 +2766,24 @@ bool MainScreen::RenderLabel( int iPos, bool bSetState )
     return true;
 }
 
-float MainScreen::GetNoteX( int iNote )
+float MainScreen::GetNoteX( int iNote, int iStartNote, float fNotesX, float fWhiteCX )
 {
-    int iWhiteKeys = MIDI::WhiteCount( m_iStartNote, iNote );
-    float fStartX = ( MIDI::IsSharp( m_iStartNote ) - MIDI::IsSharp( iNote ) ) * SharpRatio / 2.0f;
+    int iWhiteKeys = MIDI::WhiteCount( iStartNote, iNote );
+    float fStartX = ( MIDI::IsSharp( iStartNote ) - MIDI::IsSharp( iNote ) ) * SharpRatio / 2.0f;
     if ( MIDI::IsSharp( iNote ) )
     {
         MIDI::Note eNote = MIDI::NoteVal( iNote );
         if ( eNote == MIDI::CS || eNote == MIDI::FS ) fStartX -= SharpRatio / 5.0f;
         else if ( eNote == MIDI::AS || eNote == MIDI::DS ) fStartX += SharpRatio / 5.0f;
     }
-    return m_fNotesX + m_fWhiteCX * ( iWhiteKeys + fStartX );
+    return fNotesX + fWhiteCX * ( iWhiteKeys + fStartX );
 }
 
-void MainScreen::RenderKeys()
+void MainScreen::RenderKeys( const Frame &f )
 {
     // Screen info
-    float fKeysY = m_fNotesY + m_fNotesCY;
-    float fKeysCY = m_pRenderer->GetBufferHeight() - m_fNotesCY;
+    float fKeysY = f.fNotesY + f.fNotesCY;
+    float fKeysCY = m_pRenderer->GetBufferHeight() - f.fNotesCY;
 
     float fTransitionPct = .02f;
     float fTransitionCY = max( 3.0f, floor( fKeysCY * fTransitionPct + 0.5f ) );
@@ -2284,95 +2794,88 @@ void MainScreen::RenderKeys()
     float fNearCY = fKeysCY - fSpacerCY - fRedCY - fTransitionCY - fTopCY;
 
     // Draw the background
-    m_pRenderer->DrawRect( m_fNotesX, fKeysY, m_fNotesCX, fKeysCY, m_csKBBackground.iVeryDarkRGB );
-    m_pRenderer->DrawRect( m_fNotesX, fKeysY, m_fNotesCX, fTransitionCY,
-        m_csBackground.iPrimaryRGB, m_csBackground.iPrimaryRGB, m_csKBBackground.iVeryDarkRGB, m_csKBBackground.iVeryDarkRGB );
-    m_pRenderer->DrawRect( m_fNotesX, fKeysY + fTransitionCY, m_fNotesCX, fRedCY,
+    m_pRenderer->DrawRect( f.fNotesX, fKeysY, f.fNotesCX, fKeysCY, m_csKBBackground.iVeryDarkRGB );
+    m_pRenderer->DrawRect( f.fNotesX, fKeysY, f.fNotesCX, fTransitionCY,
+        f.csBackground.iPrimaryRGB, f.csBackground.iPrimaryRGB, m_csKBBackground.iVeryDarkRGB, m_csKBBackground.iVeryDarkRGB );
+    m_pRenderer->DrawRect( f.fNotesX, fKeysY + fTransitionCY, f.fNotesCX, fRedCY,
         m_csKBRed.iDarkRGB, m_csKBRed.iDarkRGB, m_csKBRed.iPrimaryRGB, m_csKBRed.iPrimaryRGB );
-    m_pRenderer->DrawRect( m_fNotesX, fKeysY + fTransitionCY + fRedCY, m_fNotesCX, fSpacerCY,
+    m_pRenderer->DrawRect( f.fNotesX, fKeysY + fTransitionCY + fRedCY, f.fNotesCX, fSpacerCY,
         m_csKBBackground.iDarkRGB, m_csKBBackground.iDarkRGB, m_csKBBackground.iDarkRGB, m_csKBBackground.iDarkRGB );
 
     // Keys info
-    float fKeyGap = max( 1.0f, floor( m_fWhiteCX * 0.05f + 0.5f ) );
+    float fKeyGap = max( 1.0f, floor( f.fWhiteCX * 0.05f + 0.5f ) );
     float fKeyGap1 = fKeyGap - floor( fKeyGap / 2.0f + 0.5f );
 
-    int iStartRender = ( MIDI::IsSharp( m_iStartNote ) ? m_iStartNote - 1 : m_iStartNote );
-    int iEndRender = ( MIDI::IsSharp( m_iEndNote ) ? m_iEndNote + 1 : m_iEndNote );
-    float fStartX = ( MIDI::IsSharp( m_iStartNote ) ? m_fWhiteCX * ( SharpRatio / 2.0f - 1.0f ) : 0.0f );
+    int iStartRender = ( MIDI::IsSharp( f.iStartNote ) ? f.iStartNote - 1 : f.iStartNote );
+    int iEndRender = ( MIDI::IsSharp( f.iEndNote ) ? f.iEndNote + 1 : f.iEndNote );
+    float fStartX = ( MIDI::IsSharp( f.iStartNote ) ? f.fWhiteCX * ( SharpRatio / 2.0f - 1.0f ) : 0.0f );
     float fSharpCY = fTopCY * 0.67f;
 
     // Draw the white keys
-    float fCurX = m_fNotesX + fStartX;
+    float fCurX = f.fNotesX + fStartX;
     float fCurY = fKeysY + fTransitionCY + fRedCY + fSpacerCY;
     for ( int i = iStartRender; i <= iEndRender; i++ )
         if ( !MIDI::IsSharp( i ) )
         {
-            if ( m_pNoteState[i] == -1 && m_pInputState[i] == -1 )
+            if ( !f.aKeyDown[i] )
             {
-                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY, m_fWhiteCX - fKeyGap, fTopCY + fNearCY,
+                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY, f.fWhiteCX - fKeyGap, fTopCY + fNearCY,
                     m_csKBWhite.iDarkRGB, m_csKBWhite.iDarkRGB, m_csKBWhite.iPrimaryRGB, m_csKBWhite.iPrimaryRGB );
-                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY + fTopCY, m_fWhiteCX - fKeyGap, fNearCY,
+                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY + fTopCY, f.fWhiteCX - fKeyGap, fNearCY,
                     m_csKBWhite.iDarkRGB, m_csKBWhite.iDarkRGB, m_csKBWhite.iVeryDarkRGB, m_csKBWhite.iVeryDarkRGB );
-                m_pRenderer->DrawRect( fCurX + fKeyGap1, fCurY + fTopCY, m_fWhiteCX - fKeyGap, 2.0f,
+                m_pRenderer->DrawRect( fCurX + fKeyGap1, fCurY + fTopCY, f.fWhiteCX - fKeyGap, 2.0f,
                     m_csKBBackground.iDarkRGB, m_csKBBackground.iDarkRGB, m_csKBWhite.iVeryDarkRGB, m_csKBWhite.iVeryDarkRGB );
 
                 if ( i == MIDI::C4 )
                 {
-                    float fMXGap = floor( m_fWhiteCX * 0.25f + 0.5f );
-                    float fMCX = m_fWhiteCX - fMXGap * 2.0f - fKeyGap;
+                    float fMXGap = floor( f.fWhiteCX * 0.25f + 0.5f );
+                    float fMCX = f.fWhiteCX - fMXGap * 2.0f - fKeyGap;
                     float fMY = max( fCurY + fTopCY - fMCX - 5.0f, fCurY + fSharpCY + 5.0f );
                     m_pRenderer->DrawRect( fCurX + fKeyGap1 + fMXGap, fMY, fMCX, fCurY + fTopCY - 5.0f - fMY, m_csKBWhite.iDarkRGB );
                 }
             }
             else
             {
-                const MIDIChannelEvent *pEvent = ( m_pInputState[i] >= 0 ? m_vEvents[m_pInputState[i]] : m_pNoteState[i] >= 0 ? m_vEvents[m_pNoteState[i]] : NULL );
-                const int iTrack = ( pEvent ? pEvent->GetTrack() : -1 );
-                const int iChannel = ( pEvent ? pEvent->GetChannel() : -1 );
-
-                int iAlpha = m_iNotesAlpha << 24;
+                int iAlpha = f.iNotesAlpha << 24;
                 if ( iAlpha )
                 {
-                    m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY, m_fWhiteCX - fKeyGap, fTopCY + fNearCY - 2.0f,
+                    m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY, f.fWhiteCX - fKeyGap, fTopCY + fNearCY - 2.0f,
                         m_csKBWhite.iDarkRGB, m_csKBWhite.iDarkRGB, m_csKBWhite.iPrimaryRGB, m_csKBWhite.iPrimaryRGB );
-                    m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY + fTopCY + fNearCY - 2.0f, m_fWhiteCX - fKeyGap, 2.0f, m_csKBWhite.iDarkRGB );
+                    m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY + fTopCY + fNearCY - 2.0f, f.fWhiteCX - fKeyGap, 2.0f, m_csKBWhite.iDarkRGB );
                 }
 
-                bool bBadLearn = ( m_eGameMode == Learn && m_iLearnOrdinal >= 0 && ( iTrack != m_iLearnTrack || iChannel != m_iLearnChannel ) );
-                ChannelSettings &csKBWhite = ( m_pInputState[i] == -2 || bBadLearn ||
-                                               pEvent->GetInputQuality() == MIDIChannelEvent::Missed ? m_csKBBadNote :
-                                               m_vTrackSettings[iTrack].aChannels[iChannel] );
-                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY, m_fWhiteCX - fKeyGap, fTopCY + fNearCY - 2.0f,
+                const ChannelSettings &csKBWhite = f.aKeyColors[i];
+                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY, f.fWhiteCX - fKeyGap, fTopCY + fNearCY - 2.0f,
                     csKBWhite.iDarkRGB | iAlpha, csKBWhite.iDarkRGB | iAlpha, csKBWhite.iPrimaryRGB | iAlpha, csKBWhite.iPrimaryRGB | iAlpha );
-                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY + fTopCY + fNearCY - 2.0f, m_fWhiteCX - fKeyGap, 2.0f, csKBWhite.iDarkRGB | iAlpha );
+                m_pRenderer->DrawRect( fCurX + fKeyGap1 , fCurY + fTopCY + fNearCY - 2.0f, f.fWhiteCX - fKeyGap, 2.0f, csKBWhite.iDarkRGB | iAlpha );
 
                 if ( i == MIDI::C4 )
                 {
-                    float fMXGap = floor( m_fWhiteCX * 0.25f + 0.5f );
-                    float fMCX = m_fWhiteCX - fMXGap * 2.0f - fKeyGap;
+                    float fMXGap = floor( f.fWhiteCX * 0.25f + 0.5f );
+                    float fMCX = f.fWhiteCX - fMXGap * 2.0f - fKeyGap;
                     float fMY = max( fCurY + fTopCY + fNearCY - fMCX - 7.0f, fCurY + fSharpCY + 5.0f );
                     if ( iAlpha )
                         m_pRenderer->DrawRect( fCurX + fKeyGap1 + fMXGap, fMY, fMCX, fCurY + fTopCY + fNearCY - 7.0f - fMY, m_csKBWhite.iDarkRGB );
                     m_pRenderer->DrawRect( fCurX + fKeyGap1 + fMXGap, fMY, fMCX, fCurY + fTopCY + fNearCY - 7.0f - fMY, csKBWhite.iDarkRGB | iAlpha );
                 }
             }
-            m_pRenderer->DrawRect( floor( fCurX + fKeyGap1 + m_fWhiteCX - fKeyGap + 0.5f ), fCurY, fKeyGap, fTopCY + fNearCY,
+            m_pRenderer->DrawRect( floor( fCurX + fKeyGap1 + f.fWhiteCX - fKeyGap + 0.5f ), fCurY, fKeyGap, fTopCY + fNearCY,
                 m_csKBBackground.iVeryDarkRGB, m_csKBBackground.iPrimaryRGB, m_csKBBackground.iPrimaryRGB, m_csKBBackground.iVeryDarkRGB );
 
-            fCurX += m_fWhiteCX;
+            fCurX += f.fWhiteCX;
         }
 
     // Draw the sharps
-    iStartRender = ( m_iStartNote != MIDI::A0 && !MIDI::IsSharp( m_iStartNote ) && m_iStartNote > 0 && MIDI::IsSharp( m_iStartNote - 1 ) ? m_iStartNote - 1 : m_iStartNote );
-    iEndRender = ( m_iEndNote != MIDI::C8 && !MIDI::IsSharp( m_iEndNote ) && m_iEndNote < 127 && MIDI::IsSharp( m_iEndNote + 1 ) ? m_iEndNote + 1 : m_iEndNote );
-    fStartX = ( MIDI::IsSharp( m_iStartNote ) ? m_fWhiteCX * SharpRatio / 2.0f : 0.0f );
+    iStartRender = ( f.iStartNote != MIDI::A0 && !MIDI::IsSharp( f.iStartNote ) && f.iStartNote > 0 && MIDI::IsSharp( f.iStartNote - 1 ) ? f.iStartNote - 1 : f.iStartNote );
+    iEndRender = ( f.iEndNote != MIDI::C8 && !MIDI::IsSharp( f.iEndNote ) && f.iEndNote < 127 && MIDI::IsSharp( f.iEndNote + 1 ) ? f.iEndNote + 1 : f.iEndNote );
+    fStartX = ( MIDI::IsSharp( f.iStartNote ) ? f.fWhiteCX * SharpRatio / 2.0f : 0.0f );
 
     float fSharpTop = SharpRatio * 0.7f;
-    fCurX = m_fNotesX + fStartX;
+    fCurX = f.fNotesX + fStartX;
     fCurY = fKeysY + fTransitionCY + fRedCY + fSpacerCY;
     for ( int i = iStartRender; i <= iEndRender; i++ )
         if ( !MIDI::IsSharp( i ) )
-            fCurX += m_fWhiteCX;
+            fCurX += f.fWhiteCX;
         else
         {
             float fNudgeX = 0.0;
@@ -2380,12 +2883,12 @@ void MainScreen::RenderKeys()
             if ( eNote == MIDI::CS || eNote == MIDI::FS ) fNudgeX = -SharpRatio / 5.0f;
             else if ( eNote == MIDI::AS || eNote == MIDI::DS ) fNudgeX = SharpRatio / 5.0f;
 
-            const float cx = m_fWhiteCX * SharpRatio;
-            const float x = fCurX - m_fWhiteCX * ( SharpRatio / 2.0f - fNudgeX );
-            const float fSharpTopX1 = x + m_fWhiteCX * ( SharpRatio - fSharpTop ) / 2.0f;
-            const float fSharpTopX2 = fSharpTopX1 + m_fWhiteCX * fSharpTop;
+            const float cx = f.fWhiteCX * SharpRatio;
+            const float x = fCurX - f.fWhiteCX * ( SharpRatio / 2.0f - fNudgeX );
+            const float fSharpTopX1 = x + f.fWhiteCX * ( SharpRatio - fSharpTop ) / 2.0f;
+            const float fSharpTopX2 = fSharpTopX1 + f.fWhiteCX * fSharpTop;
 
-            if ( m_pNoteState[i] == -1 && m_pInputState[i] == -1 )
+            if ( !f.aKeyDown[i] )
             {
                 m_pRenderer->DrawSkew( fSharpTopX1, fCurY + fSharpCY - fNearCY,
                                        fSharpTopX2, fCurY + fSharpCY - fNearCY,
@@ -2413,13 +2916,9 @@ void MainScreen::RenderKeys()
             }
             else
             {
-                const MIDIChannelEvent *pEvent = ( m_pInputState[i] >= 0 ? m_vEvents[m_pInputState[i]] : m_pNoteState[i] >= 0 ? m_vEvents[m_pNoteState[i]] : NULL );
-                const int iTrack = ( pEvent ? pEvent->GetTrack() : -1 );
-                const int iChannel = ( pEvent ? pEvent->GetChannel() : -1 );
-
                 const float fNewNear = fNearCY * 0.25f;
 
-                const int iAlpha = m_iNotesAlpha << 24;
+                const int iAlpha = f.iNotesAlpha << 24;
                 if ( iAlpha )
                 {
                     m_pRenderer->DrawSkew( fSharpTopX1, fCurY + fSharpCY - fNewNear,
@@ -2447,10 +2946,7 @@ void MainScreen::RenderKeys()
                                            m_csKBSharp.iPrimaryRGB, m_csKBSharp.iPrimaryRGB, m_csKBSharp.iVeryDarkRGB, m_csKBSharp.iVeryDarkRGB );
                 }
 
-                const bool bBadLearn = ( m_eGameMode == Learn && m_iLearnOrdinal >= 0 && ( iTrack != m_iLearnTrack || iChannel != m_iLearnChannel ) );
-                const ChannelSettings &csKBSharp = ( m_pInputState[i] == -2 || bBadLearn ||
-                                                     pEvent->GetInputQuality() == MIDIChannelEvent::Missed ? m_csKBBadNote :
-                                                     m_vTrackSettings[iTrack].aChannels[iChannel] );
+                const ChannelSettings &csKBSharp = f.aKeyColors[i];
                 m_pRenderer->DrawSkew( fSharpTopX1, fCurY + fSharpCY - fNewNear,
                                        fSharpTopX2, fCurY + fSharpCY - fNewNear,
                                        x + cx, fCurY + fSharpCY, x, fCurY + fSharpCY,
@@ -2478,38 +2974,38 @@ void MainScreen::RenderKeys()
         }
 }
 
-void MainScreen::RenderBorder()
+void MainScreen::RenderBorder( const Frame &f )
 {
     // Top, bottom, left, right
     const unsigned iBlack = 0x00000000;
     float fBufferCY = static_cast< float >( m_pRenderer->GetBufferHeight() );
-    m_pRenderer->DrawRect( m_fNotesX - 50.0f, m_fNotesY - 50.0f, m_fNotesCX + 100.0f, 50.0f, iBlack );
-    m_pRenderer->DrawRect( m_fNotesX - 50.0f, m_fNotesY + fBufferCY, m_fNotesCX + 100.0f, 50.0f, iBlack );
-    m_pRenderer->DrawRect( m_fNotesX - m_fWhiteCX, m_fNotesY - 50.0f, m_fWhiteCX, fBufferCY + 100.0f, iBlack );
-    m_pRenderer->DrawRect( m_fNotesX + m_fNotesCX, m_fNotesY - 50.0f, m_fWhiteCX, fBufferCY + 100.0f, iBlack );
+    m_pRenderer->DrawRect( f.fNotesX - 50.0f, f.fNotesY - 50.0f, f.fNotesCX + 100.0f, 50.0f, iBlack );
+    m_pRenderer->DrawRect( f.fNotesX - 50.0f, f.fNotesY + fBufferCY, f.fNotesCX + 100.0f, 50.0f, iBlack );
+    m_pRenderer->DrawRect( f.fNotesX - f.fWhiteCX, f.fNotesY - 50.0f, f.fWhiteCX, fBufferCY + 100.0f, iBlack );
+    m_pRenderer->DrawRect( f.fNotesX + f.fNotesCX, f.fNotesY - 50.0f, f.fWhiteCX, fBufferCY + 100.0f, iBlack );
 
     const float fPad = 10.0f;
-    const unsigned iBkg = m_csBackground.iPrimaryRGB;
-    m_pRenderer->DrawSkew( m_fNotesX, m_fNotesY + fBufferCY, m_fNotesX + m_fNotesCX, m_fNotesY + fBufferCY,
-                           m_fNotesX + m_fNotesCX + fPad, m_fNotesY + fBufferCY + fPad, m_fNotesX - fPad, m_fNotesY + fBufferCY + fPad,
+    const unsigned iBkg = f.csBackground.iPrimaryRGB;
+    m_pRenderer->DrawSkew( f.fNotesX, f.fNotesY + fBufferCY, f.fNotesX + f.fNotesCX, f.fNotesY + fBufferCY,
+                           f.fNotesX + f.fNotesCX + fPad, f.fNotesY + fBufferCY + fPad, f.fNotesX - fPad, f.fNotesY + fBufferCY + fPad,
                            iBkg, iBkg, iBlack, iBlack );
-    m_pRenderer->DrawSkew( m_fNotesX - fPad, m_fNotesY - fPad, m_fNotesX + m_fNotesCX + fPad, m_fNotesY - fPad,
-                           m_fNotesX + m_fNotesCX, m_fNotesY, m_fNotesX, m_fNotesY,
+    m_pRenderer->DrawSkew( f.fNotesX - fPad, f.fNotesY - fPad, f.fNotesX + f.fNotesCX + fPad, f.fNotesY - fPad,
+                           f.fNotesX + f.fNotesCX, f.fNotesY, f.fNotesX, f.fNotesY,
                            iBlack, iBlack, iBkg, iBkg );
-    m_pRenderer->DrawSkew( m_fNotesX - fPad, m_fNotesY - fPad, m_fNotesX, m_fNotesY,
-                           m_fNotesX, m_fNotesY + fBufferCY, m_fNotesX - fPad, m_fNotesY + fBufferCY + fPad,
+    m_pRenderer->DrawSkew( f.fNotesX - fPad, f.fNotesY - fPad, f.fNotesX, f.fNotesY,
+                           f.fNotesX, f.fNotesY + fBufferCY, f.fNotesX - fPad, f.fNotesY + fBufferCY + fPad,
                            iBlack, iBkg, iBkg, iBlack );
-    m_pRenderer->DrawSkew( m_fNotesX + m_fNotesCX, m_fNotesY, m_fNotesX + m_fNotesCX + fPad, m_fNotesY - fPad,
-                           m_fNotesX + m_fNotesCX + fPad, m_fNotesY + fBufferCY + fPad, m_fNotesX + m_fNotesCX, m_fNotesY + fBufferCY,
+    m_pRenderer->DrawSkew( f.fNotesX + f.fNotesCX, f.fNotesY, f.fNotesX + f.fNotesCX + fPad, f.fNotesY - fPad,
+                           f.fNotesX + f.fNotesCX + fPad, f.fNotesY + fBufferCY + fPad, f.fNotesX + f.fNotesCX, f.fNotesY + fBufferCY,
                            iBkg, iBlack, iBlack, iBkg );
 }
 
-void MainScreen::RenderText()
+void MainScreen::RenderText( const Frame &f )
 {
     int iLines = 2;
-    if ( m_bShowFPS ) iLines++;
-    if ( m_eGameMode == GameState::Learn ) iLines += 1;
-    else if ( m_InDevice.IsOpen() && m_bScored ) iLines += 1;
+    if ( f.bShowFPS ) iLines += 8;
+    if ( f.eGameMode == GameState::Learn ) iLines += 1;
+    else if ( f.bInDevice && f.bScored ) iLines += 1;
 
     // Screen info
     RECT rcStatus = { m_pRenderer->GetBufferWidth() - 156, 0, m_pRenderer->GetBufferWidth(), 6 + 16 * iLines };
@@ -2534,69 +3030,75 @@ void MainScreen::RenderText()
     unsigned iBkgColor = 0x40000000;
     m_pRenderer->DrawRect( static_cast< float >( rcStatus.left ), static_cast< float >( rcStatus.top ), 
         static_cast< float >( rcStatus.right - rcStatus.left ), static_cast< float >( rcStatus.bottom - rcStatus.top ), 0x80000000 );
-    if ( m_bZoomMove || m_bInstructions )
+    if ( f.bZoomMove || f.bInstructions )
         m_pRenderer->DrawRect( static_cast< float >( rcMsg.left ), static_cast< float >( rcMsg.top ), 
             static_cast< float >( rcMsg.right - rcMsg.left ), static_cast< float >( rcMsg.bottom - rcMsg.top ), iBkgColor );
-    else if ( m_iShowTop10 >= 0 )
+    else if ( f.iShowTop10 >= 0 )
     {
         m_pRenderer->DrawRect( static_cast< float >( rcTop10.left ), static_cast< float >( rcTop10.top ), 
             static_cast< float >( rcTop10.right - rcTop10.left ), static_cast< float >( rcTop10.bottom - rcTop10.top ), iBkgColor );
         m_pRenderer->DrawRect( static_cast< float >( xOffset ), static_cast< float >( rcTop10.top + 76 ), 
             static_cast< float >( pColBorders[iCols] ), 1.0f, 0x00FFFFFF );
-        if ( m_iShowTop10 < 10 )
-            m_pRenderer->DrawRect( static_cast< float >( xOffset ), static_cast< float >( rcTop10.top + 80 + m_iShowTop10 * 16 ), 
+        if ( f.iShowTop10 < 10 )
+            m_pRenderer->DrawRect( static_cast< float >( xOffset ), static_cast< float >( rcTop10.top + 80 + f.iShowTop10 * 16 ), 
                 static_cast< float >( pColBorders[iCols] ), 15.0f, 0x0066FF66 );
     }
 
     // Draw the text
     m_pRenderer->BeginText();
 
-    RenderStatus( &rcStatus );    
-    if ( m_bZoomMove )
+    RenderStatus( f, &rcStatus );    
+    if ( f.bZoomMove )
         RenderMessage( &rcMsg, TEXT( "- Left-click and drag to move the screen\n- Right-click and drag to zoom horizontally\n- Press Escape to abort changes\n- Press Ctrl+V to save changes" ) );
-    else if ( m_bInstructions && m_eGameMode == Play )
+    else if ( f.bInstructions && f.eGameMode == Play )
         RenderMessage( &rcMsg, TEXT( "You will be scored. Good luck.\n\nPlay any note when ready." ) );
-    else if ( m_bInstructions && m_eGameMode == Learn )
+    else if ( f.bInstructions && f.eGameMode == Learn )
         RenderMessage( &rcMsg, TEXT( "This mode will teach you a song, one track at a time.\nIn Adaptive mode, poorly played sections repeat at a slower rate.\nIn Waiting mode, notes will pause and wait to be played.\n\nPlay any note when ready." ) );
-    else if ( m_iShowTop10 >= 0 )
-        RenderTop10( &rcTop10, pColBorders );
-    else if ( m_tpMessage.IsAlive() )
-        m_tpMessage.Render( m_pRenderer, 0.0f, 0.0f );
-    else if ( m_tpLongMessage.IsAlive() )
-        m_tpLongMessage.Render( m_pRenderer, 0.0f, 0.0f );
+    else if ( f.iShowTop10 >= 0 )
+        RenderTop10( f, &rcTop10, pColBorders );
+    else if ( f.tpMessage.IsAlive() )
+        f.tpMessage.Render( m_pRenderer, 0.0f, 0.0f );
+    else if ( f.tpLongMessage.IsAlive() )
+        f.tpLongMessage.Render( m_pRenderer, 0.0f, 0.0f );
     
     m_pRenderer->EndText();
 }
 
-void MainScreen::RenderStatus( LPRECT prcStatus )
+void MainScreen::RenderStatus( const Frame &f, LPRECT prcStatus )
 {
     // Build the time text
     TCHAR sTime[128];
-    const MIDI::MIDIInfo &mInfo = m_MIDI.GetInfo();
-    if ( m_llStartTime >= 0 )
+        if ( f.llStartTime >= 0 )
         _stprintf_s( sTime, TEXT( "%lld:%04.1lf / %lld:%04.1lf" ),
-            m_llStartTime / 60000000, ( m_llStartTime % 60000000 ) / 1000000.0,
-            mInfo.llTotalMicroSecs / 60000000, ( mInfo.llTotalMicroSecs % 60000000 ) / 1000000.0 );
+            f.llStartTime / 60000000, ( f.llStartTime % 60000000 ) / 1000000.0,
+            f.llTotalMicroSecs / 60000000, ( f.llTotalMicroSecs % 60000000 ) / 1000000.0 );
     else
         _stprintf_s( sTime, TEXT( "\t-%lld:%04.1lf / %lld:%04.1lf" ),
-            -m_llStartTime / 60000000, ( -m_llStartTime % 60000000 ) / 1000000.0,
-            mInfo.llTotalMicroSecs / 60000000, ( mInfo.llTotalMicroSecs % 60000000 ) / 1000000.0 );
+            -f.llStartTime / 60000000, ( -f.llStartTime % 60000000 ) / 1000000.0,
+            f.llTotalMicroSecs / 60000000, ( f.llTotalMicroSecs % 60000000 ) / 1000000.0 );
 
     // Build the FPS text
-    TCHAR sFPS[128];
+    TCHAR sFPS[128], sJitter[128], sDrift[128], sTickRate[128], sDropped[128], sMerged[128], sOptimized[128], sLoad[128];
     _stprintf_s( sFPS, TEXT( "%.1lf" ), m_dFPS );
+    _stprintf_s( sJitter, TEXT( "%.2lf ms" ), m_dJitter / 1000.0 );
+    _stprintf_s( sDrift, TEXT( "%+.1lf ms" ), m_ClockStats.GetDrift() / 1000.0 );
+    _stprintf_s( sTickRate, TEXT( "%.1lf Hz" ), f.dTickRate );
+    _stprintf_s( sDropped, TEXT( "%lld" ), f.llNotesDropped );
+    _stprintf_s( sMerged, TEXT( "%lld" ), f.llNotesMerged );
+    _stprintf_s( sOptimized, TEXT( "%d" ), f.iEventsOptimized );
+    _stprintf_s( sLoad, TEXT( "%lld ms" ), f.llLoadMicroSecs / 1000 );
     
     // Build the Scoring text
     TCHAR sScore[128] = TEXT( "N/A" ), sMult[128] = TEXT( "" );
-    if ( m_InDevice.IsOpen() && m_bScored )
+    if ( f.bInDevice && f.bScored )
     {
-        Util::CommaPrintf( sScore, m_Score.GetScore() );
-        _stprintf_s( sMult, TEXT( "x%d.%d" ), m_Score.GetMult() / 10, m_Score.GetMult() % 10 );
+        Util::CommaPrintf( sScore, f.iScore );
+        _stprintf_s( sMult, TEXT( "x%d.%d" ), f.iMult / 10, f.iMult % 10 );
     }
 
     // Build the learning text
-    TCHAR sLearn[128] = TEXT( "All Tracks" ), *sMode = ( m_eLearnMode == GameState::Adaptive ? TEXT( "Adaptive" ) : TEXT( "Waiting" ) );
-    if ( m_iLearnOrdinal >= 0 ) _stprintf_s( sLearn, TEXT( "Track %d" ), m_iLearnOrdinal + 1 );
+    TCHAR sLearn[128] = TEXT( "All Tracks" ), *sMode = ( f.eLearnMode == GameState::Adaptive ? TEXT( "Adaptive" ) : TEXT( "Waiting" ) );
+    if ( f.iLearnOrdinal >= 0 ) _stprintf_s( sLearn, TEXT( "Track %d" ), f.iLearnOrdinal + 1 );
 
     // Display the text
     InflateRect( prcStatus, -6, -3 );
@@ -2608,7 +3110,7 @@ void MainScreen::RenderStatus( LPRECT prcStatus )
     m_pRenderer->DrawText( TEXT( "Time:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
     m_pRenderer->DrawText( sTime, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
 
-    if ( m_bShowFPS )
+    if ( f.bShowFPS )
     {
         OffsetRect( prcStatus, 2, 16 + 1 );
         m_pRenderer->DrawText( TEXT( "FPS:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
@@ -2616,9 +3118,58 @@ void MainScreen::RenderStatus( LPRECT prcStatus )
         OffsetRect( prcStatus, -2, -1 );
         m_pRenderer->DrawText( TEXT( "FPS:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
         m_pRenderer->DrawText( sFPS, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Jitter:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sJitter, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Jitter:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sJitter, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Drift:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sDrift, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Drift:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sDrift, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Logic:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sTickRate, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Logic:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sTickRate, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Dropped:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sDropped, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Dropped:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sDropped, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Merged:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sMerged, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Merged:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sMerged, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Optimized:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sOptimized, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Optimized:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sOptimized, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
+
+        OffsetRect( prcStatus, 2, 16 + 1 );
+        m_pRenderer->DrawText( TEXT( "Load:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
+        m_pRenderer->DrawText( sLoad, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
+        OffsetRect( prcStatus, -2, -1 );
+        m_pRenderer->DrawText( TEXT( "Load:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
+        m_pRenderer->DrawText( sLoad, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
     }
 
-    if ( m_eGameMode != GameState::Learn )
+    if ( f.eGameMode != GameState::Learn )
     {
         OffsetRect( prcStatus, 2, 16 + 1 );
         m_pRenderer->DrawText( TEXT( "Score:" ), Renderer::Small, prcStatus, 0, 0xFF404040 );
@@ -2627,7 +3178,7 @@ void MainScreen::RenderStatus( LPRECT prcStatus )
         m_pRenderer->DrawText( TEXT( "Score:" ), Renderer::Small, prcStatus, 0, 0xFFFFFFFF );
         m_pRenderer->DrawText( sScore, Renderer::Small, prcStatus, DT_RIGHT, 0xFFFFFFFF );
 
-        if ( m_InDevice.IsOpen() && m_bScored )
+        if ( f.bInDevice && f.bScored )
         {
             OffsetRect( prcStatus, 2, 16 + 1 );
             m_pRenderer->DrawText( sMult, Renderer::Small, prcStatus, DT_RIGHT, 0xFF404040 );
@@ -2650,9 +3201,9 @@ void MainScreen::RenderStatus( LPRECT prcStatus )
     }
 }
 
-void MainScreen::RenderTop10( LPRECT prcTop10, int pColBorders[9] )
+void MainScreen::RenderTop10( const Frame &f, LPRECT prcTop10, int pColBorders[9] )
 {
-    if ( m_iShowTop10 < 0 ) return;
+    if ( f.iShowTop10 < 0 ) return;
 
     OffsetRect( prcTop10, 0, 4 );
 
@@ -2669,14 +3220,16 @@ void MainScreen::RenderTop10( LPRECT prcTop10, int pColBorders[9] )
     int xOffset = ( ( prcTop10->right - prcTop10->left ) - pColBorders[iCols] ) / 2;
 
     //Draw the message
+    const vector< PFAData::Score > &vTop10 = f.pLibrary->vTop10;
+    int iTop10Size = static_cast< int >( vTop10.size() );
     TCHAR *sMsg = TEXT( "You didn't make it. Practice!" );
-    if ( m_iShowTop10 < 1 &&  m_pFileInfo->top10_size() > 1 )
+    if ( f.iShowTop10 < 1 &&  iTop10Size > 1 )
         sMsg = TEXT( "First place! Awesome!" );
-    else if ( m_iShowTop10 < 3 &&  m_pFileInfo->top10_size() > 3 )
+    else if ( f.iShowTop10 < 3 &&  iTop10Size > 3 )
         sMsg = TEXT( "You made the top 3! Congratulations!" );
-    else if ( m_iShowTop10 < 10 && ( m_pFileInfo->top10_size() > m_iShowTop10 + 1 || m_iShowTop10 == 9 || m_iShowTop10 == 0 ) )
+    else if ( f.iShowTop10 < 10 && ( iTop10Size > f.iShowTop10 + 1 || f.iShowTop10 == 9 || f.iShowTop10 == 0 ) )
         sMsg = TEXT( "You made the top 10!" );
-    else if ( m_iShowTop10 < 10 )
+    else if ( f.iShowTop10 < 10 )
         sMsg = TEXT( "Last place..." );
     OffsetRect( prcTop10, 1, 1 );
     m_pRenderer->DrawText( sMsg, Renderer::Small, prcTop10, DT_CENTER | DT_SINGLELINE, 0xFF000000 );
@@ -2696,11 +3249,11 @@ void MainScreen::RenderTop10( LPRECT prcTop10, int pColBorders[9] )
     OffsetRect( prcTop10, 0, 20 );
 
     TCHAR buf[128];
-    for ( int r = 0; r < m_pFileInfo->top10_size(); r++ )
+    for ( int r = 0; r < iTop10Size; r++ )
     {
-        int iTextColor = ( r == m_iShowTop10 ? 0xFF000000 : 0xFFFFFFFF );
-        int iBkgColor = ( r == m_iShowTop10 ? 0xFFFFFFFF : 0xFF404040 );
-        const PFAData::Score &dScore = m_pFileInfo->top10( r );
+        int iTextColor = ( r == f.iShowTop10 ? 0xFF000000 : 0xFFFFFFFF );
+        int iBkgColor = ( r == f.iShowTop10 ? 0xFFFFFFFF : 0xFF404040 );
+        const PFAData::Score &dScore = vTop10[r];
         int iNotes = dScore.great() + dScore.good() + dScore.ok() + dScore.incorrect() + dScore.missed();
         for ( int c = 0; c < iCols; c++ )
         {
@@ -2745,7 +3298,7 @@ void MainScreen::RenderMessage( LPRECT prcMsg, TCHAR *sMsg )
     m_pRenderer->DrawText( sMsg, eFontSize, &rcMsg, 0, 0xFFFFFFFF );
 }
 
-void TextPath::Render( Renderer *pRenderer, float xOffset, float yOffset )
+void TextPath::Render( Renderer *pRenderer, float xOffset, float yOffset ) const
 {
     if ( !IsAlive() ) return;
 
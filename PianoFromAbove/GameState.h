@@ -11,6 +11,7 @@
 
 #include <Windows.h>
 #include <map>
+#include <memory>
 #include <string>
 using namespace std;
 
@@ -29,6 +30,7 @@ public:
     enum GameError { Success = 0, BadPointer, OutOfMemory, DirectXError, NoInputDevice, BadInputDevice };
     enum State { Intro = 0, Splash, Practice = 160, Play, Learn };
     enum LearnMode { Adaptive, Waiting };
+    static const int LogicRate = 250; // Ticks a second for decoupled states when vsync paces the drawing
 
     //Static methods
     static const wstring Errors[];
@@ -47,9 +49,16 @@ public:
     //Run logic
     virtual GameError Logic() = 0;
 
-    //Render scene
+    //Render scene. Called on the render thread
     virtual GameError Render() = 0;
 
+    //Nothing on screen is moving. Frames can slow right down till a message comes in
+    virtual bool IsIdle() const { return false; }
+
+    //Render only draws what Logic published, so it can run alongside Logic and MsgProc.
+    //Otherwise the game thread waits for each frame to be drawn before going on
+    virtual bool IsDecoupled() const { return false; }
+
     //Null for same state, 
     GameState *NextState() { return m_pNextState; };
 
@@ -68,6 +77,47 @@ protected:
     static const int QueueSize = 50;
 };
 
+//-----------------------------------------------------------------------------
+// The render thread. Owns the renderer: Direct3D is only ever used from here,
+// so Present's wait for vsync never holds up the game thread. The game thread
+// says when Logic's done. Decoupled states are drawn whenever there's a new
+// frame, while the game thread gets on with input and playback. The rest are
+// drawn in lockstep, with the game thread waiting on each frame.
+//-----------------------------------------------------------------------------
+
+class RenderThread
+{
+public:
+    RenderThread();
+    ~RenderThread();
+
+    // Creates the renderer on the new thread. Fails if that does
+    HRESULT Start( HWND hWnd, bool bLimitFPS );
+    void Stop();
+    Renderer *GetRenderer() const { return m_pRenderer; }
+
+    // Game thread. Same as GameState::ChangeState, once the old state's done being drawn
+    GameState::GameError ChangeState( GameState *pNextState, GameState **pDestObj );
+
+    // Game thread, after each Logic. Waits for the frame to be drawn if asked to
+    void FrameDone( bool bWait );
+
+private:
+    void Run( HWND hWnd, bool bLimitFPS );
+
+    thread m_Thread;
+    Renderer *m_pRenderer;
+    HRESULT m_hrInit;
+
+    mutex m_StateMutex; // Held while drawing
+    GameState *m_pState;
+
+    mutex m_FrameMutex; // Guards the rest
+    condition_variable m_cvFrame, m_cvDrawn;
+    int m_iFrame, m_iDrawn;
+    bool m_bStarted, m_bQuit;
+};
+
 struct ChannelSettings
 {
     ChannelSettings() { bHidden = bMuted = bScored = false; SetColor( 0x00000000 ); }
@@ -115,6 +165,7 @@ private:
     bool m_bMute;
 
     MIDIOutDevice m_OutDevice;
+    MIDIOutStream m_OutStream; // What Logic plays goes out once a frame
 
     static const float SharpRatio;
     static const long long TimeSpan = 3000000;
@@ -190,19 +241,24 @@ class TextPath
 public:
     struct TextPathVertex { float x, y, t; int a; };
 
-    void SetPath( const vector< TextPathVertex > &vPath ) { m_vPath = vPath; }
+    TextPath() : m_pPath( NULL ), m_iPos( 0 ), m_sText( NULL ) { }
+
+    // Not copied. Has to outlive the path and any copies of it, which then copy cheaply into frames
+    void SetPath( const vector< TextPathVertex > *pPath ) { m_pPath = pPath; }
     void SetFont( Renderer::FontSize fFont ) { m_fFont = fFont; }
     void Reset( float xOffset, float yOffset, unsigned iColor, const wchar_t *sText )
         { m_t = 0.0f; m_iPos = 0; m_xOffset = xOffset; m_yOffset = yOffset; m_iColor = iColor; m_sText = sText; }
 
-    bool IsAlive() const { return m_iPos < static_cast< int >( m_vPath.size() ) - 1; }
-    void Kill() { m_iPos = (int)m_vPath.size() - 1; }
+    bool IsAlive() const { return m_pPath && m_iPos < static_cast< int >( m_pPath->size() ) - 1; }
+    void Kill() { m_iPos = ( m_pPath ? (int)m_pPath->size() - 1 : 0 ); }
+    const wchar_t *GetText() const { return m_sText; }
+    void SetText( const wchar_t *sText ) { m_sText = sText; }
 
     void Logic( long long llElapsed );
-    void Render( Renderer *pRenderer, float xOffset, float yOffset );
+    void Render( Renderer *pRenderer, float xOffset, float yOffset ) const;
 
 private:
-    vector< TextPathVertex > m_vPath;
+    const vector< TextPathVertex > *m_pPath;
     Renderer::FontSize m_fFont;
     float m_xOffset, m_yOffset, m_t, m_x, m_y;
     int m_iPos;
@@ -210,22 +266,32 @@ private:
     const wchar_t *m_sText;
 };
 
-class MainScreen : public GameState
+class MainScreen : public GameState, private MIDIEventSink
 {
 public:
     static const float KBPercent;
 
-    MainScreen( wstring sMIDIFile, State eGameMode, HWND hWnd, Renderer *pRenderer );
+    MainScreen( wstring sMIDIFile, State eGameMode, HWND hWnd, Renderer *pRenderer, LoadProgress *pProgress = NULL, bool bStream = false );
+    ~MainScreen();
 
     // GameState functions
     GameError MsgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam );
     GameError Init();
     GameError Logic( void );
     GameError Render( void );
+    bool IsIdle() const;
+    bool IsDecoupled() const { return true; }
+
+    // Hooks up scores and labels from the song library. Call on the UI thread once loaded
+    void InitLibrary();
+    void SetLoadTime( long long llMicroSecs ) { m_llLoadMicroSecs = llMicroSecs; } // Shown with the FPS
 
     // Info
     bool IsValid() const { return m_MIDI.IsValid(); }
+    bool IsStreaming() const { return m_bStreaming; }
     const MIDI& GetMIDI() const { return m_MIDI; }
+    long long GetMinTime() const { return m_MIDI.GetInfo().llFirstNote - 3000000; } // What the position bar spans
+    long long GetMaxTime() const { return ( m_bStreaming ? m_llStreamLength : m_MIDI.GetInfo().llTotalMicroSecs ) + 500000; }
 
     // Settings
     void ToggleMuted( int iTrack, int iChannel ) { m_vTrackSettings[iTrack].aChannels[iChannel].bMuted =
@@ -242,12 +308,92 @@ public:
 private:
     typedef vector< pair< long long, int > > eventvec_t;
 
+    // A frame as Logic left it. Render draws from this and nothing else Logic or MsgProc write,
+    // so the two can run on different threads
+    struct FrameNote
+    {
+        int iPos, iNote, iLabel; // Label is in the frame library's vLabels, -1 for none
+        long long llNoteStart, llNoteEnd; // End is -1 while the rest of the song's streaming in
+        bool bWaiting, bOutline;
+        unsigned iPrimaryRGB, iDarkRGB, iVeryDarkRGB, iLabelRGB;
+    };
+    // Labels and top 10. These hardly ever change, so frames share one copy till they do
+    struct FrameLibrary
+    {
+        vector< string > vLabels;
+        vector< PFAData::Score > vTop10; // No more than 10
+    };
+    struct Frame
+    {
+        Frame() : iLibraryVersion( -1 ) { }
+
+        // Time. Render carries the start time forward by how long ago the frame was made
+        long long llFrameTime; // Timer::GetNanoSecsNow
+        double dSpeed; // 0 when time's not moving
+        long long llStartTime, llTimeSpan, llTotalMicroSecs, llMinTime;
+        long long llRndStartTime; // Rounded start time to make stuff drop at the same time. Set by Render
+
+        // Layout, from RenderGlobals
+        int iStartNote, iEndNote, iAllWhiteKeys;
+        float fNotesX, fNotesY, fNotesCX, fNotesCY, fWhiteCX;
+        bool bShowKB;
+        ChannelSettings csBackground;
+
+        // Notes. The ones already on come first
+        vector< FrameNote > vNotes;
+        int iStateNotes;
+        vector< long long > vMeasures; // Times of the measure lines
+        bool bNoteLabels;
+        int iNotesAlpha, iWaitingAlpha;
+
+        // Keyboard
+        bool aKeyDown[128];
+        ChannelSettings aKeyColors[128];
+
+        // Mouse
+        bool bPaused, bHaveMouse, bZoomMove;
+        int iHotNote, iSelectedNote;
+        POINT ptLastPos;
+
+        // Text
+        TextPath tpParticles[128], tpMessage, tpLongMessage;
+        wchar_t sMessage[128], sLongMessage[128];
+        State eGameMode;
+        LearnMode eLearnMode;
+        int iLearnOrdinal;
+        bool bShowFPS, bInstructions, bScored, bInDevice;
+        int iScore, iMult;
+        double dTickRate;
+        long long llNotesDropped, llNotesMerged;
+        int iEventsOptimized;
+        long long llLoadMicroSecs;
+        int iShowTop10;
+
+        // Library. Only reassigned when the version moves on
+        shared_ptr< const FrameLibrary > pLibrary;
+        int iLibraryVersion;
+    };
+
     // Initialization
-    void InitNoteMap( const vector< MIDIEvent* > &vEvents );
+    void InitNoteMap();
+    void AddEvent( MIDIEvent *pEvent );
+    void IndexEvent( int iPos );
+    void OptimizeEvents();
+    int GetSourcePos( int iEvent ) const;
+    int FindSourcePos( int iSourcePos ) const;
     void InitColors();
     void InitLabels();
     void InitState();
     void InitLearning( bool bResetMinTime = true );
+    void InitStream( LoadProgress *pProgress );
+    void SetChannelSettings( int iTrack, int iChannel, size_t iPos );
+
+    // Incremental loading
+    void StreamProc();
+    void PollStream();
+    void AddStreamedEvent( MIDIEvent *pEvent );
+    void FinishStream();
+    void StopStream();
 
     // Logic
     void UpdateState( int iPos );
@@ -273,22 +419,27 @@ private:
     int GetBeat( int iTick, int iBeatType, int iLastTempoTick );
     int GetBeatTick( int iTick, int iBeatType, int iLastTempoTick );
     int GetMetTick( int iTick, int iClocksPerMet, int iLastSignatureTick );
-    long long GetMinTime() const { return m_MIDI.GetInfo().llFirstNote - 3000000; }
-    long long GetMaxTime() const { return m_MIDI.GetInfo().llTotalMicroSecs + 500000; }
+
+    // Frames. Logic publishes, Render draws on the render thread
+    void PublishFrame( bool bTimeMoving );
+    void AddFrameNote( Frame &f, int iPos );
+    void BuildFrameLibrary();
+    void FindMeasures( Frame &f, long long llEndTime );
 
     // Rendering
     void RenderGlobals();
-    void RenderLines();
-    void RenderNotes();
-    void RenderNote( int iPos );
-    void RenderLabels();
-    bool RenderLabel( int iPos, bool bSetState );
-    float GetNoteX( int iNote );
-    void RenderKeys();
-    void RenderBorder();
-    void RenderText();
-    void RenderStatus( LPRECT prcPos );
-    void RenderTop10( LPRECT prcTop10, int pColBorders[9] );
+    void RenderLines( const Frame &f );
+    void RenderNotes( const Frame &f );
+    void RenderNote( const Frame &f, const FrameNote &note );
+    void RenderLabels( const Frame &f );
+    bool RenderLabel( const Frame &f, const FrameNote &note, bool bSetState );
+    float GetNoteX( int iNote ) { return GetNoteX( iNote, m_iStartNote, m_fNotesX, m_fWhiteCX ); }
+    static float GetNoteX( int iNote, int iStartNote, float fNotesX, float fWhiteCX );
+    void RenderKeys( const Frame &f );
+    void RenderBorder( const Frame &f );
+    void RenderText( const Frame &f );
+    void RenderStatus( const Frame &f, LPRECT prcPos );
+    void RenderTop10( const Frame &f, LPRECT prcTop10, int pColBorders[9] );
     void RenderMessage( LPRECT prcMsg, TCHAR *sMsg );
 
     // MIDI info
@@ -300,6 +451,9 @@ private:
     eventvec_t m_vProgramChange; // Tracked so we don't jump over them during random access
     eventvec_t m_vTempo; // Tracked for drawing measure lines
     eventvec_t m_vSignature; // Measure lines again
+    MIDI::OptimizeStats m_OptimizeStats; // What OptimizeEvents took out
+    vector< int > m_vSourcePos; // Each event's position before OptimizeEvents, which is what labels store. Empty if not optimized
+    long long m_llLoadMicroSecs; // Reading, parsing and merging
     eventvec_t::const_iterator m_itNextProgramChange;
     eventvec_t::const_iterator m_itNextTempo;
     eventvec_t::const_iterator m_itNextSignature;
@@ -307,6 +461,20 @@ private:
     long long m_llLastTempoTime; // Tempo
     int m_iBeatsPerMeasure, m_iBeatType, m_iClocksPerMet, m_iLastSignatureTick; // Time signature
 
+    // Incremental loading. The stream thread merges the song ahead of playback and Logic picks up what's new
+    static const long long StreamPrimeTime = 5000000; // Merged past the first note before playback can start
+    bool m_bStreaming;
+    long long m_llStreamTime; // Everything before this has been added
+    long long m_llStreamLength; // Guess at the song length until it's all in
+    vector< MIDIEvent* > m_vStreamBatch; // Being added. Kept around to reuse the memory
+    thread m_StreamThread;
+    atomic< bool > m_bStopStream;
+    mutex m_StreamMutex; // Guards the next four
+    vector< MIDIEvent* > m_vStreamEvents; // Merged but not picked up yet
+    long long m_llStreamShared;
+    double m_dStreamFraction;
+    bool m_bStreamDone;
+
     // Playback
     State m_eGameMode;
     int m_iStartPos, m_iEndPos; // Postions of the start and end events that occur in the current window
@@ -341,20 +509,41 @@ private:
     wchar_t m_sBuf[128];
     TextPath m_tpMessage, m_tpLongMessage;
     TextPath m_tpParticles[128];
+    vector< TextPath::TextPathVertex > m_vParticlePath, m_vMessagePath, m_vLongMessagePath; // The TextPaths point at these
     PFAData::FileInfo *m_pFileInfo;
+    int m_iFileInfoPos; // In the library, for journaling changes to m_pFileInfo
 
     // Labeling
-    int m_iHotNote, m_iNextHotNote, m_iSelectedNote;
+    int m_iHotNote, m_iSelectedNote;
+    atomic< int > m_iNextHotNote; // Under the mouse in the last frame drawn
     bool m_bHaveMouse;
     
-    // FPS variables
+    // FPS variables. Frames are counted by Render, logic ticks by Logic
     bool m_bShowFPS;
+    int m_iTickCount;
+    long long m_llTickTime;
+    double m_dTickRate;
+
+    // Frames
+    static const long long MaxFrameAge = 100000; // How far Render will carry a frame's time forward
+    TripleBuffer< Frame > m_Frames;
+    shared_ptr< const FrameLibrary > m_pFrameLibrary;
+    map< int, int > m_mFrameLabels; // Event position -> index into m_pFrameLibrary's labels
+    int m_iLibraryVersion, m_iFrameLibraryVersion; // Bumped on every label or top 10 change, and what m_pFrameLibrary was built from
+
+    // Render thread only
+    Timer m_RenderTimer;
     int m_iFPSCount;
     long long m_llFPSTime;
     double m_dFPS;
+    ClockDiagnostics m_ClockStats; // Frame jitter and clock drift, shown with the FPS
+    double m_dJitter;
+    int m_iRenderHotNote;
 
     // Devices
     MIDIOutDevice m_OutDevice;
+    MIDIOutStream m_OutStream; // What Logic plays goes out once a frame
+    MIDIVoiceGovernor m_Governor; // Between the stream and the device
     MIDIInDevice m_InDevice;
 
     // Metronome
@@ -371,6 +560,9 @@ private:
     ChannelSettings m_csBackground;
     ChannelSettings m_csKBRed, m_csKBWhite, m_csKBSharp, m_csKBBackground, m_csKBBadNote;
     vector< TrackSettings > m_vTrackSettings;
+    vector< bool > m_vChannelScored, m_vChannelMuted, m_vChannelHidden; // Kept for channels that are streamed in later
+    vector< unsigned > m_vChannelColor;
+    int m_iChannelsSet; // -1 until SetChannelSettings
 
     float m_fZoomX, m_fOffsetX, m_fOffsetY;
     float m_fTempZoomX, m_fTempOffsetX, m_fTempOffsetY;
@@ -382,5 +574,4 @@ private:
     float m_fNotesX, m_fNotesY, m_fNotesCX, m_fNotesCY; // Notes position
     int m_iAllWhiteKeys; // Number of white keys are on the screen
     float m_fWhiteCX; // Width of the white keys
-    long long m_llRndStartTime; // Rounded start time to make stuff drop at the same time
 };
\ No newline at end of file
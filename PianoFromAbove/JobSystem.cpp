@@ -0,0 +1,241 @@
+/*************************************************************************************************
+*
+* File: JobSystem.cpp
+*
+* Description: Implements the shared pool of worker threads
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <Windows.h>
+#include <algorithm>
+
+#include "JobSystem.h"
+#include "Misc.h"
+
+JobSystem &JobSystem::GetJobSystem()
+{
+    static JobSystem jobSystem;
+    return jobSystem;
+}
+
+// All the workers are made before any start, so they can look at each other from the get go
+JobSystem::JobSystem() : m_iQueued( 0 ), m_iSleeping( 0 ), m_bQuit( false )
+{
+    int iWorkers = max( static_cast< int >( thread::hardware_concurrency() ) - 1, 1 );
+    for ( int i = 0; i < iWorkers; i++ )
+        m_vWorkers.push_back( new Worker() );
+    for ( int i = 0; i < iWorkers; i++ )
+        m_vWorkers[i]->thWorker = thread( &JobSystem::Work, this, i );
+}
+
+// Jobs that haven't started are dropped
+JobSystem::~JobSystem()
+{
+    {
+        lock_guard< mutex > lock( m_SleepMutex );
+        m_bQuit = true;
+    }
+    m_cvWork.notify_all();
+    for ( vector< Worker* >::iterator it = m_vWorkers.begin(); it != m_vWorkers.end(); ++it )
+    {
+        ( *it )->thWorker.join();
+        delete *it;
+    }
+}
+
+// Workers keep what they make for themselves. Everyone else goes through the shared queue
+void JobSystem::Submit( const function< void() > &fnJob, Priority ePriority, JobGroup *pGroup )
+{
+    if ( pGroup ) pGroup->m_iPending++;
+
+    int iWorker = FindWorker();
+    JobQueue &jqJobs = ( iWorker >= 0 ? m_vWorkers[iWorker]->jqJobs : m_Shared );
+    {
+        lock_guard< mutex > lock( jqJobs.mLock );
+        jqJobs.aJobs[ePriority].push_back( Job( fnJob, pGroup ) );
+    }
+
+    bool bWake;
+    {
+        lock_guard< mutex > lock( m_SleepMutex );
+        m_iQueued++;
+        bWake = ( m_iSleeping > 0 );
+    }
+    if ( bWake ) m_cvWork.notify_one();
+}
+
+// A worker never just blocks: its group might be sitting in its own deque. Other threads only
+// help with high priority work so they don't get stuck behind a long background job
+void JobSystem::Wait( JobGroup &group )
+{
+    int iWorker = FindWorker();
+    int iMaxPriority = ( iWorker >= 0 ? PriorityCount - 1 : High );
+    Job job;
+    Priority ePriority;
+    while ( !group.IsDone() )
+    {
+        if ( FindJob( iWorker, iMaxPriority, job, ePriority ) )
+        {
+            RunJob( job );
+            continue;
+        }
+
+        unique_lock< mutex > lock( m_DoneMutex );
+        m_cvDone.wait( lock, [&]() { return group.IsDone(); } );
+    }
+}
+
+// One job per worker, each taking the next index till there are none left. The caller takes
+// them too, so it never sits there waiting for a worker to get around to it
+void JobSystem::ParallelFor( int iCount, const function< void( int ) > &fnBody, Priority ePriority )
+{
+    atomic< int > iNext( 0 );
+    auto fnWork = [&]()
+    {
+        for ( int i = iNext++; i < iCount; i = iNext++ )
+            fnBody( i );
+    };
+
+    JobGroup group;
+    int iJobs = min( iCount - 1, GetWorkerCount() );
+    for ( int i = 0; i < iJobs; i++ )
+        Submit( fnWork, ePriority, &group );
+    fnWork();
+    Wait( group );
+}
+
+void JobSystem::GetStats( vector< WorkerStats > &vStats ) const
+{
+    vStats.resize( m_vWorkers.size() );
+    for ( size_t i = 0; i < m_vWorkers.size(); i++ )
+    {
+        vStats[i].llBusyMicroSecs = m_vWorkers[i]->llBusyMicroSecs;
+        vStats[i].llIdleMicroSecs = m_vWorkers[i]->llIdleMicroSecs;
+        vStats[i].iJobs = m_vWorkers[i]->iJobs;
+        vStats[i].iSteals = m_vWorkers[i]->iSteals;
+    }
+}
+
+void JobSystem::ResetStats()
+{
+    for ( vector< Worker* >::iterator it = m_vWorkers.begin(); it != m_vWorkers.end(); ++it )
+    {
+        ( *it )->llBusyMicroSecs = ( *it )->llIdleMicroSecs = 0;
+        ( *it )->iJobs = ( *it )->iSteals = 0;
+    }
+}
+
+int JobSystem::FindWorker() const
+{
+    thread::id idThis = this_thread::get_id();
+    for ( size_t i = 0; i < m_vWorkers.size(); i++ )
+        if ( m_vWorkers[i]->thWorker.get_id() == idThis )
+            return static_cast< int >( i );
+    return -1;
+}
+
+// Best priority first. Within one: our own newest job (its data is still in cache), then the
+// shared queue, then the oldest job of whoever's next over
+bool JobSystem::FindJob( int iWorker, int iMaxPriority, Job &job, Priority &ePriority )
+{
+    int iWorkers = GetWorkerCount();
+    for ( int p = 0; p <= iMaxPriority; p++ )
+    {
+        if ( iWorker >= 0 )
+        {
+            JobQueue &jqOwn = m_vWorkers[iWorker]->jqJobs;
+            lock_guard< mutex > lock( jqOwn.mLock );
+            if ( !jqOwn.aJobs[p].empty() )
+            {
+                job = jqOwn.aJobs[p].back();
+                jqOwn.aJobs[p].pop_back();
+                ePriority = static_cast< Priority >( p );
+                m_iQueued--;
+                return true;
+            }
+        }
+
+        {
+            lock_guard< mutex > lock( m_Shared.mLock );
+            if ( !m_Shared.aJobs[p].empty() )
+            {
+                job = m_Shared.aJobs[p].front();
+                m_Shared.aJobs[p].pop_front();
+                ePriority = static_cast< Priority >( p );
+                m_iQueued--;
+                return true;
+            }
+        }
+
+        for ( int i = 1; i <= iWorkers; i++ )
+        {
+            int iVictim = ( max( iWorker, 0 ) + i ) % iWorkers;
+            if ( iVictim == iWorker ) continue;
+
+            JobQueue &jqVictim = m_vWorkers[iVictim]->jqJobs;
+            lock_guard< mutex > lock( jqVictim.mLock );
+            if ( !jqVictim.aJobs[p].empty() )
+            {
+                job = jqVictim.aJobs[p].front();
+                jqVictim.aJobs[p].pop_front();
+                ePriority = static_cast< Priority >( p );
+                m_iQueued--;
+                if ( iWorker >= 0 ) m_vWorkers[iWorker]->iSteals++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void JobSystem::RunJob( Job &job )
+{
+    job.fnRun();
+    if ( job.pGroup && --job.pGroup->m_iPending == 0 )
+    {
+        lock_guard< mutex > lock( m_DoneMutex );
+        m_cvDone.notify_all();
+    }
+}
+
+// A worker. The thread's priority follows the job's, but only changes when it has to
+void JobSystem::Work( int iWorker )
+{
+    Worker &worker = *m_vWorkers[iWorker];
+    Priority eRunning = High;
+    Job job;
+    Priority ePriority;
+    for (;;)
+    {
+        if ( FindJob( iWorker, PriorityCount - 1, job, ePriority ) )
+        {
+            if ( ePriority != eRunning )
+            {
+                SetThreadPriority( GetCurrentThread(), ePriority == Background ? THREAD_PRIORITY_IDLE : THREAD_PRIORITY_NORMAL );
+                eRunning = ePriority;
+            }
+
+            long long llStart = Timer::GetNanoSecsNow();
+            RunJob( job );
+            job = Job(); // Lets go of whatever the job held on to
+            worker.llBusyMicroSecs += ( Timer::GetNanoSecsNow() - llStart ) / 1000;
+            worker.iJobs++;
+            continue;
+        }
+
+        // Nothing anywhere. If a job's on its way (counted but not yet found) go look again
+        long long llStart = Timer::GetNanoSecsNow();
+        {
+            unique_lock< mutex > lock( m_SleepMutex );
+            if ( !m_bQuit && m_iQueued == 0 )
+            {
+                m_iSleeping++;
+                m_cvWork.wait( lock );
+                m_iSleeping--;
+            }
+            if ( m_bQuit ) return;
+        }
+        worker.llIdleMicroSecs += ( Timer::GetNanoSecsNow() - llStart ) / 1000;
+    }
+}
@@ -0,0 +1,129 @@
+/*************************************************************************************************
+*
+* File: JobSystem.h
+*
+* Description: Defines the shared pool of worker threads that parallel and background work runs on
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Jobs that can be waited on together. Has to outlive its jobs.
+//-----------------------------------------------------------------------------
+
+class JobGroup
+{
+public:
+    JobGroup() : m_iPending( 0 ) { }
+    bool IsDone() const { return m_iPending == 0; }
+
+private:
+    JobGroup( const JobGroup& );
+    JobGroup &operator=( const JobGroup& );
+
+    friend class JobSystem;
+    atomic< int > m_iPending;
+};
+
+//-----------------------------------------------------------------------------
+// The job system. One worker per core (less one for the game thread), each
+// with its own deque per priority. A worker runs its newest job first and,
+// when it runs dry, steals the oldest from the others. Jobs from outside the
+// pool go in a shared queue that everyone takes from.
+//
+// High priority is for anything a frame or the user is waiting on. It always
+// goes before background work, and background jobs run at idle thread
+// priority so the game thread preempts them. Jobs aren't interrupted once
+// they start, so background work should come in small pieces.
+//-----------------------------------------------------------------------------
+
+class JobSystem
+{
+public:
+    enum Priority { High, Background, PriorityCount };
+
+    struct WorkerStats
+    {
+        long long llBusyMicroSecs; // Running jobs
+        long long llIdleMicroSecs; // Asleep, waiting for jobs
+        int iJobs;
+        int iSteals; // Jobs taken from another worker's deque
+    };
+
+    static JobSystem &GetJobSystem();
+    ~JobSystem();
+
+    // Any thread
+    void Submit( const function< void() > &fnJob, Priority ePriority = High, JobGroup *pGroup = NULL );
+
+    // Runs high priority jobs while it waits. Background work is left to the workers
+    void Wait( JobGroup &group );
+
+    // fnBody( i ) for every i in [0, iCount), spread over the workers and the calling thread. Blocks
+    void ParallelFor( int iCount, const function< void( int ) > &fnBody, Priority ePriority = High );
+
+    int GetWorkerCount() const { return static_cast< int >( m_vWorkers.size() ); }
+    void GetStats( vector< WorkerStats > &vStats ) const;
+    void ResetStats();
+
+private:
+    JobSystem();
+    JobSystem( const JobSystem& );
+    JobSystem &operator=( const JobSystem& );
+
+    struct Job
+    {
+        Job() : pGroup( NULL ) { }
+        Job( const function< void() > &fnRun, JobGroup *pGroup ) : fnRun( fnRun ), pGroup( pGroup ) { }
+
+        function< void() > fnRun;
+        JobGroup *pGroup;
+    };
+
+    // A deque per priority. Each worker has one of these and there's one shared
+    struct JobQueue
+    {
+        mutex mLock;
+        deque< Job > aJobs[PriorityCount];
+    };
+
+    struct Worker
+    {
+        Worker() : llBusyMicroSecs( 0 ), llIdleMicroSecs( 0 ), iJobs( 0 ), iSteals( 0 ) { }
+
+        thread thWorker;
+        JobQueue jqJobs;
+        atomic< long long > llBusyMicroSecs, llIdleMicroSecs;
+        atomic< int > iJobs, iSteals;
+    };
+
+    int FindWorker() const; // The calling thread's index, or -1 if it isn't a worker
+    bool FindJob( int iWorker, int iMaxPriority, Job &job, Priority &ePriority );
+    void RunJob( Job &job );
+    void Work( int iWorker );
+
+    vector< Worker* > m_vWorkers;
+    JobQueue m_Shared;
+
+    // Sleeping. The count only goes up under the lock, so a worker that sees none can't miss one
+    atomic< int > m_iQueued;
+    int m_iSleeping;
+    bool m_bQuit;
+    mutex m_SleepMutex;
+    condition_variable m_cvWork;
+
+    // Groups finishing
+    mutex m_DoneMutex;
+    condition_variable m_cvDone;
+};
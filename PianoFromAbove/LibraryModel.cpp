@@ -0,0 +1,422 @@
+/*************************************************************************************************
+*
+* File: LibraryModel.cpp
+*
+* Description: Implements the model behind the library list
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "LibraryModel.h"
+
+static inline char Lower( char c )
+{
+    return ( c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c );
+}
+
+// Letters and digits get their own slot. Everything else shares what's left
+static inline int Fold( unsigned char c )
+{
+    if ( c >= 'a' && c <= 'z' ) return c - 'a';
+    if ( c >= '0' && c <= '9' ) return 26 + c - '0';
+    return 36 + c % 28;
+}
+
+int LibraryModel::Gram( const char *pText )
+{
+    return ( Fold( pText[0] ) << ( 2 * GramBits ) ) | ( Fold( pText[1] ) << GramBits ) | Fold( pText[2] );
+}
+
+// Byte compare of two pieces of lower cased text. Shorter comes first on a tie
+static inline int CompareText( const char *pText1, int iLen1, const char *pText2, int iLen2 )
+{
+    int iCompare = memcmp( pText1, pText2, min( iLen1, iLen2 ) );
+    if ( iCompare ) return iCompare;
+    return ( iLen1 == iLen2 ? 0 : iLen1 < iLen2 ? -1 : 1 );
+}
+
+void LibraryModel::Clear()
+{
+    m_vSongs.clear();
+    m_sText.clear();
+    m_vTextStart.clear();
+    m_vGramStart.clear();
+    m_vGramSongs.clear();
+    for ( int i = 0; i <= ColumnCount; i++ )
+        m_aOrder[i].clear();
+    m_vTieRank.clear();
+    m_vMatch.clear();
+    m_vRows.clear();
+}
+
+void LibraryModel::Add( const string &sPath, int iSeconds, int iTracks, int iNotes, const PFAData::File *pFile )
+{
+    m_vSongs.push_back( Song() );
+    Song &song = m_vSongs.back();
+    song.sPath = sPath;
+    song.iSeconds = iSeconds;
+    song.iTracks = iTracks;
+    song.iNotes = iNotes;
+    song.pFile = pFile;
+
+    size_t iSlash = sPath.find_last_of( '\\' );
+    size_t iFolderSlash = ( iSlash == string::npos || iSlash == 0 ? string::npos : sPath.find_last_of( '\\', iSlash - 1 ) );
+    song.iNameStart = ( iSlash == string::npos ? 0 : static_cast< int >( iSlash ) + 1 );
+    song.iFolderStart = ( iFolderSlash == string::npos ? 0 : static_cast< int >( iFolderSlash ) + 1 );
+}
+
+void LibraryModel::Build()
+{
+    int iSongs = GetSongCount();
+
+    // Search text
+    m_sText.clear();
+    m_vTextStart.resize( iSongs + 1 );
+    for ( int i = 0; i < iSongs; i++ )
+    {
+        const Song &song = m_vSongs[i];
+        m_vTextStart[i] = static_cast< int >( m_sText.size() );
+        for ( size_t j = song.iFolderStart; j < song.sPath.size(); j++ )
+            m_sText.push_back( Lower( song.sPath[j] ) );
+        m_sText.push_back( '\0' );
+    }
+    m_vTextStart[iSongs] = static_cast< int >( m_sText.size() );
+
+    // Trigram index. Counting sort: count each song once per gram, then drop the songs in place.
+    // Songs go in in order so each gram's list comes out sorted
+    vector< int > vLast( GramCount, -1 );
+    m_vGramStart.assign( GramCount + 1, 0 );
+    for ( int i = 0; i < iSongs; i++ )
+        for ( int j = m_vTextStart[i]; j + 3 < m_vTextStart[i + 1]; j++ )
+        {
+            int iGram = Gram( &m_sText[j] );
+            if ( vLast[iGram] != i )
+            {
+                vLast[iGram] = i;
+                m_vGramStart[iGram + 1]++;
+            }
+        }
+    for ( int i = 0; i < GramCount; i++ )
+        m_vGramStart[i + 1] += m_vGramStart[i];
+
+    vector< int > vFill( m_vGramStart.begin(), m_vGramStart.end() - 1 );
+    m_vGramSongs.resize( m_vGramStart[GramCount] );
+    vLast.assign( GramCount, -1 );
+    for ( int i = 0; i < iSongs; i++ )
+        for ( int j = m_vTextStart[i]; j + 3 < m_vTextStart[i + 1]; j++ )
+        {
+            int iGram = Gram( &m_sText[j] );
+            if ( vLast[iGram] != i )
+            {
+                vLast[iGram] = i;
+                m_vGramSongs[ vFill[iGram]++ ] = i;
+            }
+        }
+
+    // Orders get rebuilt as they're asked for. Rerun the search against the new songs
+    for ( int i = 0; i <= ColumnCount; i++ )
+        m_aOrder[i].clear();
+    m_vTieRank.clear();
+    Filter( m_sQuery );
+}
+
+//-----------------------------------------------------------------------------
+// Sorting
+//-----------------------------------------------------------------------------
+
+void LibraryModel::Sort( int iSortCol )
+{
+    if ( iSortCol == 0 || abs( iSortCol ) > ColumnCount ) iSortCol = Name;
+    m_iSortCol = iSortCol;
+    UpdateRows();
+}
+
+// Strings only get compared to set up the name and folder orders. The number columns sort on
+// (value, position in the folder order) packed into one integer
+const vector< int > &LibraryModel::GetOrder( int iColumn )
+{
+    vector< int > &vOrder = m_aOrder[iColumn];
+    int iSongs = GetSongCount();
+    if ( static_cast< int >( vOrder.size() ) == iSongs ) return vOrder;
+
+    // Folders that aren't there go last
+    auto fnFolder = [this]( int i, const char *&pText ) -> int {
+        const Song &song = m_vSongs[i];
+        pText = &m_sText[ m_vTextStart[i] ];
+        return ( song.iNameStart > 0 ? song.iNameStart - 1 - song.iFolderStart : 0 );
+    };
+    auto fnName = [this]( int i, const char *&pText ) -> int {
+        const Song &song = m_vSongs[i];
+        pText = &m_sText[ m_vTextStart[i] + song.iNameStart - song.iFolderStart ];
+        return m_vTextStart[i + 1] - 1 - ( m_vTextStart[i] + song.iNameStart - song.iFolderStart );
+    };
+    auto fnCompareFolder = [&fnFolder]( int i1, int i2 ) -> int {
+        const char *pText1, *pText2;
+        int iLen1 = fnFolder( i1, pText1 ), iLen2 = fnFolder( i2, pText2 );
+        if ( !iLen1 || !iLen2 ) return ( iLen1 == iLen2 ? 0 : !iLen1 ? 1 : -1 );
+        return CompareText( pText1, iLen1, pText2, iLen2 );
+    };
+    auto fnCompareName = [&fnName]( int i1, int i2 ) -> int {
+        const char *pText1, *pText2;
+        int iLen1 = fnName( i1, pText1 ), iLen2 = fnName( i2, pText2 );
+        return CompareText( pText1, iLen1, pText2, iLen2 );
+    };
+
+    vOrder.resize( iSongs );
+    for ( int i = 0; i < iSongs; i++ )
+        vOrder[i] = i;
+
+    switch ( iColumn )
+    {
+        case Name:
+            sort( vOrder.begin(), vOrder.end(), [&]( int i1, int i2 ) -> bool {
+                int iCompare = fnCompareName( i1, i2 );
+                return ( iCompare ? iCompare < 0 : fnCompareFolder( i1, i2 ) < 0 ); } );
+            break;
+        case Folder:
+            sort( vOrder.begin(), vOrder.end(), [&]( int i1, int i2 ) -> bool {
+                int iCompare = fnCompareFolder( i1, i2 );
+                return ( iCompare ? iCompare < 0 : fnCompareName( i1, i2 ) < 0 ); } );
+            break;
+        default:
+        {
+            const vector< int > &vFolder = GetOrder( Folder );
+            if ( m_vTieRank.empty() )
+            {
+                m_vTieRank.resize( iSongs );
+                for ( int i = 0; i < iSongs; i++ )
+                    m_vTieRank[ vFolder[i] ] = i;
+            }
+
+            vector< unsigned long long > vKeys( iSongs );
+            for ( int i = 0; i < iSongs; i++ )
+            {
+                const Song &song = m_vSongs[i];
+                unsigned iKey = 0;
+                if ( iColumn == Length ) iKey = static_cast< unsigned >( max( song.iSeconds, 0 ) );
+                else if ( iColumn == Tracks ) iKey = static_cast< unsigned >( max( song.iTracks, 0 ) );
+                else if ( song.iSeconds <= 0 ) iKey = 0xFFFFFFFF; // No notes/sec. Goes last
+                else
+                {
+                    // Non-negative floats sort the same as their bits
+                    float fNotesPerSec = max( static_cast< float >( song.iNotes ) / song.iSeconds, 0.0f );
+                    memcpy( &iKey, &fNotesPerSec, sizeof( iKey ) );
+                }
+                vKeys[i] = ( static_cast< unsigned long long >( iKey ) << 32 ) | m_vTieRank[i];
+            }
+            sort( vKeys.begin(), vKeys.end() );
+            for ( int i = 0; i < iSongs; i++ )
+                vOrder[i] = vFolder[ static_cast< int >( vKeys[i] & 0xFFFFFFFF ) ];
+            break;
+        }
+    }
+
+    return vOrder;
+}
+
+void LibraryModel::UpdateRows()
+{
+    const vector< int > &vOrder = GetOrder( abs( m_iSortCol ) );
+    m_vRows.clear();
+    if ( m_iSortCol > 0 )
+    {
+        for ( vector< int >::const_iterator it = vOrder.begin(); it != vOrder.end(); ++it )
+            if ( m_vMatch.empty() || m_vMatch[*it] ) m_vRows.push_back( *it );
+    }
+    else
+    {
+        for ( vector< int >::const_reverse_iterator it = vOrder.rbegin(); it != vOrder.rend(); ++it )
+            if ( m_vMatch.empty() || m_vMatch[*it] ) m_vRows.push_back( *it );
+    }
+}
+
+int LibraryModel::FindRow( const PFAData::File *pFile ) const
+{
+    for ( int i = 0; i < GetRowCount(); i++ )
+        if ( GetRow( i ).pFile == pFile ) return i;
+    return -1;
+}
+
+int LibraryModel::FindRowByPrefix( const string &sPrefix, int iStart, bool bWrap ) const
+{
+    string sLower( sPrefix );
+    transform( sLower.begin(), sLower.end(), sLower.begin(), Lower );
+
+    int iRows = GetRowCount();
+    if ( iStart < 0 || iStart >= iRows ) iStart = 0;
+    for ( int i = 0; i < ( bWrap ? iRows : iRows - iStart ); i++ )
+    {
+        int iRow = ( iStart + i ) % iRows;
+        int iSong = m_vRows[iRow];
+        const Song &song = m_vSongs[iSong];
+        int iName = m_vTextStart[iSong] + song.iNameStart - song.iFolderStart;
+        if ( m_sText.compare( iName, sLower.size(), sLower ) == 0 ) return iRow;
+    }
+    return -1;
+}
+
+// Backs up so a multibyte character doesn't get cut in half
+static int CopyText( const char *pText, int iLen, char *pBuf, int iSize )
+{
+    if ( iSize <= 0 ) return 0;
+    if ( iLen > iSize - 1 )
+    {
+        iLen = iSize - 1;
+        while ( iLen > 0 && ( pText[iLen] & 0xC0 ) == 0x80 ) iLen--;
+    }
+    memcpy( pBuf, pText, iLen );
+    pBuf[iLen] = '\0';
+    return iLen;
+}
+
+int LibraryModel::GetCellText( int iRow, int iColumn, char *pBuf, int iSize ) const
+{
+    const Song &song = GetRow( iRow );
+    char buf[32];
+    switch ( iColumn )
+    {
+        case Name:
+            return CopyText( song.sPath.c_str() + song.iNameStart, static_cast< int >( song.sPath.size() ) - song.iNameStart, pBuf, iSize );
+        case Folder:
+            return CopyText( song.sPath.c_str() + song.iFolderStart, max( song.iNameStart - 1 - song.iFolderStart, 0 ), pBuf, iSize );
+        case Length:
+            sprintf( buf, "%d:%02d", song.iSeconds / 60, song.iSeconds % 60 );
+            break;
+        case Tracks:
+            sprintf( buf, "%d", song.iTracks );
+            break;
+        case NotesPerSec:
+            if ( song.iSeconds > 0 ) sprintf( buf, "%.1f", static_cast< float >( song.iNotes ) / song.iSeconds );
+            else buf[0] = '\0';
+            break;
+        default:
+            buf[0] = '\0';
+    }
+    return CopyText( buf, static_cast< int >( strlen( buf ) ), pBuf, iSize );
+}
+
+//-----------------------------------------------------------------------------
+// Searching
+//-----------------------------------------------------------------------------
+
+void LibraryModel::Filter( const string &sQuery )
+{
+    m_sQuery = sQuery;
+    m_vMatch.clear();
+
+    vector< string > vTerms;
+    for ( size_t iStart = 0; iStart < sQuery.size(); )
+    {
+        size_t iEnd = sQuery.find( ' ', iStart );
+        if ( iEnd == string::npos ) iEnd = sQuery.size();
+        if ( iEnd > iStart )
+        {
+            vTerms.push_back( sQuery.substr( iStart, iEnd - iStart ) );
+            transform( vTerms.back().begin(), vTerms.back().end(), vTerms.back().begin(), Lower );
+        }
+        iStart = iEnd + 1;
+    }
+
+    // Each word narrows down the hits of the ones before it. Long words go first since they hit the least
+    sort( vTerms.begin(), vTerms.end(), []( const string &s1, const string &s2 ) -> bool { return s1.size() > s2.size(); } );
+    vector< int > vHits;
+    bool bFirst = true;
+    for ( vector< string >::const_iterator it = vTerms.begin(); it != vTerms.end(); ++it, bFirst = false )
+        Search( *it, bFirst, vHits );
+
+    if ( !bFirst )
+    {
+        m_vMatch.assign( m_vSongs.size(), 0 );
+        for ( vector< int >::const_iterator it = vHits.begin(); it != vHits.end(); ++it )
+            m_vMatch[*it] = 1;
+    }
+    UpdateRows();
+}
+
+// Keeps the songs in vSongs that are also in [pBegin, pEnd). Both sorted
+static void Intersect( vector< int > &vSongs, const int *pBegin, const int *pEnd )
+{
+    // Walk the other list if it's about the same size. Otherwise jump through it
+    bool bJump = vSongs.size() * 16 < static_cast< size_t >( pEnd - pBegin );
+    size_t iOut = 0;
+    for ( size_t i = 0; i < vSongs.size() && pBegin != pEnd; i++ )
+    {
+        if ( bJump ) pBegin = lower_bound( pBegin, pEnd, vSongs[i] );
+        else while ( pBegin != pEnd && *pBegin < vSongs[i] ) ++pBegin;
+        if ( pBegin != pEnd && *pBegin == vSongs[i] ) vSongs[iOut++] = vSongs[i];
+    }
+    vSongs.resize( iOut );
+}
+
+// Replaces vHits with the songs in vHits (or all songs if bFirst) that contain sTerm
+void LibraryModel::Search( const string &sTerm, bool bFirst, vector< int > &vHits ) const
+{
+    int iSongs = GetSongCount();
+    if ( !iSongs ) return;
+
+    const int *pSongs = m_vGramSongs.data();
+    vector< int > vCandidates;
+    if ( sTerm.size() >= 3 )
+    {
+        // Start from the rarest trigram and narrow down with the others
+        vector< int > vGrams;
+        for ( size_t i = 0; i + 3 <= sTerm.size(); i++ )
+            vGrams.push_back( Gram( &sTerm[i] ) );
+        sort( vGrams.begin(), vGrams.end() );
+        vGrams.erase( unique( vGrams.begin(), vGrams.end() ), vGrams.end() );
+        sort( vGrams.begin(), vGrams.end(), [this]( int iGram1, int iGram2 ) -> bool {
+            return m_vGramStart[iGram1 + 1] - m_vGramStart[iGram1] < m_vGramStart[iGram2 + 1] - m_vGramStart[iGram2]; } );
+
+        vCandidates.assign( pSongs + m_vGramStart[ vGrams[0] ], pSongs + m_vGramStart[ vGrams[0] + 1 ] );
+        if ( !bFirst ) Intersect( vCandidates, vHits.data(), vHits.data() + vHits.size() );
+        for ( size_t i = 1; i < vGrams.size() && !vCandidates.empty(); i++ )
+            Intersect( vCandidates, pSongs + m_vGramStart[ vGrams[i] ], pSongs + m_vGramStart[ vGrams[i] + 1 ] );
+    }
+    else if ( !bFirst )
+        vCandidates.swap( vHits );
+    else if ( sTerm.size() == 2 )
+    {
+        // A two letter word starts one of 64 trigrams, or else it ends the song's text
+        vector< char > vFound( iSongs, 0 );
+        int iPrefix = ( Fold( sTerm[0] ) << ( 2 * GramBits ) ) | ( Fold( sTerm[1] ) << GramBits );
+        for ( int iGram = iPrefix; iGram < iPrefix + ( 1 << GramBits ); iGram++ )
+            for ( int i = m_vGramStart[iGram]; i < m_vGramStart[iGram + 1]; i++ )
+                vFound[ pSongs[i] ] = 1;
+        for ( int i = 0; i < iSongs; i++ )
+            if ( vFound[i] || ( m_vTextStart[i + 1] - m_vTextStart[i] >= 3 &&
+                                m_sText.compare( m_vTextStart[i + 1] - 3, 2, sTerm ) == 0 ) )
+                vCandidates.push_back( i );
+    }
+    else
+    {
+        // One letter is in most songs anyway. Just look through all the text
+        const char *pText = m_sText.data(), *pEnd = pText + m_sText.size();
+        int iSong = 0;
+        for ( const char *p = pText; ( p = static_cast< const char* >( memchr( p, sTerm[0], pEnd - p ) ) ) != NULL; )
+        {
+            int iPos = static_cast< int >( p - pText );
+            while ( m_vTextStart[iSong + 1] <= iPos ) iSong++;
+            vCandidates.push_back( iSong );
+            p = pText + m_vTextStart[iSong + 1];
+        }
+    }
+
+    // Trigrams can collide and don't say where they are, so check the text itself. Except for
+    // words of up to three letters and digits, which the lookups above find exactly
+    if ( sTerm.size() <= 3 && all_of( sTerm.begin(), sTerm.end(), []( char c ) -> bool {
+             return ( c >= 'a' && c <= 'z' ) || ( c >= '0' && c <= '9' ); } ) &&
+         ( bFirst || sTerm.size() == 3 ) )
+    {
+        vHits.swap( vCandidates );
+        return;
+    }
+    vHits.clear();
+    for ( vector< int >::const_iterator it = vCandidates.begin(); it != vCandidates.end(); ++it )
+        if ( strstr( &m_sText[ m_vTextStart[*it] ], sTerm.c_str() ) )
+            vHits.push_back( *it );
+}
@@ -0,0 +1,94 @@
+/*************************************************************************************************
+*
+* File: LibraryModel.h
+*
+* Description: Defines the model behind the library list: search index and sort orders. Plain
+*              C++, no Windows, so it can be driven and timed on any platform.
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <string>
+#include <vector>
+using namespace std;
+
+namespace PFAData { class File; }
+
+//-----------------------------------------------------------------------------
+// The library list, flattened out of the song library. Call Build after adding
+// songs: it indexes every trigram of the folder and file names and works out
+// the sort keys. From then on sorting and searching only shuffle row numbers.
+// Rows are handed out by index and formatted on demand, so the view never has
+// to hold a copy of the whole library.
+//-----------------------------------------------------------------------------
+
+class LibraryModel
+{
+public:
+    // Sort columns are 1-based like the list view's. Negative sorts descending
+    enum Column { Name = 1, Folder, Length, Tracks, NotesPerSec };
+    static const int ColumnCount = 5;
+
+    struct Song
+    {
+        string sPath; // UTF-8, like in the library
+        int iFolderStart, iNameStart; // Offsets into sPath. The folder runs up to the '\\' before the name
+        int iSeconds, iTracks, iNotes;
+        const PFAData::File *pFile;
+    };
+
+    LibraryModel() : m_iSortCol( Name ) { }
+
+    void Clear();
+    void Add( const string &sPath, int iSeconds, int iTracks, int iNotes, const PFAData::File *pFile );
+    void Build();
+
+    // Both update the rows. A query is words separated by spaces that all have to show up in the
+    // folder or file name. Case insensitive (ASCII only)
+    void Sort( int iSortCol );
+    void Filter( const string &sQuery );
+
+    int GetSortCol() const { return m_iSortCol; }
+    const string &GetQuery() const { return m_sQuery; }
+    int GetSongCount() const { return static_cast< int >( m_vSongs.size() ); }
+    int GetRowCount() const { return static_cast< int >( m_vRows.size() ); }
+    const Song &GetRow( int iRow ) const { return m_vSongs[ m_vRows[iRow] ]; }
+    int FindRow( const PFAData::File *pFile ) const; // -1 if it's not showing
+    int FindRowByPrefix( const string &sPrefix, int iStart, bool bWrap ) const; // First file name from iStart on. -1 if none
+
+    // Text of one cell, UTF-8. Only made when asked for so a virtual list just formats what it shows.
+    // Cut short to fit iSize including the terminator. Returns the length
+    int GetCellText( int iRow, int iColumn, char *pBuf, int iSize ) const;
+
+private:
+    // Trigrams are indexed on a 64 letter alphabet. Collisions only cost a few extra candidates
+    static const int GramBits = 6;
+    static const int GramCount = 1 << ( 3 * GramBits );
+    static int Gram( const char *pText );
+
+    const vector< int > &GetOrder( int iColumn );
+    void Search( const string &sTerm, bool bFirst, vector< int > &vHits ) const;
+    void UpdateRows();
+
+    vector< Song > m_vSongs;
+
+    // Lower cased "folder\name" of every song, each one null terminated
+    string m_sText;
+    vector< int > m_vTextStart;
+
+    // Songs containing each trigram, in song order. Gram g's songs are [m_vGramStart[g], m_vGramStart[g + 1])
+    vector< int > m_vGramStart;
+    vector< int > m_vGramSongs;
+
+    // Ascending order of each column, built on first use. Ties go by folder then name
+    vector< int > m_aOrder[ColumnCount + 1];
+    vector< int > m_vTieRank; // Position of each song in the folder order
+
+    // What's showing
+    int m_iSortCol;
+    string m_sQuery;
+    vector< char > m_vMatch; // Empty if there's no query
+    vector< int > m_vRows;
+};
@@ -0,0 +1,233 @@
+/*************************************************************************************************
+*
+* File: Loader.h
+*
+* Description: Defines the background song loader. Plain C++, no Windows, so it can be driven
+*              and timed on any platform.
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Progress of one load. Written by the loading thread, read by anybody.
+// Setting the cancel flag makes the parse bail out at its next check.
+//-----------------------------------------------------------------------------
+
+struct LoadProgress
+{
+    enum Phase { Waiting, Reading, Parsing, Merging, Done, Canceled, Failed, PhaseCount };
+    static const int CheckInterval = 0x10000; // Events between progress updates/cancel checks
+
+    LoadProgress() { Reset(); }
+    void Reset();
+
+    void SetPhase( Phase ePhase );
+    Phase GetPhase() const { return static_cast< Phase >( ePhase.load() ); }
+    bool IsCanceled() const { return bCancel; }
+    int GetPercent() const;
+    long long GetPhaseMicroSecs( Phase ePhase ) const { return aPhaseMicroSecs[ePhase]; }
+    static const wchar_t *PhaseName( Phase ePhase );
+
+    atomic< int > ePhase;
+    atomic< long long > llTotalBytes, llBytesParsed;
+    atomic< int > iTotalEvents, iEventsProcessed;
+    atomic< bool > bCancel;
+
+private:
+    // Time spent in each phase. Only touched by the loading thread until the load is finished
+    chrono::steady_clock::time_point m_tPhaseStart;
+    long long aPhaseMicroSecs[PhaseCount];
+};
+
+inline void LoadProgress::Reset()
+{
+    ePhase = Waiting;
+    llTotalBytes = llBytesParsed = 0;
+    iTotalEvents = iEventsProcessed = 0;
+    bCancel = false;
+    for ( int i = 0; i < PhaseCount; i++ )
+        aPhaseMicroSecs[i] = 0;
+    m_tPhaseStart = chrono::steady_clock::now();
+}
+
+// Charges the time since the last phase change to the phase we're leaving
+inline void LoadProgress::SetPhase( Phase ePhase )
+{
+    chrono::steady_clock::time_point tNow = chrono::steady_clock::now();
+    aPhaseMicroSecs[GetPhase()] += chrono::duration_cast< chrono::microseconds >( tNow - m_tPhaseStart ).count();
+    m_tPhaseStart = tNow;
+    this->ePhase = ePhase;
+}
+
+// Rough percent done. Reading and parsing are weighted by bytes, the rest by events
+inline int LoadProgress::GetPercent() const
+{
+    Phase ePhase = GetPhase();
+    long long llTotal = llTotalBytes, llParsed = llBytesParsed;
+    int iTotal = iTotalEvents, iProcessed = iEventsProcessed;
+    switch ( ePhase )
+    {
+        case Waiting: return 0;
+        case Reading: case Parsing: return llTotal > 0 ? static_cast< int >( 60 * llParsed / llTotal ) : 0;
+        case Merging: return 60 + ( iTotal > 0 ? static_cast< int >( 40LL * iProcessed / iTotal ) : 0 );
+        default: return 100;
+    }
+}
+
+inline const wchar_t *LoadProgress::PhaseName( Phase ePhase )
+{
+    static const wchar_t *aNames[] = { L"Waiting", L"Reading", L"Parsing", L"Merging tracks", L"Done", L"Canceled", L"Failed" };
+    return aNames[ePhase];
+}
+
+//-----------------------------------------------------------------------------
+// Runs one load at a time on a worker thread. Starting a new load cancels the
+// one in flight. The result is only handed out for the most recent load.
+// Canceling never waits: a canceled load is left to notice the flag on its own
+// and its thread is joined once it has, the next time the loader's used.
+//-----------------------------------------------------------------------------
+
+template< class T >
+class AsyncLoader
+{
+public:
+    typedef function< T*( LoadProgress &progress ) > LoadFunc; // Returns NULL on failure
+    typedef function< void( unsigned iJob ) > DoneFunc; // Called on the worker thread when the load finishes
+
+    AsyncLoader() : m_iJob( 0 ), m_pLoad( new Load() ) {}
+    ~AsyncLoader();
+
+    unsigned Start( LoadFunc fnLoad, DoneFunc fnDone );
+    void Cancel();
+    T *Take( unsigned iJob );
+
+    bool IsLoading() const { return m_pLoad->thWorker.joinable() && !m_pLoad->bFinished; }
+    unsigned GetJob() const { return m_iJob; }
+    const LoadProgress &GetProgress() const { return m_pLoad->progress; }
+
+private:
+    // Everything one load touches, so a canceled one can finish up alongside the next
+    struct Load
+    {
+        Load() : pResult( NULL ), bFinished( true ) {}
+        LoadProgress progress;
+        T *pResult;
+        atomic< bool > bFinished;
+        mutex mtx; // Guards pResult
+        thread thWorker;
+    };
+
+    AsyncLoader( const AsyncLoader& );
+    AsyncLoader &operator=( const AsyncLoader& );
+
+    static void Run( Load *pLoad, LoadFunc fnLoad, DoneFunc fnDone, unsigned iJob );
+    void Reap( bool bWait );
+
+    unsigned m_iJob;
+    unique_ptr< Load > m_pLoad; // The current load. Never NULL
+    vector< unique_ptr< Load > > m_vCanceled; // Still winding down
+};
+
+// Only here do we wait on canceled loads. Letting them run past the end of the app isn't safe
+template< class T >
+AsyncLoader< T >::~AsyncLoader()
+{
+    Cancel();
+    Reap( true );
+}
+
+template< class T >
+unsigned AsyncLoader< T >::Start( LoadFunc fnLoad, DoneFunc fnDone )
+{
+    Cancel();
+
+    m_pLoad.reset( new Load() );
+    m_pLoad->bFinished = false;
+
+    unsigned iJob = ++m_iJob;
+    m_pLoad->thWorker = thread( &AsyncLoader< T >::Run, m_pLoad.get(), fnLoad, fnDone, iJob );
+    return iJob;
+}
+
+// Stops the load in flight and throws away anything it produced. Returns right away. The load
+// checks the cancel flag every LoadProgress::CheckInterval events and cleans up after itself
+template< class T >
+void AsyncLoader< T >::Cancel()
+{
+    m_pLoad->progress.bCancel = true;
+    {
+        lock_guard< mutex > lock( m_pLoad->mtx );
+        delete m_pLoad->pResult;
+        m_pLoad->pResult = NULL;
+    }
+
+    if ( m_pLoad->thWorker.joinable() )
+    {
+        m_vCanceled.push_back( move( m_pLoad ) );
+        m_pLoad.reset( new Load() );
+        m_pLoad->progress.SetPhase( LoadProgress::Canceled );
+    }
+    Reap( false );
+}
+
+// Hands over ownership of the result if iJob is still the current load. NULL otherwise
+template< class T >
+T *AsyncLoader< T >::Take( unsigned iJob )
+{
+    Reap( false );
+    if ( iJob != m_iJob ) return NULL;
+
+    lock_guard< mutex > lock( m_pLoad->mtx );
+    T *pResult = m_pLoad->pResult;
+    m_pLoad->pResult = NULL;
+    return pResult;
+}
+
+// Joins the canceled loads that are done, or all of them
+template< class T >
+void AsyncLoader< T >::Reap( bool bWait )
+{
+    for ( size_t i = 0; i < m_vCanceled.size(); )
+    {
+        if ( bWait || m_vCanceled[i]->bFinished )
+        {
+            m_vCanceled[i]->thWorker.join();
+            delete m_vCanceled[i]->pResult; // Finished just as it was canceled
+            m_vCanceled[i] = move( m_vCanceled.back() );
+            m_vCanceled.pop_back();
+        }
+        else i++;
+    }
+}
+
+template< class T >
+void AsyncLoader< T >::Run( Load *pLoad, LoadFunc fnLoad, DoneFunc fnDone, unsigned iJob )
+{
+    T *pResult = fnLoad( pLoad->progress );
+    if ( pLoad->progress.IsCanceled() )
+    {
+        delete pResult;
+        pLoad->progress.SetPhase( LoadProgress::Canceled );
+        pLoad->bFinished = true;
+        return;
+    }
+
+    {
+        lock_guard< mutex > lock( pLoad->mtx );
+        pLoad->pResult = pResult;
+    }
+    pLoad->progress.SetPhase( pResult ? LoadProgress::Done : LoadProgress::Failed );
+    pLoad->bFinished = true;
+    if ( fnDone ) fnDone( iJob );
+}
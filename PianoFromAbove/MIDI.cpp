@@ -8,7 +8,13 @@
 *
 *************************************************************************************************/
 #include "MIDI.h"
+#include "JobSystem.h"
+#include "SoftSynth.h"
 #include <fstream>
+#include <queue>
+#include <functional>
+#include <climits>
+#include <cmath>
 
 //-----------------------------------------------------------------------------
 // MIDIPos functions
@@ -136,24 +142,95 @@ int MIDIPos::GetNextEvents( int iMicroSecs, vector< MIDIEvent* > &vEvents )
 // MIDI functions
 //-----------------------------------------------------------------------------
 
-MIDI::MIDI ( const wstring &sFilename )
+// Where the merge left off. The merge half belongs to whoever calls StreamEvents and the note half to
+// whoever calls AddStreamedEvent
+struct MIDI::StreamState
 {
+    typedef pair< int, int > mergepos_t;
+
+    StreamState() : pFile( NULL ), iSimultaneous( 0 ) { }
+    ~StreamState() { delete pFile; }
+
+    // Same math as PostProcess
+    long long GetTime( int iTick ) const
+    {
+        if ( bIsStandard )
+            return llLastTempoTime + ( static_cast< long long >( iMicroSecsPerBeat ) * ( iTick - iLastTempoTick ) ) / iTicksPerBeat;
+        return llLastTempoTime + ( 1000000LL * ( iTick - iLastTempoTick ) ) / iTicksPerSecond;
+    }
+
+    // Last tick at or before llTime, as long as there are no tempo changes in between. Capped at iMaxTick, which
+    // also covers a tempo of 0 (time stands still)
+    int GetTick( long long llTime, int iMaxTick ) const
+    {
+        long long llTicks = ( bIsStandard ? iTicksPerBeat : iTicksPerSecond ) * ( llTime - llLastTempoTime );
+        long long llPer = ( bIsStandard ? iMicroSecsPerBeat : 1000000LL );
+        if ( llPer <= 0 || llTicks / llPer >= iMaxTick - iLastTempoTick ) return iMaxTick;
+        return iLastTempoTick + static_cast< int >( llTicks / llPer );
+    }
+
+    MappedFile *pFile; // NULL if somebody else owns the data
+
+    // Merge heap of ( tick, track ) and tempo
+    priority_queue< mergepos_t, vector< mergepos_t >, greater< mergepos_t > > pqMerge;
+    bool bIsStandard;
+    int iTicksPerBeat, iTicksPerSecond, iMicroSecsPerBeat, iLastTempoTick;
+    long long llLastTempoTime, llTime, llNextTime;
+    long long llTotalBytes, llBytesLeft;
+
+    // Note ons still waiting on their note off
+    vector< MIDIChannelEvent* > vOpen[16][128];
+    int iSimultaneous;
+};
+
+MIDI::MIDI ( const wstring &sFilename, LoadProgress *pProgress, bool bStream ) : m_pProgress( pProgress ), m_pStream( NULL )
+{
+    // Incremental. Only the headers are read now, the events as they're merged. No MD5: it needs the whole file
+    if ( bStream )
+    {
+        MappedFile *pFile = new MappedFile();
+        if ( pFile->Open( sFilename ) && StreamMIDI( pFile->GetData(), pFile->GetSize() ) > 0 )
+        {
+            m_pStream->pFile = pFile;
+            m_Info.sFilename = sFilename;
+        }
+        else
+            delete pFile;
+        return;
+    }
+
     // Open the file
     ifstream ifs( sFilename, ios::in | ios::binary | ios::ate );
     if ( !ifs.is_open() )
         return;
 
-    // Read it all in
+    // Read it all in. In chunks when loading in the background so we can report and bail out
     int iSize = static_cast<int>( ifs.tellg() );
     unsigned char *pcMemBlock = new unsigned char[iSize];
     ifs.seekg( 0, ios::beg );
-    ifs.read( reinterpret_cast< char* >( pcMemBlock ), iSize );
+    if ( m_pProgress )
+    {
+        static const int ChunkSize = 1 << 22;
+        m_pProgress->SetPhase( LoadProgress::Reading );
+        m_pProgress->llTotalBytes = 2LL * iSize; // Reading and parsing each count once
+        for ( int iRead = 0; iRead < iSize && !m_pProgress->IsCanceled(); iRead += ChunkSize )
+        {
+            ifs.read( reinterpret_cast< char* >( pcMemBlock ) + iRead, min( ChunkSize, iSize - iRead ) );
+            m_pProgress->llBytesParsed = min( iRead + ChunkSize, iSize );
+        }
+    }
+    else
+        ifs.read( reinterpret_cast< char* >( pcMemBlock ), iSize );
     ifs.close();
 
     // Parse it
-    int iTotal = ParseMIDI ( pcMemBlock, iSize );
-    m_Info.sFilename = sFilename;
-    Util::MD5( pcMemBlock, iSize, m_Info.sMd5 );
+    if ( !m_pProgress || !m_pProgress->IsCanceled() )
+    {
+        if ( m_pProgress ) m_pProgress->SetPhase( LoadProgress::Parsing );
+        int iTotal = ParseMIDI ( pcMemBlock, iSize );
+        m_Info.sFilename = sFilename;
+        Util::MD5( pcMemBlock, iSize, m_Info.sMd5 );
+    }
  
     // Clean up
     delete[] pcMemBlock;
@@ -277,20 +354,43 @@ void MIDI::InitArrays()
     }
 }
 
+// Tracks only hold pointers. The events all go at once with the arena
 void MIDI::clear( void )
 {
     for ( vector< MIDITrack* >::iterator it = m_vTracks.begin(); it != m_vTracks.end(); ++it )
         delete *it;
     m_vTracks.clear();
+    m_Arena.clear();
     m_Info.clear();
+    delete m_pStream;
+    m_pStream = NULL;
+}
+
+void MIDI::swap( MIDI &other )
+{
+    std::swap( m_Info, other.m_Info );
+    m_vTracks.swap( other.m_vTracks );
+    m_Arena.swap( other.m_Arena );
+    std::swap( m_pProgress, other.m_pProgress );
+    std::swap( m_pStream, other.m_pStream );
 }
 
 int MIDI::ParseMIDI( const unsigned char *pcData, int iMaxSize )
+{
+    int iTotal = ParseHeader( pcData, iMaxSize );
+    if ( iTotal == 0 ) return 0;
+
+    // Parse the rest of the file
+    if ( m_pProgress ) m_pProgress->llBytesParsed += iTotal;
+    return iTotal + ParseTracks( pcData + iTotal, iMaxSize - iTotal );
+}
+
+int MIDI::ParseHeader( const unsigned char *pcData, int iMaxSize )
 {
     char pcBuf[4];
     int iTotal, iHdrSize;
 
-    // Reset first. This is the only parsing function that resets/clears first.
+    // Reset first. This and ParseMIDI/StreamMIDI are the only parsing functions that reset/clear first.
     clear();
 
     // Read header info
@@ -310,19 +410,30 @@ int MIDI::ParseMIDI( const unsigned char *pcData, int iMaxSize )
     // Check header
     if ( iTotal != 14 || m_Info.iFormatType < 0 || m_Info.iFormatType > 2 || m_Info.iDivision == 0 ) return 0;
 
-    // Parse the rest of the file
-    iTotal += iHdrSize - 6;
-    return iTotal + ParseTracks( pcData + iTotal, iMaxSize - iTotal );
+    return min( iTotal + iHdrSize - 6, iMaxSize );
 }
 
+// Big files go a track per job first. Whatever that couldn't vouch for is parsed here one track at a time
 int MIDI::ParseTracks( const unsigned char *pcData, int iMaxSize )
 {
-    int iTotal = 0, iCount = 0, iTrack = static_cast< int >( m_vTracks.size() );
+    int iTotal = 0, iCount = 0;
+    if ( m_Info.iFormatType != 2 && iMaxSize >= ParallelParseSize )
+    {
+        iTotal = ParseTracksParallel( pcData, iMaxSize );
+        if ( m_pProgress && m_pProgress->IsCanceled() )
+        {
+            clear();
+            return 0;
+        }
+        if ( iTotal >= iMaxSize ) return iTotal;
+    }
+
+    int iTrack = static_cast< int >( m_vTracks.size() );
     do
     {
         // Create and parse the track
         MIDITrack *track = new MIDITrack();
-        iCount = track->ParseTrack( pcData + iTotal, iMaxSize - iTotal, iTrack++ );
+        iCount = track->ParseTrack( pcData + iTotal, iMaxSize - iTotal, iTrack++, m_Arena, m_pProgress );
 
         // If Success, add it to the list
         if ( iCount > 0 )
@@ -334,17 +445,74 @@ int MIDI::ParseTracks( const unsigned char *pcData, int iMaxSize )
             delete track;
 
         iTotal += iCount;
+
+        // Canceled. Throw everything out so the load looks invalid
+        if ( m_pProgress && m_pProgress->IsCanceled() )
+        {
+            clear();
+            return 0;
+        }
     }
     while ( iMaxSize - iTotal > 0 && iCount > 0 && m_Info.iFormatType != 2 );
 
     return iTotal;
 }
 
+// Tracks are found by their chunk sizes and parsed side by side, each into its own arena. A track
+// is only kept if the ones before it ended right where it starts, which is where parsing one after
+// the other would have found it. Returns how far that got
+int MIDI::ParseTracksParallel( const unsigned char *pcData, int iMaxSize )
+{
+    vector< int > vStarts;
+    int iPos = 0, iTrkSize;
+    while ( iMaxSize - iPos >= 8 && strncmp( reinterpret_cast< const char* >( pcData + iPos ), "MTrk", 4 ) == 0 &&
+            Parse32Bit( pcData + iPos + 4, iMaxSize - iPos - 4, &iTrkSize ) == 4 && iTrkSize >= 0 )
+    {
+        vStarts.push_back( iPos );
+        iPos += 8 + min( iTrkSize, iMaxSize - iPos - 8 );
+    }
+    int iTracks = static_cast< int >( vStarts.size() );
+    if ( iTracks < 2 ) return 0;
+    vStarts.push_back( iPos );
+
+    int iFirstTrack = static_cast< int >( m_vTracks.size() );
+    vector< MIDITrack* > vTracks( iTracks, NULL );
+    vector< Arena* > vArenas( iTracks, NULL );
+    vector< int > vCounts( iTracks, 0 );
+    JobSystem::GetJobSystem().ParallelFor( iTracks, [&]( int i )
+    {
+        vTracks[i] = new MIDITrack();
+        vArenas[i] = new Arena();
+        vCounts[i] = vTracks[i]->ParseTrack( pcData + vStarts[i], iMaxSize - vStarts[i], iFirstTrack + i, *vArenas[i], m_pProgress );
+    } );
+
+    int iTotal = 0;
+    for ( int i = 0; i < iTracks && vCounts[i] > 0 && ( i == 0 || vStarts[i - 1] + vCounts[i - 1] == vStarts[i] ); i++ )
+    {
+        m_vTracks.push_back( vTracks[i] );
+        m_Info.AddTrackInfo( *vTracks[i] );
+        m_Arena.Adopt( *vArenas[i] );
+        vTracks[i] = NULL;
+        iTotal += vCounts[i];
+    }
+
+    // The rest get parsed again. Their bytes were already reported, so take them back
+    long long llRejected = 0;
+    for ( int i = 0; i < iTracks; i++ )
+    {
+        if ( vTracks[i] ) llRejected += vCounts[i];
+        delete vTracks[i];
+        delete vArenas[i];
+    }
+    if ( m_pProgress ) m_pProgress->llBytesParsed -= llRejected;
+    return iTotal;
+}
+
 int MIDI::ParseEvents( const unsigned char *pcData, int iMaxSize )
 {
     // Create and parse the track
     MIDITrack *track = new MIDITrack();
-    int iCount = track->ParseEvents( pcData, iMaxSize, static_cast< int >( m_vTracks.size() ) );
+    int iCount = track->ParseEvents( pcData, iMaxSize, static_cast< int >( m_vTracks.size() ), m_Arena );
 
     // If Success, add it to the list
     if ( iCount > 0 ) {
@@ -381,15 +549,32 @@ void MIDI::MIDIInfo::AddTrackInfo( const MIDITrack &mTrack )
         }
     }
     this->iNoteCount += mti.iNoteCount;
+    this->iChannelEventCount += mti.iChannelEventCount;
+    this->iMetaEventCount += mti.iMetaEventCount;
+    this->iPairedNoteCount += mti.iPairedNoteCount;
+    this->iControllerCount += mti.iControllerCount;
+    this->iTempoCount += mti.iTempoCount;
+    this->iSignatureCount += mti.iSignatureCount;
     if ( !( this->iDivision & 0x8000 ) && this->iDivision > 0 )
         this->iTotalBeats = this->iTotalTicks / this->iDivision;
 }
 
-// Sets absolute time variables. A lot of code for not much happening...
-// Has to be EXACT. Even a little drift and things start messing up a few minutes in (metronome, etc)
 void MIDI::PostProcess( vector< MIDIEvent* > *vEvents )
 {
-    // Iterator like class
+    if ( !vEvents )
+        return PostProcess( static_cast< MIDIEventSink* >( NULL ) );
+
+    vEvents->reserve( vEvents->size() + m_Info.iEventCount );
+    MIDIEventVector sink( *vEvents );
+    PostProcess( &sink );
+}
+
+// Merges the tracks into one time ordered stream, handing each event to the sink (if any)
+// Sets absolute time variables along the way. A lot of code for not much happening...
+// Has to be EXACT. Even a little drift and things start messing up a few minutes in (metronome, etc)
+void MIDI::PostProcess( MIDIEventSink *pSink )
+{
+    // Tempo. Same defaults as MIDIPos
     MIDIPos midiPos( *this );
     bool bIsStandard = midiPos.IsStandard();
     int iTicksPerBeat = midiPos.GetTicksPerBeat();
@@ -399,11 +584,41 @@ void MIDI::PostProcess( vector< MIDIEvent* > *vEvents )
     long long llLastTempoTime = 0;
     int iSimultaneous = 0;
 
-    MIDIEvent *pEvent = NULL;
+    // Merge heap of ( tick, track ). Ties go to the lower track, same as MIDIPos
+    typedef pair< int, int > mergepos_t;
+    vector< mergepos_t > vHeap;
+    vector< size_t > vTrackPos( m_vTracks.size(), 0 );
+    vHeap.reserve( m_vTracks.size() );
+    for ( size_t i = 0; i < m_vTracks.size(); i++ )
+        if ( !m_vTracks[i]->m_vEvents.empty() )
+            vHeap.push_back( mergepos_t( m_vTracks[i]->m_vEvents[0]->GetAbsT(), static_cast< int >( i ) ) );
+    priority_queue< mergepos_t, vector< mergepos_t >, greater< mergepos_t > > pqMerge( greater< mergepos_t >(), vHeap );
+
     long long llFirstNote = -1;
     long long llTime = 0;
-    for ( midiPos.GetNextEvent( -1, &pEvent ); pEvent; midiPos.GetNextEvent( -1, &pEvent ) )
+    int iProcessed = 0;
+    if ( m_pProgress )
+    {
+        m_pProgress->SetPhase( LoadProgress::Merging );
+        m_pProgress->iTotalEvents = m_Info.iEventCount;
+        m_pProgress->iEventsProcessed = 0;
+    }
+    while ( !pqMerge.empty() )
     {
+        // Next event, and queue up the one after it on the same track
+        int iTrack = pqMerge.top().second;
+        pqMerge.pop();
+        const vector< MIDIEvent* > &vTrackEvents = m_vTracks[iTrack]->m_vEvents;
+        MIDIEvent *pEvent = vTrackEvents[vTrackPos[iTrack]++];
+        if ( vTrackPos[iTrack] < vTrackEvents.size() )
+            pqMerge.push( mergepos_t( vTrackEvents[vTrackPos[iTrack]]->GetAbsT(), iTrack ) );
+
+        if ( m_pProgress && ++iProcessed % LoadProgress::CheckInterval == 0 )
+        {
+            m_pProgress->iEventsProcessed = iProcessed;
+            if ( m_pProgress->IsCanceled() ) return;
+        }
+
         // Compute the exact time (off by at most a micro second... I don't feel like rounding)
         int iTick = pEvent->GetAbsT();
         if ( bIsStandard )
@@ -434,79 +649,765 @@ void MIDI::PostProcess( vector< MIDIEvent* > *vEvents )
             MIDIMetaEvent *pMetaEvent = reinterpret_cast< MIDIMetaEvent* >( pEvent );
             if ( pMetaEvent->GetMetaEventType() == MIDIMetaEvent::SetTempo )
             {
-                iTicksPerBeat = midiPos.GetTicksPerBeat();
-                iTicksPerSecond = midiPos.GetTicksPerSecond();
-                iMicroSecsPerBeat = midiPos.GetMicroSecsPerBeat();
+                if ( pMetaEvent->GetDataLen() == 3 )
+                    MIDI::Parse24Bit( pMetaEvent->GetData(), 3, &iMicroSecsPerBeat );
                 iLastTempoTick = iTick;
                 llLastTempoTime = llTime;
             }
         }
 
-        if ( vEvents ) vEvents->push_back( pEvent );
+        if ( pSink ) pSink->AddEvent( pEvent );
     }
 
     m_Info.llTotalMicroSecs = llTime;
     m_Info.llFirstNote = max( 0LL, llFirstNote );
 }
 
-void MIDI::ConnectNotes()
+//-----------------------------------------------------------------------------
+// Incremental loading
+//-----------------------------------------------------------------------------
+
+// Reads the header and finds the tracks. Each track gets its first event parsed so the merge can start
+int MIDI::StreamMIDI( const unsigned char *pcData, int iMaxSize )
 {
-    const int StackSize = 10;
-    int pSize[16][128];
-    MIDIChannelEvent *pStacks[16][128][StackSize];
+    int iTotal = ParseHeader( pcData, iMaxSize );
+    if ( iTotal == 0 ) return 0;
+
+    m_pStream = new StreamState();
+    StreamState &ss = *m_pStream;
+    ss.llTotalBytes = ss.llBytesLeft = 0;
 
-    for ( vector< MIDITrack* >::iterator itTrack = m_vTracks.begin(); itTrack != m_vTracks.end(); ++itTrack )
+    int iCount = 0, iTrack = 0;
+    do
+    {
+        MIDITrack *track = new MIDITrack();
+        iCount = track->StreamTrack( pcData + iTotal, iMaxSize - iTotal, iTrack );
+        if ( iCount > 0 )
+        {
+            m_vTracks.push_back( track );
+            ss.llTotalBytes += track->m_iStreamLeft;
+            if ( track->StreamEvent( m_Arena ) )
+                ss.pqMerge.push( StreamState::mergepos_t( track->m_pStreamEvent->GetAbsT(), iTrack ) );
+            ss.llBytesLeft += track->m_iStreamLeft;
+            iTrack++;
+        }
+        else
+            delete track;
+        iTotal += iCount;
+    }
+    while ( iMaxSize - iTotal > 0 && iCount > 0 && m_Info.iFormatType != 2 );
+
+    if ( m_vTracks.empty() )
     {
-        memset( pSize, 0, sizeof( pSize ) );
-        vector< MIDIEvent* > &vEvents = ( *itTrack )->m_vEvents;
-        int iEvents = (int)vEvents.size();
-        for ( int i = 0; i < iEvents; i++ )
-            if ( vEvents[i]->GetEventType() == MIDIEvent::ChannelEvent )
+        clear();
+        return 0;
+    }
+
+    // Tempo. Same defaults as MIDIPos
+    MIDIPos midiPos( *this );
+    ss.bIsStandard = midiPos.IsStandard();
+    ss.iTicksPerBeat = midiPos.GetTicksPerBeat();
+    ss.iTicksPerSecond = midiPos.GetTicksPerSecond();
+    ss.iMicroSecsPerBeat = midiPos.GetMicroSecsPerBeat();
+    ss.iLastTempoTick = 0;
+    ss.llLastTempoTime = ss.llTime = ss.llNextTime = 0;
+    return iTotal;
+}
+
+// Merges up to iMaxEvents more events, stopping early at the first one after llMaxMicroSec
+bool MIDI::StreamEvents( int iMaxEvents, long long llMaxMicroSec, MIDIEventSink *pSink )
+{
+    if ( !m_pStream ) return false;
+    StreamState &ss = *m_pStream;
+
+    for ( int i = 0; i < iMaxEvents && !ss.pqMerge.empty(); i++ )
+    {
+        int iTrack = ss.pqMerge.top().second;
+        MIDITrack *pTrack = m_vTracks[iTrack];
+        MIDIEvent *pEvent = pTrack->m_pStreamEvent;
+        int iTick = pEvent->GetAbsT();
+        long long llTime = ss.GetTime( iTick );
+        if ( llTime > llMaxMicroSec ) break;
+
+        // Queue up the next one on the same track before this one gets handed out
+        ss.pqMerge.pop();
+        int iLeft = pTrack->m_iStreamLeft;
+        if ( pTrack->StreamEvent( m_Arena ) )
+            ss.pqMerge.push( StreamState::mergepos_t( pTrack->m_pStreamEvent->GetAbsT(), iTrack ) );
+        ss.llBytesLeft -= iLeft - pTrack->m_iStreamLeft;
+
+        ss.llTime = llTime;
+        pEvent->SetAbsMicroSec( llTime );
+        if ( pEvent->GetEventType() == MIDIEvent::MetaEvent )
+        {
+            MIDIMetaEvent *pMetaEvent = reinterpret_cast< MIDIMetaEvent* >( pEvent );
+            if ( pMetaEvent->GetMetaEventType() == MIDIMetaEvent::SetTempo )
             {
-                MIDIChannelEvent *pEvent = reinterpret_cast< MIDIChannelEvent* >( vEvents[i] );
-                MIDIChannelEvent::ChannelEventType eEventType = pEvent->GetChannelEventType();
-                int iChannel = pEvent->GetChannel();
-                int iNote = pEvent->GetParam1();
-                int iVelocity = pEvent->GetParam2();
-                
-                if ( eEventType == MIDIChannelEvent::NoteOn && iVelocity > 0 )
-                {
-                    int &iSize = pSize[iChannel][iNote];
-                    if ( iSize < StackSize ) pStacks[iChannel][iNote][iSize] = pEvent;
-                    iSize++;
-                }
-                else if ( eEventType == MIDIChannelEvent::NoteOff || eEventType == MIDIChannelEvent::NoteOn )
+                if ( pMetaEvent->GetDataLen() == 3 )
+                    MIDI::Parse24Bit( pMetaEvent->GetData(), 3, &ss.iMicroSecsPerBeat );
+                ss.iLastTempoTick = iTick;
+                ss.llLastTempoTime = llTime;
+            }
+        }
+
+        if ( pSink ) pSink->AddEvent( pEvent );
+    }
+
+    ss.llNextTime = ( ss.pqMerge.empty() ? LLONG_MAX : ss.GetTime( ss.pqMerge.top().first ) );
+    return !ss.pqMerge.empty();
+}
+
+long long MIDI::GetStreamTime() const
+{
+    return m_pStream ? m_pStream->llNextTime : LLONG_MAX;
+}
+
+double MIDI::GetStreamFraction() const
+{
+    if ( !m_pStream || m_pStream->llTotalBytes <= 0 ) return 1.0;
+    return 1.0 - static_cast< double >( m_pStream->llBytesLeft ) / m_pStream->llTotalBytes;
+}
+
+// Pairs up notes (last in first out per track, channel and note, same as parsing) and counts
+// what's on. Also keeps the note info current so volume correction works before the end
+void MIDI::AddStreamedEvent( MIDIEvent *pEvent )
+{
+    if ( !m_pStream ) return;
+    StreamState &ss = *m_pStream;
+    MIDITrack::MIDITrackInfo &mTrackInfo = m_vTracks[pEvent->GetTrack()]->m_TrackInfo;
+    mTrackInfo.AddEventInfo( *pEvent );
+    m_Info.iEventCount++;
+    if ( pEvent->GetEventType() != MIDIEvent::ChannelEvent ) return;
+
+    MIDIChannelEvent *pChannelEvent = reinterpret_cast< MIDIChannelEvent* >( pEvent );
+    MIDIChannelEvent::ChannelEventType eEventType = pChannelEvent->GetChannelEventType();
+    int iNote = pChannelEvent->GetParam1();
+    int iVelocity = pChannelEvent->GetParam2();
+    vector< MIDIChannelEvent* > &vOpen = ss.vOpen[pChannelEvent->GetChannel()][iNote & 0x7F];
+    pChannelEvent->SetSimultaneous( ss.iSimultaneous );
+
+    if ( eEventType == MIDIChannelEvent::NoteOn && iVelocity > 0 )
+    {
+        vOpen.push_back( pChannelEvent );
+        ss.iSimultaneous++;
+
+        if ( !m_Info.iNoteCount )
+        {
+            m_Info.llFirstNote = pEvent->GetAbsMicroSec();
+            m_Info.iMinNote = m_Info.iMaxNote = iNote;
+        }
+        m_Info.iMinNote = min( iNote, m_Info.iMinNote );
+        m_Info.iMaxNote = max( iNote, m_Info.iMaxNote );
+        m_Info.iMaxVolume = max( iVelocity, m_Info.iMaxVolume );
+        m_Info.iVolumeSum += iVelocity;
+        m_Info.iNoteCount++;
+    }
+    else if ( eEventType == MIDIChannelEvent::NoteOff || eEventType == MIDIChannelEvent::NoteOn )
+    {
+        for ( vector< MIDIChannelEvent* >::reverse_iterator it = vOpen.rbegin(); it != vOpen.rend(); ++it )
+            if ( (*it)->GetTrack() == pEvent->GetTrack() )
+            {
+                (*it)->SetSister( pChannelEvent );
+                vOpen.erase( ( it + 1 ).base() );
+                mTrackInfo.iPairedNoteCount++;
+                ss.iSimultaneous--;
+                break;
+            }
+    }
+}
+
+// Everything's been handed out and added. Redo the totals from the complete tracks and let go of the file
+void MIDI::FinishStream()
+{
+    if ( !m_pStream ) return;
+
+    MIDIInfo mHeader = m_Info;
+    m_Info.clear();
+    m_Info.sFilename = mHeader.sFilename;
+    m_Info.sMd5 = mHeader.sMd5;
+    m_Info.iFormatType = mHeader.iFormatType;
+    m_Info.iNumTracks = mHeader.iNumTracks;
+    m_Info.iDivision = mHeader.iDivision;
+    for ( vector< MIDITrack* >::const_iterator it = m_vTracks.begin(); it != m_vTracks.end(); ++it )
+        m_Info.AddTrackInfo( **it );
+    m_Info.llTotalMicroSecs = m_pStream->llTime;
+    m_Info.llFirstNote = max( 0LL, mHeader.llFirstNote );
+
+    delete m_pStream;
+    m_pStream = NULL;
+}
+
+//-----------------------------------------------------------------------------
+// Previews
+//-----------------------------------------------------------------------------
+
+// Mapped rather than read in, so the pages past the start of each track never come off the disk
+bool MIDI::LoadPreview( const wstring &sFilename, long long llMaxMicroSec, vector< MIDIEvent* > &vEvents, MIDIControlState *pState )
+{
+    MappedFile file;
+    if ( !file.Open( sFilename ) || !ParsePreview( file.GetData(), file.GetSize(), llMaxMicroSec, vEvents, pState ) )
+        return false;
+    m_Info.sFilename = sFilename;
+    return true;
+}
+
+// A stream that's merged up to the cutoff and then finished early. The tracks' decoders are left one event past
+// the cutoff, which is as far as any of them got parsed
+bool MIDI::ParsePreview( const unsigned char *pcData, int iMaxSize, long long llMaxMicroSec, vector< MIDIEvent* > &vEvents,
+                         MIDIControlState *pState )
+{
+    if ( pState ) pState->clear();
+    if ( StreamMIDI( pcData, iMaxSize ) == 0 ) return false;
+    StreamState &ss = *m_pStream;
+
+    size_t iFirst = vEvents.size();
+    MIDIEventVector sink( vEvents );
+    bool bMore = StreamEvents( INT_MAX, llMaxMicroSec, &sink );
+    for ( size_t i = iFirst; i < vEvents.size(); i++ )
+    {
+        AddStreamedEvent( vEvents[i] );
+        if ( pState ) pState->AddEvent( *vEvents[i] );
+    }
+
+    // Cut off whatever's still on, unless the song's really over. A full load leaves those unpaired too
+    if ( bMore )
+    {
+        int iTick = ss.GetTick( llMaxMicroSec, ss.pqMerge.top().first );
+        for ( int iChannel = 0; iChannel < 16; iChannel++ )
+            for ( int iNote = 0; iNote < 128; iNote++ )
+                for ( vector< MIDIChannelEvent* > &vOpen = ss.vOpen[iChannel][iNote]; !vOpen.empty(); )
                 {
-                    int &iSize = pSize[iChannel][iNote];
-                    if ( iSize > 0 )
-                    {
-                        if ( iSize <= StackSize ) pStacks[iChannel][iNote][iSize - 1]->SetSister( pEvent );
-                        else // Should never get here
-                        {
-                            int j = i - 1;
-                            while ( j >= 0 && !pEvent->GetSister() )
-                            {
-                                if ( vEvents[j]->GetEventType() == MIDIEvent::ChannelEvent )
-                                {
-                                    MIDIChannelEvent *pSister = reinterpret_cast< MIDIChannelEvent* >( vEvents[j] );
-                                    if ( !pSister->GetSister() &&
-                                         pSister->GetChannelEventType() == MIDIChannelEvent::NoteOn && 
-                                         pSister->GetParam1() == iNote && pSister->GetParam2() > 0 )
-                                        pEvent->SetSister( pSister );
-                                }
-                                j--;
-                            }
-                        }
-                        iSize--;
-                    }
+                    MIDIChannelEvent *pEvent = MIDIChannelEvent::MakeNoteOff( vOpen.back()->GetTrack(), iChannel,
+                                                                              vOpen.back()->GetParam1(), iTick, m_Arena );
+                    pEvent->SetAbsMicroSec( llMaxMicroSec );
+                    AddStreamedEvent( pEvent ); // Pairs it with vOpen.back()
+                    vEvents.push_back( pEvent );
                 }
+        ss.llTime = llMaxMicroSec;
+    }
+
+    FinishStream();
+    return true;
+}
+
+void MIDI::MIDIControlState::AddEvent( const MIDIEvent &mEvent )
+{
+    if ( mEvent.GetEventType() == MIDIEvent::MetaEvent )
+    {
+        const MIDIMetaEvent &mMetaEvent = reinterpret_cast< const MIDIMetaEvent& >( mEvent );
+        if ( mMetaEvent.GetMetaEventType() == MIDIMetaEvent::SetTempo && mMetaEvent.GetDataLen() == 3 )
+            MIDI::Parse24Bit( mMetaEvent.GetData(), 3, &iMicroSecsPerBeat );
+    }
+    else if ( mEvent.GetEventType() == MIDIEvent::ChannelEvent )
+    {
+        const MIDIChannelEvent &mChannelEvent = reinterpret_cast< const MIDIChannelEvent& >( mEvent );
+        int iChannel = mChannelEvent.GetChannel();
+        switch ( mChannelEvent.GetChannelEventType() )
+        {
+            case MIDIChannelEvent::ProgramChange:
+                aProgram[iChannel] = mChannelEvent.GetParam1() & 0x7F;
+                break;
+            case MIDIChannelEvent::Controller:
+                aController[iChannel][mChannelEvent.GetParam1() & 0x7F] = static_cast< signed char >( mChannelEvent.GetParam2() & 0x7F );
+                break;
+            case MIDIChannelEvent::PitchBend:
+                aPitchBend[iChannel] = ( ( mChannelEvent.GetParam2() & 0x7F ) << 7 ) | ( mChannelEvent.GetParam1() & 0x7F );
+                break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Event optimizing
+//-----------------------------------------------------------------------------
+
+// Each continuous value gets a stream: per channel, the 128 controllers, poly aftertouch on the 128 keys,
+// channel aftertouch, then pitch bend
+static const int OptimizeStreams = 128 + 128 + 2;
+
+static int GetOptimizeStream( const MIDIChannelEvent &mEvent )
+{
+    int iBase = mEvent.GetChannel() * OptimizeStreams;
+    switch ( mEvent.GetChannelEventType() )
+    {
+        case MIDIChannelEvent::Controller: return iBase + ( mEvent.GetParam1() & 0x7F );
+        case MIDIChannelEvent::NoteAftertouch: return iBase + 128 + ( mEvent.GetParam1() & 0x7F );
+        case MIDIChannelEvent::ChannelAftertouch: return iBase + 256;
+        case MIDIChannelEvent::PitchBend: return iBase + 257;
+        default: return -1;
+    }
+}
+
+// Controllers whose value is a level, so a few in a row can be thinned. LSBs aren't: they go with their MSB
+static bool IsContinuous( int iController )
+{
+    return iController == 1 || iController == 2 || ( iController >= 4 && iController <= 5 ) || ( iController >= 7 && iController <= 8 ) ||
+           ( iController >= 10 && iController <= 13 ) || ( iController >= 16 && iController <= 19 ) ||
+           ( iController >= 71 && iController <= 79 ) || ( iController >= 91 && iController <= 95 );
+}
+
+// Controllers where sending the value it already has does nothing. Data entry and increment/decrement act
+// each time, and the channel mode messages from 120 up are commands
+static bool IsStateful( int iController )
+{
+    return iController < 120 && iController != 6 && iController != 38 && iController != 96 && iController != 97;
+}
+
+void MIDI::OptimizeEvents( vector< MIDIChannelEvent* > &vEvents, long long llThinMicroSecs, OptimizeStats &stats,
+                           vector< int > *pvSourcePos )
+{
+    if ( pvSourcePos ) pvSourcePos->clear();
+
+    // When each stream's next event is, for thinning. -1 if it has none
+    vector< long long > vNextTime;
+    vector< long long > vLastTime( 16 * OptimizeStreams, -1 );
+    if ( llThinMicroSecs > 0 )
+    {
+        vNextTime.resize( vEvents.size() );
+        for ( size_t i = vEvents.size(); i-- > 0; )
+        {
+            int iStream = GetOptimizeStream( *vEvents[i] );
+            vNextTime[i] = ( iStream >= 0 ? vLastTime[iStream] : -1 );
+            if ( iStream >= 0 ) vLastTime[iStream] = vEvents[i]->GetAbsMicroSec();
+        }
+        vLastTime.assign( vLastTime.size(), -1 );
+    }
+
+    // Values as sent, -1 if unknown. Thinned and dropped events don't change them
+    vector< int > vValue( 16 * OptimizeStreams, -1 );
+    int aProgram[16], aProgramBank[16];
+    for ( int i = 0; i < 16; i++ ) aProgram[i] = aProgramBank[i] = -1;
+
+    size_t iOut = 0;
+    for ( size_t i = 0; i < vEvents.size(); i++ )
+    {
+        MIDIChannelEvent *pEvent = vEvents[i];
+        int iChannel = pEvent->GetChannel();
+        int iBase = iChannel * OptimizeStreams;
+        MIDIChannelEvent::ChannelEventType eType = pEvent->GetChannelEventType();
+
+        // Notes that end where they start. Both halves go
+        bool bNoteOn = ( eType == MIDIChannelEvent::NoteOn && pEvent->GetParam2() > 0 );
+        if ( ( eType == MIDIChannelEvent::NoteOn || eType == MIDIChannelEvent::NoteOff ) && pEvent->GetSister() )
+        {
+            const MIDIChannelEvent *pOn = ( bNoteOn ? pEvent : pEvent->GetSister() );
+            const MIDIChannelEvent *pOff = pOn->GetSister();
+            if ( pOn->GetChannelEventType() == MIDIChannelEvent::NoteOn && pOn->GetParam2() > 0 && pOff->GetAbsT() == pOn->GetAbsT() )
+            {
+                if ( bNoteOn ) stats.iZeroNotes++;
+                continue;
+            }
+        }
+        if ( bNoteOn ) vValue[iBase + 128 + ( pEvent->GetParam1() & 0x7F )] = -1; // A new note's pressure starts over
+
+        // No-ops. A program change isn't one if the bank's changed since the last
+        int iStream = GetOptimizeStream( *pEvent );
+        int iValue = -1;
+        bool bThinnable = false;
+        if ( eType == MIDIChannelEvent::ProgramChange )
+        {
+            int iProgram = pEvent->GetParam1() & 0x7F;
+            int iBank = vValue[iBase] * 256 + vValue[iBase + 32];
+            if ( iProgram == aProgram[iChannel] && iBank == aProgramBank[iChannel] )
+            {
+                stats.iPrograms++;
+                continue;
             }
+            aProgram[iChannel] = iProgram;
+            aProgramBank[iChannel] = iBank;
+        }
+        else if ( eType == MIDIChannelEvent::Controller )
+        {
+            int iController = pEvent->GetParam1() & 0x7F;
+            if ( iController == 121 ) // Reset all controllers. Only some of them, and it depends on the synth
+                fill( vValue.begin() + iBase, vValue.begin() + iBase + OptimizeStreams, -1 );
+            if ( IsStateful( iController ) ) iValue = pEvent->GetParam2() & 0x7F;
+            bThinnable = IsContinuous( iController );
+        }
+        else if ( eType == MIDIChannelEvent::NoteAftertouch )
+        {
+            iValue = pEvent->GetParam2() & 0x7F;
+            bThinnable = true;
+        }
+        else if ( eType == MIDIChannelEvent::ChannelAftertouch )
+        {
+            iValue = pEvent->GetParam1() & 0x7F;
+            bThinnable = true;
+        }
+        else if ( eType == MIDIChannelEvent::PitchBend )
+        {
+            iValue = ( ( pEvent->GetParam2() & 0x7F ) << 7 ) | ( pEvent->GetParam1() & 0x7F );
+            bThinnable = true;
+        }
+
+        if ( iValue >= 0 )
+        {
+            if ( iValue == vValue[iStream] )
+            {
+                stats.iControllers++;
+                continue;
+            }
+
+            // Too soon after the last one sent, and another's coming soon enough to carry the value on
+            long long llTime = pEvent->GetAbsMicroSec();
+            if ( bThinnable && llThinMicroSecs > 0 && vLastTime[iStream] >= 0 && llTime - vLastTime[iStream] < llThinMicroSecs &&
+                 vNextTime[i] >= 0 && vNextTime[i] - llTime < llThinMicroSecs )
+            {
+                stats.iThinned++;
+                continue;
+            }
+            vValue[iStream] = iValue;
+            vLastTime[iStream] = llTime;
+        }
+
+        if ( pvSourcePos )
+        {
+            if ( pvSourcePos->empty() && iOut < i ) // First gap. Everything before stayed put
+                for ( int iPos = 0; iPos < static_cast< int >( iOut ); iPos++ ) pvSourcePos->push_back( iPos );
+            if ( !pvSourcePos->empty() || iOut < i ) pvSourcePos->push_back( static_cast< int >( i ) );
+        }
+        vEvents[iOut++] = pEvent;
+    }
+    vEvents.resize( iOut );
+
+    // Notes on at each event, as PostProcess counts them. Zero length notes were counted there
+    if ( stats.iZeroNotes > 0 )
+    {
+        int iSimultaneous = 0;
+        for ( size_t i = 0; i < vEvents.size(); i++ )
+        {
+            MIDIChannelEvent *pEvent = vEvents[i];
+            pEvent->SetSimultaneous( iSimultaneous );
+            if ( pEvent->GetSister() )
+                iSimultaneous += ( pEvent->GetChannelEventType() == MIDIChannelEvent::NoteOn && pEvent->GetParam2() > 0 ? 1 : -1 );
+        }
     }
 }
 
+//-----------------------------------------------------------------------------
+// Fast decoding. Dense note data is nearly all channel events with one byte
+// DTs and running status. Those take a branch that's almost always predicted
+// right; longer DTs read a word and look up the length instead of looping.
+// Each event depends on the last one's length, so going branch-free all the
+// way is slower. The bounds checks are left to the caller.
+//-----------------------------------------------------------------------------
+
+// VLQ length by the continuation bits of the first 4 bytes, the first byte's in bit 3. Capped at 4 like ParseVarNum
+static const unsigned char g_aVarNumLength[16] = { 1, 1, 1, 1, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 4, 4 };
+
+// Parameter count by the top nibble of the event code. 0 means not a channel event
+static const unsigned char g_aChannelParams[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 1, 1, 2, 0 };
+
+// ParseVarNum without the checks. Reads 4 bytes whatever the length turns out to be
+static inline int ParseFastVarNum( const unsigned char *pcData, int *piOut )
+{
+    unsigned uWord = ( static_cast< unsigned >( pcData[0] ) << 24 ) | ( pcData[1] << 16 ) | ( pcData[2] << 8 ) | pcData[3];
+
+    // Gather the four continuation bits into the top nibble, then keep just this number's bytes
+    int iLength = g_aVarNumLength[( ( uWord & 0x80808080 ) * 0x00204081 ) >> 28];
+    uWord >>= 32 - 8 * iLength;
+    *piOut = static_cast< int >( ( uWord & 0x7F ) | ( ( uWord >> 1 ) & 0x3F80 ) | ( ( uWord >> 2 ) & 0x1FC000 ) | ( ( uWord >> 3 ) & 0xFE00000 ) );
+    return iLength;
+}
+
+int MIDIChannelEvent::DecodeFast( const unsigned char *pcData, int iPrevCode, int *piDT, int *piEventCode, int *piParams )
+{
+    int iTotal = 1;
+    if ( pcData[0] < 0x80 )
+        *piDT = pcData[0];
+    else
+        iTotal = ParseFastVarNum( pcData, piDT );
+    int iEventCode = pcData[iTotal];
+    if ( iEventCode < 0x80 )
+        iEventCode = iPrevCode;
+    else
+        iTotal++;
+
+    *piEventCode = iEventCode;
+    *piParams = g_aChannelParams[iEventCode >> 4];
+    return *piParams > 0 ? iTotal : 0;
+}
 
 //-----------------------------------------------------------------------------
-// MIDITrack functions
+// Library scanning
+//-----------------------------------------------------------------------------
+
+// A tempo change found while scanning. iMicroSecsPerBeat is -1 if the event's data was bad (tempo stays put)
+struct ScanTempo
+{
+    ScanTempo( int iTick, int iTrack, int iMicroSecsPerBeat ) : iTick( iTick ), iTrack( iTrack ), iMicroSecsPerBeat( iMicroSecsPerBeat ) { }
+    bool operator<( const ScanTempo &other ) const { return iTick < other.iTick || ( iTick == other.iTick && iTrack < other.iTrack ); }
+
+    int iTick, iTrack, iMicroSecsPerBeat;
+};
+
+// Turns ticks into microseconds once ScanInfo has walked the tempo changes. Lookups with rising ticks share a
+// cursor, so converting a whole track or a sorted list is one pass over the changes
+struct ScanTempoMap
+{
+    long long GetTime( int iTick, size_t &iCursor ) const
+    {
+        while ( iCursor < vTempo.size() && vTempo[iCursor].iTick <= iTick ) iCursor++;
+        int iLastTempoTick = ( iCursor > 0 ? vTempo[iCursor - 1].iTick : 0 );
+        long long llLastTempoTime = ( iCursor > 0 ? vTime[iCursor - 1] : 0 );
+        if ( !bIsStandard )
+            return llLastTempoTime + ( 1000000LL * ( iTick - iLastTempoTick ) ) / iTicksPerSecond;
+        int iMicroSecsPerBeat = ( iCursor > 0 ? vTempo[iCursor - 1].iMicroSecsPerBeat : iStartMicroSecsPerBeat );
+        return llLastTempoTime + ( static_cast< long long >( iMicroSecsPerBeat ) * ( iTick - iLastTempoTick ) ) / iTicksPerBeat;
+    }
+
+    vector< ScanTempo > vTempo; // In merge order. Once walked, iMicroSecsPerBeat is the tempo from that change on
+    vector< long long > vTime; // When each change happens
+    bool bIsStandard;
+    int iTicksPerBeat, iTicksPerSecond, iStartMicroSecsPerBeat;
+};
+
+// Steps through one track's events exactly like MIDITrack::ParseEvents, only counting. Returns the bytes used.
+// fnNote( tick, key ) gets called for every note on
+template< class NoteFn >
+static int ScanEvents( const unsigned char *pcData, int iMaxSize, int iTrack, MIDI::MIDIInfo &mInfo, vector< ScanTempo > &vTempo, NoteFn fnNote )
+{
+    int iTotal = 0, iTick = 0, iPrevCode = -1, iEvents = 0, iNotes = 0;
+    unsigned iChannels = 0;
+    bool bEnd = false;
+    int iFastEnd = iMaxSize - MIDIChannelEvent::FastParseSize; // Negative for tiny tracks, so never fast
+    while ( iMaxSize - iTotal > 0 && !bEnd )
+    {
+        // Runs of channel events go the fast way, unless we're near the end of the data. Notes are
+        // counted without branching, since note ons and offs come in no particular order
+        const unsigned char *pcEvent = pcData + iTotal;
+        int iDT, iEventCode, iParams, iCount;
+        while ( pcEvent - pcData <= iFastEnd &&
+                ( iCount = MIDIChannelEvent::DecodeFast( pcEvent, max( iPrevCode, 0 ), &iDT, &iEventCode, &iParams ) ) > 0 )
+        {
+            pcEvent += iCount;
+            int iNote = ( ( iEventCode >> 4 ) == MIDIChannelEvent::NoteOn ) & ( pcEvent[1] > 0 );
+            iNotes += iNote;
+            iChannels |= iNote << ( iEventCode & 0xF );
+            if ( iNote ) fnNote( iTick + iDT, pcEvent[0] & 0x7F );
+
+            iTick += iDT;
+            pcEvent += iParams;
+            iPrevCode = iEventCode;
+            iEvents++;
+        }
+        iTotal = static_cast< int >( pcEvent - pcData );
+        int iLeft = iMaxSize - iTotal;
+        if ( iLeft <= 0 ) break;
+
+        // DT and event code. Running status reuses the last code, whatever kind of event it was
+        iCount = MIDI::ParseVarNum( pcEvent, iLeft, &iDT );
+        if ( iCount == 0 || iLeft - iCount < 1 ) break;
+        iEventCode = pcEvent[iCount];
+        if ( iEventCode < 0x80 )
+        {
+            if ( iPrevCode < 0 ) break;
+            iEventCode = iPrevCode;
+        }
+        else
+            iCount++;
+        iParams = g_aChannelParams[iEventCode >> 4];
+        pcEvent += iCount;
+        iLeft -= iCount;
+
+        // The rest of the event
+        int iDataLen, iLenCount;
+        if ( iEventCode < 0xF0 )
+        {
+            int iType = iEventCode >> 4;
+            if ( iLeft < iParams ) break;
+            if ( iType == MIDIChannelEvent::NoteOn && pcEvent[1] > 0 )
+            {
+                iNotes++;
+                iChannels |= 1 << ( iEventCode & 0xF );
+                fnNote( iTick + iDT, pcEvent[0] & 0x7F );
+            }
+            iCount += iParams;
+        }
+        else if ( iEventCode < 0xFF )
+        {
+            iLenCount = MIDI::ParseVarNum( pcEvent, iLeft, &iDataLen );
+            if ( iLenCount == 0 || iLeft < iLenCount + iDataLen ) break;
+            iCount += iLenCount + iDataLen;
+        }
+        else
+        {
+            iLenCount = MIDI::ParseVarNum( pcEvent + 1, iLeft - 1, &iDataLen );
+            if ( iLenCount == 0 || iLeft < 1 + iLenCount + iDataLen ) break;
+            if ( pcEvent[0] == MIDIMetaEvent::SetTempo )
+            {
+                int iMicroSecsPerBeat = -1;
+                if ( iDataLen == 3 ) MIDI::Parse24Bit( pcEvent + 1 + iLenCount, 3, &iMicroSecsPerBeat );
+                vTempo.push_back( ScanTempo( iTick + iDT, iTrack, iMicroSecsPerBeat ) );
+            }
+            bEnd = ( pcEvent[0] == MIDIMetaEvent::EndOfTrack );
+            iCount += 1 + iLenCount + iDataLen;
+        }
+
+        iTick += iDT;
+        iTotal += iCount;
+        iPrevCode = iEventCode;
+        iEvents++;
+    }
+
+    for ( ; iChannels; iChannels &= iChannels - 1 )
+        mInfo.iNumChannels++;
+    mInfo.iEventCount += iEvents;
+    mInfo.iNoteCount += iNotes;
+    mInfo.iTotalTicks = max( mInfo.iTotalTicks, iTick );
+    return iTotal;
+}
+
+// Difficulty from every note on, packed as ( tick << 7 ) | key. Chords come straight off the sorted notes, then the
+// notes are turned into start times for the busiest second
+static void ScanStats( vector< long long > &vNotes, const ScanTempoMap &tempoMap, MIDI::MIDIStats &mStats )
+{
+    if ( vNotes.empty() ) return;
+    sort( vNotes.begin(), vNotes.end() );
+    vNotes.erase( unique( vNotes.begin(), vNotes.end() ), vNotes.end() );
+
+    // Chords. The keys of a tick come out in order
+    mStats.iLowKey = 127;
+    for ( size_t i = 0, j; i < vNotes.size(); i = j )
+    {
+        long long llTick = vNotes[i] >> 7;
+        for ( j = i + 1; j < vNotes.size() && ( vNotes[j] >> 7 ) == llTick; j++ );
+        int iLow = static_cast< int >( vNotes[i] & 0x7F ), iHigh = static_cast< int >( vNotes[j - 1] & 0x7F );
+        mStats.iMaxChord = max( mStats.iMaxChord, static_cast< int >( j - i ) );
+        mStats.iMaxChordSpan = max( mStats.iMaxChordSpan, iHigh - iLow );
+        mStats.iLowKey = min( mStats.iLowKey, iLow );
+        mStats.iHighKey = max( mStats.iHighKey, iHigh );
+    }
+
+    // Start times. Sorted ticks give sorted times
+    size_t iCursor = 0;
+    for ( vector< long long >::iterator it = vNotes.begin(); it != vNotes.end(); ++it )
+        *it = tempoMap.GetTime( static_cast< int >( *it >> 7 ), iCursor );
+
+    // Busiest second
+    for ( size_t i = 0, j = 0; j < vNotes.size(); j++ )
+    {
+        while ( vNotes[j] - vNotes[i] >= 1000000 ) i++;
+        mStats.iPeakNotesPerSec = max( mStats.iPeakNotesPerSec, static_cast< int >( j - i + 1 ) );
+    }
+}
+
+// A second pass over the tracks that bins each note on as it's found. Nothing is kept per note, so big songs
+// cost no more memory than small ones
+static void ScanThumbnail( const unsigned char *pcData, int iMaxSize, const vector< int > &vTrackStart, const ScanTempoMap &tempoMap,
+                           long long llLength, MIDI::MIDIThumbnail &mThumb )
+{
+    typedef MIDI::MIDIThumbnail Thumb;
+    unsigned aCounts[Thumb::Height][Thumb::Width] = { 0 };
+    MIDI::MIDIInfo mScratch;
+    vector< ScanTempo > vScratch;
+    for ( size_t i = 0; i < vTrackStart.size(); i++ )
+    {
+        size_t iCursor = 0;
+        int iLastTick = -1, iX = 0;
+        vScratch.clear();
+        ScanEvents( pcData + vTrackStart[i], iMaxSize - vTrackStart[i], static_cast< int >( i ), mScratch, vScratch, [&]( int iTick, int iKey )
+        {
+            // Chords share a column
+            if ( iTick != iLastTick && llLength > 0 )
+                iX = static_cast< int >( min( tempoMap.GetTime( iTick, iCursor ) * Thumb::Width / llLength, Thumb::Width - 1LL ) );
+            iLastTick = iTick;
+            int iY = min( max( iKey - Thumb::FirstKey, 0 ) / Thumb::KeysPerRow, Thumb::Height - 1 );
+            aCounts[iY][iX]++;
+        } );
+    }
+
+    // Log scale against the busiest cell so quiet passages still show up. Any notes at all get at least 1
+    unsigned iMax = 0;
+    for ( int y = 0; y < Thumb::Height; y++ )
+        for ( int x = 0; x < Thumb::Width; x++ )
+            iMax = max( iMax, aCounts[y][x] );
+    if ( iMax == 0 ) return;
+
+    double dScale = 15.0 / log( 1.0 + iMax );
+    for ( int y = 0; y < Thumb::Height; y++ )
+        for ( int x = 0; x < Thumb::Width; x++ )
+            if ( aCounts[y][x] > 0 )
+                mThumb.Set( x, y, max( 1, static_cast< int >( log( 1.0 + aCounts[y][x] ) * dScale + 0.5 ) ) );
+}
+
+bool MIDI::ScanInfo( const wstring &sFilename, MIDIInfo &mInfo, MIDIStats *pStats, MIDIThumbnail *pThumb )
+{
+    MappedFile file;
+    mInfo.clear();
+    if ( !file.Open( sFilename ) || !ScanInfo( file.GetData(), file.GetSize(), mInfo, pStats, pThumb ) ) return false;
+
+    mInfo.sFilename = sFilename;
+    Util::MD5( file.GetData(), file.GetSize(), mInfo.sMd5 );
+    return true;
+}
+
+// Tracks are found the same way ParseTracks finds them. The length is worked out from the tempo changes alone,
+// visited in the order PostProcess's merge would hand them out
+bool MIDI::ScanInfo( const unsigned char *pcData, int iMaxSize, MIDIInfo &mInfo, MIDIStats *pStats, MIDIThumbnail *pThumb )
+{
+    MIDI midi;
+    int iTotal = midi.ParseHeader( pcData, iMaxSize );
+    mInfo = midi.m_Info;
+    if ( pStats ) pStats->clear();
+    if ( pThumb ) pThumb->clear();
+    if ( iTotal == 0 ) return false;
+
+    int iTracks = 0;
+    ScanTempoMap tempoMap;
+    vector< ScanTempo > &vTempo = tempoMap.vTempo;
+    vector< long long > vNotes; // Only for the stats
+    vector< int > vTrackStart; // Only for the thumbnail
+    while ( iMaxSize - iTotal >= 8 && strncmp( reinterpret_cast< const char* >( pcData + iTotal ), "MTrk", 4 ) == 0 )
+    {
+        if ( pThumb ) vTrackStart.push_back( iTotal + 8 );
+        if ( pStats )
+            iTotal += 8 + ScanEvents( pcData + iTotal + 8, iMaxSize - iTotal - 8, iTracks++, mInfo, vTempo,
+                                      [&vNotes]( int iTick, int iKey ) { vNotes.push_back( ( static_cast< long long >( iTick ) << 7 ) | iKey ); } );
+        else
+            iTotal += 8 + ScanEvents( pcData + iTotal + 8, iMaxSize - iTotal - 8, iTracks++, mInfo, vTempo, []( int, int ) { } );
+        if ( mInfo.iFormatType == 2 ) break;
+    }
+    if ( !( mInfo.iDivision & 0x8000 ) && mInfo.iDivision > 0 )
+        mInfo.iTotalBeats = mInfo.iTotalTicks / mInfo.iDivision;
+
+    // Tempo. Same defaults and rounding as PostProcess
+    MIDIPos midiPos( midi );
+    bool bIsStandard = midiPos.IsStandard();
+    int iTicksPerBeat = midiPos.GetTicksPerBeat();
+    int iTicksPerSecond = midiPos.GetTicksPerSecond();
+    int iMicroSecsPerBeat = midiPos.GetMicroSecsPerBeat();
+    int iLastTempoTick = 0;
+    long long llLastTempoTime = 0;
+    if ( !bIsStandard && iTicksPerSecond == 0 ) return false;
+
+    stable_sort( vTempo.begin(), vTempo.end() );
+    vTempo.push_back( ScanTempo( mInfo.iTotalTicks, iTracks, -1 ) ); // The end of the song
+    for ( vector< ScanTempo >::iterator it = vTempo.begin(); it != vTempo.end(); ++it )
+    {
+        if ( bIsStandard )
+            mInfo.llTotalMicroSecs = llLastTempoTime + ( static_cast< long long >( iMicroSecsPerBeat ) * ( it->iTick - iLastTempoTick ) ) / iTicksPerBeat;
+        else
+            mInfo.llTotalMicroSecs = llLastTempoTime + ( 1000000LL * ( it->iTick - iLastTempoTick ) ) / iTicksPerSecond;
+        if ( pStats && bIsStandard && it->iTick > 0 && it->iMicroSecsPerBeat >= 0 && it->iMicroSecsPerBeat != iMicroSecsPerBeat )
+            pStats->iTempoChanges++;
+        if ( it->iMicroSecsPerBeat >= 0 ) iMicroSecsPerBeat = it->iMicroSecsPerBeat;
+        it->iMicroSecsPerBeat = iMicroSecsPerBeat;
+        iLastTempoTick = it->iTick;
+        llLastTempoTime = mInfo.llTotalMicroSecs;
+        tempoMap.vTime.push_back( llLastTempoTime );
+    }
+
+    tempoMap.bIsStandard = bIsStandard;
+    tempoMap.iTicksPerBeat = iTicksPerBeat;
+    tempoMap.iTicksPerSecond = iTicksPerSecond;
+    tempoMap.iStartMicroSecsPerBeat = midiPos.GetMicroSecsPerBeat();
+    if ( pStats ) ScanStats( vNotes, tempoMap, *pStats );
+    if ( pThumb ) ScanThumbnail( pcData, iMaxSize, vTrackStart, tempoMap, mInfo.llTotalMicroSecs, *pThumb );
+
+    return iTracks > 0 && mInfo.iNoteCount > 0 && mInfo.iDivision > 0;
+}
+
 //-----------------------------------------------------------------------------
 
 MIDITrack::~MIDITrack( void )
@@ -514,15 +1415,14 @@ MIDITrack::~MIDITrack( void )
     clear();
 }
 
+// The events belong to the MIDI's arena
 void MIDITrack::clear( void )
 {
-    for ( auto it = m_vEvents.begin(); it != m_vEvents.end(); ++it )
-        delete *it;
     m_vEvents.clear();
     m_TrackInfo.clear();
 }
 
-int MIDITrack::ParseTrack( const unsigned char *pcData, int iMaxSize, int iTrack )
+int MIDITrack::ParseTrack( const unsigned char *pcData, int iMaxSize, int iTrack, Arena &arena, LoadProgress *pProgress )
 {
     char pcBuf[4];
     int iTotal, iTrkSize;
@@ -538,31 +1438,111 @@ int MIDITrack::ParseTrack( const unsigned char *pcData, int iMaxSize, int iTrack
     // Check header
     if ( strncmp( pcBuf, "MTrk", 4 ) != 0 ) return 0;
 
-    return iTotal + ParseEvents( pcData + iTotal, iMaxSize - iTotal, iTrack );
+    if ( pProgress ) pProgress->llBytesParsed += iTotal;
+    return iTotal + ParseEvents( pcData + iTotal, iMaxSize - iTotal, iTrack, arena, pProgress );
+}
+
+// Streaming only looks at the header. The events are parsed one at a time by StreamEvent
+int MIDITrack::StreamTrack( const unsigned char *pcData, int iMaxSize, int iTrack )
+{
+    char pcBuf[4];
+    int iTrkSize;
+
+    // Reset first
+    clear();
+
+    // Read header
+    if ( MIDI::ParseNChars( pcData, 4, iMaxSize, pcBuf ) != 4 ) return 0;
+    if ( MIDI::Parse32Bit( pcData + 4, iMaxSize - 4, &iTrkSize) != 4 ) return 0;
+
+    // Check header
+    if ( strncmp( pcBuf, "MTrk", 4 ) != 0 ) return 0;
+
+    // Have to trust the size to find the next track
+    m_pcStream = pcData + 8;
+    m_iStreamLeft = min( max( iTrkSize, 0 ), iMaxSize - 8 );
+    m_iStreamTrack = iTrack;
+    m_pStreamEvent = NULL;
+    m_TrackInfo.iSequenceNumber = iTrack;
+    return 8 + m_iStreamLeft;
+}
+
+// Parses the next event of a streamed track. NULL at the end of the track or on bad data, same as ParseEvents
+MIDIEvent *MIDITrack::StreamEvent( Arena &arena )
+{
+    MIDIEvent *pEvent = m_pStreamEvent;
+    if ( m_iStreamLeft <= 0 || ( pEvent && pEvent->GetEventType() == MIDIEvent::MetaEvent &&
+         reinterpret_cast< MIDIMetaEvent* >( pEvent )->GetMetaEventType() == MIDIMetaEvent::EndOfTrack ) )
+    {
+        m_iStreamLeft = 0;
+        return NULL;
+    }
+
+    int iCount = 0;
+    if ( m_iStreamLeft >= MIDIChannelEvent::FastParseSize )
+        iCount = MIDIChannelEvent::MakeFastEvent( m_pcStream, m_iStreamTrack, arena, &pEvent );
+    if ( iCount == 0 )
+    {
+        int iDTCode = MIDIEvent::MakeNextEvent( m_pcStream, m_iStreamLeft, m_iStreamTrack, arena, &pEvent );
+        if ( iDTCode > 0 )
+            iCount = pEvent->ParseEvent( m_pcStream + iDTCode, m_iStreamLeft - iDTCode, arena );
+        if ( iCount > 0 )
+            iCount += iDTCode;
+    }
+    if ( iCount <= 0 )
+    {
+        m_iStreamLeft = 0;
+        return NULL;
+    }
+
+    m_pcStream += iCount;
+    m_iStreamLeft -= iCount;
+    m_pStreamEvent = pEvent;
+    return pEvent;
 }
 
-int MIDITrack::ParseEvents( const unsigned char *pcData, int iMaxSize, int iTrack )
+// Also pairs up note ons with their note offs (sisters) as they're parsed
+int MIDITrack::ParseEvents( const unsigned char *pcData, int iMaxSize, int iTrack, Arena &arena, LoadProgress *pProgress )
 {
-    int iTotal = 0, iDTCode = 0, iCount = 0;
+    int iTotal = 0, iCount = 0, iReported = 0;
     MIDIEvent *pEvent = NULL;
     m_TrackInfo.iSequenceNumber = iTrack;
 
+    // Note stacks for pairing
+    int pSize[16][128];
+    MIDIChannelEvent *pStacks[16][128][StackSize];
+    memset( pSize, 0, sizeof( pSize ) );
+
     do
     {
-        // Create and parse the event
+        // Create and parse the event. Channel events skip the checks unless we're near the end of the data
         iCount = 0;
-        iDTCode = MIDIEvent::MakeNextEvent( pcData + iTotal, iMaxSize - iTotal, iTrack, &pEvent );
-        if ( iDTCode > 0 )
+        if ( iMaxSize - iTotal >= MIDIChannelEvent::FastParseSize )
+            iCount = MIDIChannelEvent::MakeFastEvent( pcData + iTotal, iTrack, arena, &pEvent );
+        if ( iCount == 0 )
         {
-            iCount = pEvent->ParseEvent( pcData + iDTCode + iTotal, iMaxSize - iDTCode - iTotal );
+            int iDTCode = MIDIEvent::MakeNextEvent( pcData + iTotal, iMaxSize - iTotal, iTrack, arena, &pEvent );
+            if ( iDTCode > 0 )
+                iCount = pEvent->ParseEvent( pcData + iDTCode + iTotal, iMaxSize - iDTCode - iTotal, arena );
             if ( iCount > 0 )
+                iCount += iDTCode;
+        }
+
+        if ( iCount > 0 )
+        {
+            iTotal += iCount;
+            m_vEvents.push_back( pEvent );
+            m_TrackInfo.AddEventInfo( *pEvent );
+            if ( pEvent->GetEventType() == MIDIEvent::ChannelEvent )
+                ConnectNote( reinterpret_cast< MIDIChannelEvent* >( pEvent ), pSize, pStacks );
+
+            // Report every so often. Stop if the load got canceled
+            if ( pProgress && m_vEvents.size() % LoadProgress::CheckInterval == 0 )
             {
-                iTotal += iDTCode + iCount;
-                m_vEvents.push_back( pEvent );
-                m_TrackInfo.AddEventInfo( *pEvent );
+                pProgress->llBytesParsed += iTotal - iReported;
+                iReported = iTotal;
+                if ( pProgress->IsCanceled() ) break;
             }
-            else
-                delete pEvent;
         }
     }
     // Until we've parsed all the data, the last parse failed, or the event signals the end of track
@@ -570,9 +1550,52 @@ int MIDITrack::ParseEvents( const unsigned char *pcData, int iMaxSize, int iTrac
             ( pEvent->GetEventType() != MIDIEvent::MetaEvent ||
               reinterpret_cast< MIDIMetaEvent* >( pEvent )->GetMetaEventType() != MIDIMetaEvent::EndOfTrack ) );
 
+    if ( pProgress ) pProgress->llBytesParsed += iTotal - iReported;
     return iTotal;
 }
 
+// Pairs a freshly parsed event with an earlier note on from this track, last in first out
+void MIDITrack::ConnectNote( MIDIChannelEvent *pEvent, int pSize[16][128], MIDIChannelEvent *pStacks[16][128][StackSize] )
+{
+    MIDIChannelEvent::ChannelEventType eEventType = pEvent->GetChannelEventType();
+    int iChannel = pEvent->GetChannel();
+    int iNote = pEvent->GetParam1();
+    int iVelocity = pEvent->GetParam2();
+
+    if ( eEventType == MIDIChannelEvent::NoteOn && iVelocity > 0 )
+    {
+        int &iSize = pSize[iChannel][iNote];
+        if ( iSize < StackSize ) pStacks[iChannel][iNote][iSize] = pEvent;
+        iSize++;
+    }
+    else if ( eEventType == MIDIChannelEvent::NoteOff || eEventType == MIDIChannelEvent::NoteOn )
+    {
+        int &iSize = pSize[iChannel][iNote];
+        if ( iSize > 0 )
+        {
+            if ( iSize <= StackSize ) pStacks[iChannel][iNote][iSize - 1]->SetSister( pEvent );
+            else // Should never get here
+            {
+                int j = static_cast< int >( m_vEvents.size() ) - 2;
+                while ( j >= 0 && !pEvent->GetSister() )
+                {
+                    if ( m_vEvents[j]->GetEventType() == MIDIEvent::ChannelEvent )
+                    {
+                        MIDIChannelEvent *pSister = reinterpret_cast< MIDIChannelEvent* >( m_vEvents[j] );
+                        if ( !pSister->GetSister() &&
+                             pSister->GetChannelEventType() == MIDIChannelEvent::NoteOn && 
+                             pSister->GetParam1() == iNote && pSister->GetParam2() > 0 )
+                            pEvent->SetSister( pSister );
+                    }
+                    j--;
+                }
+            }
+            if ( pEvent->GetSister() ) m_TrackInfo.iPairedNoteCount++;
+            iSize--;
+        }
+    }
+}
+
 // Computes some of the TrackInfo info
 // DOES NOT DO: llTotalMicroSecs (because info's not available yet), iSequenceNumber default value (done in parse event)
 void MIDITrack::MIDITrackInfo::AddEventInfo( const MIDIEvent &mEvent )
@@ -587,8 +1610,15 @@ void MIDITrack::MIDITrackInfo::AddEventInfo( const MIDIEvent &mEvent )
         {
             const MIDIMetaEvent &mMetaEvent = reinterpret_cast< const MIDIMetaEvent & >( mEvent );
             MIDIMetaEvent::MetaEventType eMetaEventType = mMetaEvent.GetMetaEventType();
+            this->iMetaEventCount++;
             switch ( eMetaEventType )
             {
+                case MIDIMetaEvent::SetTempo:
+                    this->iTempoCount++;
+                    break;
+                case MIDIMetaEvent::TimeSignature:
+                    this->iSignatureCount++;
+                    break;
                 //SequenceName
                 case MIDIMetaEvent::SequenceName:
                     this->sSequenceName.assign( reinterpret_cast< char* >( mMetaEvent.GetData() ), mMetaEvent.GetDataLen() );
@@ -608,9 +1638,13 @@ void MIDITrack::MIDITrackInfo::AddEventInfo( const MIDIEvent &mEvent )
             int iChannel = mChannelEvent.GetChannel();
             int iParam1 = mChannelEvent.GetParam1();
             int iParam2 = mChannelEvent.GetParam2();
+            this->iChannelEventCount++;
 
             switch ( eChannelEventType )
             {
+                case MIDIChannelEvent::Controller:
+                    this->iControllerCount++;
+                    break;
                 case MIDIChannelEvent::NoteOn:
                     if ( iParam2 > 0 )
                     {
@@ -638,6 +1672,7 @@ void MIDITrack::MIDITrackInfo::AddEventInfo( const MIDIEvent &mEvent )
                     break;
                 // Should we break it down further?
                 case MIDIChannelEvent::ProgramChange:
+                    this->iControllerCount++;
                     if ( this->aProgram[ iChannel ] != iParam1 )
                     {
                         if ( this->aNoteCount[ iChannel ] > 0 )
@@ -664,7 +1699,7 @@ MIDIEvent::EventType MIDIEvent::DecodeEventType( int iEventCode )
     return MetaEvent;
 }
 
-int MIDIEvent::MakeNextEvent( const unsigned char *pcData, int iMaxSize, int iTrack, MIDIEvent **pOutEvent )
+int MIDIEvent::MakeNextEvent( const unsigned char *pcData, int iMaxSize, int iTrack, Arena &arena, MIDIEvent **pOutEvent )
 {
     MIDIEvent *pPrevEvent = *pOutEvent;
 
@@ -689,9 +1724,9 @@ int MIDIEvent::MakeNextEvent( const unsigned char *pcData, int iMaxSize, int iTr
     // Make the object
     switch ( eEventType )
     {
-        case ChannelEvent: *pOutEvent = new MIDIChannelEvent(); break;
-        case MetaEvent: *pOutEvent = new MIDIMetaEvent(); break;
-        case SysExEvent: *pOutEvent = new MIDISysExEvent(); break;
+        case ChannelEvent: *pOutEvent = arena.New< MIDIChannelEvent >(); break;
+        case MetaEvent: *pOutEvent = arena.New< MIDIMetaEvent >(); break;
+        case SysExEvent: *pOutEvent = arena.New< MIDISysExEvent >(); break;
     }
 
     (*pOutEvent)->m_eEventType = eEventType;
@@ -704,7 +1739,7 @@ int MIDIEvent::MakeNextEvent( const unsigned char *pcData, int iMaxSize, int iTr
     return iTotal;
 }
 
-int MIDIChannelEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
+int MIDIChannelEvent::ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena )
 {
     // Split up the event code
     m_eChannelEventType = static_cast< ChannelEventType >( m_iEventCode >> 4 );
@@ -728,7 +1763,48 @@ int MIDIChannelEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
     }
 }
 
-int MIDIMetaEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
+// MakeNextEvent and ParseEvent rolled into one for channel events, minus the bounds checks and the virtual call
+int MIDIChannelEvent::MakeFastEvent( const unsigned char *pcData, int iTrack, Arena &arena, MIDIEvent **pOutEvent )
+{
+    MIDIEvent *pPrevEvent = *pOutEvent;
+
+    // Running status only carries on from channel events here. Anything odd goes the slow way
+    int iPrevCode = ( pPrevEvent && pPrevEvent->GetEventType() == ChannelEvent ? pPrevEvent->GetEventCode() : 0 );
+    int iDT, iEventCode, iParams;
+    int iTotal = DecodeFast( pcData, iPrevCode, &iDT, &iEventCode, &iParams );
+    if ( iTotal == 0 ) return 0;
+
+    MIDIChannelEvent *pEvent = arena.New< MIDIChannelEvent >();
+    pEvent->m_eEventType = ChannelEvent;
+    pEvent->m_iEventCode = iEventCode;
+    pEvent->m_iTrack = iTrack;
+    pEvent->m_iDT = iDT;
+    pEvent->m_iAbsT = iDT + ( pPrevEvent ? pPrevEvent->GetAbsT() : 0 );
+    pEvent->m_eChannelEventType = static_cast< ChannelEventType >( iEventCode >> 4 );
+    pEvent->m_cChannel = iEventCode & 0xF;
+    pEvent->m_cParam1 = pcData[iTotal];
+    pEvent->m_cParam2 = ( iParams == 2 ? pcData[iTotal + 1] : 0 );
+
+    *pOutEvent = pEvent;
+    return iTotal + iParams;
+}
+
+MIDIChannelEvent *MIDIChannelEvent::MakeNoteOff( int iTrack, int iChannel, int iNote, int iAbsT, Arena &arena )
+{
+    MIDIChannelEvent *pEvent = arena.New< MIDIChannelEvent >();
+    pEvent->m_eEventType = ChannelEvent;
+    pEvent->m_iEventCode = ( NoteOff << 4 ) | iChannel;
+    pEvent->m_iTrack = iTrack;
+    pEvent->m_iDT = 0;
+    pEvent->m_iAbsT = iAbsT;
+    pEvent->m_eChannelEventType = NoteOff;
+    pEvent->m_cChannel = static_cast< unsigned char >( iChannel );
+    pEvent->m_cParam1 = static_cast< unsigned char >( iNote );
+    pEvent->m_cParam2 = 0;
+    return pEvent;
+}
+
+int MIDIMetaEvent::ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena )
 {
     if ( iMaxSize < 1 ) return 0;
 
@@ -740,7 +1816,7 @@ int MIDIMetaEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
     // Get the data
     if ( m_iDataLen > 0 )
     {
-        m_pcData = new unsigned char[m_iDataLen];
+        m_pcData = static_cast< unsigned char* >( arena.Alloc( m_iDataLen ) );
         memcpy( m_pcData, pcData + 1 + iCount, m_iDataLen );
     }
 
@@ -749,7 +1825,7 @@ int MIDIMetaEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
 
 // NOTE: this is INCOMPLETE. Data is parsed but not fully interpreted:
 // divided messages don't know about each other
-int MIDISysExEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
+int MIDISysExEvent::ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena )
 {
     if ( iMaxSize < 1 ) return 0;
 
@@ -760,7 +1836,7 @@ int MIDISysExEvent::ParseEvent( const unsigned char *pcData, int iMaxSize )
     // Get the data
     if ( m_iDataLen > 0 )
     {
-        m_pcData = new unsigned char[m_iDataLen];
+        m_pcData = static_cast< unsigned char* >( arena.Alloc( m_iDataLen ) );
         memcpy( m_pcData, pcData + iCount, m_iDataLen );
         if ( m_iEventCode == 0xF0 && m_pcData[ m_iDataLen - 1 ] != 0xF7 )
             m_bHasMoreData = true;
@@ -848,17 +1924,21 @@ int MIDI::ParseNChars( const unsigned char *pcData, int iNChars, int iMaxSize, c
 //-----------------------------------------------------------------------------
 
 // Port management functions
+// The built-in synth comes after the driver's devices, once it has a SoundFont
 int MIDIOutDevice::GetNumDevs() const
 {
-    return midiOutGetNumDevs();
+    return MIDIDriver::GetDriver().GetNumOutDevs() + ( SoftSynth::GetSynth().HasSoundFont() ? 1 : 0 );
 }
 
 wstring MIDIOutDevice::GetDevName( int iDev ) const
 {
-    MIDIOUTCAPS moc;
-    if ( midiOutGetDevCaps( iDev, &moc, sizeof( MIDIOUTCAPS ) ) == MMSYSERR_NOERROR )
-        return moc.szPname;
-    return wstring();
+    if ( IsSynth( iDev ) ) return SoftSynth::GetDeviceName();
+    return MIDIDriver::GetDriver().GetOutDevName( iDev );
+}
+
+bool MIDIOutDevice::IsSynth( int iDev )
+{
+    return iDev == MIDIDriver::GetDriver().GetNumOutDevs() && SoftSynth::GetSynth().HasSoundFont();
 }
 
 bool MIDIOutDevice::Open( int iDev )
@@ -867,8 +1947,16 @@ bool MIDIOutDevice::Open( int iDev )
     m_iDevice = iDev;
     m_sDevice = GetDevName( iDev );
 
-    MMRESULT mmResult = midiOutOpen( &m_hMIDIOut, iDev, ( DWORD_PTR )MIDIOutProc, ( DWORD_PTR )this, CALLBACK_FUNCTION );
-    m_bIsOpen = ( mmResult == MMSYSERR_NOERROR );
+    m_pPort = ( IsSynth( iDev ) ? SoftSynth::GetSynth().CreatePort() : MIDIDriver::GetDriver().CreateOutPort() );
+    if ( !m_pPort->SetScheduled( m_bScheduled ) ) m_bScheduled = false;
+    if ( !m_pPort->Open( iDev ) )
+    {
+        delete m_pPort;
+        m_pPort = NULL;
+        return false;
+    }
+
+    m_bIsOpen = true;
     return m_bIsOpen;
 }
 
@@ -876,8 +1964,9 @@ void MIDIOutDevice::Close()
 {
     if ( !m_bIsOpen ) return;
 
-    midiOutReset( m_hMIDIOut );
-    midiOutClose( m_hMIDIOut );
+    m_pPort->Close();
+    delete m_pPort;
+    m_pPort = NULL;
     m_bIsOpen = false;
 }
 
@@ -896,21 +1985,22 @@ void MIDIOutDevice::AllNotesOff( const vector< int > &vChannels )
 
 void MIDIOutDevice::SetVolume( double dVolume )
 {
-    DWORD dwVolume = static_cast< DWORD >( 0xFFFF * dVolume + 0.5 );
-    midiOutSetVolume( m_hMIDIOut, dwVolume | ( dwVolume << 16 ) );
+    if ( m_pPort ) m_pPort->SetVolume( dVolume );
 }
 
-// Play events
+// Play events. These go right away, even when scheduled
 bool MIDIOutDevice::PlayEventAcrossChannels( unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 )
 {
     if ( !m_bIsOpen ) return false;
 
     cStatus &= 0xF0;
-    bool bResult = true;
+    MIDIShortMsg aMsgs[16];
     for ( int i = 0; i < 16; i++ )
-        bResult &= PlayEvent( cStatus + i, cParam1, cParam2 );
-
-    return bResult;
+    {
+        aMsgs[i].llTime = 0;
+        aMsgs[i].iMsg = MIDIShortMsg::Pack( cStatus + i, cParam1, cParam2 );
+    }
+    return m_pPort->SendNow( aMsgs, 16 );
 }
 
 bool MIDIOutDevice::PlayEventAcrossChannels( unsigned char cStatus, unsigned char cParam1, unsigned char cParam2, const vector< int > &vChannels )
@@ -918,9 +2008,20 @@ bool MIDIOutDevice::PlayEventAcrossChannels( unsigned char cStatus, unsigned cha
     if ( !m_bIsOpen ) return false;
 
     cStatus &= 0xF0;
+    MIDIShortMsg aMsgs[16];
+    int iMsgs = 0;
     bool bResult = true;
     for ( vector< int >::const_iterator it = vChannels.begin(); it != vChannels.end(); ++it )
-        bResult &= PlayEvent( cStatus + *it, cParam1, cParam2 );
+    {
+        aMsgs[iMsgs].llTime = 0;
+        aMsgs[iMsgs].iMsg = MIDIShortMsg::Pack( cStatus + *it, cParam1, cParam2 );
+        if ( ++iMsgs == 16 )
+        {
+            bResult &= m_pPort->SendNow( aMsgs, iMsgs );
+            iMsgs = 0;
+        }
+    }
+    if ( iMsgs > 0 ) bResult &= m_pPort->SendNow( aMsgs, iMsgs );
 
     return bResult;
 }
@@ -928,34 +2029,39 @@ bool MIDIOutDevice::PlayEventAcrossChannels( unsigned char cStatus, unsigned cha
 bool MIDIOutDevice::PlayEvent( unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 )
 {
     if ( !m_bIsOpen ) return false;
-    return midiOutShortMsg( m_hMIDIOut, ( cParam2 << 16 ) + ( cParam1 << 8 ) + cStatus ) == MMSYSERR_NOERROR;
+
+    MIDIShortMsg msg = { 0, MIDIShortMsg::Pack( cStatus, cParam1, cParam2 ) };
+    return m_pPort->SendNow( &msg, 1 );
 }
 
-void CALLBACK MIDIOutDevice::MIDIOutProc( HMIDIOUT hmo, UINT wMsg, DWORD_PTR dwInstance,
-                                          DWORD_PTR dwParam1, DWORD_PTR dwParam2 )
+bool MIDIOutDevice::SetScheduled( bool bScheduled )
 {
-    MIDIOutDevice *pOutDevice = reinterpret_cast< MIDIOutDevice* >( dwInstance );
+    if ( m_pPort && !m_pPort->SetScheduled( bScheduled ) ) return false;
+    m_bScheduled = bScheduled;
+    return true;
+}
 
-    switch ( wMsg )
-    {
-        case MOM_CLOSE:
-        {
-        }
-    }
+bool MIDIOutDevice::Send( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    if ( !m_bIsOpen ) return false;
+    return m_pPort->Send( pMsgs, iMsgs );
+}
+
+bool MIDIOutDevice::Send( const unsigned char *pcData, int iSize, int iMsgs )
+{
+    if ( !m_bIsOpen ) return false;
+    return m_pPort->Send( pcData, iSize, iMsgs );
 }
 
 // Port management functions
 int MIDIInDevice::GetNumDevs() const
 {
-    return midiInGetNumDevs();
+    return MIDIDriver::GetDriver().GetNumInDevs();
 }
 
 wstring MIDIInDevice::GetDevName( int iDev ) const
 {
-    MIDIINCAPS mic;
-    if ( midiInGetDevCaps( iDev, &mic, sizeof( MIDIINCAPS ) ) == MMSYSERR_NOERROR )
-        return mic.szPname;
-    return wstring();
+    return MIDIDriver::GetDriver().GetInDevName( iDev );
 }
 
 bool MIDIInDevice::Open( int iDev )
@@ -964,11 +2070,13 @@ bool MIDIInDevice::Open( int iDev )
     m_iDevice = iDev;
     m_sDevice = GetDevName( iDev );
 
-    MMRESULT mmResult = midiInOpen( &m_hMIDIIn, iDev, ( DWORD_PTR )MIDIInProc, ( DWORD_PTR )this, CALLBACK_FUNCTION );
-    if ( mmResult != MMSYSERR_NOERROR ) return false;
-
-    mmResult = midiInStart( m_hMIDIIn );
-    if ( mmResult != MMSYSERR_NOERROR ) return false;
+    m_pPort = MIDIDriver::GetDriver().CreateInPort();
+    if ( !m_pPort->Open( iDev, OnMessage, this ) )
+    {
+        delete m_pPort;
+        m_pPort = NULL;
+        return false;
+    }
 
     m_bIsOpen = true;
     return m_bIsOpen;
@@ -978,33 +2086,27 @@ void MIDIInDevice::Close()
 {
     if ( !m_bIsOpen ) return;
 
-    midiInReset( m_hMIDIIn );
-    midiInStop( m_hMIDIIn );
-    midiInClose( m_hMIDIIn );
+    m_pPort->Close();
+    delete m_pPort;
+    m_pPort = NULL;
     m_bIsOpen = false;
 }
 
-void CALLBACK MIDIInDevice::MIDIInProc( HMIDIIN hMidiIn, UINT wMsg, DWORD_PTR dwInstance,
-                                        DWORD_PTR dwParam1, DWORD_PTR dwParam2 )
+// On the driver's thread
+void MIDIInDevice::OnMessage( const MIDIInMsg &msg, void *pUserData )
 {
-    MIDIInDevice *pInDevice = reinterpret_cast< MIDIInDevice* >( dwInstance );
+    MIDIInDevice *pInDevice = reinterpret_cast< MIDIInDevice* >( pUserData );
 
-    switch ( wMsg )
-    {
-        case MIM_DATA:
-        {
-            MIDIInMessage miMsg = { dwParam1, dwParam2 };
-            unsigned char *pMessage = reinterpret_cast< unsigned char * >( &dwParam1 );
-
-            // Ignore system common and real time messages and make sure status bit is set
-            if ( ( pMessage[0] & 0xF0 ) == 0xF0 || !( pMessage[0] & 0x80 ) ) return;
+    // Ignore system common and real time messages and make sure status bit is set
+    if ( ( msg.cStatus & 0xF0 ) == 0xF0 || !( msg.cStatus & 0x80 ) ) return;
 
-            if ( pInDevice->m_pCallback )
-                ( *pInDevice->m_pCallback )( pMessage[0], pMessage[1], pMessage[2], (int)dwParam2, pInDevice->m_pUserData );
-            else
-                pInDevice->m_qMessages.Push( miMsg );
-            return;
-        }
+    int iMilliSecs = static_cast< int >( msg.llTime / 1000 );
+    if ( pInDevice->m_pCallback )
+        ( *pInDevice->m_pCallback )( msg.cStatus, msg.cParam1, msg.cParam2, iMilliSecs, pInDevice->m_pUserData );
+    else
+    {
+        MIDIInMessage miMsg = { msg.cStatus, msg.cParam1, msg.cParam2, iMilliSecs };
+        pInDevice->m_qMessages.Push( miMsg );
     }
 }
 
@@ -1013,11 +2115,10 @@ bool MIDIInDevice::GetMIDIMessage( unsigned char &cStatus, unsigned char &cParam
     MIDIInMessage miMsg;
     if ( !m_qMessages.Pop( miMsg ) ) return false;
 
-    unsigned char *pMessage = reinterpret_cast< unsigned char * >( &miMsg.dwMsg );
-    cStatus = pMessage[0];
-    cParam1 = pMessage[1];
-    cParam2 = pMessage[2];
-    iMilliSecs = (int)miMsg.dwMilliSecs;
+    cStatus = miMsg.cStatus;
+    cParam1 = miMsg.cParam1;
+    cParam2 = miMsg.cParam2;
+    iMilliSecs = miMsg.iMilliSecs;
 
     return true;
 }
\ No newline at end of file
@@ -15,6 +15,8 @@
 using namespace std;
 
 #include "Misc.h"
+#include "MIDIDriver.h"
+#include "Loader.h"
 
 //Classes defined in this file
 class MIDI;
@@ -24,6 +26,7 @@ class MIDIChannelEvent;
 class MIDIMetaEvent;
 class MIDISysExEvent;
 class MIDIPos;
+class MIDIEventSink;
 
 class MIDIDevice;
 class MIDIInDevice;
@@ -85,20 +88,72 @@ public:
     static int Parse16Bit( const unsigned char *pcData, int iMaxSize, int *piOut );
     static int ParseNChars( const unsigned char *pcData, int iNChars, int iMaxSize, char *pcOut );
 
-    MIDI( void ) {};
-    MIDI( const wstring &sFilename );
+    MIDI( void ) : m_pProgress( NULL ), m_pStream( NULL ) {};
+    MIDI( const wstring &sFilename, LoadProgress *pProgress = NULL, bool bStream = false );
     ~MIDI( void );
 
     //Parsing functions that load data into the instance
     int ParseMIDI( const unsigned char *pcData, int iMaxSize );
+    int ParseHeader( const unsigned char *pcData, int iMaxSize );
     int ParseTracks( const unsigned char *pcData, int iMaxSize );
+    int ParseTracksParallel( const unsigned char *pcData, int iMaxSize );
     int ParseEvents( const unsigned char *pcData, int iMaxSize );
     bool IsValid() const { return ( m_vTracks.size() > 0 && m_Info.iNoteCount > 0 && m_Info.iDivision > 0 ); }
 
-    void PostProcess() { PostProcess( NULL ); } 
+    void PostProcess() { PostProcess( static_cast< MIDIEventSink* >( NULL ) ); } 
     void PostProcess( vector< MIDIEvent* > *vEvents );
-    void ConnectNotes();
+    void PostProcess( MIDIEventSink *pSink );
     void clear( void );
+    void swap( MIDI &other );
+
+    //Incremental loading. StreamMIDI only reads the headers (pcData has to stay put until FinishStream).
+    //StreamEvents merges the next piece of the song, returning false once there's nothing left. It may run
+    //on its own thread, as long as every event it hands out goes through AddStreamedEvent, in order, on
+    //the thread that uses the events. That pairs the notes and keeps the info up to date.
+    int StreamMIDI( const unsigned char *pcData, int iMaxSize );
+    bool StreamEvents( int iMaxEvents, long long llMaxMicroSec, MIDIEventSink *pSink );
+    void AddStreamedEvent( MIDIEvent *pEvent );
+    void FinishStream();
+    bool IsStreaming() const { return m_pStream != NULL; }
+    long long GetStreamTime() const; // Everything before this has been handed out
+    double GetStreamFraction() const; // Of the track data
+
+    // Where the tempo and each channel's program, controllers and pitch bend stand after some of a song's events
+    struct MIDIControlState
+    {
+        MIDIControlState() { clear(); }
+        void clear() { iMicroSecsPerBeat = 500000;
+                       memset( aProgram, 0, sizeof( aProgram ) );
+                       memset( aController, -1, sizeof( aController ) );
+                       for ( int i = 0; i < 16; i++ ) aPitchBend[i] = 0x2000; }
+        void AddEvent( const MIDIEvent &mEvent );
+
+        int iMicroSecsPerBeat; // Standard division only
+        int aProgram[16], aPitchBend[16];
+        signed char aController[16][128]; // -1 if it was never set
+    };
+
+    //Optional pass over a song's merged channel events. Drops controller, pitch bend, aftertouch and program
+    //events that don't change anything, thins the continuous ones so each keeps an event at most every
+    //llThinMicroSecs (0 for no thinning) apart from the last of a run, and drops notes that end on the tick
+    //they start. Needs the whole song: thinning looks ahead. pvSourcePos, if given, gets where each event that's
+    //left was before, or is emptied if none moved. The notes-on counts are redone
+    struct OptimizeStats
+    {
+        OptimizeStats() { iControllers = iPrograms = iThinned = iZeroNotes = 0; }
+        int iControllers, iPrograms; // No-ops. Controllers counts pitch bend and aftertouch too
+        int iThinned, iZeroNotes;
+    };
+    static void OptimizeEvents( vector< MIDIChannelEvent* > &vEvents, long long llThinMicroSecs, OptimizeStats &stats,
+                                vector< int > *pvSourcePos = NULL );
+
+    //Partial loading for previews. Merges just the first llMaxMicroSec of the song into vEvents: each track gets
+    //decoded up to its first event past that point and no further, so only the start of each track is read. Notes
+    //still on at the cutoff get a note off there. Otherwise it's the same as the start of a full load. pState gets
+    //the controls as they stand at the cutoff. No MD5: it needs the whole file
+    bool LoadPreview( const wstring &sFilename, long long llMaxMicroSec, vector< MIDIEvent* > &vEvents, MIDIControlState *pState = NULL );
+    bool ParsePreview( const unsigned char *pcData, int iMaxSize, long long llMaxMicroSec, vector< MIDIEvent* > &vEvents,
+                       MIDIControlState *pState = NULL );
 
     friend class MIDIPos;
 
@@ -106,7 +161,8 @@ public:
     {
         MIDIInfo() { clear(); }
         void clear() { llTotalMicroSecs = llFirstNote = iFormatType = iNumTracks = iNumChannels = iDivision = iMinNote =
-                       iMaxNote = iNoteCount = iEventCount = iMaxVolume = iVolumeSum = iTotalTicks = iTotalBeats = 0;
+                       iMaxNote = iNoteCount = iEventCount = iMaxVolume = iVolumeSum = iTotalTicks = iTotalBeats =
+                       iChannelEventCount = iMetaEventCount = iPairedNoteCount = iControllerCount = iTempoCount = iSignatureCount = 0;
                        sFilename.clear(); }
         void AddTrackInfo( const MIDITrack &mTrack);
 
@@ -119,31 +175,83 @@ public:
         int iMaxVolume, iVolumeSum;
         int iTotalTicks, iTotalBeats;
         long long llTotalMicroSecs, llFirstNote;
+        int iChannelEventCount, iMetaEventCount, iPairedNoteCount; // For sizing things up front
+        int iControllerCount, iTempoCount, iSignatureCount;
+    };
+
+    // How hard a song is to play, worked out by the library scanner. Notes struck on the same key and tick
+    // (doubled across tracks) count once
+    struct MIDIStats
+    {
+        MIDIStats() { clear(); }
+        void clear() { iPeakNotesPerSec = iMaxChord = iMaxChordSpan = iLowKey = iHighKey = iTempoChanges = 0; }
+
+        int iPeakNotesPerSec; // Most notes started in any one second
+        int iMaxChord, iMaxChordSpan; // Most notes started on the same tick, and the widest such chord in keys
+        int iLowKey, iHighKey;
+        int iTempoChanges; // Not counting the starting tempo
     };
 
+    // Piano roll overview: how many notes start in each cell of a time x key grid, on a log scale from 0 to 15.
+    // Columns split the song's length evenly. Rows cover the 88 piano keys, 4 to a row, lowest first. Keys off
+    // the piano go in the end rows
+    struct MIDIThumbnail
+    {
+        static const int Width = 64, Height = 22;
+        static const int FirstKey = 21, KeysPerRow = 4;
+        static const int Size = Width * Height / 2; // Bytes. 2 cells to a byte
+
+        MIDIThumbnail() { clear(); }
+        void clear() { memset( aCells, 0, sizeof( aCells ) ); }
+        int Get( int iX, int iY ) const { int i = iY * Width + iX; return ( aCells[i / 2] >> ( 4 * ( i & 1 ) ) ) & 0xF; }
+        void Set( int iX, int iY, int iVal ) { int i = iY * Width + iX; aCells[i / 2] = static_cast< unsigned char >(
+                                                 ( aCells[i / 2] & ( 0xF0 >> ( 4 * ( i & 1 ) ) ) ) | ( iVal << ( 4 * ( i & 1 ) ) ) ); }
+
+        unsigned char aCells[Size];
+    };
+
+    //Library info (division, notes, beats, length, channels, MD5) straight from the file's bytes without making
+    //any events. Comes out the same as a full load and PostProcess. Returns false if the song isn't valid.
+    //Asking for the stats as well costs a sort of all the notes. The thumbnail costs a second pass over the tracks
+    static bool ScanInfo( const wstring &sFilename, MIDIInfo &mInfo, MIDIStats *pStats = NULL, MIDIThumbnail *pThumb = NULL );
+    static bool ScanInfo( const unsigned char *pcData, int iMaxSize, MIDIInfo &mInfo, MIDIStats *pStats = NULL,
+                          MIDIThumbnail *pThumb = NULL );
+
     const MIDIInfo& GetInfo() const { return m_Info; }
     const vector< MIDITrack* >& GetTracks() const { return m_vTracks; }
+    void SetProgress( LoadProgress *pProgress ) { m_pProgress = pProgress; }
+    long long GetEventBytes() const { return m_Arena.GetBytesUsed(); }
 
 private:
+    static const int ParallelParseSize = 1 << 20; // Smaller files aren't worth splitting up
+
     static void InitArrays();
     static wstring aNoteNames[KEYS + 1];
     static Note aNoteVal[KEYS];
     static bool aIsSharp[KEYS];
     static int aWhiteCount[KEYS + 1];
 
+    struct StreamState;
+
     MIDIInfo m_Info;
     vector< MIDITrack* > m_vTracks;
+    Arena m_Arena; // Owns every event (and event data) of every track
+    LoadProgress *m_pProgress; // Only set while loading in the background
+    StreamState *m_pStream; // Only set while loading incrementally
 };
 
 //Holds all the event of one MIDI track
 class MIDITrack
 {
 public:
+    MIDITrack( void ) : m_pcStream( NULL ), m_iStreamLeft( 0 ), m_iStreamTrack( 0 ), m_pStreamEvent( NULL ) { }
     ~MIDITrack( void );
 
     //Parsing functions that load data into the instance
-    int ParseTrack( const unsigned char *pcData, int iMaxSize, int iTrack );
-    int ParseEvents( const unsigned char *pcData, int iMaxSize, int iTrack );
+    int ParseTrack( const unsigned char *pcData, int iMaxSize, int iTrack, Arena &arena, LoadProgress *pProgress = NULL );
+    int ParseEvents( const unsigned char *pcData, int iMaxSize, int iTrack, Arena &arena, LoadProgress *pProgress = NULL );
+    int StreamTrack( const unsigned char *pcData, int iMaxSize, int iTrack );
+    MIDIEvent *StreamEvent( Arena &arena );
     void clear( void );
 
     friend class MIDIPos;
@@ -154,6 +262,7 @@ public:
         MIDITrackInfo() { clear(); }
         void clear() { llTotalMicroSecs = iSequenceNumber = iMinNote = iMaxNote = iNoteCount = 
                        iEventCount = iMaxVolume = iVolumeSum = iTotalTicks = iNumChannels = 0;
+                       iChannelEventCount = iMetaEventCount = iPairedNoteCount = iControllerCount = iTempoCount = iSignatureCount = 0;
                        memset( aNoteCount, 0, sizeof( aNoteCount ) ),
                        memset( aProgram, 0, sizeof( aProgram ) ),
                        sSequenceName.clear(); }
@@ -166,12 +275,44 @@ public:
         int iTotalTicks;
         long long llTotalMicroSecs;
         int aNoteCount[16], aProgram[16], iNumChannels;
+        int iChannelEventCount, iMetaEventCount, iPairedNoteCount;
+        int iControllerCount, iTempoCount, iSignatureCount;
     };
     const MIDITrackInfo& GetInfo() const { return m_TrackInfo; }
 
 private:
+    static const int StackSize = 10;
+    void ConnectNote( MIDIChannelEvent *pEvent, int pSize[16][128], MIDIChannelEvent *pStacks[16][128][StackSize] );
+
     MIDITrackInfo m_TrackInfo;
-    vector< MIDIEvent* > m_vEvents;
+    vector< MIDIEvent* > m_vEvents; // Left empty when streaming. The events only exist in merged form
+
+    // Where incremental parsing left off
+    const unsigned char *m_pcStream;
+    int m_iStreamLeft, m_iStreamTrack;
+    MIDIEvent *m_pStreamEvent; // Last one parsed. Needed for running status
+};
+
+//Receives the events of a song in time order from MIDI::PostProcess
+class MIDIEventSink
+{
+public:
+    virtual void AddEvent( MIDIEvent *pEvent ) = 0;
+
+protected:
+    ~MIDIEventSink() { }
+};
+
+//Collects the events into a vector
+class MIDIEventVector : public MIDIEventSink
+{
+public:
+    MIDIEventVector( vector< MIDIEvent* > &vEvents ) : m_vEvents( vEvents ) { }
+    void AddEvent( MIDIEvent *pEvent ) { m_vEvents.push_back( pEvent ); }
+
+private:
+    MIDIEventVector &operator=( const MIDIEventVector& );
+    vector< MIDIEvent* > &m_vEvents;
 };
 
 //Base Event class
@@ -184,9 +325,9 @@ public:
     enum EventType { ChannelEvent, MetaEvent, SysExEvent, RunningStatus };
     static EventType DecodeEventType( int iEventCode );
 
-    //Parsing functions that load data into the instance
-    static int MakeNextEvent( const unsigned char *pcData, int iMaxSize, int iTrack, MIDIEvent **pOutEvent );
-    virtual int ParseEvent( const unsigned char *pcData, int iMaxSize ) = 0;
+    //Parsing functions that load data into the instance. Events live in the arena and are never deleted
+    static int MakeNextEvent( const unsigned char *pcData, int iMaxSize, int iTrack, Arena &arena, MIDIEvent **pOutEvent );
+    virtual int ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena ) = 0;
 
     //Accessors
     EventType GetEventType() const { return m_eEventType; }
@@ -214,7 +355,18 @@ public:
 
     enum ChannelEventType { NoteOff = 0x8, NoteOn, NoteAftertouch, Controller, ProgramChange, ChannelAftertouch, PitchBend };
     enum InputQuality { OnRadar, Waiting, Missed, Ok, Good, Great, Ignore };
-    int ParseEvent( const unsigned char *pcData, int iMaxSize );
+    int ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena );
+
+    //Unchecked decoders for the common case. Need FastParseSize bytes of data. DecodeFast gets the DT, the event
+    //code (iPrevCode under running status, 0 for none) and the parameter count, and returns the bytes before the
+    //parameters. MakeFastEvent makes the event. Both return 0 if it's not a channel event, in which case the
+    //caller should go through MakeNextEvent/ParseEvent instead
+    static const int FastParseSize = 7; // 4 byte DT, code, 2 params
+    static int DecodeFast( const unsigned char *pcData, int iPrevCode, int *piDT, int *piEventCode, int *piParams );
+    static int MakeFastEvent( const unsigned char *pcData, int iTrack, Arena &arena, MIDIEvent **pOutEvent );
+
+    //A note off that isn't in the file. No DT: it doesn't follow anything in its track
+    static MIDIChannelEvent *MakeNoteOff( int iTrack, int iChannel, int iNote, int iAbsT, Arena &arena );
 
     //Accessors
     ChannelEventType GetChannelEventType() const { return m_eChannelEventType; }
@@ -248,12 +400,11 @@ class MIDIMetaEvent : public MIDIEvent
 {
 public:
     MIDIMetaEvent() : m_pcData( 0 ) { }
-    ~MIDIMetaEvent() { if ( m_pcData ) delete[] m_pcData; }
 
     enum MetaEventType { SequenceNumber, TextEvent, Copyright, SequenceName, InstrumentName, Lyric, Marker,
                          CuePoint, ChannelPrefix = 0x20, PortPrefix = 0x21, EndOfTrack = 0x2F, SetTempo = 0x51,
                          SMPTEOffset = 0x54, TimeSignature = 0x58, KeySignature = 0x59, Proprietary = 0x7F };
-    int ParseEvent( const unsigned char *pcData, int iMaxSize );
+    int ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena );
 
     //Accessors
     MetaEventType GetMetaEventType() const { return m_eMetaEventType; }
@@ -271,9 +422,8 @@ class MIDISysExEvent : public MIDIEvent
 {
 public:
     MIDISysExEvent() : m_pcData( 0 ) { }
-    ~MIDISysExEvent() { if ( m_pcData ) delete[] m_pcData; }
 
-    int ParseEvent( const unsigned char *pcData, int iMaxSize );
+    int ParseEvent( const unsigned char *pcData, int iMaxSize, Arena &arena );
 
 private:
     int m_iSysExCode;
@@ -307,10 +457,11 @@ protected:
     wstring m_sDevice;
 };
 
-class MIDIOutDevice : public MIDIDevice
+// Also a backend for MIDIOutStream. The port comes from MIDIDriver when opened
+class MIDIOutDevice : public MIDIDevice, public MIDIOutBackend
 {
 public:
-    MIDIOutDevice() : m_hMIDIOut( NULL ) { }
+    MIDIOutDevice() : m_pPort( NULL ), m_bScheduled( false ) { }
     virtual ~MIDIOutDevice() { Close(); }
 
     int GetNumDevs() const;
@@ -318,6 +469,8 @@ public:
     bool Open( int iDev );
     void Close();
 
+    static bool IsSynth( int iDev );
+
     void AllNotesOff();
     void AllNotesOff( const vector< int > &vChannels );
     void SetVolume( double dVolume );
@@ -326,10 +479,15 @@ public:
     bool PlayEventAcrossChannels( unsigned char cStatus, unsigned char cParam1, unsigned char cParam2, const vector< int > &vChannels );
     bool PlayEvent( unsigned char bStatus, unsigned char bParam1, unsigned char bParam2 = 0 );
 
+    // MIDIOutBackend
+    int GetCaps() const { return m_pPort ? m_pPort->GetCaps() : 0; }
+    bool SetScheduled( bool bScheduled );
+    bool Send( const MIDIShortMsg *pMsgs, int iMsgs );
+    bool Send( const unsigned char *pcData, int iSize, int iMsgs );
+
 private:
-    static void CALLBACK MIDIOutProc( HMIDIOUT hmo, UINT wMsg, DWORD_PTR dwInstance,
-                                      DWORD_PTR dwParam1, DWORD_PTR dwParam2 );
-    HMIDIOUT m_hMIDIOut;
+    MIDIOutPort *m_pPort;
+    bool m_bScheduled; // Kept so a port gets it on open
 };
 
 class MIDIInDevice : public MIDIDevice
@@ -338,7 +496,7 @@ public:
     typedef void (*MIDIInCallback)( unsigned char cStatus, unsigned char cParam1, unsigned char cParam2,
                                     int iMilliSecs, void *pUserData );
 
-    MIDIInDevice() : m_hMIDIIn( NULL ), m_pCallback( NULL ) { }
+    MIDIInDevice() : m_pPort( NULL ), m_pCallback( NULL ) { }
     virtual ~MIDIInDevice() { Close(); }
 
     void SetCallback( MIDIInCallback pCallback, void *pUserData ) { m_pCallback = pCallback; m_pUserData = pUserData; }
@@ -351,11 +509,10 @@ public:
     void Close();
 
 private:
-    static void CALLBACK MIDIInProc( HMIDIIN hMidiIn, UINT wMsg, DWORD_PTR dwInstance,
-                                     DWORD_PTR dwParam1, DWORD_PTR dwParam2 );
-    struct MIDIInMessage { DWORD_PTR dwMsg, dwMilliSecs; };
+    static void OnMessage( const MIDIInMsg &msg, void *pUserData );
+    struct MIDIInMessage { unsigned char cStatus, cParam1, cParam2; int iMilliSecs; };
 
-    HMIDIIN m_hMIDIIn;
+    MIDIInPort *m_pPort;
     MIDIInCallback m_pCallback;
     void *m_pUserData;
     TSQueue< MIDIInMessage > m_qMessages;
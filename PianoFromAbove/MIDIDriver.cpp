@@ -0,0 +1,139 @@
+/*************************************************************************************************
+*
+* File: MIDIDriver.cpp
+*
+* Description: Implements driver selection and the loopback driver
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <chrono>
+
+#include "MIDIDriver.h"
+
+MIDIDriver *MIDIDriver::s_pDriver = NULL;
+
+MIDIDriver &MIDIDriver::GetDriver()
+{
+#if defined( _WIN32 )
+    static MIDIDriver *pPlatform = CreateWinMMDriver();
+#elif defined( __linux__ )
+    static MIDIDriver *pPlatform = CreateALSADriver();
+#else
+    static MIDIDriver *pPlatform = NULL;
+#endif
+    static MIDILoopbackDriver loopback;
+
+    if ( s_pDriver ) return *s_pDriver;
+    if ( pPlatform ) return *pPlatform;
+    return loopback;
+}
+
+void MIDIDriver::SetDriver( MIDIDriver *pDriver )
+{
+    s_pDriver = pDriver;
+}
+
+//-----------------------------------------------------------------------------
+// MIDILoopbackDriver
+//-----------------------------------------------------------------------------
+
+class MIDILoopbackDriver::InPort : public MIDIInPort
+{
+public:
+    InPort( MIDILoopbackDriver &driver ) : m_Driver( driver ), m_pCable( NULL ), m_pCallback( NULL ), m_pUserData( NULL ) { }
+    ~InPort() { Close(); }
+
+    bool Open( int iDev, MIDIInCallback pCallback, void *pUserData )
+    {
+        Close();
+        if ( iDev < 0 || iDev >= m_Driver.GetNumInDevs() ) return false;
+
+        Cable &cable = m_Driver.m_vCables[iDev];
+        lock_guard< mutex > lock( cable.mtx );
+        if ( cable.pIn ) return false;
+        m_pCallback = pCallback;
+        m_pUserData = pUserData;
+        m_tpOpen = chrono::steady_clock::now();
+        cable.pIn = this;
+        m_pCable = &cable;
+        return true;
+    }
+
+    void Close()
+    {
+        if ( !m_pCable ) return;
+        lock_guard< mutex > lock( m_pCable->mtx );
+        m_pCable->pIn = NULL;
+        m_pCable = NULL;
+    }
+
+    // Cable's locked
+    void Receive( const MIDIShortMsg *pMsgs, int iMsgs )
+    {
+        MIDIInMsg msg;
+        msg.llTime = chrono::duration_cast< chrono::microseconds >( chrono::steady_clock::now() - m_tpOpen ).count();
+        for ( int i = 0; i < iMsgs; i++ )
+        {
+            msg.cStatus = static_cast< unsigned char >( pMsgs[i].iMsg );
+            msg.cParam1 = static_cast< unsigned char >( pMsgs[i].iMsg >> 8 );
+            msg.cParam2 = static_cast< unsigned char >( pMsgs[i].iMsg >> 16 );
+            ( *m_pCallback )( msg, m_pUserData );
+        }
+    }
+
+private:
+    MIDILoopbackDriver &m_Driver;
+    Cable *m_pCable;
+    MIDIInCallback m_pCallback;
+    void *m_pUserData;
+    chrono::steady_clock::time_point m_tpOpen;
+};
+
+class MIDILoopbackDriver::OutPort : public MIDIOutPort
+{
+public:
+    OutPort( MIDILoopbackDriver &driver ) : m_Driver( driver ), m_pCable( NULL ) { }
+
+    bool Open( int iDev )
+    {
+        if ( iDev < 0 || iDev >= m_Driver.GetNumOutDevs() ) return false;
+        m_pCable = &m_Driver.m_vCables[iDev];
+        return true;
+    }
+    void Close() { m_pCable = NULL; }
+
+    int GetCaps() const { return 0; }
+    bool Send( const MIDIShortMsg *pMsgs, int iMsgs ) { return SendNow( pMsgs, iMsgs ); }
+    bool SendNow( const MIDIShortMsg *pMsgs, int iMsgs )
+    {
+        if ( !m_pCable ) return false;
+        lock_guard< mutex > lock( m_pCable->mtx );
+        if ( m_pCable->pIn ) m_pCable->pIn->Receive( pMsgs, iMsgs );
+        return true;
+    }
+
+private:
+    MIDILoopbackDriver &m_Driver;
+    Cable *m_pCable;
+};
+
+MIDILoopbackDriver::MIDILoopbackDriver( int iCables ) : m_vCables( iCables )
+{
+}
+
+wstring MIDILoopbackDriver::GetInDevName( int iDev ) const
+{
+    if ( iDev < 0 || iDev >= GetNumInDevs() ) return wstring();
+    return L"Loopback " + to_wstring( iDev + 1 );
+}
+
+MIDIInPort *MIDILoopbackDriver::CreateInPort()
+{
+    return new InPort( *this );
+}
+
+MIDIOutPort *MIDILoopbackDriver::CreateOutPort()
+{
+    return new OutPort( *this );
+}
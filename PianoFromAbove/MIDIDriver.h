@@ -0,0 +1,114 @@
+/*************************************************************************************************
+*
+* File: MIDIDriver.h
+*
+* Description: Defines the layer between the MIDI devices and the platform's MIDI API. WinMM on
+*              Windows, the ALSA sequencer on Linux, and a loopback that works anywhere
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <mutex>
+using namespace std;
+
+#include "MIDIOut.h"
+
+//-----------------------------------------------------------------------------
+// Ports are one open device. Input comes in on the driver's own thread
+//-----------------------------------------------------------------------------
+
+struct MIDIInMsg
+{
+    unsigned char cStatus, cParam1, cParam2;
+    long long llTime; // Microseconds since the port was opened. From the kernel where the driver can
+};
+
+class MIDIInPort
+{
+public:
+    typedef void (*MIDIInCallback)( const MIDIInMsg &msg, void *pUserData );
+
+    virtual ~MIDIInPort() { }
+    virtual bool Open( int iDev, MIDIInCallback pCallback, void *pUserData ) = 0;
+    virtual void Close() = 0; // No more callbacks once this returns
+};
+
+class MIDIOutPort : public MIDIOutBackend
+{
+public:
+    virtual bool Open( int iDev ) = 0;
+    virtual void Close() = 0;
+    virtual void SetVolume( double /*dVolume*/ ) { }
+
+    // Right away, even when scheduled
+    virtual bool SendNow( const MIDIShortMsg *pMsgs, int iMsgs ) = 0;
+};
+
+//-----------------------------------------------------------------------------
+// The driver lists the devices and makes ports for them. GetDriver is the
+// platform's unless SetDriver's put another in, before any ports are made.
+//-----------------------------------------------------------------------------
+
+class MIDIDriver
+{
+public:
+    static MIDIDriver &GetDriver();
+    static void SetDriver( MIDIDriver *pDriver ); // NULL for the platform's again. Caller keeps ownership
+
+    virtual ~MIDIDriver() { }
+    virtual const wchar_t *GetName() const = 0;
+
+    virtual int GetNumInDevs() const = 0;
+    virtual wstring GetInDevName( int iDev ) const = 0;
+    virtual int GetNumOutDevs() const = 0;
+    virtual wstring GetOutDevName( int iDev ) const = 0;
+
+    // Caller deletes
+    virtual MIDIInPort *CreateInPort() = 0;
+    virtual MIDIOutPort *CreateOutPort() = 0;
+
+private:
+    static MIDIDriver *s_pDriver;
+};
+
+// One per platform. NULL where there isn't one
+MIDIDriver *CreateWinMMDriver();
+MIDIDriver *CreateALSADriver();
+
+//-----------------------------------------------------------------------------
+// Virtual cables: whatever goes out on device i comes in on device i, on the
+// sending thread. Stamped with when it arrived, so it can time a pipeline.
+// Doesn't schedule.
+//-----------------------------------------------------------------------------
+
+class MIDILoopbackDriver : public MIDIDriver
+{
+public:
+    MIDILoopbackDriver( int iCables = 1 );
+
+    const wchar_t *GetName() const { return L"Loopback"; }
+    int GetNumInDevs() const { return static_cast< int >( m_vCables.size() ); }
+    wstring GetInDevName( int iDev ) const;
+    int GetNumOutDevs() const { return static_cast< int >( m_vCables.size() ); }
+    wstring GetOutDevName( int iDev ) const { return GetInDevName( iDev ); }
+
+    MIDIInPort *CreateInPort();
+    MIDIOutPort *CreateOutPort();
+
+private:
+    class InPort;
+    class OutPort;
+
+    struct Cable
+    {
+        Cable() : pIn( NULL ) { }
+        mutex mtx; // Sends hold it, so closing waits on them
+        InPort *pIn; // The one input open on it, if any
+    };
+
+    vector< Cable > m_vCables;
+};
@@ -0,0 +1,423 @@
+/*************************************************************************************************
+*
+* File: MIDIDriverALSA.cpp
+*
+* Description: Implements the MIDI driver on the ALSA sequencer. Links against libasound. Only
+*              built with PFA_ALSA defined, since it hasn't been run on a real sequencer yet.
+*              Otherwise Linux gets the loopback driver
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include "MIDIDriver.h"
+
+#if defined( __linux__ ) && defined( PFA_ALSA )
+
+#include <alsa/asoundlib.h>
+#include <poll.h>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+static const char *ClientName = "Piano From Above";
+
+//-----------------------------------------------------------------------------
+// The driver. Devices are other clients' ports, listed as "client: port"
+//-----------------------------------------------------------------------------
+
+class ALSADriver : public MIDIDriver
+{
+public:
+    ALSADriver( snd_seq_t *pSeq ) : m_pSeq( pSeq ) { }
+    ~ALSADriver() { snd_seq_close( m_pSeq ); }
+
+    const wchar_t *GetName() const { return L"ALSA Sequencer"; }
+
+    // Counting rescans. Names and opens use the last scan, so indices match what was counted
+    int GetNumInDevs() const { return Scan( SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ, m_vInPorts ); }
+    wstring GetInDevName( int iDev ) const { return GetPort( iDev, m_vInPorts, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ ).sName; }
+    int GetNumOutDevs() const { return Scan( SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE, m_vOutPorts ); }
+    wstring GetOutDevName( int iDev ) const { return GetPort( iDev, m_vOutPorts, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE ).sName; }
+
+    bool GetInAddr( int iDev, snd_seq_addr_t &addr ) const;
+    bool GetOutAddr( int iDev, snd_seq_addr_t &addr ) const;
+
+    MIDIInPort *CreateInPort();
+    MIDIOutPort *CreateOutPort();
+
+private:
+    struct Port
+    {
+        snd_seq_addr_t addr;
+        wstring sName; // Empty if there's no such port
+    };
+
+    int Scan( unsigned int iCaps, vector< Port > &vPorts ) const;
+    Port GetPort( int iDev, vector< Port > &vPorts, unsigned int iCaps ) const;
+
+    snd_seq_t *m_pSeq; // Just for listing. Ports open their own
+    mutable mutex m_mtx;
+    mutable vector< Port > m_vInPorts, m_vOutPorts;
+};
+
+// Skips ourselves, the system client's timer and announce ports, and anything that's not for MIDI
+int ALSADriver::Scan( unsigned int iCaps, vector< Port > &vPorts ) const
+{
+    lock_guard< mutex > lock( m_mtx );
+    vPorts.clear();
+
+    snd_seq_client_info_t *pClientInfo;
+    snd_seq_port_info_t *pPortInfo;
+    snd_seq_client_info_alloca( &pClientInfo );
+    snd_seq_port_info_alloca( &pPortInfo );
+
+    int iSelf = snd_seq_client_id( m_pSeq );
+    snd_seq_client_info_set_client( pClientInfo, -1 );
+    while ( snd_seq_query_next_client( m_pSeq, pClientInfo ) >= 0 )
+    {
+        int iClient = snd_seq_client_info_get_client( pClientInfo );
+        if ( iClient == iSelf || iClient == SND_SEQ_CLIENT_SYSTEM ) continue;
+
+        snd_seq_port_info_set_client( pPortInfo, iClient );
+        snd_seq_port_info_set_port( pPortInfo, -1 );
+        while ( snd_seq_query_next_port( m_pSeq, pPortInfo ) >= 0 )
+        {
+            unsigned int iPortCaps = snd_seq_port_info_get_capability( pPortInfo );
+            unsigned int iPortType = snd_seq_port_info_get_type( pPortInfo );
+            if ( ( iPortCaps & iCaps ) != iCaps || ( iPortCaps & SND_SEQ_PORT_CAP_NO_EXPORT ) ) continue;
+            if ( !( iPortType & ( SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_SYNTH | SND_SEQ_PORT_TYPE_APPLICATION ) ) ) continue;
+
+            // Names are ASCII in practice, so widening the bytes will do
+            string sName = string( snd_seq_client_info_get_name( pClientInfo ) ) + ": " + snd_seq_port_info_get_name( pPortInfo );
+            Port port;
+            port.addr = *snd_seq_port_info_get_addr( pPortInfo );
+            port.sName.assign( sName.begin(), sName.end() );
+            vPorts.push_back( port );
+        }
+    }
+
+    return static_cast< int >( vPorts.size() );
+}
+
+// Scans first if it never has
+ALSADriver::Port ALSADriver::GetPort( int iDev, vector< Port > &vPorts, unsigned int iCaps ) const
+{
+    bool bScanned;
+    {
+        lock_guard< mutex > lock( m_mtx );
+        bScanned = !vPorts.empty();
+    }
+    if ( !bScanned ) Scan( iCaps, vPorts );
+
+    lock_guard< mutex > lock( m_mtx );
+    if ( iDev < 0 || iDev >= static_cast< int >( vPorts.size() ) ) return Port();
+    return vPorts[iDev];
+}
+
+bool ALSADriver::GetInAddr( int iDev, snd_seq_addr_t &addr ) const
+{
+    Port port = GetPort( iDev, m_vInPorts, SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ );
+    addr = port.addr;
+    return !port.sName.empty();
+}
+
+bool ALSADriver::GetOutAddr( int iDev, snd_seq_addr_t &addr ) const
+{
+    Port port = GetPort( iDev, m_vOutPorts, SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE );
+    addr = port.addr;
+    return !port.sName.empty();
+}
+
+//-----------------------------------------------------------------------------
+// Output. Scheduled, messages go on a queue of our own and the kernel plays
+// them at their times. The sequencer has no port volume, so that's left to
+// the synth.
+//-----------------------------------------------------------------------------
+
+class ALSAOutPort : public MIDIOutPort
+{
+public:
+    ALSAOutPort( const ALSADriver &driver ) : m_Driver( driver ), m_pSeq( NULL ), m_pEncoder( NULL ), m_iPort( -1 ),
+                                              m_iQueue( -1 ), m_bScheduled( false ), m_bHaveTime( false ) { }
+    ~ALSAOutPort() { Close(); }
+
+    bool Open( int iDev );
+    void Close();
+
+    int GetCaps() const { return 0; }
+    bool SetScheduled( bool bScheduled ) { m_bScheduled = bScheduled; m_bHaveTime = false; return true; }
+    bool Send( const MIDIShortMsg *pMsgs, int iMsgs ) { return Output( pMsgs, iMsgs, m_bScheduled ); }
+    bool SendNow( const MIDIShortMsg *pMsgs, int iMsgs ) { return Output( pMsgs, iMsgs, false ); }
+
+private:
+    bool Output( const MIDIShortMsg *pMsgs, int iMsgs, bool bScheduled );
+    long long GetQueueTime() const;
+
+    const ALSADriver &m_Driver;
+    snd_seq_t *m_pSeq;
+    snd_midi_event_t *m_pEncoder;
+    int m_iPort, m_iQueue;
+    bool m_bScheduled;
+
+    // Where the last scheduled message went, in our time and the queue's
+    bool m_bHaveTime;
+    long long m_llLastTime, m_llLastQueueTime;
+};
+
+bool ALSAOutPort::Open( int iDev )
+{
+    Close();
+
+    snd_seq_addr_t addr;
+    if ( !m_Driver.GetOutAddr( iDev, addr ) ) return false;
+    if ( snd_seq_open( &m_pSeq, "default", SND_SEQ_OPEN_OUTPUT, 0 ) < 0 )
+    {
+        m_pSeq = NULL;
+        return false;
+    }
+    snd_seq_set_client_name( m_pSeq, ClientName );
+
+    m_iPort = snd_seq_create_simple_port( m_pSeq, "Out", SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+                                          SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION );
+    m_iQueue = snd_seq_alloc_queue( m_pSeq );
+    if ( m_iPort < 0 || m_iQueue < 0 ||
+         snd_seq_connect_to( m_pSeq, m_iPort, addr.client, addr.port ) < 0 ||
+         snd_midi_event_new( 16, &m_pEncoder ) < 0 )
+    {
+        Close();
+        return false;
+    }
+
+    snd_seq_start_queue( m_pSeq, m_iQueue, NULL );
+    snd_seq_drain_output( m_pSeq );
+    m_bHaveTime = false;
+    return true;
+}
+
+// Closing the client drops whatever's still on its queue
+void ALSAOutPort::Close()
+{
+    if ( m_pEncoder ) snd_midi_event_free( m_pEncoder );
+    if ( m_pSeq ) snd_seq_close( m_pSeq );
+    m_pEncoder = NULL;
+    m_pSeq = NULL;
+    m_iPort = m_iQueue = -1;
+}
+
+// Microseconds since the queue started
+long long ALSAOutPort::GetQueueTime() const
+{
+    snd_seq_queue_status_t *pStatus;
+    snd_seq_queue_status_alloca( &pStatus );
+    if ( snd_seq_get_queue_status( m_pSeq, m_iQueue, pStatus ) < 0 ) return 0;
+
+    const snd_seq_real_time_t *pTime = snd_seq_queue_status_get_real_time( pStatus );
+    return pTime->tv_sec * 1000000LL + pTime->tv_nsec / 1000;
+}
+
+// Scheduled messages keep the spacing of their times, like the WinMM stream does. If that would put one
+// in the past, after a pause say, the schedule restarts from now
+bool ALSAOutPort::Output( const MIDIShortMsg *pMsgs, int iMsgs, bool bScheduled )
+{
+    if ( !m_pSeq ) return false;
+
+    long long llNow = ( bScheduled ? GetQueueTime() : 0 );
+    bool bResult = true;
+    for ( int i = 0; i < iMsgs; i++ )
+    {
+        unsigned char pcMsg[3] = { pMsgs[i].GetStatus(), static_cast< unsigned char >( pMsgs[i].iMsg >> 8 ),
+                                   static_cast< unsigned char >( pMsgs[i].iMsg >> 16 ) };
+        long lLen = 1 + pMsgs[i].GetDataLen();
+
+        snd_seq_event_t ev;
+        snd_seq_ev_clear( &ev );
+        snd_midi_event_reset_encode( m_pEncoder );
+        if ( snd_midi_event_encode( m_pEncoder, pcMsg, lLen, &ev ) != lLen || ev.type == SND_SEQ_EVENT_NONE )
+        {
+            bResult = false;
+            continue;
+        }
+
+        snd_seq_ev_set_source( &ev, m_iPort );
+        snd_seq_ev_set_subs( &ev );
+        if ( bScheduled )
+        {
+            long long llAt = ( m_bHaveTime ? m_llLastQueueTime + max( pMsgs[i].llTime - m_llLastTime, 0LL ) : llNow );
+            if ( llAt < llNow ) llAt = llNow;
+            m_llLastTime = pMsgs[i].llTime;
+            m_llLastQueueTime = llAt;
+            m_bHaveTime = true;
+
+            snd_seq_real_time_t rt;
+            rt.tv_sec = static_cast< unsigned int >( llAt / 1000000 );
+            rt.tv_nsec = static_cast< unsigned int >( llAt % 1000000 ) * 1000;
+            snd_seq_ev_schedule_real( &ev, m_iQueue, 0, &rt );
+        }
+        else
+            snd_seq_ev_set_direct( &ev );
+
+        // Blocking, so a full buffer drains rather than fails
+        if ( snd_seq_event_output( m_pSeq, &ev ) < 0 ) bResult = false;
+    }
+
+    if ( snd_seq_drain_output( m_pSeq ) < 0 ) bResult = false;
+    return bResult;
+}
+
+//-----------------------------------------------------------------------------
+// Input. The subscription has the kernel stamp events with our queue's real
+// time as they arrive, so times don't pick up our thread's wake-up latency.
+// A thread of our own reads them.
+//-----------------------------------------------------------------------------
+
+class ALSAInPort : public MIDIInPort
+{
+public:
+    ALSAInPort( const ALSADriver &driver ) : m_Driver( driver ), m_pSeq( NULL ), m_pDecoder( NULL ), m_iPort( -1 ),
+                                             m_iQueue( -1 ), m_bQuit( false ), m_pCallback( NULL ), m_pUserData( NULL ) { }
+    ~ALSAInPort() { Close(); }
+
+    bool Open( int iDev, MIDIInCallback pCallback, void *pUserData );
+    void Close();
+
+private:
+    static const int PollMilliSecs = 50; // How long Close can wait on the thread
+
+    void Run();
+
+    const ALSADriver &m_Driver;
+    snd_seq_t *m_pSeq;
+    snd_midi_event_t *m_pDecoder;
+    int m_iPort, m_iQueue;
+
+    thread m_Thread;
+    atomic< bool > m_bQuit;
+    chrono::steady_clock::time_point m_tpOpen; // For events that come in unstamped
+    MIDIInCallback m_pCallback;
+    void *m_pUserData;
+};
+
+bool ALSAInPort::Open( int iDev, MIDIInCallback pCallback, void *pUserData )
+{
+    Close();
+    m_pCallback = pCallback;
+    m_pUserData = pUserData;
+
+    snd_seq_addr_t addr;
+    if ( !m_Driver.GetInAddr( iDev, addr ) ) return false;
+    if ( snd_seq_open( &m_pSeq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK ) < 0 )
+    {
+        m_pSeq = NULL;
+        return false;
+    }
+    snd_seq_set_client_name( m_pSeq, ClientName );
+
+    m_iPort = snd_seq_create_simple_port( m_pSeq, "In", SND_SEQ_PORT_CAP_WRITE | SND_SEQ_PORT_CAP_SUBS_WRITE,
+                                          SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION );
+    m_iQueue = snd_seq_alloc_queue( m_pSeq );
+    if ( m_iPort < 0 || m_iQueue < 0 || snd_midi_event_new( 16, &m_pDecoder ) < 0 )
+    {
+        Close();
+        return false;
+    }
+    snd_midi_event_no_status( m_pDecoder, 1 );
+
+    snd_seq_port_subscribe_t *pSubs;
+    snd_seq_port_subscribe_alloca( &pSubs );
+    snd_seq_addr_t dest = { static_cast< unsigned char >( snd_seq_client_id( m_pSeq ) ), static_cast< unsigned char >( m_iPort ) };
+    snd_seq_port_subscribe_set_sender( pSubs, &addr );
+    snd_seq_port_subscribe_set_dest( pSubs, &dest );
+    snd_seq_port_subscribe_set_queue( pSubs, m_iQueue );
+    snd_seq_port_subscribe_set_time_update( pSubs, 1 );
+    snd_seq_port_subscribe_set_time_real( pSubs, 1 );
+    if ( snd_seq_subscribe_port( m_pSeq, pSubs ) < 0 )
+    {
+        Close();
+        return false;
+    }
+
+    snd_seq_start_queue( m_pSeq, m_iQueue, NULL );
+    snd_seq_drain_output( m_pSeq );
+    m_tpOpen = chrono::steady_clock::now();
+
+    m_bQuit = false;
+    m_Thread = thread( &ALSAInPort::Run, this );
+    return true;
+}
+
+void ALSAInPort::Close()
+{
+    if ( m_Thread.joinable() )
+    {
+        m_bQuit = true;
+        m_Thread.join();
+    }
+    if ( m_pDecoder ) snd_midi_event_free( m_pDecoder );
+    if ( m_pSeq ) snd_seq_close( m_pSeq );
+    m_pDecoder = NULL;
+    m_pSeq = NULL;
+    m_iPort = m_iQueue = -1;
+}
+
+// Polls with a timeout so it sees Close. Anything that doesn't decode to a short message, SysEx say, is dropped
+void ALSAInPort::Run()
+{
+    int iFds = snd_seq_poll_descriptors_count( m_pSeq, POLLIN );
+    vector< pollfd > vFds( iFds );
+    snd_seq_poll_descriptors( m_pSeq, &vFds[0], iFds, POLLIN );
+
+    while ( !m_bQuit )
+    {
+        if ( poll( &vFds[0], iFds, PollMilliSecs ) <= 0 ) continue;
+
+        snd_seq_event_t *pEv;
+        int iResult;
+        while ( ( iResult = snd_seq_event_input( m_pSeq, &pEv ) ) >= 0 || iResult == -ENOSPC )
+        {
+            if ( iResult == -ENOSPC ) continue; // Overran. What's left is still good
+
+            unsigned char pcMsg[16];
+            long lLen = snd_midi_event_decode( m_pDecoder, pcMsg, sizeof( pcMsg ), pEv );
+            if ( lLen < 1 || lLen > 3 || !( pcMsg[0] & 0x80 ) ) continue;
+
+            MIDIInMsg msg;
+            msg.cStatus = pcMsg[0];
+            msg.cParam1 = ( lLen > 1 ? pcMsg[1] : 0 );
+            msg.cParam2 = ( lLen > 2 ? pcMsg[2] : 0 );
+            if ( ( pEv->flags & SND_SEQ_TIME_STAMP_MASK ) == SND_SEQ_TIME_STAMP_REAL )
+                msg.llTime = pEv->time.time.tv_sec * 1000000LL + pEv->time.time.tv_nsec / 1000;
+            else
+                msg.llTime = chrono::duration_cast< chrono::microseconds >( chrono::steady_clock::now() - m_tpOpen ).count();
+            ( *m_pCallback )( msg, m_pUserData );
+        }
+    }
+}
+
+MIDIInPort *ALSADriver::CreateInPort()
+{
+    return new ALSAInPort( *this );
+}
+
+MIDIOutPort *ALSADriver::CreateOutPort()
+{
+    return new ALSAOutPort( *this );
+}
+
+// NULL if there's no sequencer, and the loopback gets used
+MIDIDriver *CreateALSADriver()
+{
+    snd_seq_t *pSeq;
+    if ( snd_seq_open( &pSeq, "default", SND_SEQ_OPEN_DUPLEX, 0 ) < 0 ) return NULL;
+    snd_seq_set_client_name( pSeq, ClientName );
+    return new ALSADriver( pSeq );
+}
+
+#else
+
+MIDIDriver *CreateALSADriver()
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,336 @@
+/*************************************************************************************************
+*
+* File: MIDIDriverWinMM.cpp
+*
+* Description: Implements the MIDI driver on the Windows multimedia API
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include "MIDIDriver.h"
+
+#ifdef _WIN32
+
+#include <Windows.h>
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+// Output. Scheduled, it plays through a MIDI stream, which does the timing
+//-----------------------------------------------------------------------------
+
+class WinMMOutPort : public MIDIOutPort
+{
+public:
+    WinMMOutPort() : m_hMIDIOut( NULL ), m_hStream( NULL ), m_bIsOpen( false ), m_iDevice( 0 ), m_bScheduled( false ),
+                     m_hDone( NULL ), m_iNextBuffer( 0 ), m_llLastStreamTime( 0 ), m_bHaveStreamTime( false ) { }
+    ~WinMMOutPort();
+
+    bool Open( int iDev );
+    void Close();
+    void SetVolume( double dVolume );
+
+    int GetCaps() const { return 0; }
+    bool SetScheduled( bool bScheduled );
+    bool Send( const MIDIShortMsg *pMsgs, int iMsgs );
+    bool SendNow( const MIDIShortMsg *pMsgs, int iMsgs );
+
+private:
+    static const int MaxStreamBuffers = 64; // Flushes the stream can be behind by before sending waits
+    static const int MaxStreamMsgs = 65536 / ( 3 * sizeof( DWORD ) );
+    static const DWORD StreamWaitMs = 1000; // Longest to wait for a buffer before giving up on the device
+
+    struct StreamBuffer
+    {
+        MIDIHDR hdr;
+        vector< DWORD > vData;
+    };
+
+    bool SendStream( const MIDIShortMsg *pMsgs, int iMsgs );
+
+    HMIDIOUT m_hMIDIOut; // The stream's handle when scheduled. It takes short messages too
+    HMIDISTRM m_hStream;
+    bool m_bIsOpen;
+    int m_iDevice;
+    bool m_bScheduled;
+
+    // Stream buffers stay put till the device is done with them. A ring, oldest next, that grows
+    // while the device has all of them
+    HANDLE m_hDone; // Set each time the device hands a buffer back
+    vector< StreamBuffer* > m_vBuffers;
+    int m_iNextBuffer;
+    long long m_llLastStreamTime;
+    bool m_bHaveStreamTime;
+};
+
+WinMMOutPort::~WinMMOutPort()
+{
+    Close();
+    for ( size_t i = 0; i < m_vBuffers.size(); i++ )
+        delete m_vBuffers[i];
+}
+
+bool WinMMOutPort::Open( int iDev )
+{
+    if ( m_bIsOpen ) Close();
+    m_iDevice = iDev;
+
+    MMRESULT mmResult;
+    if ( !m_bScheduled )
+        mmResult = midiOutOpen( &m_hMIDIOut, iDev, NULL, NULL, CALLBACK_NULL );
+    else
+    {
+        UINT uDev = iDev;
+        m_hDone = CreateEvent( NULL, FALSE, FALSE, NULL );
+        mmResult = midiStreamOpen( &m_hStream, &uDev, 1, reinterpret_cast< DWORD_PTR >( m_hDone ), NULL, CALLBACK_EVENT );
+        if ( mmResult == MMSYSERR_NOERROR )
+        {
+            // A tick a microsecond, same as the times we're given
+            MIDIPROPTIMEDIV mptd = { sizeof( MIDIPROPTIMEDIV ), 10000 };
+            MIDIPROPTEMPO mpt = { sizeof( MIDIPROPTEMPO ), 10000 };
+            midiStreamProperty( m_hStream, reinterpret_cast< LPBYTE >( &mptd ), MIDIPROP_SET | MIDIPROP_TIMEDIV );
+            midiStreamProperty( m_hStream, reinterpret_cast< LPBYTE >( &mpt ), MIDIPROP_SET | MIDIPROP_TEMPO );
+            m_hMIDIOut = reinterpret_cast< HMIDIOUT >( m_hStream );
+
+            for ( size_t i = 0; i < m_vBuffers.size(); i++ )
+                memset( &m_vBuffers[i]->hdr, 0, sizeof( MIDIHDR ) );
+            m_iNextBuffer = 0;
+            m_bHaveStreamTime = false;
+            mmResult = midiStreamRestart( m_hStream );
+            if ( mmResult != MMSYSERR_NOERROR )
+            {
+                midiStreamClose( m_hStream );
+                m_hStream = NULL;
+            }
+        }
+        if ( mmResult != MMSYSERR_NOERROR )
+        {
+            CloseHandle( m_hDone );
+            m_hDone = NULL;
+        }
+    }
+
+    m_bIsOpen = ( mmResult == MMSYSERR_NOERROR );
+    return m_bIsOpen;
+}
+
+void WinMMOutPort::Close()
+{
+    if ( !m_bIsOpen ) return;
+
+    // Reset hands back any stream buffers still queued
+    midiOutReset( m_hMIDIOut );
+    if ( m_hStream )
+    {
+        midiStreamStop( m_hStream );
+        for ( size_t i = 0; i < m_vBuffers.size(); i++ )
+            if ( m_vBuffers[i]->hdr.dwFlags & MHDR_PREPARED )
+                midiOutUnprepareHeader( m_hMIDIOut, &m_vBuffers[i]->hdr, sizeof( MIDIHDR ) );
+        midiStreamClose( m_hStream );
+        m_hStream = NULL;
+        CloseHandle( m_hDone );
+        m_hDone = NULL;
+    }
+    else
+        midiOutClose( m_hMIDIOut );
+    m_bIsOpen = false;
+}
+
+void WinMMOutPort::SetVolume( double dVolume )
+{
+    DWORD dwVolume = static_cast< DWORD >( 0xFFFF * dVolume + 0.5 );
+    midiOutSetVolume( m_hMIDIOut, dwVolume | ( dwVolume << 16 ) );
+}
+
+// Switching reopens the device as the other kind
+bool WinMMOutPort::SetScheduled( bool bScheduled )
+{
+    if ( bScheduled == m_bScheduled ) return true;
+
+    m_bScheduled = bScheduled;
+    if ( !m_bIsOpen || Open( m_iDevice ) ) return true;
+
+    m_bScheduled = !bScheduled;
+    Open( m_iDevice );
+    return false;
+}
+
+bool WinMMOutPort::Send( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    if ( !m_bIsOpen ) return false;
+    if ( !m_bScheduled ) return SendNow( pMsgs, iMsgs );
+
+    // A stream buffer can't go over 64K
+    bool bResult = true;
+    for ( int i = 0; i < iMsgs; i += MaxStreamMsgs )
+        bResult &= SendStream( pMsgs + i, min( iMsgs - i, static_cast< int >( MaxStreamMsgs ) ) );
+    return bResult;
+}
+
+// The API only takes them one at a time
+bool WinMMOutPort::SendNow( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    if ( !m_bIsOpen ) return false;
+
+    bool bResult = true;
+    for ( int i = 0; i < iMsgs; i++ )
+        bResult &= ( midiOutShortMsg( m_hMIDIOut, pMsgs[i].iMsg ) == MMSYSERR_NOERROR );
+    return bResult;
+}
+
+// One buffer of MIDIEVENTs, without their params: delta time, stream ID, event.
+// If the device still has the oldest buffer, adds another, or once there are
+// enough, waits for the device to hand it back. Fails only if it never does
+bool WinMMOutPort::SendStream( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    if ( m_vBuffers.empty() || ( m_vBuffers[m_iNextBuffer]->hdr.dwFlags & MHDR_INQUEUE ) )
+    {
+        if ( static_cast< int >( m_vBuffers.size() ) < MaxStreamBuffers )
+        {
+            StreamBuffer *pBuffer = new StreamBuffer();
+            memset( &pBuffer->hdr, 0, sizeof( MIDIHDR ) );
+            m_vBuffers.insert( m_vBuffers.begin() + m_iNextBuffer, pBuffer );
+        }
+        else
+        {
+            while ( m_vBuffers[m_iNextBuffer]->hdr.dwFlags & MHDR_INQUEUE )
+                if ( WaitForSingleObject( m_hDone, StreamWaitMs ) != WAIT_OBJECT_0 ) return false;
+        }
+    }
+
+    MIDIHDR &hdr = m_vBuffers[m_iNextBuffer]->hdr;
+    if ( hdr.dwFlags & MHDR_PREPARED ) midiOutUnprepareHeader( m_hMIDIOut, &hdr, sizeof( MIDIHDR ) );
+
+    vector< DWORD > &vData = m_vBuffers[m_iNextBuffer]->vData;
+    vData.resize( iMsgs * 3 );
+    for ( int i = 0; i < iMsgs; i++ )
+    {
+        long long llDelta = ( m_bHaveStreamTime ? pMsgs[i].llTime - m_llLastStreamTime : 0 );
+        m_llLastStreamTime = pMsgs[i].llTime;
+        m_bHaveStreamTime = true;
+
+        vData[i * 3] = static_cast< DWORD >( max( llDelta, 0LL ) );
+        vData[i * 3 + 1] = 0;
+        vData[i * 3 + 2] = ( MEVT_SHORTMSG << 24 ) | ( pMsgs[i].iMsg & 0x00FFFFFF );
+    }
+
+    memset( &hdr, 0, sizeof( MIDIHDR ) );
+    hdr.lpData = reinterpret_cast< LPSTR >( &vData[0] );
+    hdr.dwBufferLength = hdr.dwBytesRecorded = static_cast< DWORD >( vData.size() * sizeof( DWORD ) );
+    if ( midiOutPrepareHeader( m_hMIDIOut, &hdr, sizeof( MIDIHDR ) ) != MMSYSERR_NOERROR ) return false;
+    if ( midiStreamOut( m_hStream, &hdr, sizeof( MIDIHDR ) ) != MMSYSERR_NOERROR ) return false;
+
+    m_iNextBuffer = ( m_iNextBuffer + 1 ) % static_cast< int >( m_vBuffers.size() );
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Input. WinMM stamps messages in milliseconds since midiInStart
+//-----------------------------------------------------------------------------
+
+class WinMMInPort : public MIDIInPort
+{
+public:
+    WinMMInPort() : m_hMIDIIn( NULL ), m_bIsOpen( false ), m_pCallback( NULL ), m_pUserData( NULL ) { }
+    ~WinMMInPort() { Close(); }
+
+    bool Open( int iDev, MIDIInCallback pCallback, void *pUserData );
+    void Close();
+
+private:
+    static void CALLBACK MIDIInProc( HMIDIIN hMidiIn, UINT wMsg, DWORD_PTR dwInstance,
+                                     DWORD_PTR dwParam1, DWORD_PTR dwParam2 );
+
+    HMIDIIN m_hMIDIIn;
+    bool m_bIsOpen;
+    MIDIInCallback m_pCallback;
+    void *m_pUserData;
+};
+
+bool WinMMInPort::Open( int iDev, MIDIInCallback pCallback, void *pUserData )
+{
+    if ( m_bIsOpen ) Close();
+    m_pCallback = pCallback;
+    m_pUserData = pUserData;
+
+    MMRESULT mmResult = midiInOpen( &m_hMIDIIn, iDev, ( DWORD_PTR )MIDIInProc, ( DWORD_PTR )this, CALLBACK_FUNCTION );
+    if ( mmResult != MMSYSERR_NOERROR ) return false;
+
+    mmResult = midiInStart( m_hMIDIIn );
+    if ( mmResult != MMSYSERR_NOERROR )
+    {
+        midiInClose( m_hMIDIIn );
+        return false;
+    }
+
+    m_bIsOpen = true;
+    return m_bIsOpen;
+}
+
+void WinMMInPort::Close()
+{
+    if ( !m_bIsOpen ) return;
+
+    midiInReset( m_hMIDIIn );
+    midiInStop( m_hMIDIIn );
+    midiInClose( m_hMIDIIn );
+    m_bIsOpen = false;
+}
+
+void CALLBACK WinMMInPort::MIDIInProc( HMIDIIN hMidiIn, UINT wMsg, DWORD_PTR dwInstance,
+                                       DWORD_PTR dwParam1, DWORD_PTR dwParam2 )
+{
+    WinMMInPort *pInPort = reinterpret_cast< WinMMInPort* >( dwInstance );
+    if ( wMsg != MIM_DATA ) return;
+
+    MIDIInMsg msg;
+    msg.cStatus = static_cast< unsigned char >( dwParam1 );
+    msg.cParam1 = static_cast< unsigned char >( dwParam1 >> 8 );
+    msg.cParam2 = static_cast< unsigned char >( dwParam1 >> 16 );
+    msg.llTime = static_cast< long long >( dwParam2 ) * 1000;
+    ( *pInPort->m_pCallback )( msg, pInPort->m_pUserData );
+}
+
+//-----------------------------------------------------------------------------
+// The driver
+//-----------------------------------------------------------------------------
+
+class WinMMDriver : public MIDIDriver
+{
+public:
+    const wchar_t *GetName() const { return L"Windows Multimedia"; }
+
+    int GetNumInDevs() const { return midiInGetNumDevs(); }
+    wstring GetInDevName( int iDev ) const
+    {
+        MIDIINCAPS mic;
+        if ( midiInGetDevCaps( iDev, &mic, sizeof( MIDIINCAPS ) ) == MMSYSERR_NOERROR )
+            return mic.szPname;
+        return wstring();
+    }
+
+    int GetNumOutDevs() const { return midiOutGetNumDevs(); }
+    wstring GetOutDevName( int iDev ) const
+    {
+        MIDIOUTCAPS moc;
+        if ( midiOutGetDevCaps( iDev, &moc, sizeof( MIDIOUTCAPS ) ) == MMSYSERR_NOERROR )
+            return moc.szPname;
+        return wstring();
+    }
+
+    MIDIInPort *CreateInPort() { return new WinMMInPort(); }
+    MIDIOutPort *CreateOutPort() { return new WinMMOutPort(); }
+};
+
+MIDIDriver *CreateWinMMDriver()
+{
+    return new WinMMDriver();
+}
+
+#else
+
+MIDIDriver *CreateWinMMDriver()
+{
+    return NULL;
+}
+
+#endif
@@ -0,0 +1,380 @@
+/*************************************************************************************************
+*
+* File: MIDIOut.cpp
+*
+* Description: Implements buffered MIDI output and the device-less backends
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <algorithm>
+#include <cstring>
+
+#include "MIDIOut.h"
+
+// Program change and channel pressure have one param. System messages vary
+int MIDIShortMsg::GetDataLen( unsigned char cStatus )
+{
+    if ( cStatus < 0xF0 )
+        return ( ( cStatus & 0xE0 ) == 0xC0 ? 1 : 2 );
+    if ( cStatus == 0xF1 || cStatus == 0xF3 ) return 1;
+    if ( cStatus == 0xF2 ) return 2;
+    return 0;
+}
+
+//-----------------------------------------------------------------------------
+// MIDIOutStream
+//-----------------------------------------------------------------------------
+
+MIDIOutStream::MIDIOutStream( MIDIOutBackend *pBackend ) : m_pBackend( NULL ), m_pGovernor( NULL ), m_bScheduled( false )
+{
+    SetBackend( pBackend );
+}
+
+void MIDIOutStream::SetBackend( MIDIOutBackend *pBackend )
+{
+    m_pBackend = pBackend;
+    if ( m_pBackend ) m_pBackend->SetScheduled( m_bScheduled );
+    m_vQueue.clear();
+    m_iRunningStatus = -1;
+    m_bHaveLastTime = false;
+    m_llLastTime = 0;
+    m_Stats.llMsgs = m_Stats.llBytes = m_Stats.llFlushes = m_Stats.llStatusSaved = 0;
+}
+
+bool MIDIOutStream::SetScheduled( bool bScheduled )
+{
+    if ( m_pBackend && !m_pBackend->SetScheduled( bScheduled ) )
+        return false;
+    m_bScheduled = bScheduled;
+    return true;
+}
+
+void MIDIOutStream::Queue( long long llTime, unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 )
+{
+    MIDIShortMsg msg = { llTime, MIDIShortMsg::Pack( cStatus, cParam1, cParam2 ) };
+    m_vQueue.push_back( msg );
+}
+
+void MIDIOutStream::Queue( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    m_vQueue.insert( m_vQueue.end(), pMsgs, pMsgs + iMsgs );
+}
+
+void MIDIOutStream::QueueAcrossChannels( long long llTime, unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 )
+{
+    cStatus &= 0xF0;
+    for ( int i = 0; i < 16; i++ )
+        Queue( llTime, cStatus + i, cParam1, cParam2 );
+}
+
+void MIDIOutStream::QueueAcrossChannels( long long llTime, unsigned char cStatus, unsigned char cParam1, unsigned char cParam2, const vector< int > &vChannels )
+{
+    cStatus &= 0xF0;
+    for ( vector< int >::const_iterator it = vChannels.begin(); it != vChannels.end(); ++it )
+        Queue( llTime, cStatus + *it, cParam1, cParam2 );
+}
+
+// Channel by channel, so running status gets both messages on a channel for one status byte
+void MIDIOutStream::QueueAllNotesOff( long long llTime )
+{
+    for ( int i = 0; i < 16; i++ )
+    {
+        Queue( llTime, 0xB0 + i, 0x7B, 0x00 ); // All notes off
+        Queue( llTime, 0xB0 + i, 0x40, 0x00 ); // Sustain off
+    }
+}
+
+void MIDIOutStream::QueueAllNotesOff( long long llTime, const vector< int > &vChannels )
+{
+    for ( vector< int >::const_iterator it = vChannels.begin(); it != vChannels.end(); ++it )
+    {
+        Queue( llTime, 0xB0 + *it, 0x7B, 0x00 );
+        Queue( llTime, 0xB0 + *it, 0x40, 0x00 );
+    }
+}
+
+bool MIDIOutStream::Flush()
+{
+    if ( m_vQueue.empty() ) return true;
+    if ( !m_pBackend )
+    {
+        m_vQueue.clear();
+        return false;
+    }
+
+    if ( m_pGovernor )
+    {
+        m_pGovernor->Filter( m_vQueue );
+        if ( m_vQueue.empty() ) return true;
+    }
+
+    bool bResult;
+    int iMsgs = static_cast< int >( m_vQueue.size() );
+    if ( m_pBackend->GetCaps() & MIDIOutBackend::RunningStatus )
+    {
+        Encode();
+        bResult = m_pBackend->Send( &m_vBytes[0], static_cast< int >( m_vBytes.size() ), iMsgs );
+        m_Stats.llBytes += m_vBytes.size();
+    }
+    else
+    {
+        bResult = m_pBackend->Send( &m_vQueue[0], iMsgs );
+        m_Stats.llBytes += iMsgs * sizeof( unsigned int );
+    }
+
+    m_Stats.llMsgs += iMsgs;
+    m_Stats.llFlushes++;
+    m_vQueue.clear();
+    return bResult;
+}
+
+// Delta time, then the status if it's changed, then the params. Time going backwards, after a jump
+// say, counts as none passing
+void MIDIOutStream::Encode()
+{
+    m_vBytes.resize( m_vQueue.size() * 8 ); // At most 5 for the delta and 3 for the message
+    unsigned char *pcOut = &m_vBytes[0];
+    for ( vector< MIDIShortMsg >::const_iterator it = m_vQueue.begin(); it != m_vQueue.end(); ++it )
+    {
+        long long llDelta = ( m_bHaveLastTime ? it->llTime - m_llLastTime : 0 );
+        pcOut += WriteVarLen( static_cast< unsigned int >( min( max( llDelta, 0LL ), 0x0FFFFFFFLL ) ), pcOut );
+        m_llLastTime = it->llTime;
+        m_bHaveLastTime = true;
+
+        unsigned char cStatus = it->GetStatus();
+        if ( cStatus >= 0xF0 )
+        {
+            *pcOut++ = cStatus;
+            if ( cStatus < 0xF8 ) m_iRunningStatus = -1; // Real time messages don't interrupt it. System common does
+        }
+        else if ( cStatus != m_iRunningStatus )
+        {
+            *pcOut++ = cStatus;
+            m_iRunningStatus = cStatus;
+        }
+        else
+            m_Stats.llStatusSaved++;
+
+        int iDataLen = MIDIShortMsg::GetDataLen( cStatus );
+        if ( iDataLen > 0 ) *pcOut++ = static_cast< unsigned char >( it->iMsg >> 8 ) & 0x7F;
+        if ( iDataLen > 1 ) *pcOut++ = static_cast< unsigned char >( it->iMsg >> 16 ) & 0x7F;
+    }
+    m_vBytes.resize( pcOut - &m_vBytes[0] );
+}
+
+// Big endian, 7 bits a byte, high bit set on all but the last. Up to 28 bits
+int MIDIOutStream::WriteVarLen( unsigned int iValue, unsigned char *pcOut )
+{
+    int iBytes = 1;
+    while ( iBytes < 4 && ( iValue >> ( 7 * iBytes ) ) ) iBytes++;
+    for ( int i = iBytes - 1; i >= 0; i-- )
+        *pcOut++ = static_cast< unsigned char >( ( ( iValue >> ( 7 * i ) ) & 0x7F ) | ( i ? 0x80 : 0x00 ) );
+    return iBytes;
+}
+
+//-----------------------------------------------------------------------------
+// MIDIVoiceGovernor
+//-----------------------------------------------------------------------------
+
+MIDIVoiceGovernor::MIDIVoiceGovernor( int iMaxVoices, int iMaxChannelVoices )
+{
+    SetLimits( iMaxVoices, iMaxChannelVoices );
+    SetPriority( 32, 20000, 75 );
+    Reset();
+    m_Stats.llNotes = m_Stats.llDropped = m_Stats.llMerged = 0;
+    m_Stats.iPeakVoices = 0;
+}
+
+void MIDIVoiceGovernor::SetPriority( int iQuietVelocity, long long llShortMicroSecs, int iPressurePct )
+{
+    m_iQuietVelocity = iQuietVelocity;
+    m_llShortMicroSecs = llShortMicroSecs;
+    m_iPressurePct = iPressurePct;
+}
+
+void MIDIVoiceGovernor::Reset()
+{
+    memset( m_aKeys, 0, sizeof( m_aKeys ) );
+    memset( m_aChannelVoices, 0, sizeof( m_aChannelVoices ) );
+    m_Stats.iVoices = 0;
+}
+
+void MIDIVoiceGovernor::Filter( vector< MIDIShortMsg > &vMsgs )
+{
+    int iPressure = m_iMaxVoices * m_iPressurePct / 100;
+    int iChannelPressure = m_iMaxChannelVoices * m_iPressurePct / 100;
+    if ( m_llShortMicroSecs > 0 ) FindShortNotes( vMsgs );
+
+    size_t iOut = 0;
+    for ( size_t i = 0; i < vMsgs.size(); i++ )
+    {
+        const MIDIShortMsg &msg = vMsgs[i];
+        unsigned char cStatus = msg.GetStatus();
+        int iChannel = cStatus & 0x0F;
+        int iNote = ( msg.iMsg >> 8 ) & 0x7F;
+        int iVelocity = ( msg.iMsg >> 16 ) & 0x7F;
+        Key &key = m_aKeys[iChannel][iNote];
+
+        if ( ( cStatus & 0xF0 ) == 0x90 && iVelocity > 0 )
+        {
+            bool bFull = ( m_iMaxVoices > 0 && m_Stats.iVoices >= m_iMaxVoices ) ||
+                         ( m_iMaxChannelVoices > 0 && m_aChannelVoices[iChannel] >= m_iMaxChannelVoices );
+            bool bPressure = ( m_iMaxVoices > 0 && m_Stats.iVoices >= iPressure ) ||
+                             ( m_iMaxChannelVoices > 0 && m_aChannelVoices[iChannel] >= iChannelPressure );
+            bool bLow = iVelocity < m_iQuietVelocity || ( m_llShortMicroSecs > 0 && m_vShort[i] );
+
+            if ( !bFull && !( bPressure && bLow ) )
+            {
+                key.iSounding++;
+                m_aChannelVoices[iChannel]++;
+                m_Stats.iVoices++;
+                m_Stats.iPeakVoices = max( m_Stats.iPeakVoices, m_Stats.iVoices );
+                m_Stats.llNotes++;
+            }
+            else if ( key.iSounding > 0 )
+            {
+                key.iMerged++;
+                m_Stats.llMerged++;
+                continue;
+            }
+            else
+            {
+                key.iDropped++;
+                m_Stats.llDropped++;
+                continue;
+            }
+        }
+        else if ( ( cStatus & 0xF0 ) == 0x80 || ( cStatus & 0xF0 ) == 0x90 )
+        {
+            // A merged note's off would cut the voice it shares
+            if ( key.iMerged > 0 )
+            {
+                key.iMerged--;
+                continue;
+            }
+            if ( key.iDropped > 0 )
+            {
+                key.iDropped--;
+                continue;
+            }
+            if ( key.iSounding > 0 )
+            {
+                key.iSounding--;
+                m_aChannelVoices[iChannel]--;
+                m_Stats.iVoices--;
+            }
+        }
+        else if ( ( cStatus & 0xF0 ) == 0xB0 && ( iNote == 0x7B || iNote == 0x78 ) ) // All notes off, all sound off
+            ChannelOff( iChannel );
+
+        vMsgs[iOut++] = msg;
+    }
+    vMsgs.resize( iOut );
+}
+
+// Pairs each note-on with the first note-off after it on its key, first in first out, like a file's notes are
+void MIDIVoiceGovernor::FindShortNotes( const vector< MIDIShortMsg > &vMsgs )
+{
+    m_vShort.assign( vMsgs.size(), 0 );
+    m_vNextOn.resize( vMsgs.size() );
+    memset( m_aFirstOn, -1, sizeof( m_aFirstOn ) );
+    memset( m_aLastOn, -1, sizeof( m_aLastOn ) );
+
+    for ( int i = 0; i < static_cast< int >( vMsgs.size() ); i++ )
+    {
+        unsigned char cStatus = vMsgs[i].GetStatus();
+        if ( ( cStatus & 0xE0 ) != 0x80 ) continue;
+
+        int iKey = ( cStatus & 0x0F ) * 128 + ( ( vMsgs[i].iMsg >> 8 ) & 0x7F );
+        if ( ( cStatus & 0xF0 ) == 0x90 && ( vMsgs[i].iMsg >> 16 ) & 0x7F )
+        {
+            m_vNextOn[i] = -1;
+            if ( m_aLastOn[iKey] >= 0 ) m_vNextOn[m_aLastOn[iKey]] = i;
+            else m_aFirstOn[iKey] = i;
+            m_aLastOn[iKey] = i;
+        }
+        else if ( m_aFirstOn[iKey] >= 0 )
+        {
+            int iOn = m_aFirstOn[iKey];
+            m_vShort[iOn] = ( vMsgs[i].llTime - vMsgs[iOn].llTime < m_llShortMicroSecs );
+            m_aFirstOn[iKey] = m_vNextOn[iOn];
+            if ( m_aFirstOn[iKey] < 0 ) m_aLastOn[iKey] = -1;
+        }
+    }
+}
+
+void MIDIVoiceGovernor::ChannelOff( int iChannel )
+{
+    memset( m_aKeys[iChannel], 0, sizeof( m_aKeys[iChannel] ) );
+    m_Stats.iVoices -= m_aChannelVoices[iChannel];
+    m_aChannelVoices[iChannel] = 0;
+}
+
+//-----------------------------------------------------------------------------
+// MIDINullOut
+//-----------------------------------------------------------------------------
+
+bool MIDINullOut::Send( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    for ( int i = 0; i < iMsgs; i++ )
+        m_iSum += pMsgs[i].iMsg;
+    m_llMsgs += iMsgs;
+    m_llBytes += iMsgs * sizeof( unsigned int );
+    return true;
+}
+
+bool MIDINullOut::Send( const unsigned char *pcData, int iSize, int iMsgs )
+{
+    for ( int i = 0; i < iSize; i++ )
+        m_iSum += pcData[i];
+    m_llMsgs += iMsgs;
+    m_llBytes += iSize;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// MIDIFileOut
+//-----------------------------------------------------------------------------
+
+// Format 0, one track. The track's length is filled in on Close
+bool MIDIFileOut::Open( const string &sFile )
+{
+    Close();
+    m_File.clear();
+    m_File.open( sFile.c_str(), ios::out | ios::binary | ios::trunc );
+    if ( !m_File.is_open() ) return false;
+
+    static const char pcHeader[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, ( Division >> 8 ) & 0x7F, Division & 0xFF,
+        'M', 'T', 'r', 'k', 0, 0, 0, 0 };
+    static const unsigned char pcTempo[] = { 0x00, 0xFF, 0x51, 0x03, ( Tempo >> 16 ) & 0xFF, ( Tempo >> 8 ) & 0xFF, Tempo & 0xFF };
+    m_File.write( pcHeader, sizeof( pcHeader ) );
+    m_llTrackStart = m_File.tellp();
+    m_File.write( reinterpret_cast< const char* >( pcTempo ), sizeof( pcTempo ) );
+    return m_File.good();
+}
+
+bool MIDIFileOut::Close()
+{
+    if ( !m_File.is_open() ) return true;
+
+    static const char pcEnd[] = { 0x00, static_cast< char >( 0xFF ), 0x2F, 0x00 };
+    m_File.write( pcEnd, sizeof( pcEnd ) );
+    long long llLen = static_cast< long long >( m_File.tellp() ) - m_llTrackStart;
+    char pcLen[4] = { static_cast< char >( llLen >> 24 ), static_cast< char >( llLen >> 16 ),
+                      static_cast< char >( llLen >> 8 ), static_cast< char >( llLen ) };
+    m_File.seekp( m_llTrackStart - 4 );
+    m_File.write( pcLen, sizeof( pcLen ) );
+
+    bool bResult = m_File.good();
+    m_File.close();
+    return bResult && !m_File.fail();
+}
+
+bool MIDIFileOut::Send( const unsigned char *pcData, int iSize, int /*iMsgs*/ )
+{
+    if ( !m_File.is_open() ) return false;
+    m_File.write( reinterpret_cast< const char* >( pcData ), iSize );
+    return m_File.good();
+}
@@ -0,0 +1,214 @@
+/*************************************************************************************************
+*
+* File: MIDIOut.h
+*
+* Description: Defines buffered MIDI output. Messages are queued with their times and go to a
+*              backend in batches. Nothing here needs Windows, so output can be run anywhere
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// A short MIDI message and when it's meant to play
+//-----------------------------------------------------------------------------
+
+struct MIDIShortMsg
+{
+    long long llTime; // Microseconds, on whatever clock the stream's user keeps
+    unsigned int iMsg; // Packed like midiOutShortMsg takes it: status in the low byte, then the params
+
+    static unsigned int Pack( unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 )
+        { return ( cParam2 << 16 ) | ( cParam1 << 8 ) | cStatus; }
+    unsigned char GetStatus() const { return static_cast< unsigned char >( iMsg ); }
+    int GetDataLen() const { return GetDataLen( GetStatus() ); }
+    static int GetDataLen( unsigned char cStatus );
+};
+
+//-----------------------------------------------------------------------------
+// Where the messages go. Gets one call per flush. Backends that take a byte
+// stream say so with RunningStatus, and get their messages packed like a
+// standard MIDI file track: a variable length delta time in microseconds,
+// then the message with running status applied. The rest get the messages.
+//-----------------------------------------------------------------------------
+
+class MIDIOutBackend
+{
+public:
+    enum Caps { RunningStatus = 0x1 };
+
+    virtual ~MIDIOutBackend() { }
+    virtual int GetCaps() const = 0;
+
+    // Scheduled backends play each message at its time, counting from the first one they're sent.
+    // Otherwise everything plays as soon as it's sent. Returns false if the backend can't
+    virtual bool SetScheduled( bool bScheduled ) { return !bScheduled; }
+
+    // Messages are in the order they were queued
+    virtual bool Send( const MIDIShortMsg * /*pMsgs*/, int /*iMsgs*/ ) { return false; }
+    virtual bool Send( const unsigned char * /*pcData*/, int /*iSize*/, int /*iMsgs*/ ) { return false; }
+};
+
+//-----------------------------------------------------------------------------
+// Keeps the notes sent under a voice limit, globally and per channel. A voice
+// is a note-on sent and not yet turned off; the sustain pedal isn't modeled.
+// Once past the pressure point, quiet notes and notes shorter than the short
+// time (counting only those whose note-off is in the same batch) are the
+// first to go. A note-on that can't get a voice but whose key is already
+// sounding is merged into it: the voice lasts till the last of the two ends.
+// Note-offs always go out unless their note-on didn't.
+// Deterministic: the same messages in the same batches give the same output.
+//-----------------------------------------------------------------------------
+
+class MIDIVoiceGovernor
+{
+public:
+    struct Stats
+    {
+        long long llNotes, llDropped, llMerged; // Note-ons sent, dropped and merged
+        int iVoices, iPeakVoices;
+    };
+
+    MIDIVoiceGovernor( int iMaxVoices = 0, int iMaxChannelVoices = 0 );
+
+    // 0 for no limit
+    void SetLimits( int iMaxVoices, int iMaxChannelVoices ) { m_iMaxVoices = iMaxVoices; m_iMaxChannelVoices = iMaxChannelVoices; }
+    // Pressure is a percentage of the limits
+    void SetPriority( int iQuietVelocity, long long llShortMicroSecs, int iPressurePct );
+    void Reset(); // Forgets what's sounding. Stats are kept
+
+    // Drops and merges in place
+    void Filter( vector< MIDIShortMsg > &vMsgs );
+    const Stats &GetStats() const { return m_Stats; }
+
+private:
+    struct Key
+    {
+        int iSounding, iMerged, iDropped; // Note-offs to come, by what happened to their note-on
+    };
+
+    void FindShortNotes( const vector< MIDIShortMsg > &vMsgs );
+    void ChannelOff( int iChannel );
+
+    int m_iMaxVoices, m_iMaxChannelVoices;
+    int m_iQuietVelocity, m_iPressurePct;
+    long long m_llShortMicroSecs;
+
+    Key m_aKeys[16][128];
+    int m_aChannelVoices[16];
+
+    // Scratch for FindShortNotes, kept for its memory
+    vector< char > m_vShort; // By message
+    vector< int > m_vNextOn; // Pending note-ons on a key, oldest first
+    int m_aFirstOn[16 * 128], m_aLastOn[16 * 128];
+
+    Stats m_Stats;
+};
+
+//-----------------------------------------------------------------------------
+// Queues messages and hands them to the backend when flushed. They go out in
+// the order they were queued, which should be time order.
+//-----------------------------------------------------------------------------
+
+class MIDIOutStream
+{
+public:
+    struct Stats
+    {
+        long long llMsgs, llBytes, llFlushes;
+        long long llStatusSaved; // Status bytes left out thanks to running status
+    };
+
+    MIDIOutStream( MIDIOutBackend *pBackend = NULL );
+
+    // Drops anything queued for the old one
+    void SetBackend( MIDIOutBackend *pBackend );
+    MIDIOutBackend *GetBackend() const { return m_pBackend; }
+    void SetGovernor( MIDIVoiceGovernor *pGovernor ) { m_pGovernor = pGovernor; } // Filters each flush. NULL for none
+    bool SetScheduled( bool bScheduled );
+    bool IsScheduled() const { return m_bScheduled; }
+
+    void Queue( long long llTime, unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 = 0 );
+    void Queue( const MIDIShortMsg *pMsgs, int iMsgs );
+    void QueueAcrossChannels( long long llTime, unsigned char cStatus, unsigned char cParam1, unsigned char cParam2 );
+    void QueueAcrossChannels( long long llTime, unsigned char cStatus, unsigned char cParam1, unsigned char cParam2, const vector< int > &vChannels );
+    void QueueAllNotesOff( long long llTime );
+    void QueueAllNotesOff( long long llTime, const vector< int > &vChannels );
+
+    // Sends everything queued in one go. False if there's no backend or it failed. Either way the queue's emptied
+    bool Flush();
+    void Clear() { m_vQueue.clear(); }
+    int GetQueued() const { return static_cast< int >( m_vQueue.size() ); }
+    const Stats &GetStats() const { return m_Stats; }
+
+    static int WriteVarLen( unsigned int iValue, unsigned char *pcOut );
+
+private:
+    void Encode();
+
+    MIDIOutBackend *m_pBackend;
+    MIDIVoiceGovernor *m_pGovernor;
+    bool m_bScheduled;
+    vector< MIDIShortMsg > m_vQueue;
+    vector< unsigned char > m_vBytes;
+
+    // The backend's byte stream is one long track, so these carry across flushes
+    int m_iRunningStatus; // -1 for none
+    long long m_llLastTime;
+    bool m_bHaveLastTime;
+
+    Stats m_Stats;
+};
+
+//-----------------------------------------------------------------------------
+// Backends for when there's no device. Null drops everything, File captures
+// it to a standard MIDI file, with a microsecond a tick.
+//-----------------------------------------------------------------------------
+
+class MIDINullOut : public MIDIOutBackend
+{
+public:
+    MIDINullOut( int iCaps = RunningStatus ) : m_iCaps( iCaps ), m_llMsgs( 0 ), m_llBytes( 0 ), m_iSum( 0 ) { }
+
+    int GetCaps() const { return m_iCaps; }
+    bool SetScheduled( bool /*bScheduled*/ ) { return true; }
+    bool Send( const MIDIShortMsg *pMsgs, int iMsgs );
+    bool Send( const unsigned char *pcData, int iSize, int iMsgs );
+
+    long long GetMsgs() const { return m_llMsgs; }
+    long long GetBytes() const { return m_llBytes; }
+    unsigned GetSum() const { return m_iSum; } // Touches the data like a real backend would
+
+private:
+    int m_iCaps;
+    long long m_llMsgs, m_llBytes;
+    unsigned m_iSum;
+};
+
+class MIDIFileOut : public MIDIOutBackend
+{
+public:
+    static const int Division = 10000; // Ticks a quarter note. With the tempo below, a tick is a microsecond
+    static const int Tempo = 10000; // Microseconds a quarter note
+
+    MIDIFileOut() : m_llTrackStart( 0 ) { }
+    ~MIDIFileOut() { Close(); }
+
+    bool Open( const string &sFile );
+    bool Close(); // Finishes the track. False if the file couldn't be written
+    bool IsOpen() const { return m_File.is_open(); }
+
+    int GetCaps() const { return RunningStatus; }
+    bool SetScheduled( bool /*bScheduled*/ ) { return true; } // Times are always kept
+    bool Send( const unsigned char *pcData, int iSize, int iMsgs );
+
+private:
+    ofstream m_File;
+    long long m_llTrackStart;
+};
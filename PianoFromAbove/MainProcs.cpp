@@ -11,8 +11,6 @@
 #include <shlobj.h>
 #include <Dbt.h>
 
-#include <set>
-
 #include "MainProcs.h"
 #include "ConfigProcs.h"
 #include "Globals.h"
@@ -20,9 +18,18 @@
 
 #include "GameState.h"
 #include "Config.h"
+#include "Loader.h"
+#include "LibraryModel.h"
 
 static WNDPROC g_pPrevBarProc; // Have to override the toolbar proc to make controls transparent
 
+// Songs are loaded in the background. Remember what PlayFile asked for until the load is done
+static AsyncLoader< MainScreen > g_Loader;
+static struct { wstring sFile, sPrevTitle; int ePlayMode; bool bCustomSettings, bLibraryEligible; } g_PendingPlay;
+static const long long StreamFileSize = 32LL << 20; // Songs at least this big start playing while they load
+
+static LibraryModel g_LibModel; // What the library list is showing
+
 //-----------------------------------------------------------------------------
 // Name: MsgProc()
 // Desc: The window's message handler
@@ -48,6 +55,12 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                     HWND hWndLib = GetDlgItem( g_hWndLibDlg, IDC_LIBRARYFILES );
                     if ( GetFocus() == hWndLib )
                         PlayLibrary( hWndLib, (int)SendMessage( hWndLib, LVM_GETNEXTITEM, -1, LVNI_SELECTED ), GameState::Practice );
+                    // Enter in the search box plays the selected song, or else the top hit
+                    else if ( GetFocus() == GetDlgItem( g_hWndLibDlg, IDC_LIBSEARCH ) )
+                    {
+                        int iItem = (int)SendMessage( hWndLib, LVM_GETNEXTITEM, -1, LVNI_SELECTED );
+                        PlayLibrary( hWndLib, iItem >= 0 ? iItem : 0, GameState::Practice );
+                    }
                     return 0;
                 }
                 case ID_FILE_LEARNSONG: case ID_FILE_PRACTICESONG: case ID_FILE_PRACTICESONGCUSTOM: case ID_FILE_PLAYSONG:
@@ -76,6 +89,7 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                     cPlayback.SetPlayMode( GameState::Intro, true );
                     cPlayback.SetPlayable( SendMessage( hWndLib, LVM_GETNEXTITEM, -1, LVNI_SELECTED ) >= 0, true );
                     cPlayback.SetPosition( 0 );
+                    CancelPlayFile();
                     SetWindowText( g_hWnd, TEXT( APPNAME ) );
                     HandOffMsg( WM_COMMAND, ID_CHANGESTATE, ( LPARAM )new IntroScreen( NULL, NULL ) );
                     return 0;
@@ -155,7 +169,7 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                     for ( map< wstring, SongLibrary::Source >::const_iterator it = mSources.begin(); it != mSources.end(); ++it )
                         cLibrary.RemoveSource( it->first );
                     for ( map< wstring, SongLibrary::Source >::const_iterator it = mSources.begin(); it != mSources.end(); ++it )
-                        cLibrary.AddSource( it->first, it->second );
+                        cLibrary.AddSource( it->first, it->second, true, true ); // Catches songs written over in place
                     PopulateLibrary( GetDlgItem( g_hWndLibDlg, IDC_LIBRARYFILES ) );
                     return 0;
                 }
@@ -165,7 +179,10 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                 case ID_PLAY_DEFAULT:
                 case ID_PLAY_PLAY:
                     if ( cPlayback.GetPlayMode() && iId == ID_PLAY_PLAY )
+                    {
                         cPlayback.SetPaused( false, true );
+                        HandOffMsg( WM_NULL, 0, 0 ); // Wakes the game thread if it's idling
+                    }
                     else
                     {
                         HWND hWndLib = GetDlgItem( g_hWndLibDlg, IDC_LIBRARYFILES );
@@ -180,7 +197,11 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                     cPlayback.SetPaused( true, true );
                     return 0;
                 case ID_PLAY_PLAYPAUSE:
-                    if ( cPlayback.GetPlayMode() ) cPlayback.TogglePaused( true );
+                    if ( cPlayback.GetPlayMode() )
+                    {
+                        cPlayback.TogglePaused( true );
+                        HandOffMsg( WM_NULL, 0, 0 );
+                    }
                     return 0;
                 case ID_PLAY_STOP:
                     if ( cPlayback.GetPlayMode() ) HandOffMsg( msg, wParam, lParam );
@@ -278,9 +299,22 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                 case ID_GAMEERROR:
                     MessageBoxW( hWnd, GameState::Errors[lParam].c_str(), L"Error", MB_OK | MB_ICONEXCLAMATION );
                     return 0;
+                case ID_LOADCOMPLETE:
+                    FinishPlayFile( static_cast< UINT >( lParam ) );
+                    return 0;
+                case ID_STATSREADY:
+                    cLibrary.ApplyStats();
+                    return 0;
             }
             break;
         }
+        case WM_TIMER:
+            if ( wParam == IDC_LOADTIMER )
+            {
+                ShowLoadProgress();
+                return 0;
+            }
+            break;
         case WM_ACTIVATE:
             if ( LOWORD( wParam ) != WA_INACTIVE )
                 SetFocus( g_hWndGfx );
@@ -332,6 +366,7 @@ LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
             HandOffMsg( WM_DEVICECHANGE, 0, 0 );
             break;
         case WM_DESTROY:
+            CancelPlayFile();
             PostQuitMessage( 0 );
             return 0;
     }
@@ -857,6 +892,7 @@ LRESULT WINAPI PosnProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
     static HBITMAP hBackbuffer = NULL;
     static HBITMAP hBackground = NULL;
     static int iLoopStart = -1, iLoopEnd = -1;
+    static vector< unsigned char > vOverview; // Note density from 0 to 15, spread evenly along the channel
 
     switch( msg )
     {
@@ -890,6 +926,11 @@ LRESULT WINAPI PosnProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                 SendMessage( g_hWndBar, RB_GETRECT, 1, ( LPARAM )&rc );
                 RedrawWindow( g_hWndBar, &rc, NULL, RDW_ERASE | RDW_INVALIDATE | RDW_ALLCHILDREN );
             }
+            else if ( iId == ID_POSNOVERVIEW )
+            {
+                vOverview = *reinterpret_cast< const vector< unsigned char >* >( lParam );
+                InvalidateRect( hWnd, NULL, FALSE );
+            }
             return 0;
         }
         case WM_ENABLE:
@@ -953,6 +994,20 @@ LRESULT WINAPI PosnProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                 SetDCBrushColor( hDCMem, RGB( 255, 255, 255 ) );
                 HBRUSH hBrush = ( HBRUSH )GetStockObject( DC_BRUSH );
                 FillRect( hDCMem, &rcChannel, hBrush );
+
+                // Overview, darker where the song's busier. One rect per run of the same shade
+                int iWidth = rcChannel.right - rcChannel.left;
+                for ( int x = 0, iRun; x < iWidth && !vOverview.empty(); x = iRun )
+                {
+                    int iLevel = vOverview[ x * vOverview.size() / iWidth ];
+                    for ( iRun = x + 1; iRun < iWidth && vOverview[ iRun * vOverview.size() / iWidth ] == iLevel; iRun++ );
+                    if ( iLevel == 0 ) continue;
+
+                    SetDCBrushColor( hDCMem, RGB( 255 - 9 * iLevel, 255 - 8 * iLevel, 255 - 3 * iLevel ) );
+                    RECT rcRun = { rcChannel.left + x, rcChannel.top, rcChannel.left + iRun, rcChannel.bottom };
+                    FillRect( hDCMem, &rcRun, hBrush );
+                }
+
                 if ( iLoopStart >= 0 && ( iLoopEnd >= 0 || iPosition >= iLoopStart ) )
                 {
                     SetDCBrushColor( hDCMem, RGB( 63, 72, 204 ) );
@@ -1098,7 +1153,7 @@ INT_PTR WINAPI LibDlgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
 
     // Lots of ugly static vars to handle the splitter functionality :/
     static bool bInPanelResize = false;
-    static int iCurWidth, iCurHeight, iBarHeight, iParentWidth, iSplitOffset, iMinWidth, iLibXOffset, iLibYOffset; 
+    static int iCurWidth, iCurHeight, iBarHeight, iParentWidth, iSplitOffset, iMinWidth, iLibXOffset, iLibYOffset, iSearchHeight; 
     const static int iMaxOffset = 6;
     const static HCURSOR hCursorWE = LoadCursor( NULL, IDC_SIZEWE );
 
@@ -1149,10 +1204,26 @@ INT_PTR WINAPI LibDlgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                 SendMessage( hWndLibrary, LVM_INSERTCOLUMN, i, ( LPARAM )&lvc );
             }
 
+            // Search box goes across the top
+            RECT rcSearch;
+            HWND hWndSearch = GetDlgItem( hWnd, IDC_LIBSEARCH );
+            GetWindowRect( hWndSearch, &rcSearch );
+            iSearchHeight = rcSearch.bottom - rcSearch.top;
+            SendMessage( hWndSearch, EM_SETCUEBANNER, TRUE, ( LPARAM )L"Search" );
+
             PopulateLibrary( hWndLibrary );
             return TRUE;
         }
         // Library functionality stuff
+        case WM_COMMAND:
+            if ( LOWORD( wParam ) == IDC_LIBSEARCH && HIWORD( wParam ) == EN_CHANGE )
+            {
+                TCHAR buf[1024];
+                GetDlgItemText( hWnd, IDC_LIBSEARCH, buf, sizeof( buf ) / sizeof( TCHAR ) );
+                SearchLibrary( GetDlgItem( hWnd, IDC_LIBRARYFILES ), buf );
+                return 0;
+            }
+            break;
         case WM_NOTIFY:
         {
             LPNMHDR lpnmhdr = ( LPNMHDR )lParam;
@@ -1173,6 +1244,28 @@ INT_PTR WINAPI LibDlgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
                         }
                         return 0;
                     }
+                    case LVN_GETDISPINFO:
+                    {
+                        NMLVDISPINFO *pdi = ( NMLVDISPINFO* )lParam;
+                        if ( pdi->item.mask & LVIF_TEXT )
+                        {
+                            char buf[1024];
+                            g_LibModel.GetCellText( pdi->item.iItem, pdi->item.iSubItem + 1, buf, sizeof( buf ) );
+                            _tcsncpy_s( pdi->item.pszText, pdi->item.cchTextMax, Util::StringToWstring( buf ), _TRUNCATE );
+                        }
+                        return 0;
+                    }
+                    case LVN_ODFINDITEM:
+                    {
+                        // Typing in the list jumps to the next file name starting with what was typed
+                        NMLVFINDITEM *pfi = ( NMLVFINDITEM* )lParam;
+                        int iRow = -1;
+                        if ( pfi->lvfi.flags & ( LVFI_STRING | LVFI_PARTIAL ) )
+                            iRow = g_LibModel.FindRowByPrefix( Util::WstringToString( pfi->lvfi.psz ), pfi->iStart,
+                                                               ( pfi->lvfi.flags & LVFI_WRAP ) != 0 );
+                        SetWindowLongPtr( hWnd, DWLP_MSGRESULT, iRow );
+                        return TRUE;
+                    }
                     case LVN_ITEMACTIVATE:
                     {
                         LPNMLISTVIEW pnmv = ( LPNMLISTVIEW )lParam;
@@ -1260,6 +1353,8 @@ INT_PTR WINAPI LibDlgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam )
             SetWindowPos(hWndLibrary, HWND_TOP, iLibXOffset, iLibYOffset,
                          iCurWidth - 2 * iLibXOffset, iCurHeight - iLibYOffset - iLibXOffset,
                          SWP_NOACTIVATE | SWP_NOZORDER | SWP_NOOWNERZORDER );
+            SetWindowPos( GetDlgItem( g_hWndLibDlg, IDC_LIBSEARCH ), HWND_TOP, 0, 0, iCurWidth - 2 * iLibXOffset, iSearchHeight,
+                          SWP_NOMOVE | SWP_NOACTIVATE | SWP_NOZORDER | SWP_NOOWNERZORDER );
             return 0;
         }
         case WM_LBUTTONDBLCLK:
@@ -1345,64 +1440,60 @@ VOID PopulateLibrary( HWND hWndLibrary )
     Config &config = Config::GetConfig();
     SongLibrary &cLibrary = config.GetSongLibrary();
     const map< wstring, vector< PFAData::File* >* > &mFiles = cLibrary.GetFiles();
-    set< wstring > sFiles;
 
-    SendMessage( hWndLibrary, WM_SETREDRAW, FALSE, 0 );
-    SendMessage( hWndLibrary, LVM_DELETEALLITEMS, 0, 0 );
-
-    TCHAR buf[1024];
-    LVITEM lvi = { 0 };
-    lvi.pszText = buf;
-    lvi.iItem = 0;
+    // The same file can come in through more than one source. Only show it once
+    const PFAData::File *pSelected = GetLibrarySelection( hWndLibrary );
+    HashIndex< const PFAData::File* > hiShown;
+    g_LibModel.Clear();
     for ( map< wstring, vector< PFAData::File* >* >::const_iterator itSource = mFiles.begin(); itSource != mFiles.end(); ++itSource )
     {
         const vector< PFAData::File* > *pvFiles = itSource->second;
         for ( vector< PFAData::File* >::const_iterator itFile = pvFiles->begin(); itFile != pvFiles->end(); ++itFile )
         {
-            const wstring sFilename = Util::StringToWstring( ( *itFile )->filename() );
-            if ( sFiles.find( sFilename ) == sFiles.end() )
-            {
-                const PFAData::SongInfo &dSongInfo = cLibrary.GetInfo( ( *itFile )->infopos() )->info();
-                int iFileStart = (int)sFilename.find_last_of( L'\\' );
-                int iFolderStart = (int)sFilename.find_last_of( L'\\', iFileStart - 1 );
-
-                lvi.iSubItem = 0;
-                lvi.mask = LVIF_TEXT | LVIF_PARAM;
-                lvi.lParam = ( LPARAM )*itFile;
-                _tcscpy_s( buf, sFilename.c_str() + iFileStart + 1 );
-                lvi.iItem = (int)SendMessage( hWndLibrary, LVM_INSERTITEM, 0, ( LPARAM )&lvi );
-
-                lvi.iSubItem++;
-                lvi.mask = LVIF_TEXT;
-                if ( iFileStart - 1 > iFolderStart )
-                {
-                    _tcsncpy_s( buf, sFilename.c_str() + iFolderStart + 1, iFileStart - iFolderStart - 1 );
-                    SendMessage( hWndLibrary, LVM_SETITEM, 0, ( LPARAM )&lvi );
-                }
+            const string &sFilename = ( *itFile )->filename();
+            unsigned iHash = HashIndex< const PFAData::File* >::Hash( sFilename.data(), sFilename.length() );
+            auto fnEq = [&]( const PFAData::File *file ) { return file->filename() == sFilename; };
+            if ( hiShown.Find( iHash, fnEq ) ) continue;
+            hiShown.Set( iHash, fnEq, *itFile );
+
+            const PFAData::SongInfo &dSongInfo = cLibrary.GetInfo( ( *itFile )->infopos() )->info();
+            g_LibModel.Add( sFilename, dSongInfo.seconds(), dSongInfo.tracks(), dSongInfo.notes(), *itFile );
+        }
+    }
+    g_LibModel.Build();
 
-                lvi.iSubItem++;
-                _stprintf_s( buf, TEXT( "%d:%02d" ), dSongInfo.seconds() / 60, dSongInfo.seconds() % 60 );
-                SendMessage( hWndLibrary, LVM_SETITEM, 0, ( LPARAM )&lvi );
+    FillLibrary( hWndLibrary, pSelected );
+    SortLibrary( hWndLibrary, cLibrary.GetSortCol() );
 
-                lvi.iSubItem++;
-                _stprintf_s( buf, TEXT( "%d" ), dSongInfo.tracks() );
-                SendMessage( hWndLibrary, LVM_SETITEM, 0, ( LPARAM )&lvi );
+    // Anything new or not yet looked at gets its difficulty worked out in the background
+    cLibrary.StartAnalysis( []() { PostMessage( g_hWnd, WM_COMMAND, ID_STATSREADY, 0 ); } );
+}
 
-                lvi.iSubItem++;
-                _stprintf_s( buf, TEXT( "%.1f" ), static_cast< float >( dSongInfo.notes() ) / dSongInfo.seconds() );
-                SendMessage( hWndLibrary, LVM_SETITEM, 0, ( LPARAM )&lvi );
+// The list view is owner data: it only gets the row count and asks for the text of the rows
+// it shows with LVN_GETDISPINFO. The selected song stays selected if it's still showing
+VOID FillLibrary( HWND hWndLibrary, const PFAData::File *pSelected )
+{
+    LVITEM lvi = { 0 };
+    lvi.stateMask = LVIS_SELECTED | LVIS_FOCUSED;
+    SendMessage( hWndLibrary, LVM_SETITEMSTATE, -1, ( LPARAM )&lvi );
+    SendMessage( hWndLibrary, LVM_SETITEMCOUNT, g_LibModel.GetRowCount(), 0 );
 
-                lvi.iItem++;
-                sFiles.insert( sFilename );
-            }
-        }
+    int iSelected = ( pSelected ? g_LibModel.FindRow( pSelected ) : -1 );
+    if ( iSelected >= 0 )
+    {
+        lvi.state = LVIS_SELECTED | LVIS_FOCUSED;
+        SendMessage( hWndLibrary, LVM_SETITEMSTATE, iSelected, ( LPARAM )&lvi );
+        SendMessage( hWndLibrary, LVM_ENSUREVISIBLE, iSelected, 0 );
     }
-
-    SortLibrary( hWndLibrary, cLibrary.GetSortCol() );
-    SendMessage( hWndLibrary, WM_SETREDRAW, TRUE, 0 );
     InvalidateRect( hWndLibrary, NULL, FALSE );
 }
 
+const PFAData::File *GetLibrarySelection( HWND hWndLibrary )
+{
+    int iItem = (int)SendMessage( hWndLibrary, LVM_GETNEXTITEM, -1, LVNI_SELECTED );
+    return ( iItem >= 0 && iItem < g_LibModel.GetRowCount() ? g_LibModel.GetRow( iItem ).pFile : NULL );
+}
+
 VOID SortLibrary( HWND hWndLibrary, INT iSortCol )
 {
     static SongLibrary &cLibrary = Config::GetConfig().GetSongLibrary();
@@ -1419,113 +1510,26 @@ VOID SortLibrary( HWND hWndLibrary, INT iSortCol )
     hdi.fmt |= ( iSortCol < 0 ? HDF_SORTDOWN : HDF_SORTUP );
     SendMessage( hWndHeader, HDM_SETITEM, abs( iSortCol ) - 1, ( LPARAM )&hdi );
 
-    SendMessage( hWndLibrary, LVM_SORTITEMS, iSortCol, ( LPARAM )CompareLibrary );
-    int iItem = (int)SendMessage( hWndLibrary, LVM_GETNEXTITEM, -1, LVNI_SELECTED );
-    if ( iItem >= 0 ) SendMessage( hWndLibrary, LVM_ENSUREVISIBLE, iItem, 0 );
+    // Each column's order is worked out once. After that this is just picking the rows back out
+    const PFAData::File *pSelected = GetLibrarySelection( hWndLibrary );
+    g_LibModel.Sort( iSortCol );
+    FillLibrary( hWndLibrary, pSelected );
 
     cLibrary.SetSortCol( iSortCol );
 }
 
-INT CALLBACK CompareLibrary( LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort )
-{
-    static Config &config = Config::GetConfig();
-    static SongLibrary &cLibrary = config.GetSongLibrary();
-
-    const PFAData::File *dFile1 = reinterpret_cast< PFAData::File * >( lParam1 );
-    const PFAData::File *dFile2 = reinterpret_cast< PFAData::File * >( lParam2 );
-    const PFAData::SongInfo &dSongInfo1 = cLibrary.GetInfo( dFile1->infopos() )->info();
-    const PFAData::SongInfo &dSongInfo2 = cLibrary.GetInfo( dFile2->infopos() )->info();
-    const string &sFile1 = dFile1->filename();
-    const string &sFile2 = dFile2->filename();
-    int iFileStart1 = (int)sFile1.find_last_of( L'\\' );
-    int iFileStart2 = (int)sFile2.find_last_of( L'\\' );
-    int iFolderStart1 = (int)sFile1.find_last_of( L'\\', iFileStart1 - 1 );
-    int iFolderStart2 = (int)sFile2.find_last_of( L'\\', iFileStart2 - 1 );
-
-    int iMult = ( lParamSort < 0 ? -1 : 1 );
-    int iCompare = 0;
-    switch ( abs( lParamSort ) )
-    {
-        case 1:
-            iCompare = _stricmp( sFile1.c_str() + iFileStart1 + 1, sFile2.c_str() + iFileStart2 + 1 );
-            break;
-        case 2:
-            break;
-        case 3:
-            iCompare = ( dSongInfo1.seconds() < dSongInfo2.seconds() ? -1 :
-                         dSongInfo1.seconds() > dSongInfo2.seconds() ? 1 : 0 );
-            break;
-        case 4:
-            iCompare = ( dSongInfo1.tracks() < dSongInfo2.tracks() ? -1 :
-                         dSongInfo1.tracks() > dSongInfo2.tracks() ? 1 : 0 );
-            break;
-        case 5:
-            if ( dSongInfo1.seconds() == 0 ) iCompare = 1;
-            else if ( dSongInfo2.seconds() == 0 ) iCompare = -1;
-            else iCompare = ( static_cast< float >( dSongInfo1.notes() ) / dSongInfo1.seconds() < static_cast< float >( dSongInfo2.notes() ) / dSongInfo2.seconds() ? -1 :
-                              static_cast< float >( dSongInfo1.notes() ) / dSongInfo1.seconds() > static_cast< float >( dSongInfo2.notes() ) / dSongInfo2.seconds() ? 1 : 0 );
-            break;
-    }
-
-    if ( !iCompare )
-    {
-        if ( iFileStart1 - iFolderStart1 <= 1 ) iCompare = 1;
-        else if ( iFileStart2 - iFolderStart2 <= 1 ) iCompare = -1;
-        else iCompare = _strnicmp( sFile1.c_str() + iFolderStart1 + 1, sFile2.c_str() + iFolderStart2 + 1,
-                                   min( iFileStart1 - iFolderStart1 - 1, iFileStart2 - iFolderStart2 - 1 ) );
-        if ( !iCompare ) iCompare = ( iFileStart1 - iFolderStart1 == iFileStart2 - iFolderStart2 ? 0 :
-                                      iFileStart1 - iFolderStart1 < iFileStart2 - iFolderStart2 ? -1 : 1 );
-    }
-
-    if ( !iCompare && abs( lParamSort ) != 1 )
-        iCompare = _stricmp( sFile1.c_str() + iFileStart1 + 1, sFile2.c_str() + iFileStart2 + 1 );
-
-    return ( lParamSort < 0 ? -iCompare : iCompare );
-}
-
-VOID AddSingleLibraryFile( HWND hWndLibrary, const wstring &sFile )
+VOID SearchLibrary( HWND hWndLibrary, const wstring &sQuery )
 {
-    // Get a copy of the config to overwrite the settings
-    Config &config = Config::GetConfig();
-    const SongLibrary &cLibrary = config.GetSongLibrary();
-    const map< wstring, vector< PFAData::File* >* > &mFiles = cLibrary.GetFiles();
-    if ( mFiles.find( sFile ) == mFiles.end() ) return;
-
-    // Set up insertion item
-    const PFAData::File *pInfo = mFiles.at( sFile )->at( 0 );
-    LVITEM lvi = { 0 };
-    lvi.mask = LVIF_TEXT | LVIF_PARAM;
-    lvi.iItem = 0;
-    lvi.iSubItem = 0;
-    lvi.lParam = ( LPARAM )pInfo;
-    lvi.pszText = ( LPTSTR )( sFile.c_str() + sFile.find_last_of( L'\\' ) + 1 );
-
-    // Make sure it's not already there
-    int iStartPos = -1;
-    LVFINDINFO lvfi = { LVFI_STRING, lvi.pszText };
-    LVITEM lvif = { 0 };
-    while ( ( iStartPos = (int)SendMessage( hWndLibrary, LVM_FINDITEM, iStartPos, ( LPARAM )&lvfi ) ) >= 0 )
-    {
-        lvif.mask = LVIF_PARAM;
-        lvif.iItem = iStartPos;
-        SendMessage( hWndLibrary, LVM_GETITEM, 0, ( LPARAM )&lvif );
-        if ( pInfo->filename() == ( ( PFAData::File* )lvif.lParam )->filename() ) return;
-    }
-
-    // Insert!
-    SendMessage( hWndLibrary, LVM_INSERTITEM, 0, ( LPARAM )&lvi );
+    const PFAData::File *pSelected = GetLibrarySelection( hWndLibrary );
+    g_LibModel.Filter( Util::WstringToString( sQuery ) );
+    FillLibrary( hWndLibrary, pSelected );
 }
 
 BOOL PlayLibrary( HWND hWndLibrary, int iItem, INT ePlayMode, bool bCustomSettings )
 {
-    if ( iItem < 0 ) return FALSE;
-
-    LVITEM lvi = { 0 };
-    lvi.mask = LVIF_PARAM;
-    lvi.iItem = iItem;
-    SendMessage( hWndLibrary, LVM_GETITEM, 0, ( LPARAM )&lvi );
+    if ( iItem < 0 || iItem >= g_LibModel.GetRowCount() ) return FALSE;
 
-    PFAData::File* pmInfo = ( PFAData::File* )lvi.lParam;
+    const PFAData::File* pmInfo = g_LibModel.GetRow( iItem ).pFile;
     BOOL bSuccess = PlayFile( Util::StringToWstring( pmInfo->filename() ), ePlayMode, bCustomSettings );
 
     if ( bSuccess ) SetFocus( g_hWndGfx );
@@ -1715,6 +1719,13 @@ VOID SetPosition( INT iPosition )
     PostMessage( hWndPosn, TBM_SETPOS, 0, iPosition );
 }
 
+// Sent rather than posted: the position bar copies the overview before this returns
+VOID SetPosnOverview( const vector< unsigned char > &vOverview )
+{
+    HWND hWndPosn = GetDlgItem( g_hWndBar, IDC_POSNCTRL );
+    SendMessage( hWndPosn, WM_COMMAND, ID_POSNOVERVIEW, ( LPARAM )&vOverview );
+}
+
 VOID SetLoop( BOOL bClear )
 {
     HWND hWndPosn = GetDlgItem( g_hWndBar, IDC_POSNCTRL );
@@ -1790,14 +1801,10 @@ VOID SetPlayPauseStop( BOOL bPlay, BOOL bPause, BOOL bStop )
     SendMessage( hWndToolbar, TB_PRESSBUTTON, ID_PLAY_STOP, bStop );
 }
 
+// Kicks off loading the song. The rest happens in FinishPlayFile once the loader is done
 BOOL PlayFile( const wstring &sFile, int ePlayMode, bool bCustomSettings, bool bLibraryEligible )
 {
-    Config &config = Config::GetConfig();
-    const VisualSettings &cVisual = config.GetVisualSettings();
-    const AudioSettings &cAudio = config.GetAudioSettings();
-    PlaybackSettings &cPlayback = config.GetPlaybackSettings();
-    ViewSettings &cView = config.GetViewSettings();
-    SongLibrary &cLibrary = config.GetSongLibrary();
+    const AudioSettings &cAudio = Config::GetConfig().GetAudioSettings();
 
     if ( ePlayMode != GameState::Practice && cAudio.iInDevice < 0 )
     {
@@ -1805,20 +1812,99 @@ BOOL PlayFile( const wstring &sFile, int ePlayMode, bool bCustomSettings, bool b
         return FALSE;
     }
 
-    // Try loading the file
-    MainScreen *pGameState = NULL;
-    pGameState = new MainScreen( sFile, static_cast< GameState::State >( ePlayMode ), NULL, NULL );
+    // Start loading the file. Cancels whatever was loading before
+    if ( !g_Loader.IsLoading() )
+    {
+        TCHAR sTitle[1024];
+        GetWindowText( g_hWnd, sTitle, sizeof( sTitle ) / sizeof( TCHAR ) );
+        g_PendingPlay.sPrevTitle = sTitle;
+    }
+    g_PendingPlay.sFile = sFile;
+    g_PendingPlay.ePlayMode = ePlayMode;
+    g_PendingPlay.bCustomSettings = bCustomSettings;
+    g_PendingPlay.bLibraryEligible = bLibraryEligible;
+    GameState::State eGameMode = static_cast< GameState::State >( ePlayMode );
+
+    // Big songs get streamed in so playback can start right away. Only for plain practice, since
+    // custom settings and the play/learn modes need to see every channel up front
+    bool bStream = false;
+    WIN32_FILE_ATTRIBUTE_DATA fileData;
+    if ( ePlayMode == GameState::Practice && !bCustomSettings &&
+         GetFileAttributesEx( sFile.c_str(), GetFileExInfoStandard, &fileData ) )
+        bStream = ( ( static_cast< long long >( fileData.nFileSizeHigh ) << 32 ) | fileData.nFileSizeLow ) >= StreamFileSize;
+
+    g_Loader.Start( [sFile, eGameMode, bStream]( LoadProgress &progress )
+                    { return new MainScreen( sFile, eGameMode, NULL, NULL, &progress, bStream ); },
+                    []( unsigned iJob ) { PostMessage( g_hWnd, WM_COMMAND, ID_LOADCOMPLETE, iJob ); } );
+
+    SetTimer( g_hWnd, IDC_LOADTIMER, 100, NULL );
+    ShowLoadProgress();
+    return TRUE;
+}
+
+// The song's thumbnail squashed down to a column per position bar slot, each as dark as the busiest key range
+// in it. Empty if the library hasn't made one. Streamed songs have no MD5, so they never do
+static vector< unsigned char > GetPosnOverview( const MainScreen *pGameState )
+{
+    static const SongLibrary &cLibrary = Config::GetConfig().GetSongLibrary();
+    static const int Slots = 250;
+    typedef MIDI::MIDIThumbnail Thumb;
+
+    vector< unsigned char > vOverview;
+    Thumb mThumb;
+    const MIDI::MIDIInfo &mInfo = pGameState->GetMIDI().GetInfo();
+    if ( !cLibrary.GetThumbnails().Find( mInfo.sMd5, mThumb ) || mInfo.llTotalMicroSecs <= 0 ) return vOverview;
+
+    long long llFirstTime = pGameState->GetMinTime(), llLastTime = pGameState->GetMaxTime();
+    vOverview.resize( Slots );
+    for ( int i = 0; i < Slots; i++ )
+    {
+        long long llTime = llFirstTime + ( ( 2 * i + 1 ) * ( llLastTime - llFirstTime ) ) / ( 2 * Slots );
+        if ( llTime < 0 || llTime >= mInfo.llTotalMicroSecs ) continue;
+        int iX = static_cast< int >( llTime * Thumb::Width / mInfo.llTotalMicroSecs );
+        for ( int iY = 0; iY < Thumb::Height; iY++ )
+            vOverview[i] = max( vOverview[i], static_cast< unsigned char >( mThumb.Get( iX, iY ) ) );
+    }
+    return vOverview;
+}
+
+// Called on the UI thread when a load finishes. Stale loads (user picked another song) are ignored
+VOID FinishPlayFile( UINT iJob )
+{
+    Config &config = Config::GetConfig();
+    const VisualSettings &cVisual = config.GetVisualSettings();
+    PlaybackSettings &cPlayback = config.GetPlaybackSettings();
+    ViewSettings &cView = config.GetViewSettings();
+    SongLibrary &cLibrary = config.GetSongLibrary();
+
+    MainScreen *pGameState = g_Loader.Take( iJob );
+    if ( !pGameState ) return;
+    KillTimer( g_hWnd, IDC_LOADTIMER );
+
+    // Where the load time went, for the stats panel
+    const LoadProgress &progress = g_Loader.GetProgress();
+    pGameState->SetLoadTime( progress.GetPhaseMicroSecs( LoadProgress::Reading ) + progress.GetPhaseMicroSecs( LoadProgress::Parsing ) +
+                             progress.GetPhaseMicroSecs( LoadProgress::Merging ) );
+
+    const wstring &sFile = g_PendingPlay.sFile;
+    int ePlayMode = g_PendingPlay.ePlayMode;
+    SetWindowText( g_hWnd, g_PendingPlay.sPrevTitle.c_str() );
     if ( !pGameState->IsValid() )
     {
         MessageBox( g_hWnd, ( L"Was not able to load " + sFile ).c_str(), TEXT( "Error" ), MB_OK | MB_ICONEXCLAMATION );
-        return FALSE;
+        delete pGameState;
+        return;
     }
+    pGameState->InitLibrary();
 
     // Set up track settings
-    if ( bCustomSettings )
+    if ( g_PendingPlay.bCustomSettings )
     {
         if ( !GetCustomSettings( pGameState ) )
-            return FALSE;
+        {
+            delete pGameState;
+            return;
+        }
     }
     else
     {
@@ -1836,18 +1922,39 @@ BOOL PlayFile( const wstring &sFile, int ePlayMode, bool bCustomSettings, bool b
     cPlayback.SetPaused( ePlayMode != GameState::Practice, true );
     cPlayback.SetPosition( 0 );
     cPlayback.SetLoop( true );
+    SetPosnOverview( GetPosnOverview( pGameState ) );
     cView.SetZoomMove( false, true );
     if ( ePlayMode == GameState::Play ) cPlayback.SetSpeed( 1.0, true );
     SetWindowText( g_hWnd, sFile.c_str() + ( sFile.find_last_of( L'\\' ) + 1 ) );
 
-    // Add to the library
-    if ( bLibraryEligible && cLibrary.GetAlwaysAdd() )
+    // Add to the library. Streamed songs aren't fully parsed yet
+    if ( g_PendingPlay.bLibraryEligible && cLibrary.GetAlwaysAdd() && !pGameState->IsStreaming() )
         if ( cLibrary.AddSource( sFile, SongLibrary::File ) > 0 )
-            AddSingleLibraryFile( GetDlgItem( g_hWndLibDlg, IDC_LIBRARYFILES ), sFile );
+            PopulateLibrary( GetDlgItem( g_hWndLibDlg, IDC_LIBRARYFILES ) );
 
     // Switch game state
     HandOffMsg( WM_COMMAND, ID_CHANGESTATE, ( LPARAM )pGameState );
-    return TRUE;
+}
+
+VOID CancelPlayFile()
+{
+    if ( g_Loader.IsLoading() )
+        SetWindowText( g_hWnd, g_PendingPlay.sPrevTitle.c_str() );
+    g_Loader.Cancel();
+    KillTimer( g_hWnd, IDC_LOADTIMER );
+}
+
+// Loading status goes in the title bar
+VOID ShowLoadProgress()
+{
+    if ( !g_Loader.IsLoading() ) return;
+
+    const LoadProgress &progress = g_Loader.GetProgress();
+    const wstring &sFile = g_PendingPlay.sFile;
+    TCHAR sTitle[1024];
+    _stprintf_s( sTitle, TEXT( "Loading %s... %s %d%%" ), sFile.c_str() + ( sFile.find_last_of( L'\\' ) + 1 ),
+                 LoadProgress::PhaseName( progress.GetPhase() ), progress.GetPercent() );
+    SetWindowText( g_hWnd, sTitle );
 }
 
 VOID CheckActivity( BOOL bIsActive, POINT *ptNew, BOOL bToggleEnable )
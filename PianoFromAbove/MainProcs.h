@@ -12,8 +12,11 @@
 #include <Windows.h>
 #include <CommCtrl.h>
 #include <string>
+#include <vector>
 using namespace std;
 
+namespace PFAData { class File; }
+
 // Message handlers for the main windows
 LRESULT WINAPI WndProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam );
 HMENU GetMainMenu();
@@ -33,12 +36,14 @@ VOID GetChannelRect( HWND hWnd, RECT *rcChannel );
 VOID GetThumbRect( HWND hWnd, int iPosition, const RECT *rcChannel, RECT *rcThumb );
 INT GetThumbPosition( short iXPos, RECT *rcChannel );
 VOID MoveThumbPosition( int iPositionNew, int &iPosition, HWND hWnd, RECT *rcChannel, RECT *rcThumbOld, BOOL bUpdateGame = TRUE );
+VOID SetPosnOverview( const vector< unsigned char > &vOverview );
 
 INT_PTR WINAPI LibDlgProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam );
 VOID PopulateLibrary( HWND hWndLibrary );
+VOID FillLibrary( HWND hWndLibrary, const PFAData::File *pSelected );
+const PFAData::File *GetLibrarySelection( HWND hWndLibrary );
 VOID SortLibrary( HWND hWndLibrary, INT iSortCol );
-INT CALLBACK CompareLibrary( LPARAM lParam1, LPARAM lParam2, LPARAM lParamSort );
-VOID AddSingleLibraryFile( HWND hWndLibrary, const wstring &sFile );
+VOID SearchLibrary( HWND hWndLibrary, const wstring &sQuery );
 BOOL PlayLibrary( HWND hWndLibrary, int iItem, INT ePlayMode, bool bCustomSettings = false );
 
 INT_PTR WINAPI AboutProc( HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam );
@@ -63,4 +68,7 @@ VOID SetPlayMode( INT ePlayMode );
 VOID SetLearnMode( INT eLearnMode );
 VOID SetPlayPauseStop( BOOL bPlay, BOOL bPause, BOOL bStop );
 BOOL PlayFile( const wstring &sFile, int ePlayMode, bool bCustomSettings = false, bool bLibraryEligible = false );
+VOID FinishPlayFile( UINT iJob );
+VOID CancelPlayFile();
+VOID ShowLoadProgress();
 VOID CheckActivity( BOOL bIsActive, POINT *ptNew = NULL, BOOL bToggleEnable = false );
\ No newline at end of file
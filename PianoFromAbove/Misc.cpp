@@ -12,6 +12,10 @@
 #include <tchar.h>
 
 #include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <ctime>
 using namespace std;
 
 #include "Misc.h"
@@ -20,37 +24,22 @@ using namespace std;
 // The Timer class
 //-----------------------------------------------------------------------------
 
-Timer::Timer()
+// QPC's frequency is fixed at boot
+#ifdef _WIN32
+static long long GetCounterFreq()
 {
-    // Get the frequency. This should be done in a static constructor. Oh well.
     LARGE_INTEGER liFreq = { 0 };
-    m_bHighPrecision = false; //( QueryPerformanceFrequency( &liFreq ) != 0 );
-    if ( m_bHighPrecision )
-        m_llTicksPerSec = liFreq.QuadPart;
-    else
-    {
-        timeBeginPeriod( 1 );
-        m_llTicksPerSec = 1000;
-    }
-
-    // Sometimes QPF is absurdly high. Done to avoid overflows and resorting to doubles
-    if ( m_llTicksPerSec >= m_llPrecisionLimit )
-    {
-        m_llTicksPerSec /= m_llPrecisionThrottle;
-        m_bTooPrecise = true;
-    }
-    else
-        m_bTooPrecise = false;
-
-    // Initialize status
-    m_bStarted = m_bPaused = false;
-    m_llStartTicks = m_llPausedTicks = 0;
+    QueryPerformanceFrequency( &liFreq );
+    return max( liFreq.QuadPart, 1LL );
 }
+static const long long g_llCounterFreq = GetCounterFreq();
+#endif
 
-Timer::~Timer()
+Timer::Timer()
 {
-    if ( !m_bHighPrecision )
-        timeEndPeriod( 1 );
+    // Initialize status
+    m_bStarted = m_bPaused = false;
+    m_llStartNanoSecs = m_llPausedNanoSecs = 0;
 }
 
 // Start/reset the timer
@@ -58,7 +47,7 @@ void Timer::Start()
 {
     m_bStarted = true;
     m_bPaused = false;
-    m_llStartTicks = GetRawTicks();
+    m_llStartNanoSecs = GetNanoSecsNow();
 }
 
 // Pause
@@ -67,7 +56,7 @@ void Timer::Pause()
     if ( m_bStarted && !m_bPaused )
     {
         m_bPaused = true;
-        m_llPausedTicks = GetRawTicks() - m_llStartTicks;
+        m_llPausedNanoSecs = GetNanoSecsNow() - m_llStartNanoSecs;
     }
 }
 
@@ -77,53 +66,310 @@ void Timer::Unpause()
     if ( !m_bStarted )
         Start();
 
-    if ( !m_bPaused )
+    if ( m_bPaused )
     {
         m_bPaused = false;
-        m_llStartTicks = GetRawTicks() - m_llPausedTicks;
+        m_llStartNanoSecs = GetNanoSecsNow() - m_llPausedNanoSecs;
     }
 }
 
-// Elapsed ticks since start
-long long Timer::GetTicks()
+long long Timer::Lap()
+{
+    if ( !m_bStarted )
+    {
+        Start();
+        return 0;
+    }
+
+    long long llMicroSecs = GetNanoSecs() / 1000;
+    if ( m_bPaused )
+        m_llPausedNanoSecs -= llMicroSecs * 1000;
+    else
+        m_llStartNanoSecs += llMicroSecs * 1000;
+    return llMicroSecs;
+}
+
+// Elapsed nanoseconds since start. Good for 292 years
+long long Timer::GetNanoSecs()
 {
     if ( m_bStarted )
     {
         if ( m_bPaused )
-            return m_llPausedTicks;
+            return m_llPausedNanoSecs;
         else
-            return GetRawTicks() - m_llStartTicks;
+            return GetNanoSecsNow() - m_llStartNanoSecs;
     }
 
     return 0;
 }
 
-// Elapsed micro seconds since start
-// Assuming 3,000,000 ticks/sec this will overflow in 35 days
 long long Timer::GetMicroSecs()
 {
-    return ( GetTicks() * 1000000LL ) / m_llTicksPerSec;
+    return GetNanoSecs() / 1000;
 }
 
 double Timer::GetSecs()
 {
-    return static_cast< double >( GetTicks() ) / m_llTicksPerSec;
+    return GetNanoSecs() / 1000000000.0;
 }
 
-// Private. Hits the API for the tick count.
-long long Timer::GetRawTicks()
+// Whole seconds and the remainder are scaled separately so counts don't overflow. The remainder
+// only overflows for counters over 9 GHz, which get a double instead
+long long Timer::GetNanoSecsNow()
 {
-    if ( m_bHighPrecision )
+#ifdef _WIN32
+    LARGE_INTEGER liTicks;
+    QueryPerformanceCounter( &liTicks );
+    long long llSecs = liTicks.QuadPart / g_llCounterFreq;
+    long long llRest = liTicks.QuadPart % g_llCounterFreq;
+    if ( g_llCounterFreq <= LLONG_MAX / 1000000000LL )
+        return llSecs * 1000000000LL + llRest * 1000000000LL / g_llCounterFreq;
+    return llSecs * 1000000000LL + static_cast< long long >( static_cast< double >( llRest ) * 1e9 / g_llCounterFreq );
+#else
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Clock diagnostics
+//-----------------------------------------------------------------------------
+
+void ClockDiagnostics::Reset()
+{
+    ResetJitter();
+    m_llTotal = m_llRefTotal = 0;
+    m_llRefLast = -1;
+    GetRefMicroSecs();
+}
+
+void ClockDiagnostics::ResetJitter()
+{
+    m_iFrames = 0;
+    m_dMean = m_dM2 = 0.0;
+    m_llLastFrame = -1;
+    m_llMaxJitter = 0;
+}
+
+// Welford's running variance
+void ClockDiagnostics::AddFrame( long long llMicroSecs )
+{
+    m_iFrames++;
+    double dDelta = llMicroSecs - m_dMean;
+    m_dMean += dDelta / m_iFrames;
+    m_dM2 += dDelta * ( llMicroSecs - m_dMean );
+    if ( m_llLastFrame >= 0 )
+        m_llMaxJitter = max( m_llMaxJitter, abs( llMicroSecs - m_llLastFrame ) );
+    m_llLastFrame = llMicroSecs;
+
+    m_llTotal += llMicroSecs;
+    m_llRefTotal += GetRefMicroSecs();
+}
+
+double ClockDiagnostics::GetJitter() const
+{
+    return m_iFrames > 1 ? sqrt( m_dM2 / ( m_iFrames - 1 ) ) : 0.0;
+}
+
+// The interrupt timer on Windows, which wraps every 49 days. Elsewhere the clock without NTP's slewing
+long long ClockDiagnostics::GetRefMicroSecs()
+{
+#ifdef _WIN32
+    DWORD dwNow = timeGetTime();
+    long long llElapsed = ( m_llRefLast >= 0 ? static_cast< DWORD >( dwNow - static_cast< DWORD >( m_llRefLast ) ) * 1000LL : 0 );
+    m_llRefLast = dwNow;
+#else
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+    long long llNow = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    long long llElapsed = ( m_llRefLast >= 0 ? llNow - m_llRefLast : 0 );
+    m_llRefLast = llNow;
+#endif
+    return llElapsed;
+}
+
+//-----------------------------------------------------------------------------
+// The frame scheduler
+//-----------------------------------------------------------------------------
+
+FrameScheduler::FrameScheduler() : m_llFrameTime( 0 ), m_llNextFrame( 0 ), m_llIdleFrame( 0 ), m_bIdle( false ), m_bSpin( true )
+{
+    // Sleeps round up to the system timer. Ask for 1 ms
+    timeBeginPeriod( 1 );
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    timeEndPeriod( 1 );
+}
+
+void FrameScheduler::SetFrameRate( int iFPS, bool bSpin )
+{
+    m_bSpin = bSpin;
+    long long llFrameTime = ( iFPS > 0 ? 1000000LL / iFPS : 0 );
+    if ( llFrameTime != m_llFrameTime )
     {
-        LARGE_INTEGER liTicks;
-        QueryPerformanceCounter( &liTicks );
-        if ( m_bTooPrecise )
-            return ( 2LL * liTicks.QuadPart + m_llPrecisionThrottle ) / ( 2LL * m_llPrecisionThrottle );
-        else
-            return liTicks.QuadPart;
+        m_llFrameTime = llFrameTime;
+        m_llNextFrame = 0;
     }
+}
+
+// Frames stay on the grid so a late wakeup doesn't push the rest back. More than a frame
+// behind (a hitch, or coming back from idle) starts a new grid instead of rushing to catch up
+void FrameScheduler::FrameDone( bool bIdle )
+{
+    long long llNow = GetMicroSecs();
+    if ( m_llFrameTime > 0 && m_llNextFrame > llNow - m_llFrameTime )
+        m_llNextFrame += m_llFrameTime;
     else
-        return timeGetTime();
+        m_llNextFrame = llNow + m_llFrameTime;
+
+    m_bIdle = bIdle;
+    m_llIdleFrame = llNow + IdleFrameTime;
+}
+
+long long FrameScheduler::GetMicroSecs() const
+{
+    return Timer::GetNanoSecsNow() / 1000;
+}
+
+//-----------------------------------------------------------------------------
+// Arena
+//-----------------------------------------------------------------------------
+
+void Arena::clear()
+{
+    for ( vector< char* >::iterator it = m_vBlocks.begin(); it != m_vBlocks.end(); ++it )
+        delete[] *it;
+    m_vBlocks.clear();
+    m_pCur = m_pEnd = NULL;
+    m_iNextBlock = MinBlockSize;
+    m_llUsed = 0;
+}
+
+void Arena::swap( Arena &other )
+{
+    m_vBlocks.swap( other.m_vBlocks );
+    std::swap( m_pCur, other.m_pCur );
+    std::swap( m_pEnd, other.m_pEnd );
+    std::swap( m_iNextBlock, other.m_iNextBlock );
+    std::swap( m_llUsed, other.m_llUsed );
+}
+
+// Keeps allocating out of our own block. Other's partly used one is just carried along
+void Arena::Adopt( Arena &other )
+{
+    m_vBlocks.insert( m_vBlocks.end(), other.m_vBlocks.begin(), other.m_vBlocks.end() );
+    m_llUsed += other.m_llUsed;
+    other.m_vBlocks.clear();
+    other.m_pCur = other.m_pEnd = NULL;
+    other.m_iNextBlock = MinBlockSize;
+    other.m_llUsed = 0;
+}
+
+//-----------------------------------------------------------------------------
+// Disposer
+//-----------------------------------------------------------------------------
+
+Disposer &Disposer::GetDisposer()
+{
+    static Disposer disposer;
+    return disposer;
+}
+
+// Finishes off whatever is left before going away
+Disposer::~Disposer()
+{
+    {
+        lock_guard< mutex > lock( m_mutex );
+        m_bQuit = true;
+    }
+    m_cvWork.notify_one();
+    if ( m_thread.joinable() )
+        m_thread.join();
+}
+
+void Disposer::Dispose( const function< void() > &fnFree )
+{
+    {
+        lock_guard< mutex > lock( m_mutex );
+        if ( !m_thread.joinable() )
+        {
+            m_thread = thread( &Disposer::Run, this );
+            SetThreadPriority( m_thread.native_handle(), THREAD_PRIORITY_LOWEST );
+        }
+        m_qWork.push_back( fnFree );
+    }
+    m_cvWork.notify_one();
+}
+
+void Disposer::Run()
+{
+    unique_lock< mutex > lock( m_mutex );
+    for (;;)
+    {
+        while ( !m_bQuit && m_qWork.empty() )
+            m_cvWork.wait( lock );
+        if ( m_qWork.empty() )
+            return;
+
+        function< void() > fnFree = m_qWork.front();
+        m_qWork.pop_front();
+        lock.unlock();
+        fnFree();
+        lock.lock();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// MappedFile
+//-----------------------------------------------------------------------------
+
+bool MappedFile::Open( const wstring &sFilename )
+{
+    Close();
+
+    HANDLE hFile = CreateFile( sFilename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                               FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if ( hFile == INVALID_HANDLE_VALUE ) return false;
+    m_hFile = hFile;
+
+    LARGE_INTEGER liSize;
+    if ( !GetFileSizeEx( hFile, &liSize ) || liSize.QuadPart <= 0 || liSize.QuadPart > INT_MAX )
+    {
+        Close();
+        return false;
+    }
+    m_iSize = static_cast< int >( liSize.QuadPart );
+
+    // Map the whole thing. Can fail for big files if the address space is fragmented (32 bit)
+    m_hMapping = CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    if ( m_hMapping )
+        m_pcData = static_cast< const unsigned char* >( MapViewOfFile( m_hMapping, FILE_MAP_READ, 0, 0, 0 ) );
+    if ( m_pcData ) return true;
+
+    // Plan B: read it in
+    DWORD dwRead = 0;
+    m_vData.resize( m_iSize );
+    if ( !ReadFile( hFile, &m_vData[0], m_iSize, &dwRead, NULL ) || dwRead != static_cast< DWORD >( m_iSize ) )
+    {
+        Close();
+        return false;
+    }
+    m_pcData = &m_vData[0];
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if ( m_pcData && m_vData.empty() ) UnmapViewOfFile( m_pcData );
+    if ( m_hMapping ) CloseHandle( m_hMapping );
+    if ( m_hFile ) CloseHandle( m_hFile );
+    m_hFile = m_hMapping = NULL;
+    m_pcData = NULL;
+    m_iSize = 0;
+    vector< unsigned char >().swap( m_vData );
 }
 
 //-----------------------------------------------------------------------------
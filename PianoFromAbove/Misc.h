@@ -10,50 +10,92 @@
 #pragma once
 
 #include <string>
+#include <new>
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
 using namespace std;
 
-//The timer
+//The timer. Runs off the system's monotonic high resolution clock and keeps nanoseconds
 class Timer
 {
 public:
     // Initializes variables
     Timer();
-    ~Timer();
 
     // The various clock actions
     void Start();
     void Pause();
     void Unpause();
 
+    // Microseconds since the last lap (or start), then starts the next lap. Whatever's left
+    // under a microsecond carries over, so laps add up to exactly the time that went by
+    long long Lap();
+
     // Gets the timer's time
     double GetSecs();
     long long GetMicroSecs();
-    long long GetTicks();
-    long long GetTicksPerSec() { return m_llTicksPerSec; }
+    long long GetNanoSecs();
 
     // Status accessors
     bool IsStarted() { return m_bStarted; }
     bool IsPaused() { return m_bPaused; }
 
-private:
-    static const long long m_llPrecisionLimit = 1000000000ll;
-    static const long long m_llPrecisionThrottle = 1000ll;
+    // The clock itself. Nanoseconds from some fixed point
+    static long long GetNanoSecsNow();
 
-    // Timer stuff
-    long long GetRawTicks();
-    long long m_llStartTicks;
-    long long m_llTicksPerSec;
-    bool m_bHighPrecision;
-    bool m_bTooPrecise;
+private:
+    long long m_llStartNanoSecs;
 
-    // Ticks stored when the timer was paused
-    long long m_llPausedTicks;
+    // Time stored when the timer was paused
+    long long m_llPausedNanoSecs;
 
     // Timer status
     bool m_bStarted;
     bool m_bPaused;
 };
 
+//-----------------------------------------------------------------------------
+// Clock diagnostics. Fed each frame's time as handed out by a timer, it keeps
+// the frame to frame jitter and how far the total handed out has drifted from
+// a second, independent clock (the system's interrupt timer). Only good to a
+// millisecond or so on Windows, but drift adds up and doesn't average out.
+//-----------------------------------------------------------------------------
+
+class ClockDiagnostics
+{
+public:
+    ClockDiagnostics() { Reset(); }
+
+    void Reset();
+    void ResetJitter(); // Starts a new window for the frame stats. Drift keeps going
+    void AddFrame( long long llMicroSecs );
+
+    int GetFrames() const { return m_iFrames; }
+    double GetMeanFrame() const { return m_dMean; } // Microseconds
+    double GetJitter() const; // Standard deviation of frame time, microseconds
+    long long GetMaxJitter() const { return m_llMaxJitter; } // Largest jump from one frame to the next
+    long long GetDrift() const { return m_llTotal - m_llRefTotal; } // Microseconds. Positive if the timer runs fast
+
+private:
+    long long GetRefMicroSecs(); // Since the last call
+
+    // Frame stats, running
+    int m_iFrames;
+    double m_dMean, m_dM2;
+    long long m_llLastFrame, m_llMaxJitter;
+
+    // Drift
+    long long m_llTotal, m_llRefTotal;
+    long long m_llRefLast;
+};
+
 //-----------------------------------------------------------------------------
 // Small utility functions
 //-----------------------------------------------------------------------------
@@ -74,53 +116,484 @@ private:
     static wchar_t m_wsBuf[16384];
 };
 
+//-----------------------------------------------------------------------------
+// Bump allocator. Objects are carved out of big blocks and never freed one at a
+// time: clearing the arena releases everything at once. Destructors are NOT
+// called, so only put things in here that don't need them.
+//-----------------------------------------------------------------------------
+
+class Arena
+{
+public:
+    Arena() : m_pCur( NULL ), m_pEnd( NULL ), m_iNextBlock( MinBlockSize ), m_llUsed( 0 ) { }
+    ~Arena() { clear(); }
+
+    void *Alloc( size_t iSize );
+    template< class T > T *New() { return new( Alloc( sizeof( T ) ) ) T(); }
+    void clear();
+    void swap( Arena &other );
+    void Adopt( Arena &other ); // Takes over all of other's blocks. Other is left empty
+
+    long long GetBytesUsed() const { return m_llUsed; }
+
+private:
+    Arena( const Arena& );
+    Arena &operator=( const Arena& );
+
+    static const size_t Alignment = 16;
+    static const size_t MinBlockSize = 1 << 16;
+    static const size_t MaxBlockSize = 1 << 24;
+
+    vector< char* > m_vBlocks;
+    char *m_pCur, *m_pEnd;
+    size_t m_iNextBlock;
+    long long m_llUsed;
+};
+
+inline void *Arena::Alloc( size_t iSize )
+{
+    iSize = ( iSize + Alignment - 1 ) & ~( Alignment - 1 );
+    if ( static_cast< size_t >( m_pEnd - m_pCur ) < iSize )
+    {
+        // Blocks grow so big songs don't end up with thousands of them. Oversized requests get their own
+        size_t iBlockSize = max( m_iNextBlock, iSize );
+        m_iNextBlock = min( m_iNextBlock * 2, static_cast< size_t >( MaxBlockSize ) );
+        m_pCur = new char[iBlockSize];
+        m_pEnd = m_pCur + iBlockSize;
+        m_vBlocks.push_back( m_pCur );
+    }
+
+    void *pResult = m_pCur;
+    m_pCur += iSize;
+    m_llUsed += iSize;
+    return pResult;
+}
+
+//-----------------------------------------------------------------------------
+// Open addressing hash index (linear probing). A slot only holds a hash and a
+// value. Keys aren't stored: the caller's equality test checks them against
+// the value, so keys that already live somewhere else don't get copied.
+//-----------------------------------------------------------------------------
+
+template< class T >
+class HashIndex
+{
+public:
+    HashIndex() : m_iCount( 0 ) { }
+
+    template< class Eq > const T *Find( unsigned iHash, Eq fnEq ) const;
+    template< class Eq > void Set( unsigned iHash, Eq fnEq, const T &tVal ); // Replaces a match
+    void clear() { m_vSlots.clear(); m_iCount = 0; }
+    size_t size() const { return m_iCount; }
+
+    static unsigned Hash( const void *pData, size_t iSize, unsigned iSeed = 0 );
+
+private:
+    struct Slot
+    {
+        Slot() : bUsed( false ) { }
+        unsigned iHash;
+        bool bUsed;
+        T tVal;
+    };
+
+    void Grow();
+
+    vector< Slot > m_vSlots; // Size is always a power of 2
+    size_t m_iCount;
+};
+
+template< class T > template< class Eq >
+const T *HashIndex< T >::Find( unsigned iHash, Eq fnEq ) const
+{
+    if ( m_vSlots.empty() ) return NULL;
+    size_t iMask = m_vSlots.size() - 1;
+    for ( size_t i = iHash & iMask; m_vSlots[i].bUsed; i = ( i + 1 ) & iMask )
+        if ( m_vSlots[i].iHash == iHash && fnEq( m_vSlots[i].tVal ) )
+            return &m_vSlots[i].tVal;
+    return NULL;
+}
+
+template< class T > template< class Eq >
+void HashIndex< T >::Set( unsigned iHash, Eq fnEq, const T &tVal )
+{
+    // Kept at most half full so probes stay short
+    if ( 2 * ( m_iCount + 1 ) > m_vSlots.size() ) Grow();
+
+    size_t iMask = m_vSlots.size() - 1;
+    size_t i = iHash & iMask;
+    for ( ; m_vSlots[i].bUsed; i = ( i + 1 ) & iMask )
+        if ( m_vSlots[i].iHash == iHash && fnEq( m_vSlots[i].tVal ) )
+            break;
+
+    if ( !m_vSlots[i].bUsed ) m_iCount++;
+    m_vSlots[i].iHash = iHash;
+    m_vSlots[i].bUsed = true;
+    m_vSlots[i].tVal = tVal;
+}
+
+// The hashes are kept, so growing never looks at the keys
+template< class T >
+void HashIndex< T >::Grow()
+{
+    vector< Slot > vOld( max( m_vSlots.size() * 2, static_cast< size_t >( 16 ) ) );
+    vOld.swap( m_vSlots );
+
+    size_t iMask = m_vSlots.size() - 1;
+    for ( typename vector< Slot >::const_iterator it = vOld.begin(); it != vOld.end(); ++it )
+        if ( it->bUsed )
+        {
+            size_t i = it->iHash & iMask;
+            while ( m_vSlots[i].bUsed ) i = ( i + 1 ) & iMask;
+            m_vSlots[i] = *it;
+        }
+}
+
+// FNV-1a
+template< class T >
+unsigned HashIndex< T >::Hash( const void *pData, size_t iSize, unsigned iSeed )
+{
+    const unsigned char *pcData = static_cast< const unsigned char* >( pData );
+    unsigned iHash = 2166136261u ^ iSeed;
+    for ( size_t i = 0; i < iSize; i++ )
+        iHash = ( iHash ^ pcData[i] ) * 16777619u;
+    return iHash;
+}
+
+//-----------------------------------------------------------------------------
+// Deletes things on a low priority background thread so big frees don't stall
+// whoever let go of them. Dispose takes any function that does the freeing.
+//-----------------------------------------------------------------------------
+
+class Disposer
+{
+public:
+    static Disposer &GetDisposer();
+    ~Disposer();
+
+    void Dispose( const function< void() > &fnFree );
+    template< class T > void Delete( T *pObj ) { if ( pObj ) Dispose( [pObj]() { delete pObj; } ); }
+
+private:
+    Disposer() : m_bQuit( false ) { }
+    void Run();
+
+    deque< function< void() > > m_qWork;
+    mutex m_mutex;
+    condition_variable m_cvWork;
+    thread m_thread;
+    bool m_bQuit;
+};
+
+//-----------------------------------------------------------------------------
+// Read only view of a whole file. Mapped when possible so pages only come in
+// as they're touched. Falls back on reading it all in.
+//-----------------------------------------------------------------------------
+
+class MappedFile
+{
+public:
+    MappedFile() : m_hFile( NULL ), m_hMapping( NULL ), m_pcData( NULL ), m_iSize( 0 ) { }
+    ~MappedFile() { Close(); }
+
+    bool Open( const wstring &sFilename );
+    void Close();
+
+    const unsigned char *GetData() const { return m_pcData; }
+    int GetSize() const { return m_iSize; }
+
+private:
+    MappedFile( const MappedFile& );
+    MappedFile &operator=( const MappedFile& );
+
+    void *m_hFile, *m_hMapping; // Windows handles
+    const unsigned char *m_pcData;
+    vector< unsigned char > m_vData; // Only used if mapping failed
+    int m_iSize;
+};
+
 //-----------------------------------------------------------------------------
 // The thread safe queue (TSQueue) class. Only safe for a single producer and
-// a single consumer
+// a single consumer. Lock free: each side owns one index and publishes it with
+// a release store, so whatever was written to a slot is seen before the index
+// that hands it over. Each side also keeps a copy of the other's index and
+// only goes back for a fresh one when the copy says full (or empty), so the
+// two sides only touch each other's cache line about once a lap.
+//
+// Either side can also sleep: the consumer (in Wait) till something's pushed,
+// the producer (in ForcePush) till there's room. A sleeper raises its flag and
+// fences before its last look at the indices. Push and Pop check the other
+// side's flag with a plain load after moving their index, so they cost
+// nothing extra when nobody sleeps, but that check can cross a sleeper that's
+// just lying down. ForcePush fences before its check, so a consumer in Wait
+// always hears about it. ForcePush's own sleep is in short slices, so a Pop
+// that crossed it costs a slice. The lock is only taken to sleep or to wake.
 //-----------------------------------------------------------------------------
 
-template < typename T >
+template < typename T, unsigned QueueSize = 1024 >
 class TSQueue
 {
 public:
-    TSQueue() : m_iWrite(0), m_iRead(0) { }
+    TSQueue() : m_iWrite( 0 ), m_iReadCache( 0 ), m_iRead( 0 ), m_iWriteCache( 0 ),
+                m_bConsumerAsleep( false ), m_bProducerAsleep( false ) { }
     bool Push( const T &tElement );
     bool Pop( T &tElement );
 
-    void ForcePush( const T &tElement ) { while ( !Push( tElement) ); }
+    // As many as fit (or are there), in order, handed over all at once. Returns how many
+    int Push( const T *pElements, int iCount );
+    int Pop( T *pElements, int iMaxCount );
+
+    // Sleeps while the queue is full. Use it to feed a consumer that Waits: a plain Push can slip past one
+    void ForcePush( const T &tElement );
+
+    // Consumer only. Sleeps till there's something to pop or the time is up. True if there's something
+    bool Wait( long long llMicroSecs );
+    bool IsEmpty() const { return m_iRead.load( memory_order_relaxed ) == m_iWrite.load( memory_order_acquire ); }
 
 private:
-    static const int QueueSize = 1024;
-    T m_tQueue[QueueSize]; // Does this need to be volatile? Unsure. Doesn't work with MSG if volatile.
-    volatile int m_iWrite;
-    volatile int m_iRead;
+    static const unsigned QueueMask = QueueSize - 1; // Size is a power of two. Indices run free and get masked
+    static const int CacheLine = 64;
+
+    static const int ProducerSleepMicroSecs = 1000;
+
+    bool IsFull() const { return m_iWrite.load( memory_order_relaxed ) - m_iRead.load( memory_order_acquire ) == QueueSize; }
+    bool TryPush( const T &tElement );
+    void WakeConsumer();
+    void WakeProducer();
+
+    // Producer's line, consumer's line, then the slots. Padded so neither side's writes evict the other's
+    char m_acPad0[CacheLine];
+    atomic< unsigned > m_iWrite;
+    unsigned m_iReadCache;
+    char m_acPad1[CacheLine];
+    atomic< unsigned > m_iRead;
+    unsigned m_iWriteCache;
+    char m_acPad2[CacheLine];
+    T m_tQueue[QueueSize];
+
+    // Sleeping. Written rarely, so the flags can share a line that both sides read
+    atomic< bool > m_bConsumerAsleep, m_bProducerAsleep;
+    mutex m_mutex;
+    condition_variable m_cvWake;
 };
 
-template< class T >
-bool TSQueue<T>::Push( const T &tElement )
+template< class T, unsigned QueueSize >
+inline bool TSQueue<T, QueueSize>::Push( const T &tElement )
 {
-    int iNextElement = ( m_iWrite + 1 ) % QueueSize;
+    if ( !TryPush( tElement ) ) return false;
+    WakeConsumer();
+    return true;
+}
 
-    // Is the queue full?
-    if ( iNextElement == m_iRead ) return false;
+template< class T, unsigned QueueSize >
+inline bool TSQueue<T, QueueSize>::TryPush( const T &tElement )
+{
+    unsigned iWrite = m_iWrite.load( memory_order_relaxed );
+    if ( iWrite - m_iReadCache == QueueSize )
+    {
+        m_iReadCache = m_iRead.load( memory_order_acquire );
+        if ( iWrite - m_iReadCache == QueueSize ) return false; // Full
+    }
 
-    // Push the element. Order of execution is very important.
-    m_tQueue[m_iWrite] = tElement;
-    m_iWrite = iNextElement;
+    m_tQueue[iWrite & QueueMask] = tElement;
+    m_iWrite.store( iWrite + 1, memory_order_release );
+    return true;
+}
+
+template< class T, unsigned QueueSize >
+inline bool TSQueue<T, QueueSize>::Pop( T &tElement )
+{
+    unsigned iRead = m_iRead.load( memory_order_relaxed );
+    if ( iRead == m_iWriteCache )
+    {
+        m_iWriteCache = m_iWrite.load( memory_order_acquire );
+        if ( iRead == m_iWriteCache ) return false; // Empty
+    }
 
+    tElement = m_tQueue[iRead & QueueMask];
+    m_iRead.store( iRead + 1, memory_order_release );
+    WakeProducer();
     return true;
 }
 
-template< class T >
-bool TSQueue<T>::Pop( T &tElement )
+template< class T, unsigned QueueSize >
+int TSQueue<T, QueueSize>::Push( const T *pElements, int iCount )
+{
+    unsigned iWrite = m_iWrite.load( memory_order_relaxed );
+    if ( iWrite - m_iReadCache + static_cast< unsigned >( iCount ) > QueueSize )
+        m_iReadCache = m_iRead.load( memory_order_acquire );
+    iCount = min( iCount, static_cast< int >( QueueSize - ( iWrite - m_iReadCache ) ) );
+    if ( iCount <= 0 ) return 0; // Full
+
+    for ( int i = 0; i < iCount; i++ )
+        m_tQueue[( iWrite + i ) & QueueMask] = pElements[i];
+    m_iWrite.store( iWrite + iCount, memory_order_release );
+    WakeConsumer();
+    return iCount;
+}
+
+template< class T, unsigned QueueSize >
+int TSQueue<T, QueueSize>::Pop( T *pElements, int iMaxCount )
+{
+    unsigned iRead = m_iRead.load( memory_order_relaxed );
+    if ( m_iWriteCache - iRead < static_cast< unsigned >( iMaxCount ) )
+        m_iWriteCache = m_iWrite.load( memory_order_acquire );
+    int iCount = min( iMaxCount, static_cast< int >( m_iWriteCache - iRead ) );
+    if ( iCount <= 0 ) return 0; // Empty
+
+    for ( int i = 0; i < iCount; i++ )
+        pElements[i] = m_tQueue[( iRead + i ) & QueueMask];
+    m_iRead.store( iRead + iCount, memory_order_release );
+    WakeProducer();
+    return iCount;
+}
+
+template< class T, unsigned QueueSize >
+void TSQueue<T, QueueSize>::ForcePush( const T &tElement )
+{
+    while ( !TryPush( tElement ) )
+    {
+        unique_lock< mutex > lock( m_mutex );
+        m_bProducerAsleep.store( true, memory_order_relaxed );
+        atomic_thread_fence( memory_order_seq_cst );
+        m_cvWake.wait_for( lock, chrono::microseconds( ProducerSleepMicroSecs ), [this]() { return !IsFull(); } );
+        m_bProducerAsleep.store( false, memory_order_relaxed );
+    }
+
+    // Pairs with the fence in Wait: either it sees our index or we see its flag
+    atomic_thread_fence( memory_order_seq_cst );
+    WakeConsumer();
+}
+
+template< class T, unsigned QueueSize >
+bool TSQueue<T, QueueSize>::Wait( long long llMicroSecs )
+{
+    if ( !IsEmpty() ) return true;
+    if ( llMicroSecs <= 0 ) return false;
+
+    unique_lock< mutex > lock( m_mutex );
+    m_bConsumerAsleep.store( true, memory_order_relaxed );
+    atomic_thread_fence( memory_order_seq_cst );
+    bool bReady = m_cvWake.wait_for( lock, chrono::microseconds( llMicroSecs ), [this]() { return !IsEmpty(); } );
+    m_bConsumerAsleep.store( false, memory_order_relaxed );
+    return bReady;
+}
+
+template< class T, unsigned QueueSize >
+inline void TSQueue<T, QueueSize>::WakeConsumer()
+{
+    if ( m_bConsumerAsleep.load( memory_order_relaxed ) )
+    {
+        lock_guard< mutex > lock( m_mutex );
+        m_cvWake.notify_all();
+    }
+}
+
+template< class T, unsigned QueueSize >
+inline void TSQueue<T, QueueSize>::WakeProducer()
+{
+    if ( m_bProducerAsleep.load( memory_order_relaxed ) )
+    {
+        lock_guard< mutex > lock( m_mutex );
+        m_cvWake.notify_all();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The triple buffer. Hands whole frames from one producer thread to one
+// consumer thread without either ever waiting. The producer fills its back
+// slot and publishes it, swapping it with the middle slot. The consumer swaps
+// the middle slot for its front slot whenever there's something new. Frames
+// the consumer was too slow for are just overwritten. Slots are reused, so a
+// producer that refills them in place doesn't allocate once they're grown.
+//-----------------------------------------------------------------------------
+
+template < typename T >
+class TripleBuffer
 {
-    // Is the queue empty?
-    if ( m_iWrite == m_iRead ) return false;
+public:
+    TripleBuffer() : m_iBack( 0 ), m_iMiddle( 1 ), m_iFront( 2 ) { }
+
+    // Producer
+    T &Back() { return m_tSlots[m_iBack]; }
+    void Publish() { m_iBack = m_iMiddle.exchange( m_iBack | FreshBit, memory_order_acq_rel ) & SlotMask; }
+    bool IsPending() const { return ( m_iMiddle.load( memory_order_relaxed ) & FreshBit ) != 0; } // Published and not picked up
+
+    // Consumer. Acquire swaps in the newest frame, if there's one it hasn't seen
+    bool Acquire();
+    T &Front() { return m_tSlots[m_iFront]; }
+
+private:
+    static const int FreshBit = 4;
+    static const int SlotMask = 3;
+
+    TripleBuffer( const TripleBuffer& );
+    TripleBuffer &operator=( const TripleBuffer& );
 
-    // Compute where to read. Read. Update read pointer. Order very important.
-    int iNextElement = ( m_iRead + 1 ) % QueueSize;
-    tElement = m_tQueue[m_iRead];
-    m_iRead = iNextElement;
+    T m_tSlots[3];
+    int m_iBack; // Producer's
+    atomic< int > m_iMiddle;
+    int m_iFront; // Consumer's
+};
 
+template< class T >
+inline bool TripleBuffer<T>::Acquire()
+{
+    if ( !IsPending() ) return false;
+    m_iFront = m_iMiddle.exchange( m_iFront, memory_order_acq_rel ) & SlotMask;
     return true;
-}
\ No newline at end of file
+}
+
+//-----------------------------------------------------------------------------
+// The frame scheduler. Paces a loop that handles messages and draws frames.
+// Frames go out on a fixed grid at the target rate, or back to back with no
+// target. Idle frames (nothing on screen is moving) only repeat a few times a
+// second. In between, the loop sleeps on its message queue so input still gets
+// handled right away. Sleeping is only good to a millisecond or two, so the
+// last stretch before a paced frame is spun off on the timer's clock, for
+// loops that need their frames on time.
+//-----------------------------------------------------------------------------
+
+class FrameScheduler
+{
+public:
+    FrameScheduler();
+    ~FrameScheduler();
+
+    void SetFrameRate( int iFPS, bool bSpin = true ); // 0 for no limit. Unspun frames can be a ms or two late
+    void FrameDone( bool bIdle );
+    void Wake() { m_bIdle = false; } // Something came in. Back to the normal schedule
+
+    // Waits for the next frame. False if a message came in first
+    template< class T > bool Wait( TSQueue< T > &qMessages );
+
+private:
+    static const long long IdleFrameTime = 100000; // Microseconds
+    static const long long SpinTime = 2000; // How close to a frame to stop sleeping
+
+    long long GetMicroSecs() const;
+
+    long long m_llFrameTime; // 0 for no limit
+    long long m_llNextFrame;
+    long long m_llIdleFrame;
+    bool m_bIdle, m_bSpin;
+};
+
+template< class T >
+bool FrameScheduler::Wait( TSQueue< T > &qMessages )
+{
+    for (;;)
+    {
+        long long llLeft = ( m_bIdle ? m_llIdleFrame : m_llNextFrame ) - GetMicroSecs();
+        if ( llLeft <= 0 ) return true;
+        if ( !qMessages.IsEmpty() ) return false;
+
+        // Idle frames don't need to be on time, and neither do unspun ones
+        if ( m_bIdle || !m_bSpin )
+            qMessages.Wait( llLeft );
+        else if ( llLeft > SpinTime )
+            qMessages.Wait( llLeft - SpinTime );
+        else
+            this_thread::yield();
+    }
+}
@@ -146,7 +146,9 @@ INT WINAPI WinMain( HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpszCmdL
     g_MsgQueue.ForcePush( msg );
     WaitForSingleObject( hThread, INFINITE );
 
-    // Save settings
+    // Save settings. Stats that are done get kept
+    config.GetSongLibrary().StopAnalysis();
+    config.GetSongLibrary().ApplyStats();
     config.SaveConfigValues();
 
     // Clean up
@@ -159,9 +161,10 @@ DWORD WINAPI GameThread( LPVOID lpParameter )
 {
     if ( !g_hWndGfx ) return 0;
 
-    // Initialize Direct3D
-    Renderer *pRenderer = new D3D9Renderer();
-    if( FAILED( pRenderer->Init( g_hWndGfx, Config::GetConfig().GetVideoSettings().bLimitFPS ) ) )
+    // Initialize Direct3D, on the thread that'll be drawing
+    const VideoSettings &cVideo = Config::GetConfig().GetVideoSettings();
+    RenderThread rtRender;
+    if( FAILED( rtRender.Start( g_hWndGfx, cVideo.bLimitFPS ) ) )
     {
         MessageBox( g_hWnd, TEXT( "Fatal error initializing Direct3D. Is DirectX 9 installed properly?" ), TEXT( "Error" ), MB_OK | MB_ICONEXCLAMATION );
         PostMessage( g_hWnd, WM_QUIT, 1, 0 );
@@ -169,27 +172,50 @@ DWORD WINAPI GameThread( LPVOID lpParameter )
     }
 
     // Create the game object
-    GameState *pGameState = reinterpret_cast< GameState* >( lpParameter );
-    pGameState->SetHWnd( g_hWndGfx );
-    pGameState->SetRenderer( pRenderer );
-    pGameState->Init();
+    GameState *pFirst = reinterpret_cast< GameState* >( lpParameter );
+    pFirst->SetHWnd( g_hWndGfx );
+    pFirst->SetRenderer( rtRender.GetRenderer() );
+    GameState *pGameState = NULL;
     GameState::GameError ge;
+    if ( ( ge = rtRender.ChangeState( pFirst, &pGameState ) ) != GameState::Success )
+        PostMessage( g_hWnd, WM_COMMAND, ID_GAMEERROR, ge );
 
-    // Event, logic, render...
+    // Event, logic, render... Sleeps in between frames, but not through messages
+    FrameScheduler fsFrames;
     MSG msg = { 0 };
     while( msg.message != WM_QUIT )
     {
+        bool bMsg = false;
         while ( g_MsgQueue.Pop( msg ) )
+        {
             pGameState->MsgProc( msg.hwnd, msg.message, msg.wParam, msg.lParam );
+            bMsg = true;
+        }
+        if ( bMsg ) fsFrames.Wake();
+
+        // Vsync does its own pacing, unless the render thread's doing it for us. Then logic ticks
+        // at its own rate, but needn't spin for it. Decoupled logic never goes past that rate: the
+        // render thread draws every tick, and with no cap (0) it would copy out frames flat out
+        bool bDecoupled = pGameState->IsDecoupled();
+        if ( !cVideo.bLimitFPS )
+        {
+            int iMaxFPS = cVideo.iMaxFPS;
+            if ( bDecoupled && ( iMaxFPS <= 0 || iMaxFPS > GameState::LogicRate ) ) iMaxFPS = GameState::LogicRate;
+            fsFrames.SetFrameRate( iMaxFPS );
+        }
+        else
+            fsFrames.SetFrameRate( bDecoupled ? GameState::LogicRate : 0, false );
+        if ( msg.message != WM_QUIT && !fsFrames.Wait( g_MsgQueue ) ) continue;
 
-        if ( ( ge = GameState::ChangeState( pGameState->NextState(), &pGameState ) ) != GameState::Success )
+        if ( ( ge = rtRender.ChangeState( pGameState->NextState(), &pGameState ) ) != GameState::Success )
             PostMessage( g_hWnd, WM_COMMAND, ID_GAMEERROR, ge );
         pGameState->Logic();
-        pGameState->Render();
+        rtRender.FrameDone( !pGameState->IsDecoupled() );
+        fsFrames.FrameDone( pGameState->IsIdle() );
     }
 
+    rtRender.Stop();
     delete pGameState;
-    delete pRenderer;
 
     return 0;
 }
\ No newline at end of file
@@ -811,6 +811,13 @@ const int SongInfo::kBeatsFieldNumber;
 const int SongInfo::kSecondsFieldNumber;
 const int SongInfo::kTracksFieldNumber;
 const int SongInfo::kPlaysFieldNumber;
+const int SongInfo::kStatsVersionFieldNumber;
+const int SongInfo::kPeakNotesPerSecFieldNumber;
+const int SongInfo::kMaxChordFieldNumber;
+const int SongInfo::kMaxChordSpanFieldNumber;
+const int SongInfo::kLowKeyFieldNumber;
+const int SongInfo::kHighKeyFieldNumber;
+const int SongInfo::kTempoChangesFieldNumber;
 #endif  // !_MSC_VER
 
 SongInfo::SongInfo()
@@ -836,6 +843,13 @@ void SongInfo::SharedCtor() {
   seconds_ = 0;
   tracks_ = 0;
   plays_ = 0;
+  statsversion_ = 0;
+  peaknotespersec_ = 0;
+  maxchord_ = 0;
+  maxchordspan_ = 0;
+  lowkey_ = 0;
+  highkey_ = 0;
+  tempochanges_ = 0;
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
 }
 
@@ -888,6 +902,15 @@ void SongInfo::Clear() {
     seconds_ = 0;
     tracks_ = 0;
     plays_ = 0;
+    statsversion_ = 0;
+  }
+  if (_has_bits_[8 / 32] & (0xffu << (8 % 32))) {
+    peaknotespersec_ = 0;
+    maxchord_ = 0;
+    maxchordspan_ = 0;
+    lowkey_ = 0;
+    highkey_ = 0;
+    tempochanges_ = 0;
   }
   ::memset(_has_bits_, 0, sizeof(_has_bits_));
 }
@@ -1003,6 +1026,118 @@ bool SongInfo::MergePartialFromCodedStream(
         } else {
           goto handle_uninterpreted;
         }
+        if (input->ExpectTag(64)) goto parse_statsversion;
+        break;
+      }
+
+      // optional int32 statsVersion = 8;
+      case 8: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_statsversion:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &statsversion_)));
+          set_has_statsversion();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(72)) goto parse_peaknotespersec;
+        break;
+      }
+
+      // optional int32 peakNotesPerSec = 9;
+      case 9: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_peaknotespersec:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &peaknotespersec_)));
+          set_has_peaknotespersec();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(80)) goto parse_maxchord;
+        break;
+      }
+
+      // optional int32 maxChord = 10;
+      case 10: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_maxchord:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &maxchord_)));
+          set_has_maxchord();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(88)) goto parse_maxchordspan;
+        break;
+      }
+
+      // optional int32 maxChordSpan = 11;
+      case 11: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_maxchordspan:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &maxchordspan_)));
+          set_has_maxchordspan();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(96)) goto parse_lowkey;
+        break;
+      }
+
+      // optional int32 lowKey = 12;
+      case 12: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_lowkey:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &lowkey_)));
+          set_has_lowkey();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(104)) goto parse_highkey;
+        break;
+      }
+
+      // optional int32 highKey = 13;
+      case 13: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_highkey:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &highkey_)));
+          set_has_highkey();
+        } else {
+          goto handle_uninterpreted;
+        }
+        if (input->ExpectTag(112)) goto parse_tempochanges;
+        break;
+      }
+
+      // optional int32 tempoChanges = 14;
+      case 14: {
+        if (::google::protobuf::internal::WireFormatLite::GetTagWireType(tag) ==
+            ::google::protobuf::internal::WireFormatLite::WIRETYPE_VARINT) {
+         parse_tempochanges:
+          DO_((::google::protobuf::internal::WireFormatLite::ReadPrimitive<
+                   ::google::protobuf::int32, ::google::protobuf::internal::WireFormatLite::TYPE_INT32>(
+                 input, &tempochanges_)));
+          set_has_tempochanges();
+        } else {
+          goto handle_uninterpreted;
+        }
         if (input->ExpectAtEnd()) return true;
         break;
       }
@@ -1060,6 +1195,41 @@ void SongInfo::SerializeWithCachedSizes(
     ::google::protobuf::internal::WireFormatLite::WriteInt32(7, this->plays(), output);
   }
 
+  // optional int32 statsVersion = 8;
+  if (has_statsversion()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(8, this->statsversion(), output);
+  }
+
+  // optional int32 peakNotesPerSec = 9;
+  if (has_peaknotespersec()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(9, this->peaknotespersec(), output);
+  }
+
+  // optional int32 maxChord = 10;
+  if (has_maxchord()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(10, this->maxchord(), output);
+  }
+
+  // optional int32 maxChordSpan = 11;
+  if (has_maxchordspan()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(11, this->maxchordspan(), output);
+  }
+
+  // optional int32 lowKey = 12;
+  if (has_lowkey()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(12, this->lowkey(), output);
+  }
+
+  // optional int32 highKey = 13;
+  if (has_highkey()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(13, this->highkey(), output);
+  }
+
+  // optional int32 tempoChanges = 14;
+  if (has_tempochanges()) {
+    ::google::protobuf::internal::WireFormatLite::WriteInt32(14, this->tempochanges(), output);
+  }
+
 }
 
 int SongInfo::ByteSize() const {
@@ -1115,6 +1285,57 @@ int SongInfo::ByteSize() const {
           this->plays());
     }
 
+    // optional int32 statsVersion = 8;
+    if (has_statsversion()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->statsversion());
+    }
+
+  }
+  if (_has_bits_[8 / 32] & (0xffu << (8 % 32))) {
+    // optional int32 peakNotesPerSec = 9;
+    if (has_peaknotespersec()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->peaknotespersec());
+    }
+
+    // optional int32 maxChord = 10;
+    if (has_maxchord()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->maxchord());
+    }
+
+    // optional int32 maxChordSpan = 11;
+    if (has_maxchordspan()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->maxchordspan());
+    }
+
+    // optional int32 lowKey = 12;
+    if (has_lowkey()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->lowkey());
+    }
+
+    // optional int32 highKey = 13;
+    if (has_highkey()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->highkey());
+    }
+
+    // optional int32 tempoChanges = 14;
+    if (has_tempochanges()) {
+      total_size += 1 +
+        ::google::protobuf::internal::WireFormatLite::Int32Size(
+          this->tempochanges());
+    }
+
   }
   GOOGLE_SAFE_CONCURRENT_WRITES_BEGIN();
   _cached_size_ = total_size;
@@ -1151,6 +1372,29 @@ void SongInfo::MergeFrom(const SongInfo& from) {
     if (from.has_plays()) {
       set_plays(from.plays());
     }
+    if (from.has_statsversion()) {
+      set_statsversion(from.statsversion());
+    }
+  }
+  if (from._has_bits_[8 / 32] & (0xffu << (8 % 32))) {
+    if (from.has_peaknotespersec()) {
+      set_peaknotespersec(from.peaknotespersec());
+    }
+    if (from.has_maxchord()) {
+      set_maxchord(from.maxchord());
+    }
+    if (from.has_maxchordspan()) {
+      set_maxchordspan(from.maxchordspan());
+    }
+    if (from.has_lowkey()) {
+      set_lowkey(from.lowkey());
+    }
+    if (from.has_highkey()) {
+      set_highkey(from.highkey());
+    }
+    if (from.has_tempochanges()) {
+      set_tempochanges(from.tempochanges());
+    }
   }
 }
 
@@ -1175,6 +1419,13 @@ void SongInfo::Swap(SongInfo* other) {
     std::swap(seconds_, other->seconds_);
     std::swap(tracks_, other->tracks_);
     std::swap(plays_, other->plays_);
+    std::swap(statsversion_, other->statsversion_);
+    std::swap(peaknotespersec_, other->peaknotespersec_);
+    std::swap(maxchord_, other->maxchord_);
+    std::swap(maxchordspan_, other->maxchordspan_);
+    std::swap(lowkey_, other->lowkey_);
+    std::swap(highkey_, other->highkey_);
+    std::swap(tempochanges_, other->tempochanges_);
     std::swap(_has_bits_[0], other->_has_bits_[0]);
     std::swap(_cached_size_, other->_cached_size_);
   }
@@ -430,6 +430,55 @@ class SongInfo : public ::google::protobuf::MessageLite {
   inline ::google::protobuf::int32 plays() const;
   inline void set_plays(::google::protobuf::int32 value);
 
+  // optional int32 statsVersion = 8;
+  inline bool has_statsversion() const;
+  inline void clear_statsversion();
+  static const int kStatsVersionFieldNumber = 8;
+  inline ::google::protobuf::int32 statsversion() const;
+  inline void set_statsversion(::google::protobuf::int32 value);
+
+  // optional int32 peakNotesPerSec = 9;
+  inline bool has_peaknotespersec() const;
+  inline void clear_peaknotespersec();
+  static const int kPeakNotesPerSecFieldNumber = 9;
+  inline ::google::protobuf::int32 peaknotespersec() const;
+  inline void set_peaknotespersec(::google::protobuf::int32 value);
+
+  // optional int32 maxChord = 10;
+  inline bool has_maxchord() const;
+  inline void clear_maxchord();
+  static const int kMaxChordFieldNumber = 10;
+  inline ::google::protobuf::int32 maxchord() const;
+  inline void set_maxchord(::google::protobuf::int32 value);
+
+  // optional int32 maxChordSpan = 11;
+  inline bool has_maxchordspan() const;
+  inline void clear_maxchordspan();
+  static const int kMaxChordSpanFieldNumber = 11;
+  inline ::google::protobuf::int32 maxchordspan() const;
+  inline void set_maxchordspan(::google::protobuf::int32 value);
+
+  // optional int32 lowKey = 12;
+  inline bool has_lowkey() const;
+  inline void clear_lowkey();
+  static const int kLowKeyFieldNumber = 12;
+  inline ::google::protobuf::int32 lowkey() const;
+  inline void set_lowkey(::google::protobuf::int32 value);
+
+  // optional int32 highKey = 13;
+  inline bool has_highkey() const;
+  inline void clear_highkey();
+  static const int kHighKeyFieldNumber = 13;
+  inline ::google::protobuf::int32 highkey() const;
+  inline void set_highkey(::google::protobuf::int32 value);
+
+  // optional int32 tempoChanges = 14;
+  inline bool has_tempochanges() const;
+  inline void clear_tempochanges();
+  static const int kTempoChangesFieldNumber = 14;
+  inline ::google::protobuf::int32 tempochanges() const;
+  inline void set_tempochanges(::google::protobuf::int32 value);
+
   // @@protoc_insertion_point(class_scope:PFAData.SongInfo)
  private:
   inline void set_has_md5();
@@ -446,6 +495,20 @@ class SongInfo : public ::google::protobuf::MessageLite {
   inline void clear_has_tracks();
   inline void set_has_plays();
   inline void clear_has_plays();
+  inline void set_has_statsversion();
+  inline void clear_has_statsversion();
+  inline void set_has_peaknotespersec();
+  inline void clear_has_peaknotespersec();
+  inline void set_has_maxchord();
+  inline void clear_has_maxchord();
+  inline void set_has_maxchordspan();
+  inline void clear_has_maxchordspan();
+  inline void set_has_lowkey();
+  inline void clear_has_lowkey();
+  inline void set_has_highkey();
+  inline void clear_has_highkey();
+  inline void set_has_tempochanges();
+  inline void clear_has_tempochanges();
 
   ::std::string* md5_;
   ::google::protobuf::int32 division_;
@@ -454,9 +517,16 @@ class SongInfo : public ::google::protobuf::MessageLite {
   ::google::protobuf::int32 seconds_;
   ::google::protobuf::int32 tracks_;
   ::google::protobuf::int32 plays_;
+  ::google::protobuf::int32 statsversion_;
+  ::google::protobuf::int32 peaknotespersec_;
+  ::google::protobuf::int32 maxchord_;
+  ::google::protobuf::int32 maxchordspan_;
+  ::google::protobuf::int32 lowkey_;
+  ::google::protobuf::int32 highkey_;
+  ::google::protobuf::int32 tempochanges_;
 
   mutable int _cached_size_;
-  ::google::protobuf::uint32 _has_bits_[(7 + 31) / 32];
+  ::google::protobuf::uint32 _has_bits_[(14 + 31) / 32];
 
   #ifdef GOOGLE_PROTOBUF_NO_STATIC_INITIALIZER
   friend void  protobuf_AddDesc_MetaData_2eproto_impl();
@@ -1466,6 +1536,160 @@ inline void SongInfo::set_plays(::google::protobuf::int32 value) {
   plays_ = value;
 }
 
+// optional int32 statsVersion = 8;
+inline bool SongInfo::has_statsversion() const {
+  return (_has_bits_[0] & 0x00000080u) != 0;
+}
+inline void SongInfo::set_has_statsversion() {
+  _has_bits_[0] |= 0x00000080u;
+}
+inline void SongInfo::clear_has_statsversion() {
+  _has_bits_[0] &= ~0x00000080u;
+}
+inline void SongInfo::clear_statsversion() {
+  statsversion_ = 0;
+  clear_has_statsversion();
+}
+inline ::google::protobuf::int32 SongInfo::statsversion() const {
+  return statsversion_;
+}
+inline void SongInfo::set_statsversion(::google::protobuf::int32 value) {
+  set_has_statsversion();
+  statsversion_ = value;
+}
+
+// optional int32 peakNotesPerSec = 9;
+inline bool SongInfo::has_peaknotespersec() const {
+  return (_has_bits_[0] & 0x00000100u) != 0;
+}
+inline void SongInfo::set_has_peaknotespersec() {
+  _has_bits_[0] |= 0x00000100u;
+}
+inline void SongInfo::clear_has_peaknotespersec() {
+  _has_bits_[0] &= ~0x00000100u;
+}
+inline void SongInfo::clear_peaknotespersec() {
+  peaknotespersec_ = 0;
+  clear_has_peaknotespersec();
+}
+inline ::google::protobuf::int32 SongInfo::peaknotespersec() const {
+  return peaknotespersec_;
+}
+inline void SongInfo::set_peaknotespersec(::google::protobuf::int32 value) {
+  set_has_peaknotespersec();
+  peaknotespersec_ = value;
+}
+
+// optional int32 maxChord = 10;
+inline bool SongInfo::has_maxchord() const {
+  return (_has_bits_[0] & 0x00000200u) != 0;
+}
+inline void SongInfo::set_has_maxchord() {
+  _has_bits_[0] |= 0x00000200u;
+}
+inline void SongInfo::clear_has_maxchord() {
+  _has_bits_[0] &= ~0x00000200u;
+}
+inline void SongInfo::clear_maxchord() {
+  maxchord_ = 0;
+  clear_has_maxchord();
+}
+inline ::google::protobuf::int32 SongInfo::maxchord() const {
+  return maxchord_;
+}
+inline void SongInfo::set_maxchord(::google::protobuf::int32 value) {
+  set_has_maxchord();
+  maxchord_ = value;
+}
+
+// optional int32 maxChordSpan = 11;
+inline bool SongInfo::has_maxchordspan() const {
+  return (_has_bits_[0] & 0x00000400u) != 0;
+}
+inline void SongInfo::set_has_maxchordspan() {
+  _has_bits_[0] |= 0x00000400u;
+}
+inline void SongInfo::clear_has_maxchordspan() {
+  _has_bits_[0] &= ~0x00000400u;
+}
+inline void SongInfo::clear_maxchordspan() {
+  maxchordspan_ = 0;
+  clear_has_maxchordspan();
+}
+inline ::google::protobuf::int32 SongInfo::maxchordspan() const {
+  return maxchordspan_;
+}
+inline void SongInfo::set_maxchordspan(::google::protobuf::int32 value) {
+  set_has_maxchordspan();
+  maxchordspan_ = value;
+}
+
+// optional int32 lowKey = 12;
+inline bool SongInfo::has_lowkey() const {
+  return (_has_bits_[0] & 0x00000800u) != 0;
+}
+inline void SongInfo::set_has_lowkey() {
+  _has_bits_[0] |= 0x00000800u;
+}
+inline void SongInfo::clear_has_lowkey() {
+  _has_bits_[0] &= ~0x00000800u;
+}
+inline void SongInfo::clear_lowkey() {
+  lowkey_ = 0;
+  clear_has_lowkey();
+}
+inline ::google::protobuf::int32 SongInfo::lowkey() const {
+  return lowkey_;
+}
+inline void SongInfo::set_lowkey(::google::protobuf::int32 value) {
+  set_has_lowkey();
+  lowkey_ = value;
+}
+
+// optional int32 highKey = 13;
+inline bool SongInfo::has_highkey() const {
+  return (_has_bits_[0] & 0x00001000u) != 0;
+}
+inline void SongInfo::set_has_highkey() {
+  _has_bits_[0] |= 0x00001000u;
+}
+inline void SongInfo::clear_has_highkey() {
+  _has_bits_[0] &= ~0x00001000u;
+}
+inline void SongInfo::clear_highkey() {
+  highkey_ = 0;
+  clear_has_highkey();
+}
+inline ::google::protobuf::int32 SongInfo::highkey() const {
+  return highkey_;
+}
+inline void SongInfo::set_highkey(::google::protobuf::int32 value) {
+  set_has_highkey();
+  highkey_ = value;
+}
+
+// optional int32 tempoChanges = 14;
+inline bool SongInfo::has_tempochanges() const {
+  return (_has_bits_[0] & 0x00002000u) != 0;
+}
+inline void SongInfo::set_has_tempochanges() {
+  _has_bits_[0] |= 0x00002000u;
+}
+inline void SongInfo::clear_has_tempochanges() {
+  _has_bits_[0] &= ~0x00002000u;
+}
+inline void SongInfo::clear_tempochanges() {
+  tempochanges_ = 0;
+  clear_has_tempochanges();
+}
+inline ::google::protobuf::int32 SongInfo::tempochanges() const {
+  return tempochanges_;
+}
+inline void SongInfo::set_tempochanges(::google::protobuf::int32 value) {
+  set_has_tempochanges();
+  tempochanges_ = value;
+}
+
 // -------------------------------------------------------------------
 
 // FileInfo
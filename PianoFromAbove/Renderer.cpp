@@ -11,11 +11,8 @@
 
 HRESULT Renderer::SetLimitFPS( bool bLimitFPS )
 {
-    if ( bLimitFPS != m_bLimitFPS )
-    {
-        m_bLimitFPS = bLimitFPS;
-        return ResetDevice();
-    }
+    if ( m_bLimitFPS.exchange( bLimitFPS ) != bLimitFPS )
+        RequestReset();
     return S_OK;
 }
 
@@ -140,6 +137,14 @@ HRESULT D3D9Renderer::RestoreDeviceObjects()
 
 HRESULT D3D9Renderer::ResetDeviceIfNeeded()
 {
+    // A lost device gets reset below anyway, once it can be
+    if ( m_bResetRequested.exchange( false ) && m_bIsDeviceValid )
+    {
+        HRESULT hr = ResetDevice();
+        if ( FAILED( hr ) )
+            return hr;
+    }
+
     if ( !m_bIsDeviceValid )
     {
         HRESULT hr = m_pd3dDevice->TestCooperativeLevel();
@@ -12,13 +12,15 @@
 #include <Windows.h>
 #include <d3d9.h>
 #include <d3dx9.h>
+#include <atomic>
+using namespace std;
 
 class Renderer
 {
 public:
     enum FontSize { Small, SmallBold, SmallComic, Medium, Large };
 
-    Renderer(void) : m_iBufferWidth( 0 ), m_iBufferHeight( 0 ), m_bLimitFPS( true ) {};
+    Renderer(void) : m_iBufferWidth( 0 ), m_iBufferHeight( 0 ), m_bLimitFPS( true ), m_bResetRequested( false ) {};
     virtual ~Renderer(void) {};
 
     virtual HRESULT Init( HWND hWnd, bool bLimitFPS ) = 0;
@@ -39,15 +41,17 @@ public:
     virtual HRESULT DrawSkew( float x1, float y1, float x2, float y2, float x3, float y3, float x4, float y4,
                               DWORD c1, DWORD c2, DWORD c3, DWORD c4 ) = 0;
 
+    // Any thread. Everything else belongs to the render thread, which does the actual
+    // reset in its next ResetDeviceIfNeeded
+    void RequestReset() { m_bResetRequested = true; }
     bool GetLimitFPS() const { return m_bLimitFPS; }
     HRESULT SetLimitFPS( bool bLimitFPS );
-
     int GetBufferWidth() const { return m_iBufferWidth; }
     int GetBufferHeight() const { return m_iBufferHeight; }
 
 protected:
-    int m_iBufferWidth, m_iBufferHeight;
-    bool m_bLimitFPS;
+    atomic< int > m_iBufferWidth, m_iBufferHeight;
+    atomic< bool > m_bLimitFPS, m_bResetRequested;
 };
 
 class D3D9Renderer : public Renderer
@@ -0,0 +1,958 @@
+/*************************************************************************************************
+*
+* File: SoftSynth.cpp
+*
+* Description: Implements the built-in synth
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+#define SOFTSYNTH_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "SoftSynth.h"
+#include "JobSystem.h"
+
+namespace
+{
+    const int VoicesPerJob = 256; // Fewer than this and splitting the mix costs more than it saves
+    const int StealBatch = 64; // Voices picked to steal at a time
+    const float SilentCB = 960.0f; // 96 dB down. A voice this quiet is done
+    const float EnvRangeCB = 1000.0f; // Decay and release times are for falling this far
+    const float KillSecs = 0.005f; // Release for voices cut off: all sound off, exclusive classes
+
+    inline float CBToGain( float fCB ) { return powf( 10.0f, fCB * -0.005f ); }
+
+    // Adds n frames of one voice into the mix, linearly interpolated, the gains ramping by
+    // their steps each frame. The sample has to have a frame past the last one read
+    void MixFrames( const short *psSamples, unsigned long long ullPos, unsigned long long ullStep, int n,
+                    float fGainL, float fGainR, float fStepL, float fStepR, float *pfMixL, float *pfMixR )
+    {
+        int i = 0;
+#ifdef SOFTSYNTH_SSE2
+        const __m128 vFracScale = _mm_set1_ps( 1.0f / 2147483648.0f );
+        __m128 vGainL = _mm_setr_ps( fGainL + fStepL, fGainL + 2 * fStepL, fGainL + 3 * fStepL, fGainL + 4 * fStepL );
+        __m128 vGainR = _mm_setr_ps( fGainR + fStepR, fGainR + 2 * fStepR, fGainR + 3 * fStepR, fGainR + 4 * fStepR );
+        const __m128 vStepL = _mm_set1_ps( 4 * fStepL ), vStepR = _mm_set1_ps( 4 * fStepR );
+        for ( ; i + 4 <= n; i += 4 )
+        {
+            unsigned long long ullPos1 = ullPos + ullStep, ullPos2 = ullPos1 + ullStep, ullPos3 = ullPos2 + ullStep;
+            const short *ps0 = psSamples + ( ullPos >> 32 ), *ps1 = psSamples + ( ullPos1 >> 32 );
+            const short *ps2 = psSamples + ( ullPos2 >> 32 ), *ps3 = psSamples + ( ullPos3 >> 32 );
+
+            // Each frame and the next in one load, split by shifting. The fraction's top 31 bits, so it converts as signed
+            int aiPairs[4];
+            memcpy( aiPairs, ps0, 4 );
+            memcpy( aiPairs + 1, ps1, 4 );
+            memcpy( aiPairs + 2, ps2, 4 );
+            memcpy( aiPairs + 3, ps3, 4 );
+            __m128i vPairs = _mm_loadu_si128( reinterpret_cast< const __m128i* >( aiPairs ) );
+            __m128 vA = _mm_cvtepi32_ps( _mm_srai_epi32( _mm_slli_epi32( vPairs, 16 ), 16 ) );
+            __m128 vB = _mm_cvtepi32_ps( _mm_srai_epi32( vPairs, 16 ) );
+            __m128 vFrac = _mm_mul_ps( vFracScale, _mm_cvtepi32_ps( _mm_setr_epi32(
+                static_cast< int >( static_cast< unsigned >( ullPos ) >> 1 ), static_cast< int >( static_cast< unsigned >( ullPos1 ) >> 1 ),
+                static_cast< int >( static_cast< unsigned >( ullPos2 ) >> 1 ), static_cast< int >( static_cast< unsigned >( ullPos3 ) >> 1 ) ) ) );
+            __m128 vSample = _mm_add_ps( vA, _mm_mul_ps( _mm_sub_ps( vB, vA ), vFrac ) );
+
+            _mm_storeu_ps( pfMixL + i, _mm_add_ps( _mm_loadu_ps( pfMixL + i ), _mm_mul_ps( vSample, vGainL ) ) );
+            _mm_storeu_ps( pfMixR + i, _mm_add_ps( _mm_loadu_ps( pfMixR + i ), _mm_mul_ps( vSample, vGainR ) ) );
+            vGainL = _mm_add_ps( vGainL, vStepL );
+            vGainR = _mm_add_ps( vGainR, vStepR );
+            ullPos = ullPos3 + ullStep;
+        }
+        fGainL += fStepL * i;
+        fGainR += fStepR * i;
+#endif
+        for ( ; i < n; i++ )
+        {
+            const short *ps = psSamples + ( ullPos >> 32 );
+            float fFrac = static_cast< unsigned >( ullPos ) * ( 1.0f / 4294967296.0f );
+            float fSample = ps[0] + ( ps[1] - ps[0] ) * fFrac;
+            fGainL += fStepL;
+            fGainR += fStepR;
+            pfMixL[i] += fSample * fGainL;
+            pfMixR[i] += fSample * fGainR;
+            ullPos += ullStep;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Ports. Scheduled, a message's time maps to a frame a block ahead of the
+// engine, and maps again if it's ever fallen behind.
+//-----------------------------------------------------------------------------
+
+class SoftSynth::Port : public MIDIOutPort
+{
+public:
+    Port( SoftSynth &synth ) : m_Synth( synth ), m_bIsOpen( false ), m_bScheduled( false ), m_bHaveOffset( false ), m_llOffset( 0 ) { }
+    ~Port() { Close(); }
+
+    bool Open( int iDev );
+    void Close();
+    void SetVolume( double dVolume ) { m_Synth.SetVolume( dVolume ); }
+
+    int GetCaps() const { return 0; }
+    bool SetScheduled( bool bScheduled ) { m_bScheduled = bScheduled; m_bHaveOffset = false; return true; }
+    bool Send( const MIDIShortMsg *pMsgs, int iMsgs );
+    bool SendNow( const MIDIShortMsg *pMsgs, int iMsgs );
+
+    EventQueue &GetQueue() { return m_qEvents; }
+
+private:
+    static const int BatchSize = 256;
+
+    void Push( const Event *pEvents, int iEvents );
+
+    SoftSynth &m_Synth;
+    bool m_bIsOpen, m_bScheduled, m_bHaveOffset;
+    long long m_llOffset; // The frame a message's time 0 falls on
+    EventQueue m_qEvents;
+};
+
+bool SoftSynth::Port::Open( int /*iDev*/ )
+{
+    if ( m_bIsOpen ) Close();
+    m_bHaveOffset = false;
+    m_bIsOpen = m_Synth.AddPort( this );
+    return m_bIsOpen;
+}
+
+void SoftSynth::Port::Close()
+{
+    if ( !m_bIsOpen ) return;
+    m_Synth.RemovePort( this );
+    m_bIsOpen = false;
+}
+
+bool SoftSynth::Port::Send( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    if ( !m_bIsOpen ) return false;
+    if ( !m_bScheduled ) return SendNow( pMsgs, iMsgs );
+
+    Event aEvents[BatchSize];
+    int iEvents = 0;
+    long long llNow = m_Synth.GetFrame();
+    for ( int i = 0; i < iMsgs; i++ )
+    {
+        long long llFrame = pMsgs[i].llTime * m_Synth.m_iRate / 1000000;
+        if ( !m_bHaveOffset || m_llOffset + llFrame < llNow )
+        {
+            m_llOffset = llNow + BlockFrames - llFrame;
+            m_bHaveOffset = true;
+        }
+        aEvents[iEvents].llFrame = m_llOffset + llFrame;
+        aEvents[iEvents].iMsg = pMsgs[i].iMsg;
+        if ( ++iEvents == BatchSize )
+        {
+            Push( aEvents, iEvents );
+            iEvents = 0;
+        }
+    }
+    Push( aEvents, iEvents );
+    return true;
+}
+
+bool SoftSynth::Port::SendNow( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    if ( !m_bIsOpen ) return false;
+
+    Event aEvents[BatchSize];
+    for ( int i = 0; i < iMsgs; i += BatchSize )
+    {
+        int iEvents = min( iMsgs - i, static_cast< int >( BatchSize ) );
+        for ( int j = 0; j < iEvents; j++ )
+        {
+            aEvents[j].llFrame = 0;
+            aEvents[j].iMsg = pMsgs[i + j].iMsg;
+        }
+        Push( aEvents, iEvents );
+    }
+    return true;
+}
+
+// The engine empties the queue every block, so a full one only holds us up that long
+void SoftSynth::Port::Push( const Event *pEvents, int iEvents )
+{
+    while ( iEvents > 0 )
+    {
+        int iPushed = m_qEvents.Push( pEvents, iEvents );
+        if ( iPushed == 0 )
+        {
+            m_qEvents.ForcePush( *pEvents );
+            iPushed = 1;
+        }
+        pEvents += iPushed;
+        iEvents -= iPushed;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Setup and ports
+//-----------------------------------------------------------------------------
+
+SoftSynth &SoftSynth::GetSynth()
+{
+    static SoftSynth synth;
+    return synth;
+}
+
+SoftSynth::SoftSynth() : m_pSink( NULL ), m_iMaxVoices( DefaultMaxVoices ), m_fVolume( 1.0f ), m_bQuit( false ),
+                         m_bRunning( false ), m_iPorts( 0 ), m_llFrame( 0 ), m_llBlocks( 0 ),
+                         m_iRate( DefaultRate ), m_iLatencyFrames( 0 ), m_iVoices( 0 ), m_iPeakVoices( 0 ), m_llStolen( 0 )
+{
+    for ( int i = 0; i < MaxPorts; i++ )
+        m_apPorts[i] = NULL;
+}
+
+SoftSynth::~SoftSynth()
+{
+    if ( m_thRender.joinable() ) Stop();
+}
+
+bool SoftSynth::SetSoundFont( const wstring &sFilename )
+{
+    lock_guard< mutex > lock( m_mtxPorts );
+    if ( m_bRunning ) return false;
+
+    if ( sFilename.empty() )
+    {
+        m_SoundFont.Clear();
+        return true;
+    }
+    return m_SoundFont.Load( sFilename );
+}
+
+bool SoftSynth::SetSink( AudioSink *pSink )
+{
+    lock_guard< mutex > lock( m_mtxPorts );
+    if ( m_bRunning ) return false;
+    m_pSink = pSink;
+    return true;
+}
+
+bool SoftSynth::SetMaxVoices( int iMaxVoices )
+{
+    lock_guard< mutex > lock( m_mtxPorts );
+    if ( m_bRunning || iMaxVoices <= 0 ) return false;
+    m_iMaxVoices = iMaxVoices;
+    return true;
+}
+
+SoftSynth::Stats SoftSynth::GetStats() const
+{
+    Stats stats;
+    stats.iRate = m_iRate;
+    stats.iLatencyFrames = m_iLatencyFrames;
+    stats.iVoices = m_iVoices.load( memory_order_relaxed );
+    stats.iPeakVoices = m_iPeakVoices.load( memory_order_relaxed );
+    stats.llStolen = m_llStolen.load( memory_order_relaxed );
+    return stats;
+}
+
+MIDIOutPort *SoftSynth::CreatePort()
+{
+    return new Port( *this );
+}
+
+// The first port in starts the engine
+bool SoftSynth::AddPort( Port *pPort )
+{
+    lock_guard< mutex > lock( m_mtxPorts );
+    if ( !HasSoundFont() || ( m_iPorts == 0 && !Start() ) ) return false;
+
+    for ( int i = 0; i < MaxPorts; i++ )
+        if ( !m_apPorts[i].load( memory_order_relaxed ) )
+        {
+            m_apPorts[i].store( pPort, memory_order_seq_cst );
+            m_iPorts++;
+            return true;
+        }
+
+    if ( m_iPorts == 0 ) Stop();
+    return false;
+}
+
+// The last one out stops it. Otherwise the engine may be in the middle of draining this port's
+// queue, but it can't be two blocks on, since it looks the port up again each block
+void SoftSynth::RemovePort( Port *pPort )
+{
+    lock_guard< mutex > lock( m_mtxPorts );
+    int iSlot = 0;
+    while ( iSlot < MaxPorts && m_apPorts[iSlot].load( memory_order_relaxed ) != pPort ) iSlot++;
+    if ( iSlot == MaxPorts ) return;
+
+    m_apPorts[iSlot].store( NULL, memory_order_seq_cst );
+    if ( --m_iPorts == 0 )
+    {
+        Stop();
+        return;
+    }
+
+    long long llBlocks = m_llBlocks.load( memory_order_seq_cst );
+    while ( m_llBlocks.load( memory_order_acquire ) < llBlocks + 2 )
+        this_thread::sleep_for( chrono::milliseconds( 1 ) );
+}
+
+//-----------------------------------------------------------------------------
+// The render thread. It opens the sink itself, since some want to be used
+// only from the thread that opened them.
+//-----------------------------------------------------------------------------
+
+bool SoftSynth::Start()
+{
+    AudioSink *pSink = ( m_pSink ? m_pSink : CreateDefaultAudioSink() );
+    if ( !pSink ) return false;
+
+    promise< bool > started;
+    future< bool > fStarted = started.get_future();
+    m_bQuit = false;
+    m_thRender = thread( &SoftSynth::RenderThread, this, pSink, pSink != m_pSink, &started );
+    if ( !fStarted.get() )
+    {
+        m_thRender.join();
+        return false;
+    }
+
+    m_bRunning = true;
+    return true;
+}
+
+void SoftSynth::Stop()
+{
+    m_bQuit.store( true, memory_order_release );
+    m_thRender.join();
+    m_bRunning = false;
+}
+
+void SoftSynth::RenderThread( AudioSink *pSink, bool bOwnSink, promise< bool > *pStarted )
+{
+    bool bOpen = pSink->Open( DefaultRate, BlockFrames );
+    if ( bOpen )
+    {
+        Reset( pSink->GetRate() );
+        m_iLatencyFrames = pSink->GetLatencyFrames() + BlockFrames;
+    }
+    pStarted->set_value( bOpen );
+
+    if ( bOpen )
+    {
+        // A sink that's failed (its device pulled, say) still has the ports drained in real time
+        float afOut[BlockFrames * 2];
+        while ( !m_bQuit.load( memory_order_acquire ) )
+        {
+            RenderBlock( afOut );
+            if ( !pSink->Write( afOut, BlockFrames ) )
+                this_thread::sleep_for( chrono::microseconds( 1000000LL * BlockFrames / m_iRate ) );
+        }
+        pSink->Close();
+    }
+    if ( bOwnSink ) delete pSink;
+}
+
+bool SoftSynth::StartOffline( int iRate )
+{
+    lock_guard< mutex > lock( m_mtxPorts );
+    if ( m_iPorts > 0 || !HasSoundFont() ) return false;
+
+    Reset( iRate );
+    m_iLatencyFrames = 0;
+    m_bRunning = true;
+    return true;
+}
+
+void SoftSynth::Play( const MIDIShortMsg *pMsgs, int iMsgs )
+{
+    for ( int i = 0; i < iMsgs; i++ )
+    {
+        Event event = { 0, pMsgs[i].iMsg };
+        m_vPending.push_back( event );
+    }
+}
+
+void SoftSynth::Render( float *pfOut, int iFrames )
+{
+    for ( int i = 0; i + BlockFrames <= iFrames; i += BlockFrames )
+        RenderBlock( pfOut + i * 2 );
+}
+
+void SoftSynth::Reset( int iRate )
+{
+    m_iRate = iRate;
+    m_vVoices.assign( m_iMaxVoices, Voice() );
+    for ( int i = 0; i < m_iMaxVoices; i++ )
+    {
+        m_vVoices[i].iGeneration = 0;
+        m_vVoices[i].iActivePos = -1;
+        m_vVoices[i].eStage = Voice::Done;
+    }
+    m_vFree.clear();
+    for ( int i = m_iMaxVoices - 1; i >= 0; i-- )
+        m_vFree.push_back( i );
+    m_vActive.clear();
+    m_vActive.reserve( m_iMaxVoices );
+    m_vKeyHeads.assign( 16 * 128, -1 );
+    m_vStealable.clear();
+    m_vPending.clear();
+
+    for ( int i = 0; i < 16; i++ )
+    {
+        m_aChannels[i].Reset( i );
+        m_aChannels[i].pPreset = m_SoundFont.FindPreset( m_aChannels[i].iBank, m_aChannels[i].iProgram );
+    }
+
+    m_llFrame = 0;
+    m_llBlocks = 0;
+    m_iVoices = 0;
+    m_iPeakVoices = 0;
+    m_llStolen = 0;
+}
+
+void SoftSynth::DrainPorts()
+{
+    Event aEvents[256];
+    for ( int i = 0; i < MaxPorts; i++ )
+    {
+        Port *pPort = m_apPorts[i].load( memory_order_seq_cst );
+        if ( !pPort ) continue;
+
+        int iEvents;
+        while ( ( iEvents = pPort->GetQueue().Pop( aEvents, 256 ) ) > 0 )
+            m_vPending.insert( m_vPending.end(), aEvents, aEvents + iEvents );
+    }
+
+    // In order already unless ports were interleaved or sent now between scheduled
+    auto fnEarlier = []( const Event &a, const Event &b ) { return a.llFrame < b.llFrame; };
+    if ( !is_sorted( m_vPending.begin(), m_vPending.end(), fnEarlier ) )
+        stable_sort( m_vPending.begin(), m_vPending.end(), fnEarlier );
+}
+
+//-----------------------------------------------------------------------------
+// A block: the events due in it, then every voice mixed, then the finished
+// ones freed. Note-ons start on their frame and note-offs release at the end
+// of their sub-block. Everything else changes at the start of the block.
+//-----------------------------------------------------------------------------
+
+void SoftSynth::RenderBlock( float *pfOut )
+{
+    DrainPorts();
+
+    long long llFrame = m_llFrame.load( memory_order_relaxed ), llEnd = llFrame + BlockFrames;
+    size_t iDue = 0;
+    for ( ; iDue < m_vPending.size() && m_vPending[iDue].llFrame < llEnd; iDue++ )
+        PlayEvent( m_vPending[iDue].iMsg, static_cast< int >( max( m_vPending[iDue].llFrame - llFrame, 0LL ) ) );
+    m_vPending.erase( m_vPending.begin(), m_vPending.begin() + iDue );
+
+    // Each job mixes into its own buffer, summed after
+    int iActive = static_cast< int >( m_vActive.size() );
+    JobSystem &jobs = JobSystem::GetJobSystem();
+    int iJobs = max( 1, min( iActive / VoicesPerJob, jobs.GetWorkerCount() + 1 ) );
+    m_vMix.assign( iJobs * BlockFrames * 2, 0.0f );
+    if ( iJobs == 1 )
+        MixVoices( 0, iActive, &m_vMix[0], &m_vMix[BlockFrames] );
+    else
+        jobs.ParallelFor( iJobs, [this, iActive, iJobs]( int iJob )
+        {
+            float *pfMix = &m_vMix[iJob * BlockFrames * 2];
+            MixVoices( iActive * iJob / iJobs, iActive * ( iJob + 1 ) / iJobs, pfMix, pfMix + BlockFrames );
+        } );
+    for ( int iJob = 1; iJob < iJobs; iJob++ )
+        for ( int i = 0; i < BlockFrames * 2; i++ )
+            m_vMix[i] += m_vMix[iJob * BlockFrames * 2 + i];
+
+    // From the back, so what's moved into a freed slot has already been looked at
+    for ( int i = iActive - 1; i >= 0; i-- )
+        if ( m_vVoices[m_vActive[i]].eStage == Voice::Done )
+            FreeVoice( m_vActive[i] );
+
+    float fVolume = m_fVolume.load( memory_order_relaxed );
+    for ( int i = 0; i < BlockFrames; i++ )
+    {
+        pfOut[i * 2] = max( -1.0f, min( m_vMix[i] * fVolume, 1.0f ) );
+        pfOut[i * 2 + 1] = max( -1.0f, min( m_vMix[BlockFrames + i] * fVolume, 1.0f ) );
+    }
+
+    // Priorities will have moved on
+    m_vStealable.clear();
+
+    int iVoices = static_cast< int >( m_vActive.size() );
+    m_iVoices.store( iVoices, memory_order_relaxed );
+    if ( iVoices > m_iPeakVoices.load( memory_order_relaxed ) ) m_iPeakVoices.store( iVoices, memory_order_relaxed );
+    m_llFrame.store( llEnd, memory_order_release );
+    m_llBlocks.fetch_add( 1, memory_order_release );
+}
+
+//-----------------------------------------------------------------------------
+// Events
+//-----------------------------------------------------------------------------
+
+void SoftSynth::Channel::Reset( int iChannel )
+{
+    memset( acCC, 0, sizeof( acCC ) );
+    acCC[7] = 100;
+    acCC[10] = 64;
+    acCC[11] = 127;
+    iBank = ( iChannel == 9 ? SoundFont::DrumBank : 0 );
+    iProgram = 0;
+    pPreset = NULL;
+    iBend = 0;
+    fBendRange = 200.0f;
+    iRPN = 0x3FFF;
+    iPanSerial = 0;
+    UpdateGain();
+    UpdatePan();
+}
+
+// Squared, so the controllers are about linear in loudness
+void SoftSynth::Channel::UpdateGain()
+{
+    float fVolume = acCC[7] / 127.0f, fExpression = acCC[11] / 127.0f;
+    fGain = fVolume * fVolume * fExpression * fExpression;
+}
+
+void SoftSynth::Channel::UpdatePan()
+{
+    fPan = max( -1.0f, min( ( acCC[10] - 64 ) / 63.0f, 1.0f ) );
+    iPanSerial++;
+}
+
+void SoftSynth::PlayEvent( unsigned iMsg, int iOffset )
+{
+    int iChannel = iMsg & 0x0F;
+    int iParam1 = ( iMsg >> 8 ) & 0x7F, iParam2 = ( iMsg >> 16 ) & 0x7F;
+    Channel &channel = m_aChannels[iChannel];
+
+    switch ( iMsg & 0xF0 )
+    {
+        case 0x90:
+            if ( iParam2 > 0 )
+            {
+                NoteOn( iChannel, iParam1, iParam2, iOffset );
+                break;
+            }
+            // Velocity 0 is a note-off
+        case 0x80:
+            NoteOff( iChannel, iParam1, iOffset );
+            break;
+        case 0xB0:
+            ControlChange( iChannel, iParam1, iParam2, iOffset );
+            break;
+        case 0xC0:
+            channel.iProgram = iParam1;
+            channel.iBank = ( iChannel == 9 ? SoundFont::DrumBank : channel.acCC[0] );
+            channel.pPreset = m_SoundFont.FindPreset( channel.iBank, channel.iProgram );
+            break;
+        case 0xE0:
+            channel.iBend = ( iParam1 | ( iParam2 << 7 ) ) - 8192;
+            for ( vector< int >::iterator it = m_vActive.begin(); it != m_vActive.end(); ++it )
+                if ( m_vVoices[*it].cChannel == iChannel ) UpdatePitch( m_vVoices[*it] );
+            break;
+    }
+}
+
+void SoftSynth::NoteOn( int iChannel, int iKey, int iVelocity, int iOffset )
+{
+    Channel &channel = m_aChannels[iChannel];
+    if ( !channel.pPreset ) return;
+
+    // Hi-hats and the like cut each other off. All first, so a note's own regions don't
+    const vector< SFRegion > &vRegions = channel.pPreset->vRegions;
+    for ( vector< SFRegion >::const_iterator it = vRegions.begin(); it != vRegions.end(); ++it )
+        if ( it->iExclusiveClass != 0 && iKey >= it->cLoKey && iKey <= it->cHiKey && iVelocity >= it->cLoVel && iVelocity <= it->cHiVel )
+            for ( vector< int >::iterator itActive = m_vActive.begin(); itActive != m_vActive.end(); ++itActive )
+            {
+                Voice &other = m_vVoices[*itActive];
+                if ( other.cChannel == iChannel && other.pRegion->iExclusiveClass == it->iExclusiveClass )
+                    StartRelease( other, KillSecs );
+            }
+
+    for ( vector< SFRegion >::const_iterator it = vRegions.begin(); it != vRegions.end(); ++it )
+    {
+        const SFRegion &region = *it;
+        if ( iKey < region.cLoKey || iKey > region.cHiKey || iVelocity < region.cLoVel || iVelocity > region.cHiVel )
+            continue;
+
+        int iVoice = AllocVoice();
+        if ( iVoice < 0 ) return;
+
+        Voice &voice = m_vVoices[iVoice];
+        voice.pRegion = &region;
+        voice.iGeneration++;
+        voice.cChannel = static_cast< unsigned char >( iChannel );
+        voice.cKey = static_cast< unsigned char >( iKey );
+        voice.eStage = Voice::Delay;
+        voice.iStageFrames = static_cast< int >( region.fDelay * m_iRate );
+        voice.fLevel = 0.0f;
+        voice.fReleaseStep = 0.0f;
+        float fVelocity = iVelocity / 127.0f;
+        voice.fBaseGain = CBToGain( region.fAttenuation ) * fVelocity * fVelocity / 32768.0f;
+        voice.iStartFrame = iOffset;
+        voice.iReleaseFrame = -1;
+        voice.bSustained = false;
+        voice.ullPos = static_cast< unsigned long long >( region.uStart ) << 32;
+        voice.fCents = static_cast< float >( ( iKey - region.iRootKey ) * region.iScaleTuning + region.iTuneCents );
+        UpdatePitch( voice );
+        voice.iPanSerial = channel.iPanSerial - 1;
+        voice.fGainL = voice.fGainR = 0.0f;
+
+        // Onto the front of its key's list
+        int &iHead = m_vKeyHeads[iChannel * 128 + iKey];
+        voice.iPrev = -1;
+        voice.iNext = iHead;
+        if ( iHead >= 0 ) m_vVoices[iHead].iPrev = iVoice;
+        iHead = iVoice;
+        voice.bKeyed = true;
+    }
+}
+
+// Every voice the key has going. The pedal holds them instead, if it's down
+void SoftSynth::NoteOff( int iChannel, int iKey, int iOffset )
+{
+    bool bPedal = ( m_aChannels[iChannel].acCC[64] >= 64 );
+    while ( m_vKeyHeads[iChannel * 128 + iKey] >= 0 )
+    {
+        int iVoice = m_vKeyHeads[iChannel * 128 + iKey];
+        Unkey( iVoice );
+        if ( bPedal )
+            m_vVoices[iVoice].bSustained = true;
+        else
+            m_vVoices[iVoice].iReleaseFrame = iOffset;
+    }
+}
+
+void SoftSynth::ControlChange( int iChannel, int iController, int iValue, int iOffset )
+{
+    Channel &channel = m_aChannels[iChannel];
+    int iOldValue = channel.acCC[iController];
+    channel.acCC[iController] = static_cast< unsigned char >( iValue );
+
+    switch ( iController )
+    {
+        case 7: case 11:
+            channel.UpdateGain();
+            break;
+        case 10:
+            channel.UpdatePan();
+            break;
+        case 64:
+            if ( iOldValue >= 64 && iValue < 64 ) ReleaseSustained( iChannel, iOffset );
+            break;
+        case 6: case 38: // Data entry. Only pitch bend range's taken
+            if ( channel.iRPN == 0 )
+            {
+                channel.fBendRange = channel.acCC[6] * 100.0f + channel.acCC[38];
+                for ( vector< int >::iterator it = m_vActive.begin(); it != m_vActive.end(); ++it )
+                    if ( m_vVoices[*it].cChannel == iChannel ) UpdatePitch( m_vVoices[*it] );
+            }
+            break;
+        case 98: case 99:
+            channel.iRPN = 0x3FFF;
+            break;
+        case 100: case 101:
+            channel.iRPN = ( channel.acCC[101] << 7 ) | channel.acCC[100];
+            break;
+        case 120:
+            AllNotesOff( iChannel, true );
+            break;
+        case 121:
+            channel.iBend = 0;
+            channel.acCC[1] = channel.acCC[64] = 0;
+            channel.acCC[11] = 127;
+            channel.iRPN = 0x3FFF;
+            channel.UpdateGain();
+            ReleaseSustained( iChannel, iOffset );
+            for ( vector< int >::iterator it = m_vActive.begin(); it != m_vActive.end(); ++it )
+                if ( m_vVoices[*it].cChannel == iChannel ) UpdatePitch( m_vVoices[*it] );
+            break;
+        case 123:
+            AllNotesOff( iChannel, false );
+            break;
+    }
+}
+
+void SoftSynth::ReleaseSustained( int iChannel, int iOffset )
+{
+    for ( vector< int >::iterator it = m_vActive.begin(); it != m_vActive.end(); ++it )
+    {
+        Voice &voice = m_vVoices[*it];
+        if ( voice.cChannel == iChannel && voice.bSustained )
+        {
+            voice.bSustained = false;
+            voice.iReleaseFrame = iOffset;
+        }
+    }
+}
+
+// Killing fades them out quickly instead of releasing them normally
+void SoftSynth::AllNotesOff( int iChannel, bool bKill )
+{
+    for ( vector< int >::iterator it = m_vActive.begin(); it != m_vActive.end(); ++it )
+    {
+        Voice &voice = m_vVoices[*it];
+        if ( voice.cChannel != iChannel ) continue;
+
+        if ( voice.bKeyed ) Unkey( *it );
+        voice.bSustained = false;
+        if ( bKill )
+            StartRelease( voice, KillSecs );
+        else
+            voice.iReleaseFrame = 0;
+    }
+}
+
+void SoftSynth::UpdatePitch( Voice &voice )
+{
+    const Channel &channel = m_aChannels[voice.cChannel];
+    float fCents = voice.fCents + channel.iBend * channel.fBendRange / 8192.0f;
+    double dRatio = pow( 2.0, fCents / 1200.0 ) * voice.pRegion->iSampleRate / m_iRate;
+    voice.ullStep = max( static_cast< unsigned long long >( dRatio * 4294967296.0 ), 1ULL );
+}
+
+//-----------------------------------------------------------------------------
+// Voices
+//-----------------------------------------------------------------------------
+
+int SoftSynth::AllocVoice()
+{
+    if ( m_vFree.empty() && StealVoice() < 0 ) return -1;
+
+    int iVoice = m_vFree.back();
+    m_vFree.pop_back();
+    m_vVoices[iVoice].iActivePos = static_cast< int >( m_vActive.size() );
+    m_vVoices[iVoice].bKeyed = false;
+    m_vActive.push_back( iVoice );
+    return iVoice;
+}
+
+// Frees the voice least missed. Picking is a partial sort of every voice, so a batch is picked at
+// a time and used up till the block's over, skipping any that have ended or been stolen since
+int SoftSynth::StealVoice()
+{
+    while ( !m_vStealable.empty() )
+    {
+        pair< int, unsigned > stealable = m_vStealable.back();
+        m_vStealable.pop_back();
+        const Voice &voice = m_vVoices[stealable.first];
+        if ( voice.iGeneration != stealable.second || voice.iActivePos < 0 ) continue;
+
+        FreeVoice( stealable.first );
+        m_llStolen.fetch_add( 1, memory_order_relaxed );
+        return stealable.first;
+    }
+    if ( m_vActive.empty() ) return -1;
+
+    // About how loud each is. Released voices count for a tenth
+    vector< pair< float, int > > vLoudness;
+    vLoudness.reserve( m_vActive.size() );
+    for ( vector< int >::iterator it = m_vActive.begin(); it != m_vActive.end(); ++it )
+    {
+        const Voice &voice = m_vVoices[*it];
+        float fLoudness = voice.fBaseGain * m_aChannels[voice.cChannel].fGain;
+        if ( voice.eStage > Voice::Attack ) fLoudness *= CBToGain( voice.fLevel );
+        if ( voice.eStage >= Voice::Release || voice.iReleaseFrame >= 0 ) fLoudness *= 0.1f;
+        vLoudness.push_back( make_pair( fLoudness, *it ) );
+    }
+
+    // Quietest at the back
+    size_t iBatch = min( vLoudness.size(), static_cast< size_t >( StealBatch ) );
+    nth_element( vLoudness.begin(), vLoudness.begin() + iBatch - 1, vLoudness.end() );
+    sort( vLoudness.begin(), vLoudness.begin() + iBatch, greater< pair< float, int > >() );
+    for ( size_t i = 0; i < iBatch; i++ )
+        m_vStealable.push_back( make_pair( vLoudness[i].second, m_vVoices[vLoudness[i].second].iGeneration ) );
+    return StealVoice();
+}
+
+void SoftSynth::FreeVoice( int iVoice )
+{
+    Voice &voice = m_vVoices[iVoice];
+    if ( voice.bKeyed ) Unkey( iVoice );
+
+    int iMoved = m_vActive.back();
+    m_vActive[voice.iActivePos] = iMoved;
+    m_vVoices[iMoved].iActivePos = voice.iActivePos;
+    m_vActive.pop_back();
+    voice.iActivePos = -1;
+    voice.eStage = Voice::Done;
+    m_vFree.push_back( iVoice );
+}
+
+void SoftSynth::Unkey( int iVoice )
+{
+    Voice &voice = m_vVoices[iVoice];
+    if ( voice.iPrev >= 0 )
+        m_vVoices[voice.iPrev].iNext = voice.iNext;
+    else
+        m_vKeyHeads[voice.cChannel * 128 + voice.cKey] = voice.iNext;
+    if ( voice.iNext >= 0 ) m_vVoices[voice.iNext].iPrev = voice.iPrev;
+    voice.bKeyed = false;
+}
+
+void SoftSynth::MixVoices( int iFirst, int iEnd, float *pfMixL, float *pfMixR )
+{
+    for ( int i = iFirst; i < iEnd; i++ )
+        MixVoice( m_vVoices[m_vActive[i]], pfMixL, pfMixR );
+}
+
+// A sub-block at a time, from where it starts. Channels and the font are only read, so this can
+// run on any thread as long as it has the voice to itself
+void SoftSynth::MixVoice( Voice &voice, float *pfMixL, float *pfMixR )
+{
+    const Channel &channel = m_aChannels[voice.cChannel];
+    if ( voice.iPanSerial != channel.iPanSerial )
+    {
+        // Equal power
+        float fPan = max( -1.0f, min( voice.pRegion->fPan + channel.fPan, 1.0f ) );
+        float fAngle = ( fPan + 1.0f ) * 0.785398163f;
+        voice.fPanL = cosf( fAngle );
+        voice.fPanR = sinf( fAngle );
+        voice.iPanSerial = channel.iPanSerial;
+    }
+
+    for ( int iSub = 0; iSub < BlockFrames && voice.eStage != Voice::Done; iSub += SubBlockFrames )
+    {
+        int iSubEnd = iSub + SubBlockFrames, iFrom = iSub;
+        if ( voice.iStartFrame >= 0 )
+        {
+            if ( voice.iStartFrame >= iSubEnd ) continue;
+            iFrom = voice.iStartFrame;
+            voice.iStartFrame = -1;
+        }
+
+        int iFrames = iSubEnd - iFrom;
+        float fGain = StepEnvelope( voice, iFrames ) * voice.fBaseGain * channel.fGain;
+        float fGainL = fGain * voice.fPanL, fGainR = fGain * voice.fPanR;
+        MixRun( voice, iFrom, iSubEnd, ( fGainL - voice.fGainL ) / iFrames, ( fGainR - voice.fGainR ) / iFrames, pfMixL, pfMixR );
+        voice.fGainL = fGainL;
+        voice.fGainR = fGainR;
+
+        if ( voice.iReleaseFrame >= 0 && voice.iReleaseFrame < iSubEnd )
+        {
+            StartRelease( voice, voice.pRegion->fRelease );
+            voice.iReleaseFrame = -1;
+        }
+    }
+}
+
+// Straight runs up to the loop's end or the sample's, so the inner loop needn't check
+void SoftSynth::MixRun( Voice &voice, int iFrom, int iTo, float fStepL, float fStepR, float *pfMixL, float *pfMixR )
+{
+    const SFRegion &region = *voice.pRegion;
+    const short *psSamples = &m_SoundFont.GetSamples()[0];
+    float fGainL = voice.fGainL, fGainR = voice.fGainR;
+    for ( int i = iFrom; i < iTo; )
+    {
+        bool bLoop = ( region.eLoopMode == SFRegion::Loop || ( region.eLoopMode == SFRegion::LoopTillRelease && voice.eStage < Voice::Release ) );
+        unsigned long long ullEnd = static_cast< unsigned long long >( bLoop ? region.uLoopEnd : region.uEnd ) << 32;
+        if ( voice.ullPos >= ullEnd )
+        {
+            if ( !bLoop )
+            {
+                voice.eStage = Voice::Done;
+                return;
+            }
+            unsigned long long ullLoopStart = static_cast< unsigned long long >( region.uLoopStart ) << 32;
+            voice.ullPos = ullLoopStart + ( voice.ullPos - ullLoopStart ) % ( ullEnd - ullLoopStart );
+            continue;
+        }
+
+        unsigned long long ullLeft = ( ullEnd - voice.ullPos + voice.ullStep - 1 ) / voice.ullStep;
+        int n = static_cast< int >( min( static_cast< unsigned long long >( iTo - i ), ullLeft ) );
+        MixFrames( psSamples, voice.ullPos, voice.ullStep, n, fGainL, fGainR, fStepL, fStepR, pfMixL + i, pfMixR + i );
+        voice.ullPos += voice.ullStep * n;
+        fGainL += fStepL * n;
+        fGainR += fStepR * n;
+        i += n;
+    }
+}
+
+// Moves the envelope on and returns its gain at the end. Attack's a linear
+// rise, the rest straight lines in centibels.
+float SoftSynth::StepEnvelope( Voice &voice, int iFrames )
+{
+    const SFRegion &region = *voice.pRegion;
+    while ( iFrames > 0 && voice.eStage != Voice::Done )
+    {
+        int iTake;
+        switch ( voice.eStage )
+        {
+            case Voice::Delay:
+                iTake = min( iFrames, voice.iStageFrames );
+                voice.iStageFrames -= iTake;
+                iFrames -= iTake;
+                if ( voice.iStageFrames == 0 )
+                {
+                    voice.eStage = Voice::Attack;
+                    voice.iStageFrames = max( static_cast< int >( region.fAttack * m_iRate ), 1 );
+                }
+                break;
+            case Voice::Attack:
+                iTake = min( iFrames, voice.iStageFrames );
+                voice.fLevel += static_cast< float >( iTake ) / max( static_cast< int >( region.fAttack * m_iRate ), 1 );
+                voice.iStageFrames -= iTake;
+                iFrames -= iTake;
+                if ( voice.iStageFrames == 0 )
+                {
+                    voice.eStage = Voice::Hold;
+                    voice.iStageFrames = static_cast< int >( region.fHold * m_iRate );
+                    voice.fLevel = 0.0f;
+                }
+                break;
+            case Voice::Hold:
+                iTake = min( iFrames, voice.iStageFrames );
+                voice.iStageFrames -= iTake;
+                iFrames -= iTake;
+                if ( voice.iStageFrames == 0 ) voice.eStage = Voice::Decay;
+                break;
+            case Voice::Decay:
+            {
+                float fStep = EnvRangeCB / max( region.fDecay * m_iRate, 1.0f );
+                voice.fLevel += fStep * iFrames;
+                iFrames = 0;
+                if ( voice.fLevel >= region.fSustain )
+                {
+                    voice.fLevel = region.fSustain;
+                    voice.eStage = ( voice.fLevel >= SilentCB ? Voice::Done : Voice::Sustain );
+                }
+                break;
+            }
+            case Voice::Sustain:
+                iFrames = 0;
+                break;
+            case Voice::Release:
+                voice.fLevel += voice.fReleaseStep * iFrames;
+                iFrames = 0;
+                if ( voice.fLevel >= SilentCB ) voice.eStage = Voice::Done;
+                break;
+            default:
+                break;
+        }
+    }
+
+    switch ( voice.eStage )
+    {
+        case Voice::Delay: return 0.0f;
+        case Voice::Attack: return voice.fLevel;
+        case Voice::Done: return 0.0f;
+        default: return CBToGain( voice.fLevel );
+    }
+}
+
+// Falls EnvRangeCB over the time, from wherever it's got to
+void SoftSynth::StartRelease( Voice &voice, float fSecs )
+{
+    if ( voice.eStage >= Voice::Release ) return;
+
+    if ( voice.eStage == Voice::Delay )
+        voice.fLevel = SilentCB;
+    else if ( voice.eStage == Voice::Attack )
+        voice.fLevel = -200.0f * log10f( max( voice.fLevel, 1e-5f ) );
+    voice.eStage = Voice::Release;
+    voice.fReleaseStep = EnvRangeCB / max( fSecs * m_iRate, 1.0f );
+}
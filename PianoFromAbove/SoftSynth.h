@@ -0,0 +1,196 @@
+/*************************************************************************************************
+*
+* File: SoftSynth.h
+*
+* Description: Defines the built-in synth. Plays a SoundFont straight to an audio sink, skipping
+*              the system's MIDI synth and its latency
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <future>
+using namespace std;
+
+#include "MIDIDriver.h"
+#include "SoundFont.h"
+#include "AudioSink.h"
+#include "Misc.h"
+
+//-----------------------------------------------------------------------------
+// The engine renders on its own thread, a block at a time, and the sink's
+// blocking write paces it. The rest of the app talks to it through ports:
+// MIDI outputs that hand messages over a lock-free queue, so playback never
+// waits on rendering. Each block takes whatever's queued, so a message plays
+// at most a block plus the sink's latency after it's sent. Scheduled ports
+// keep the spacing between messages instead, a block behind.
+//
+// Voices are mixed 4 frames at a time with SSE2, each a 16-bit sample read
+// at a 32.32 fixed-point position and linearly interpolated. Envelopes are
+// worked out in centibels once a sub-block and the gain ramped across it.
+// When they run out, the quietest voices are stolen first, released ones
+// before held. With enough voices, mixing is split over the job system.
+// No filter, modulation envelope or LFOs.
+//-----------------------------------------------------------------------------
+
+class SoftSynth
+{
+public:
+    static const int BlockFrames = 128; // Rendered and written at a time
+    static const int SubBlockFrames = 32; // Envelopes step and note-offs land on these
+    static const int DefaultRate = 48000; // Asked of the sink. It may run at its own
+    static const int DefaultMaxVoices = 4096;
+    static const int MaxPorts = 8;
+
+    struct Stats
+    {
+        int iRate;
+        int iLatencyFrames; // The sink's plus a block
+        int iVoices, iPeakVoices;
+        long long llStolen;
+    };
+
+    static SoftSynth &GetSynth();
+    static const wchar_t *GetDeviceName() { return L"Piano From Above Synth"; }
+
+    // These only work while no port is open. An empty name unloads
+    bool SetSoundFont( const wstring &sFilename );
+    bool HasSoundFont() const { return !m_SoundFont.GetPresets().empty(); }
+    bool SetSink( AudioSink *pSink ); // NULL for the platform's. Caller keeps ownership
+    bool SetMaxVoices( int iMaxVoices );
+
+    void SetVolume( double dVolume ) { m_fVolume = static_cast< float >( dVolume ); }
+    Stats GetStats() const;
+
+    MIDIOutPort *CreatePort(); // Caller deletes
+
+    // Without the thread or a sink, for rendering offline. Start resets everything. Frames are
+    // interleaved stereo, any count. Ports can't be open meanwhile, so messages go in with Play
+    bool StartOffline( int iRate );
+    void Play( const MIDIShortMsg *pMsgs, int iMsgs ); // Played at the next render
+    void Render( float *pfOut, int iFrames );
+    void StopOffline() { m_bRunning = false; }
+
+private:
+    class Port;
+    friend class Port;
+
+    struct Event
+    {
+        long long llFrame; // When to play it. Anything already past plays at the next block
+        unsigned iMsg;
+    };
+    typedef TSQueue< Event, 16384 > EventQueue;
+
+    struct Voice
+    {
+        enum Stage { Delay, Attack, Hold, Decay, Sustain, Release, Done };
+
+        const SFRegion *pRegion;
+        unsigned iGeneration; // Bumped each use, so a stale reference to a stolen voice can tell
+        unsigned char cChannel, cKey;
+        int iPrev, iNext; // Others on the same channel and key
+        int iActivePos; // In m_vActive
+
+        Stage eStage;
+        int iStageFrames; // Left in the stage, or into it for attack
+        float fLevel; // Centibels below the peak. During attack, the linear level instead
+        float fReleaseStep; // Centibels a frame
+        float fBaseGain; // Velocity and the region's attenuation
+        int iStartFrame, iReleaseFrame; // Within this block. -1 once passed
+        bool bSustained; // Off, but the pedal's holding it
+        bool bKeyed; // In its key's list, so a note-off can find it
+
+        unsigned long long ullPos, ullStep; // 32.32 frames
+        float fCents; // Pitch, less the bend
+        float fPanL, fPanR;
+        unsigned iPanSerial; // The channel's when the pan was worked out
+        float fGainL, fGainR; // Where the last sub-block's ramp ended
+    };
+
+    struct Channel
+    {
+        void Reset( int iChannel );
+        void UpdateGain();
+        void UpdatePan();
+
+        const SFPreset *pPreset;
+        int iBank, iProgram;
+        unsigned char acCC[128];
+        int iBend; // -8192 to 8191
+        float fBendRange; // Cents
+        int iRPN; // Selected by CCs 101 and 100. 0x3FFF for none
+        float fGain; // Volume and expression
+        float fPan; // -1 to 1
+        unsigned iPanSerial; // Bumped when the pan changes, so voices know to redo theirs
+    };
+
+    SoftSynth();
+    ~SoftSynth();
+    SoftSynth( const SoftSynth& );
+    SoftSynth &operator=( const SoftSynth& );
+
+    // Ports
+    bool AddPort( Port *pPort );
+    void RemovePort( Port *pPort );
+    long long GetFrame() const { return m_llFrame.load( memory_order_acquire ); }
+
+    // The engine
+    bool Start();
+    void Stop();
+    void RenderThread( AudioSink *pSink, bool bOwnSink, promise< bool > *pStarted );
+    void Reset( int iRate );
+    void RenderBlock( float *pfOut );
+    void DrainPorts();
+
+    // Events
+    void PlayEvent( unsigned iMsg, int iOffset );
+    void NoteOn( int iChannel, int iKey, int iVelocity, int iOffset );
+    void NoteOff( int iChannel, int iKey, int iOffset );
+    void ControlChange( int iChannel, int iController, int iValue, int iOffset );
+    void ReleaseSustained( int iChannel, int iOffset );
+    void AllNotesOff( int iChannel, bool bKill );
+    void UpdatePitch( Voice &voice );
+
+    // Voices
+    int AllocVoice();
+    int StealVoice();
+    void FreeVoice( int iVoice );
+    void Unkey( int iVoice );
+    void MixVoices( int iFirst, int iEnd, float *pfMixL, float *pfMixR );
+    void MixVoice( Voice &voice, float *pfMixL, float *pfMixR );
+    void MixRun( Voice &voice, int iFrom, int iTo, float fStepL, float fStepR, float *pfMixL, float *pfMixR );
+    float StepEnvelope( Voice &voice, int iFrames );
+    void StartRelease( Voice &voice, float fSecs );
+
+    SoundFont m_SoundFont;
+    AudioSink *m_pSink;
+    int m_iMaxVoices;
+    atomic< float > m_fVolume;
+
+    // The thread, and the ports that feed it. A slot's only emptied while the thread's not in it
+    mutex m_mtxPorts;
+    thread m_thRender;
+    atomic< bool > m_bQuit;
+    bool m_bRunning;
+    int m_iPorts;
+    atomic< Port* > m_apPorts[MaxPorts];
+    atomic< long long > m_llFrame, m_llBlocks;
+
+    // Everything below is the render thread's
+    int m_iRate, m_iLatencyFrames;
+    Channel m_aChannels[16];
+    vector< Event > m_vPending; // Taken from the ports but not due yet
+    vector< Voice > m_vVoices;
+    vector< int > m_vFree, m_vActive;
+    vector< int > m_vKeyHeads; // First voice per channel and key
+    vector< pair< int, unsigned > > m_vStealable; // Voice and generation, the best to steal last
+    vector< float > m_vMix; // Left and right planes per job
+    atomic< int > m_iVoices, m_iPeakVoices;
+    atomic< long long > m_llStolen;
+};
@@ -0,0 +1,276 @@
+/*************************************************************************************************
+*
+* File: SoundFont.cpp
+*
+* Description: Implements the SoundFont 2 reader
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <filesystem>
+
+#include "SoundFont.h"
+
+//-----------------------------------------------------------------------------
+// The file. RIFF chunks, little-endian throughout
+//-----------------------------------------------------------------------------
+
+namespace
+{
+    // The generators we use, numbered as in the spec
+    enum Generator
+    {
+        StartAddrsOffset = 0, EndAddrsOffset = 1, StartloopAddrsOffset = 2, EndloopAddrsOffset = 3,
+        StartAddrsCoarseOffset = 4, EndAddrsCoarseOffset = 12, Pan = 17,
+        DelayVolEnv = 33, AttackVolEnv = 34, HoldVolEnv = 35, DecayVolEnv = 36, SustainVolEnv = 37, ReleaseVolEnv = 38,
+        Instrument = 41, KeyRange = 43, VelRange = 44, StartloopAddrsCoarseOffset = 45, InitialAttenuation = 48,
+        EndloopAddrsCoarseOffset = 50, CoarseTune = 51, FineTune = 52, SampleID = 53, SampleModes = 54,
+        ScaleTuning = 56, ExclusiveClass = 57, OverridingRootKey = 58, GenCount = 61
+    };
+
+    struct Chunk
+    {
+        const char *pcData;
+        unsigned uSize;
+    };
+
+    // Record sizes on disk
+    const unsigned PHdrSize = 38, BagSize = 4, GenSize = 4, InstSize = 22, SHdrSize = 46;
+
+    unsigned Read16( const char *pcData ) { return static_cast< unsigned char >( pcData[0] ) | ( static_cast< unsigned char >( pcData[1] ) << 8 ); }
+    unsigned Read32( const char *pcData ) { return Read16( pcData ) | ( Read16( pcData + 2 ) << 16 ); }
+
+    // The sub-chunks of a chunk, by ID. Misses are left empty
+    void FindChunks( const char *pcData, size_t iSize, const char *const *ppcIDs, Chunk *pChunks, int iChunks )
+    {
+        memset( pChunks, 0, iChunks * sizeof( Chunk ) );
+        for ( size_t iPos = 0; iPos + 8 <= iSize; )
+        {
+            unsigned uSize = Read32( pcData + iPos + 4 );
+            if ( uSize > iSize - iPos - 8 ) break;
+            for ( int i = 0; i < iChunks; i++ )
+                if ( memcmp( pcData + iPos, ppcIDs[i], 4 ) == 0 ||
+                     ( memcmp( pcData + iPos, "LIST", 4 ) == 0 && uSize >= 4 && memcmp( pcData + iPos + 8, ppcIDs[i], 4 ) == 0 ) )
+                {
+                    bool bList = ( memcmp( pcData + iPos, "LIST", 4 ) == 0 );
+                    pChunks[i].pcData = pcData + iPos + ( bList ? 12 : 8 );
+                    pChunks[i].uSize = uSize - ( bList ? 4 : 0 );
+                }
+            iPos += 8 + uSize + ( uSize & 1 );
+        }
+    }
+
+    // A zone's generators. Instrument zones start at the defaults, preset zones at nothing
+    struct Zone
+    {
+        short aGen[GenCount];
+
+        void SetInstDefaults()
+        {
+            memset( aGen, 0, sizeof( aGen ) );
+            aGen[DelayVolEnv] = aGen[AttackVolEnv] = aGen[HoldVolEnv] = -12000;
+            aGen[DecayVolEnv] = aGen[ReleaseVolEnv] = -12000;
+            aGen[KeyRange] = aGen[VelRange] = 127 << 8;
+            aGen[ScaleTuning] = 100;
+            aGen[OverridingRootKey] = -1;
+        }
+        void SetPresetDefaults()
+        {
+            memset( aGen, 0, sizeof( aGen ) );
+            aGen[KeyRange] = aGen[VelRange] = 127 << 8;
+        }
+
+        // Gens in [iFirst, iEnd) of the gen chunk. Returns the terminal generator's amount (instrument
+        // or sample ID) or -1 if the zone hasn't one, meaning it's global
+        int Apply( const Chunk &gens, unsigned iFirst, unsigned iEnd, int iTerminal )
+        {
+            int iResult = -1;
+            for ( unsigned i = iFirst; i < iEnd && ( i + 1 ) * GenSize <= gens.uSize; i++ )
+            {
+                const char *pcGen = gens.pcData + i * GenSize;
+                unsigned uOper = Read16( pcGen );
+                if ( uOper >= GenCount ) continue;
+                aGen[uOper] = static_cast< short >( Read16( pcGen + 2 ) );
+                if ( static_cast< int >( uOper ) == iTerminal ) { iResult = static_cast< unsigned short >( aGen[uOper] ); break; }
+            }
+            return iResult;
+        }
+
+        unsigned char Lo( int iGen ) const { return static_cast< unsigned char >( aGen[iGen] & 0xFF ); }
+        unsigned char Hi( int iGen ) const { return static_cast< unsigned char >( ( aGen[iGen] >> 8 ) & 0xFF ); }
+    };
+
+    float TimecentsToSecs( int iTimecents )
+    {
+        return iTimecents <= -12000 ? 0.0f : static_cast< float >( pow( 2.0, iTimecents / 1200.0 ) );
+    }
+}
+
+bool SoundFont::Load( const wstring &sFilename )
+{
+    ifstream ifs( filesystem::path( sFilename ), ios::in | ios::binary | ios::ate );
+    if ( !ifs.is_open() )
+        return false;
+
+    size_t iSize = static_cast< size_t >( ifs.tellg() );
+    vector< char > vData( iSize );
+    ifs.seekg( 0, ios::beg );
+    if ( iSize > 0 ) ifs.read( &vData[0], iSize );
+    ifs.close();
+
+    return iSize > 0 && Load( &vData[0], iSize );
+}
+
+bool SoundFont::Load( const char *pcData, size_t iSize )
+{
+    Clear();
+    if ( iSize < 12 || memcmp( pcData, "RIFF", 4 ) != 0 || memcmp( pcData + 8, "sfbk", 4 ) != 0 )
+        return false;
+    iSize = max( min( iSize, static_cast< size_t >( Read32( pcData + 4 ) ) + 8 ), static_cast< size_t >( 12 ) ) - 12;
+    pcData += 12;
+
+    static const char *const apcLists[] = { "sdta", "pdta" };
+    Chunk aLists[2];
+    FindChunks( pcData, iSize, apcLists, aLists, 2 );
+
+    static const char *const apcSmpl[] = { "smpl" };
+    Chunk smpl;
+    FindChunks( aLists[0].pcData, aLists[0].uSize, apcSmpl, &smpl, 1 );
+
+    enum { PHdr, PBag, PGen, Inst, IBag, IGen, SHdr, PdtaChunks };
+    static const char *const apcPdta[] = { "phdr", "pbag", "pgen", "inst", "ibag", "igen", "shdr" };
+    Chunk aPdta[PdtaChunks];
+    FindChunks( aLists[1].pcData, aLists[1].uSize, apcPdta, aPdta, PdtaChunks );
+    for ( int i = 0; i < PdtaChunks; i++ )
+        if ( !aPdta[i].pcData ) return false;
+    if ( !smpl.pcData ) return false;
+
+    // Samples, then the padding
+    unsigned uFrames = smpl.uSize / 2;
+    m_vSamples.resize( uFrames + SamplePad );
+    for ( unsigned i = 0; i < uFrames; i++ )
+        m_vSamples[i] = static_cast< short >( Read16( smpl.pcData + i * 2 ) );
+
+    // Each list ends with a terminal record, so the last real one's range can be found
+    unsigned uPresets = aPdta[PHdr].uSize / PHdrSize, uPBags = aPdta[PBag].uSize / BagSize;
+    unsigned uInsts = aPdta[Inst].uSize / InstSize, uIBags = aPdta[IBag].uSize / BagSize;
+    unsigned uSHdrs = aPdta[SHdr].uSize / SHdrSize;
+    if ( uPresets < 1 || uInsts < 1 || uSHdrs < 1 ) return false;
+
+    for ( unsigned iPreset = 0; iPreset + 1 < uPresets; iPreset++ )
+    {
+        const char *pcPHdr = aPdta[PHdr].pcData + iPreset * PHdrSize;
+        SFPreset preset;
+        preset.sName.assign( pcPHdr, strnlen( pcPHdr, 20 ) );
+        preset.iProgram = Read16( pcPHdr + 20 );
+        preset.iBank = Read16( pcPHdr + 22 );
+        unsigned uBag = Read16( pcPHdr + 24 ), uBagEnd = min( Read16( pcPHdr + PHdrSize + 24 ), uPBags - 1 );
+
+        Zone pGlobal;
+        pGlobal.SetPresetDefaults();
+        for ( unsigned iPBag = uBag; iPBag < uBagEnd; iPBag++ )
+        {
+            const char *pcBag = aPdta[PBag].pcData + iPBag * BagSize;
+            Zone pZone = pGlobal;
+            int iInst = pZone.Apply( aPdta[PGen], Read16( pcBag ), Read16( pcBag + BagSize ), Instrument );
+            if ( iInst < 0 )
+            {
+                if ( iPBag == uBag ) pGlobal = pZone;
+                continue;
+            }
+            if ( iInst + 1 >= static_cast< int >( uInsts ) ) continue;
+
+            const char *pcInst = aPdta[Inst].pcData + iInst * InstSize;
+            unsigned uIBag = Read16( pcInst + 20 ), uIBagEnd = min( Read16( pcInst + InstSize + 20 ), uIBags - 1 );
+            Zone iGlobal;
+            iGlobal.SetInstDefaults();
+            for ( unsigned iIBag = uIBag; iIBag < uIBagEnd; iIBag++ )
+            {
+                const char *pcIBag = aPdta[IBag].pcData + iIBag * BagSize;
+                Zone iZone = iGlobal;
+                int iSample = iZone.Apply( aPdta[IGen], Read16( pcIBag ), Read16( pcIBag + BagSize ), SampleID );
+                if ( iSample < 0 )
+                {
+                    if ( iIBag == uIBag ) iGlobal = iZone;
+                    continue;
+                }
+                if ( iSample + 1 >= static_cast< int >( uSHdrs ) ) continue;
+
+                // Ranges intersect
+                SFRegion r;
+                r.cLoKey = max( iZone.Lo( KeyRange ), pZone.Lo( KeyRange ) );
+                r.cHiKey = min( iZone.Hi( KeyRange ), pZone.Hi( KeyRange ) );
+                r.cLoVel = max( iZone.Lo( VelRange ), pZone.Lo( VelRange ) );
+                r.cHiVel = min( iZone.Hi( VelRange ), pZone.Hi( VelRange ) );
+                if ( r.cLoKey > r.cHiKey || r.cLoVel > r.cHiVel ) continue;
+
+                // Skips ROM samples: we don't have the ROM
+                const char *pcSHdr = aPdta[SHdr].pcData + iSample * SHdrSize;
+                if ( Read16( pcSHdr + 44 ) & 0x8000 ) continue;
+                r.iSampleRate = Read32( pcSHdr + 36 );
+                if ( r.iSampleRate <= 0 ) continue;
+
+                // Addresses are only set by instruments
+                const short *aI = iZone.aGen;
+                long long llStart = Read32( pcSHdr + 20 ) + aI[StartAddrsOffset] + aI[StartAddrsCoarseOffset] * 32768LL;
+                long long llEnd = Read32( pcSHdr + 24 ) + aI[EndAddrsOffset] + aI[EndAddrsCoarseOffset] * 32768LL;
+                long long llLoopStart = Read32( pcSHdr + 28 ) + aI[StartloopAddrsOffset] + aI[StartloopAddrsCoarseOffset] * 32768LL;
+                long long llLoopEnd = Read32( pcSHdr + 32 ) + aI[EndloopAddrsOffset] + aI[EndloopAddrsCoarseOffset] * 32768LL;
+                llEnd = min( llEnd, static_cast< long long >( uFrames ) );
+                llStart = max( 0LL, min( llStart, llEnd ) );
+                if ( llStart >= llEnd ) continue;
+                r.uStart = static_cast< unsigned >( llStart );
+                r.uEnd = static_cast< unsigned >( llEnd );
+
+                r.eLoopMode = static_cast< SFRegion::LoopMode >( aI[SampleModes] & 3 );
+                if ( r.eLoopMode == 2 ) r.eLoopMode = SFRegion::NoLoop;
+                if ( llLoopStart < llStart || llLoopEnd > llEnd || llLoopEnd - llLoopStart < 2 )
+                    r.eLoopMode = SFRegion::NoLoop;
+                r.uLoopStart = static_cast< unsigned >( max( llLoopStart, llStart ) );
+                r.uLoopEnd = static_cast< unsigned >( max( min( llLoopEnd, llEnd ), llLoopStart ) );
+
+                int iOriginalKey = static_cast< unsigned char >( pcSHdr[40] );
+                r.iRootKey = ( aI[OverridingRootKey] >= 0 ? aI[OverridingRootKey] : iOriginalKey <= 127 ? iOriginalKey : 60 );
+                r.iExclusiveClass = aI[ExclusiveClass];
+
+                // The rest add
+                int aGen[GenCount];
+                for ( int i = 0; i < GenCount; i++ )
+                    aGen[i] = aI[i] + pZone.aGen[i];
+                r.iTuneCents = aGen[CoarseTune] * 100 + aGen[FineTune] + static_cast< signed char >( pcSHdr[41] );
+                r.iScaleTuning = aGen[ScaleTuning];
+                r.fAttenuation = static_cast< float >( max( aGen[InitialAttenuation], 0 ) );
+                r.fPan = max( -500, min( aGen[Pan], 500 ) ) / 500.0f;
+                r.fDelay = TimecentsToSecs( aGen[DelayVolEnv] );
+                r.fAttack = TimecentsToSecs( aGen[AttackVolEnv] );
+                r.fHold = TimecentsToSecs( aGen[HoldVolEnv] );
+                r.fDecay = TimecentsToSecs( aGen[DecayVolEnv] );
+                r.fSustain = static_cast< float >( max( 0, min( aGen[SustainVolEnv], 1440 ) ) );
+                r.fRelease = TimecentsToSecs( aGen[ReleaseVolEnv] );
+                preset.vRegions.push_back( r );
+            }
+        }
+        m_vPresets.push_back( preset );
+    }
+
+    stable_sort( m_vPresets.begin(), m_vPresets.end(), []( const SFPreset &a, const SFPreset &b )
+        { return a.iBank != b.iBank ? a.iBank < b.iBank : a.iProgram < b.iProgram; } );
+    return !m_vPresets.empty();
+}
+
+const SFPreset *SoundFont::FindPreset( int iBank, int iProgram ) const
+{
+    auto itBank = lower_bound( m_vPresets.begin(), m_vPresets.end(), iBank,
+                               []( const SFPreset &p, int iBank ) { return p.iBank < iBank; } );
+    for ( auto it = itBank; it != m_vPresets.end() && it->iBank == iBank; ++it )
+        if ( it->iProgram == iProgram ) return &*it;
+
+    // Missing drum kits stay silent rather than play a melodic preset
+    if ( iBank != 0 && iBank != DrumBank ) return FindPreset( 0, iProgram );
+    if ( itBank != m_vPresets.end() && itBank->iBank == iBank ) return &*itBank;
+    return iBank == 0 && !m_vPresets.empty() ? &m_vPresets[0] : NULL;
+}
@@ -0,0 +1,71 @@
+/*************************************************************************************************
+*
+* File: SoundFont.h
+*
+* Description: Defines the SoundFont 2 reader. Presets come out flattened into regions, each a
+*              sample and everything needed to play it
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <vector>
+#include <string>
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// A region is one preset zone crossed with one instrument zone: the
+// instrument's generators with the preset's added on. Only what the synth
+// plays is kept. Times are in seconds, levels in centibels of attenuation.
+//-----------------------------------------------------------------------------
+
+struct SFRegion
+{
+    enum LoopMode { NoLoop = 0, Loop = 1, LoopTillRelease = 3 };
+
+    unsigned char cLoKey, cHiKey, cLoVel, cHiVel;
+    unsigned uStart, uEnd, uLoopStart, uLoopEnd; // Into the font's sample data, in frames
+    int iSampleRate;
+    int iRootKey;
+    int iTuneCents; // Coarse, fine and the sample's own correction
+    int iScaleTuning; // Cents per key
+    LoopMode eLoopMode;
+    int iExclusiveClass; // A note cuts off others on its channel with the same class. 0 for none
+    float fAttenuation;
+    float fPan; // -1 left to 1 right
+
+    // Volume envelope
+    float fDelay, fAttack, fHold, fDecay, fRelease;
+    float fSustain; // Below the peak
+};
+
+struct SFPreset
+{
+    int iBank, iProgram;
+    string sName;
+    vector< SFRegion > vRegions;
+};
+
+class SoundFont
+{
+public:
+    static const int DrumBank = 128;
+
+    bool Load( const wstring &sFilename );
+    bool Load( const char *pcData, size_t iSize );
+    void Clear() { m_vPresets.clear(); m_vSamples.clear(); }
+
+    // Falls back to bank 0, then to the first preset in the bank. NULL if there's nothing at all
+    const SFPreset *FindPreset( int iBank, int iProgram ) const;
+    const vector< SFPreset > &GetPresets() const { return m_vPresets; }
+
+    // 16-bit mono, every sample back to back. Padded with silence so interpolation can read past any end
+    const vector< short > &GetSamples() const { return m_vSamples; }
+
+private:
+    static const int SamplePad = 64;
+
+    vector< SFPreset > m_vPresets; // Sorted by bank then program
+    vector< short > m_vSamples;
+};
@@ -0,0 +1,183 @@
+/*************************************************************************************************
+*
+* File: Thumbnails.cpp
+*
+* Description: Implements the piano roll thumbnail cache
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#include "Thumbnails.h"
+
+bool ThumbnailCache::Open( const string &sPath )
+{
+    lock_guard< mutex > lock( m_mutex );
+    m_fsFile.close();
+    m_fsFile.clear();
+    m_vKeys.clear();
+    m_Index.clear();
+    m_iRecords = 0;
+
+    // Keep what's there if it was made with the same grid. A torn record at the end just gets written over
+    m_fsFile.open( sPath, ios::in | ios::out | ios::binary );
+    int aHeader[HeaderSize / sizeof( int )] = { 0 };
+    bool bOk = m_fsFile.is_open() && m_fsFile.read( reinterpret_cast< char* >( aHeader ), HeaderSize ) &&
+               memcmp( aHeader, "PFAT", 4 ) == 0 && aHeader[1] == Version &&
+               aHeader[2] == MIDI::MIDIThumbnail::Width && aHeader[3] == MIDI::MIDIThumbnail::Height;
+    if ( bOk )
+    {
+        m_fsFile.seekg( 0, ios::end );
+        int iRecords = static_cast< int >( ( static_cast< long long >( m_fsFile.tellg() ) - HeaderSize ) / RecordSize );
+        m_vKeys.resize( static_cast< size_t >( iRecords ) * KeySize );
+        for ( ; m_iRecords < iRecords; m_iRecords++ )
+        {
+            char *pcKey = &m_vKeys[ static_cast< size_t >( m_iRecords ) * KeySize ];
+            m_fsFile.seekg( HeaderSize + static_cast< streamoff >( m_iRecords ) * RecordSize );
+            if ( !m_fsFile.read( pcKey, KeySize ) ) break;
+            m_Index.Set( Hash( pcKey ), [&]( int iOther ) { return memcmp( &m_vKeys[iOther * KeySize], pcKey, KeySize ) == 0; }, m_iRecords );
+        }
+        m_vKeys.resize( static_cast< size_t >( m_iRecords ) * KeySize );
+        m_fsFile.clear();
+        return true;
+    }
+
+    // Start over
+    m_vKeys.clear();
+    m_Index.clear();
+    m_iRecords = 0;
+    m_fsFile.close();
+    m_fsFile.clear();
+    m_fsFile.open( sPath, ios::in | ios::out | ios::binary | ios::trunc );
+    if ( !m_fsFile.is_open() ) return false;
+
+    memcpy( aHeader, "PFAT", 4 );
+    aHeader[1] = Version;
+    aHeader[2] = MIDI::MIDIThumbnail::Width;
+    aHeader[3] = MIDI::MIDIThumbnail::Height;
+    m_fsFile.write( reinterpret_cast< const char* >( aHeader ), HeaderSize );
+    m_fsFile.flush();
+    return m_fsFile.good();
+}
+
+void ThumbnailCache::Close()
+{
+    lock_guard< mutex > lock( m_mutex );
+    m_fsFile.close();
+    m_fsFile.clear();
+    m_vKeys.clear();
+    m_Index.clear();
+    m_iRecords = 0;
+}
+
+bool ThumbnailCache::Has( const string &sMd5 ) const
+{
+    lock_guard< mutex > lock( m_mutex );
+    return FindRecord( sMd5 ) >= 0;
+}
+
+bool ThumbnailCache::Find( const string &sMd5, MIDI::MIDIThumbnail &mThumb ) const
+{
+    lock_guard< mutex > lock( m_mutex );
+    int iRecord = FindRecord( sMd5 );
+    if ( iRecord < 0 ) return false;
+
+    m_fsFile.seekg( HeaderSize + static_cast< streamoff >( iRecord ) * RecordSize + KeySize );
+    if ( m_fsFile.read( reinterpret_cast< char* >( mThumb.aCells ), MIDI::MIDIThumbnail::Size ) ) return true;
+    m_fsFile.clear();
+    return false;
+}
+
+// Only tops up the jobs. Ones already submitted take from the new queue
+void ThumbnailCache::Generate( const vector< Job > &vJobs )
+{
+    int iNew;
+    {
+        lock_guard< mutex > lock( m_mutex );
+        if ( !m_fsFile.is_open() ) return;
+        m_qJobs.assign( vJobs.begin(), vJobs.end() );
+        m_bStop = false;
+        iNew = max( static_cast< int >( m_qJobs.size() ) - m_iSubmitted, 0 );
+        m_iSubmitted += iNew;
+    }
+
+    JobSystem &jobSystem = JobSystem::GetJobSystem();
+    for ( int i = 0; i < iNew; i++ )
+        jobSystem.Submit( [this]() { Work(); }, JobSystem::Background, &m_Group );
+}
+
+void ThumbnailCache::Stop()
+{
+    {
+        lock_guard< mutex > lock( m_mutex );
+        m_bStop = true;
+        m_qJobs.clear();
+    }
+    if ( !m_Group.IsDone() )
+        JobSystem::GetJobSystem().Wait( m_Group );
+}
+
+// MD5s come out of Util::MD5 cut short at the first zero byte, so padding with zeros keeps them apart
+bool ThumbnailCache::MakeKey( const string &sMd5, char acKey[KeySize] )
+{
+    if ( sMd5.empty() || sMd5.length() > KeySize ) return false;
+    memset( acKey, 0, KeySize );
+    memcpy( acKey, sMd5.data(), sMd5.length() );
+    return true;
+}
+
+int ThumbnailCache::FindRecord( const string &sMd5 ) const
+{
+    char acKey[KeySize];
+    if ( !MakeKey( sMd5, acKey ) ) return -1;
+    const int *piRecord = m_Index.Find( Hash( acKey ), [&]( int iRecord ) { return memcmp( &m_vKeys[iRecord * KeySize], acKey, KeySize ) == 0; } );
+    return piRecord ? *piRecord : -1;
+}
+
+// Records always go right after the last good one. If a write fails, the next one lands in the same spot
+void ThumbnailCache::AddRecord( const string &sMd5, const MIDI::MIDIThumbnail &mThumb )
+{
+    char acKey[KeySize];
+    if ( !MakeKey( sMd5, acKey ) ) return;
+
+    lock_guard< mutex > lock( m_mutex );
+    if ( !m_fsFile.is_open() || FindRecord( sMd5 ) >= 0 ) return;
+
+    m_fsFile.seekp( HeaderSize + static_cast< streamoff >( m_iRecords ) * RecordSize );
+    m_fsFile.write( acKey, KeySize );
+    m_fsFile.write( reinterpret_cast< const char* >( mThumb.aCells ), MIDI::MIDIThumbnail::Size );
+    m_fsFile.flush();
+    if ( !m_fsFile )
+    {
+        m_fsFile.clear();
+        return;
+    }
+
+    m_vKeys.insert( m_vKeys.end(), acKey, acKey + KeySize );
+    m_Index.Set( Hash( acKey ), [&]( int iOther ) { return memcmp( &m_vKeys[iOther * KeySize], acKey, KeySize ) == 0; }, m_iRecords );
+    m_iRecords++;
+}
+
+// A job. The song is mapped and scanned in one go, so jobs only wait on the disk and for the lock
+// to pop a song or write a record
+void ThumbnailCache::Work()
+{
+    Job job( L"", "" );
+    {
+        lock_guard< mutex > lock( m_mutex );
+        m_iSubmitted--;
+        if ( m_bStop ) return;
+        do
+        {
+            if ( m_qJobs.empty() ) return;
+            job = m_qJobs.front();
+            m_qJobs.pop_front();
+        }
+        while ( FindRecord( job.sMd5 ) >= 0 );
+    }
+
+    // Files that changed since the library saw them are skipped. The MD5 would be wrong
+    MIDI::MIDIInfo mInfo;
+    MIDI::MIDIThumbnail mThumb;
+    if ( MIDI::ScanInfo( job.wsPath, mInfo, NULL, &mThumb ) && mInfo.sMd5 == job.sMd5 )
+        AddRecord( job.sMd5, mThumb );
+}
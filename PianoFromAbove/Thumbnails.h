@@ -0,0 +1,82 @@
+/*************************************************************************************************
+*
+* File: Thumbnails.h
+*
+* Description: Defines the piano roll thumbnail cache for the song library
+*
+* Copyright (c) 2010 Brian Pantano. All rights reserved.
+*
+*************************************************************************************************/
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include "MIDI.h"
+#include "JobSystem.h"
+using namespace std;
+
+//-----------------------------------------------------------------------------
+// Thumbnails keyed by the song's MD5, kept in one file of fixed size records.
+// Only the keys stay in memory: a thumbnail is read back when it's asked for.
+// New ones are made as background jobs, one song each, and appended as
+// they're done, so a crash loses at most the one being written.
+//-----------------------------------------------------------------------------
+
+class ThumbnailCache
+{
+public:
+    struct Job
+    {
+        Job( const wstring &wsPath, const string &sMd5 ) : wsPath( wsPath ), sMd5( sMd5 ) { }
+
+        wstring wsPath;
+        string sMd5; // What the library has for the file. It's checked again after scanning
+    };
+
+    ThumbnailCache() : m_iRecords( 0 ), m_iSubmitted( 0 ), m_bStop( false ) { }
+    ~ThumbnailCache() { Stop(); }
+
+    bool Open( const string &sPath ); // Makes the file if there isn't one. Anything unreadable gets thrown out
+    void Close();
+
+    // Any thread
+    bool Has( const string &sMd5 ) const;
+    bool Find( const string &sMd5, MIDI::MIDIThumbnail &mThumb ) const;
+
+    // Replaces the queue. Songs that already have one are skipped when their turn comes
+    void Generate( const vector< Job > &vJobs );
+    void Stop(); // Waits for the songs being worked on. The queue is dropped
+
+private:
+    ThumbnailCache( const ThumbnailCache& );
+    ThumbnailCache &operator=( const ThumbnailCache& );
+
+    // File layout: magic, version, width, height, then records of key and cells
+    static const int Version = 1;
+    static const int HeaderSize = 16;
+    static const int KeySize = 16; // MD5s are at most 16 bytes. Shorter ones are padded with zeros
+    static const int RecordSize = KeySize + MIDI::MIDIThumbnail::Size;
+
+    static bool MakeKey( const string &sMd5, char acKey[KeySize] );
+    int FindRecord( const string &sMd5 ) const; // Caller holds the lock. -1 if it's not there
+    void AddRecord( const string &sMd5, const MIDI::MIDIThumbnail &mThumb );
+    static unsigned Hash( const char *pcKey ) { return HashIndex< int >::Hash( pcKey, KeySize ); }
+    void Work();
+
+    // The file and its index. Keys are stored back to back, KeySize each
+    mutable fstream m_fsFile;
+    vector< char > m_vKeys;
+    HashIndex< int > m_Index;
+    int m_iRecords;
+
+    // Generation. Each job submitted takes whatever's at the front of the queue when it runs
+    deque< Job > m_qJobs;
+    int m_iSubmitted; // Jobs not yet run
+    JobGroup m_Group;
+    bool m_bStop;
+
+    mutable mutex m_mutex; // Guards all of the above
+};